@@ -9,6 +9,22 @@ list(APPEND Caffe_LINKER_LIBS ${Boost_LIBRARIES})
 # ---[ Threads
 find_package(Threads REQUIRED)
 list(APPEND Caffe_LINKER_LIBS ${CMAKE_THREAD_LIBS_INIT})
+if(UNIX AND NOT APPLE)
+  # shm_open, for the shared memory collective, is in librt in older glibc
+  list(APPEND Caffe_LINKER_LIBS rt)
+endif()
+
+# ---[ OpenMP (optional, used by the multi-threaded CPU layer paths)
+find_package(OpenMP)
+if(OPENMP_FOUND)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${OpenMP_C_FLAGS}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${OpenMP_CXX_FLAGS}")
+  # the flags reach Caffe's own link lines; the runtime, which CMake 3.9 and
+  # later reports, is for those linking the static library
+  if(OpenMP_CXX_LIBRARIES)
+    list(APPEND Caffe_LINKER_LIBS ${OpenMP_CXX_LIBRARIES})
+  endif()
+endif()
 
 # ---[ Google-glog
 include("cmake/External/glog.cmake")
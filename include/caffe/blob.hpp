@@ -13,6 +13,8 @@ const int kMaxBlobAxes = 32;
 
 namespace caffe {
 
+template <typename Dtype> class Filler;
+
 /**
  * @brief A wrapper around SyncedMemory holders serving as the basic
  *        computational unit through which Layer%s, Net%s, and Solver%s
@@ -208,6 +210,7 @@ class Blob {
 
   inline const shared_ptr<SyncedMemory>& data() const {
     CHECK(data_);
+    FillDeferred();
     return data_;
   }
 
@@ -263,9 +266,33 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to @p memory, which must hold at least
+   *        count() elements. The Blob keeps using it for as long as it is
+   *        reshaped within that size.
+   *
+   * This is how Net::PlanMemory lets blobs with disjoint lifetimes share one
+   * buffer.
+   */
+  void set_data(const shared_ptr<SyncedMemory>& memory);
+  /// @brief Like set_data, for the diff_ shared_ptr.
+  void set_diff(const shared_ptr<SyncedMemory>& memory);
 
   bool ShapeEquals(const BlobProto& other);
 
+  /**
+   * @brief Leaves the data to be filled by filler when it is first accessed
+   *        (see Caffe::defer_fill). Setting the data first (FromProto,
+   *        set_cpu_data, ShareData, CopyFrom) skips the fill.
+   */
+  void set_deferred_filler(const shared_ptr<Filler<Dtype> >& filler) {
+    deferred_filler_ = filler;
+  }
+  /// @brief Drops a deferred fill, for data about to be overwritten.
+  inline void cancel_deferred_fill() { deferred_filler_.reset(); }
+  /// @brief Whether the data is still to be filled.
+  inline bool fill_deferred() const { return deferred_filler_.get() != NULL; }
+
  protected:
   shared_ptr<SyncedMemory> data_;
   shared_ptr<SyncedMemory> diff_;
@@ -273,6 +300,13 @@ class Blob {
   vector<int> shape_;
   int count_;
   int capacity_;
+  // the filler of a fill deferred to the first access of the data
+  mutable shared_ptr<Filler<Dtype> > deferred_filler_;
+
+  inline void FillDeferred() const {
+    if (deferred_filler_) { RunDeferredFill(); }
+  }
+  void RunDeferredFill() const;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
@@ -131,6 +131,15 @@ class Caffe {
     }
     return *(Get().random_generator_);
   }
+  // The random number stream of this thread, to share with another thread
+  // through set_rng_stream.
+  inline static shared_ptr<RNG> shared_rng_stream() {
+    rng_stream();
+    return Get().random_generator_;
+  }
+  inline static void set_rng_stream(shared_ptr<RNG> rng) {
+    Get().random_generator_ = rng;
+  }
 #ifndef CPU_ONLY
   inline static cublasHandle_t cublas_handle() { return Get().cublas_handle_; }
   inline static curandGenerator_t curand_generator() {
@@ -166,6 +175,12 @@ class Caffe {
   inline static bool multiprocess() { return Get().multiprocess_; }
   inline static void set_multiprocess(bool val) { Get().multiprocess_ = val; }
   inline static bool root_solver() { return Get().solver_rank_ == 0; }
+  // Whether the fillers of layer params (GetParamFiller) leave the blobs they
+  // fill to be filled when first accessed (see Blob::set_deferred_filler),
+  // which loading values into them first skips: for nets whose weights are
+  // about to be loaded.
+  inline static bool defer_fill() { return Get().defer_fill_; }
+  inline static void set_defer_fill(bool val) { Get().defer_fill_ = val; }
 
  protected:
 #ifndef CPU_ONLY
@@ -180,6 +195,7 @@ class Caffe {
   int solver_count_;
   int solver_rank_;
   bool multiprocess_;
+  bool defer_fill_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
@@ -93,6 +93,8 @@ class SmoothL1LossLayer : public LossLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// Intermediates of the GPU path; the CPU path recomputes the difference
+  /// from the bottoms instead and never touches them.
   Blob<Dtype> diff_;
   Blob<Dtype> errors_;
   bool has_weights_;
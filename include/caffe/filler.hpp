@@ -261,6 +261,23 @@ class BilinearFiller : public Filler<Dtype> {
   }
 };
 
+/**
+ * @brief Leaves blobs to be filled by another Filler when their data is first
+ *        accessed (see Caffe::defer_fill), so that the fill of values about to
+ *        be loaded is skipped.
+ */
+template <typename Dtype>
+class DeferredFiller : public Filler<Dtype> {
+ public:
+  explicit DeferredFiller(Filler<Dtype>* filler)
+      : Filler<Dtype>(FillerParameter()), filler_(filler) {}
+  virtual void Fill(Blob<Dtype>* blob) {
+    blob->set_deferred_filler(filler_);
+  }
+ private:
+  shared_ptr<Filler<Dtype> > filler_;
+};
+
 /**
  * @brief Get a specific filler from the specification given in FillerParameter.
  *
@@ -290,6 +307,19 @@ Filler<Dtype>* GetFiller(const FillerParameter& param) {
   return (Filler<Dtype>*)(NULL);
 }
 
+/**
+ * @brief Get the filler of the params a layer fills in its LayerSetUp: like
+ *        GetFiller, but deferred while Caffe::defer_fill is set.
+ */
+template <typename Dtype>
+Filler<Dtype>* GetParamFiller(const FillerParameter& param) {
+  Filler<Dtype>* filler = GetFiller<Dtype>(param);
+  if (Caffe::defer_fill()) {
+    return new DeferredFiller<Dtype>(filler);
+  }
+  return filler;
+}
+
 }  // namespace caffe
 
 #endif  // CAFFE_FILLER_HPP_
@@ -257,6 +257,27 @@ class Layer {
    */
   virtual inline bool AutoTopBlobs() const { return false; }
 
+  /**
+   * @brief Return whether the top blobs may share their data memory with
+   *        bottom[0], e.g. because the layer only provides a view of it.
+   *
+   * Net::PlanMemory keeps such blobs in one buffer. Sharing that is already
+   * set up by Reshape is detected without this, so it only needs to be
+   * overridden by layers that share memory later, in Forward or Backward.
+   */
+  virtual inline bool TopSharesBottomData() const { return false; }
+  /// @brief Like TopSharesBottomData, for the diff memory.
+  virtual inline bool TopSharesBottomDiff() const { return false; }
+
+  /**
+   * @brief Return whether Forward draws from Caffe::rng_stream().
+   *
+   * A net that runs its branches on several threads (branch_threads) runs
+   * such layers one at a time in the serial order, with the random numbers
+   * of the calling thread, so that they draw what the serial pass does.
+   */
+  virtual inline bool DrawsRandomNumbers() const { return false; }
+
   /**
    * @brief Return whether to allow force_backward for a given bottom blob
    *        index.
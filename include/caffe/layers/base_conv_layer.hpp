@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/epilogue.hpp"
 #include "caffe/util/im2col.hpp"
 
 namespace caffe {
@@ -18,7 +19,7 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), epilogue_(param.epilogue_param()) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -26,7 +27,10 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
-  virtual inline bool EqualNumBottomTopBlobs() const { return true; }
+  virtual inline bool EqualNumBottomTopBlobs() const {
+    // a residual is taken as an extra, last bottom
+    return !this->layer_param_.epilogue_param().sum();
+  }
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
@@ -92,6 +96,8 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   bool bias_term_;
   bool is_1x1_;
   bool force_nd_im2col_;
+  /// @brief The bias, residual sum and activation applied to the output.
+  Epilogue<Dtype> epilogue_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
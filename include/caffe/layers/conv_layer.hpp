@@ -60,6 +60,10 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  - bias_term (\b optional, default true). Whether to have a bias.
    *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
    *    kernels + stream parallelism) engines.
+   *
+   *  and the optional EpilogueParameter epilogue_param, which adds the last
+   *  bottom as a residual and / or applies a ReLU in the same pass over the
+   *  output as the bias (CAFFE engine only).
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
@@ -39,6 +39,9 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Dropout"; }
+  virtual inline bool DrawsRandomNumbers() const {
+    return this->phase_ == TRAIN;
+  }
 
  protected:
   /**
@@ -30,6 +30,8 @@ class FlattenLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "Flatten"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool TopSharesBottomData() const { return true; }
+  virtual inline bool TopSharesBottomDiff() const { return true; }
 
  protected:
   /**
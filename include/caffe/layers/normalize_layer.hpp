@@ -43,6 +43,10 @@ class NormalizeLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Shapes the scratch blobs and multipliers of the GPU kernels, which the
+  // CPU path does without.
+  void ReshapeGPUBuffers(const Blob<Dtype>& bottom);
+
   Blob<Dtype> norm_;
   Blob<Dtype> sum_channel_multiplier_, sum_spatial_multiplier_;
   Blob<Dtype> buffer_, buffer_channel_, buffer_spatial_;
@@ -0,0 +1,61 @@
+#ifndef CAFFE_RAND_CAT_CONV_INNER_PRODUCT_LAYER_HPP_
+#define CAFFE_RAND_CAT_CONV_INNER_PRODUCT_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/rand_cat_conv_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A RandCatConvLayer followed by an InnerProductLayer, without the
+ *        (points x hypercolumn channels) matrix in between.
+ *
+ * The hypercolumns of the sampled points are gathered tile_size points at a
+ * time into a small buffer and multiplied by the weights right away, so that
+ * the memory needed no longer grows with the number of points times the
+ * number of channels of all hypercolumn blobs. Takes the same bottoms and
+ * rand_cat_conv_param as RandCatConv, plus the inner_product_param of the
+ * fused layer; top[0] holds the (points x num_output) inner products and
+ * top[1] the labels.
+ */
+template <typename Dtype>
+class RandCatConvInnerProductLayer : public RandCatConvLayer<Dtype> {
+ public:
+  explicit RandCatConvInnerProductLayer(const LayerParameter& param)
+      : RandCatConvLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const {
+    return "RandCatConvInnerProduct";
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Gathers the hypercolumns of points [begin, begin + rows) into tile_.
+  void GatherTile(const vector<Blob<Dtype>*>& bottom, const int begin,
+      const int rows);
+
+  int num_output_;
+  bool bias_term_;
+  int tile_size_;
+  // hypercolumns of one tile of points and their gradient
+  Blob<Dtype> tile_;
+  Blob<Dtype> tile_diff_;
+  Blob<Dtype> bias_multiplier_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_RAND_CAT_CONV_INNER_PRODUCT_LAYER_HPP_
@@ -4,11 +4,14 @@
 #include <utility>
 #include <vector>
 
+#include "boost/weak_ptr.hpp"
+
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/common.hpp"
 #include "caffe/layers/neuron_layer.hpp"
+#include "caffe/util/hypercolumn.hpp"
 
 namespace caffe {
 
@@ -37,6 +40,23 @@ class RandCatConvLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "RandCatConv"; }
   virtual inline int MinBottomBlobs() const { return 3; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
+  virtual inline bool DrawsRandomNumbers() const { return true; }
+
+  /**
+   * @brief Dense inference with a bounded memory footprint.
+   *
+   * With a non-zero chunk_size the top holds the hypercolumns of chunk_size
+   * valid pixels only, those of the chunk set by set_chunk; the points are
+   * sampled with chunk 0. ForwardDense (see util/dense_inference.hpp) drives
+   * the net through the chunks, and a forward pass outside of it fails.
+   */
+  inline int chunk_size() const { return chunk_size_; }
+  // Sets the chunk of the next forward pass, or -1 after the last one.
+  inline void set_chunk(int chunk) { chunk_ = chunk; }
+  // The number of points sampled by the last forward pass, and the image,
+  // x and y of point i.
+  inline int num_points() const { return num_points_; }
+  inline const int* point(int i) const { return &rand_points_[3 * i]; }
 
  protected:
   //shared_ptr<Caffe::RNG> prefetch_rng_;
@@ -46,6 +66,29 @@ class RandCatConvLayer : public Layer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // Computes n_channels_ and the per-blob geometry from the bottom shapes.
+  void ReshapeHypercolumns(const vector<Blob<Dtype>*>& bottom);
+  // Selects rand_points_ and builds the sampling plan for them. Called once
+  // per forward pass; Backward_cpu reuses the result.
+  void SamplePoints(const vector<Blob<Dtype>*>& bottom);
+  // Turns rand_points_ into plan_ and image_start_.
+  void BuildSamplingPlan(const vector<Blob<Dtype>*>& bottom);
+  // Copies the labels of points [begin, end) into the rows of top_label.
+  void ForwardLabels(const vector<Blob<Dtype>*>& bottom, const int begin,
+      const int end, Blob<Dtype>* top_label);
+
+  // Backward_cpu in three steps, so that the gradient of the hypercolumns
+  // can also be scattered a range of points at a time: zero the bottom
+  // diffs, accumulate the gradient col_diff (one row of n_channels_ values
+  // per point, starting at point begin) of points [begin, end), and note
+  // the state of the diffs for the next call.
+  void ClearBottomDiffs(const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom);
+  void ScatterPoints(const Dtype* col_diff, const int begin, const int end,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  void RememberBottomDiffs(const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom);
+
  // no. of data points per image
  int N_;
  // if we need to run the random no. generator
@@ -76,6 +119,30 @@ class RandCatConvLayer : public Layer<Dtype> {
  std::vector<Dtype> padf_;
  // make a vector of height, width, num_pixels for diff conv.layers --
  std::vector<int> height_, width_, pixels_;
+ // column of the top blob at which the channels of each hypercol blob start
+ std::vector<int> channel_offset_;
+ // number of points sampled in the last forward pass
+ int num_points_;
+ // points per top in chunked dense mode (0 if off), and the chunk that the
+ // next forward pass produces (-1 outside of ForwardDense); the points are
+ // sampled with chunk 0
+ int chunk_size_;
+ int chunk_;
+ // sampling plan, plan_[i * n_hblobs_ + b] belongs to point i and blob b
+ std::vector<HypercolumnTap<Dtype> > plan_;
+ // points are sorted by image, those of image n are image_start_[n] ..
+ // image_start_[n + 1] - 1
+ std::vector<int> image_start_;
+ // channel-contiguous copy of a bottom blob, see hypercolumn_use_nhwc
+ Blob<Dtype> nhwc_buffer_;
+ // Row spans of the bottom diffs written by the last Backward_cpu: in blob b,
+ // image n and feature row y only the columns dirty_lo_[b][n * height_[b] + y]
+ // to dirty_hi_[b][n * height_[b] + y] of each channel can be non-zero. This
+ // holds as long as the diff memory, its version and shape are unchanged.
+ std::vector<std::vector<int> > dirty_lo_, dirty_hi_;
+ std::vector<boost::weak_ptr<SyncedMemory> > dirty_mem_;
+ std::vector<int> dirty_version_;
+ std::vector<std::vector<int> > dirty_shape_;
 
 };
 
@@ -9,6 +9,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/common.hpp"
 #include "caffe/layers/neuron_layer.hpp"
+#include "caffe/util/hypercolumn.hpp"
 
 namespace caffe {
 
@@ -37,6 +38,7 @@ class RandCatLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "RandCat"; }
   virtual inline int MinBottomBlobs() const { return 3; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
+  virtual inline bool DrawsRandomNumbers() const { return true; }
 
  protected:
   //shared_ptr<Caffe::RNG> prefetch_rng_;
@@ -59,6 +61,10 @@ class RandCatLayer : public Layer<Dtype> {
  int n_channels_;
  // points which are randomly selected --
  std::vector<int> rand_points_;
+ // where the selected points read from the bottom blobs
+ std::vector<HypercolumnTap<Dtype> > taps_;
+ // channel-contiguous copy of a bottom blob, see hypercolumn_use_nhwc
+ Blob<Dtype> nhwc_buffer_;
 };
 
 
@@ -0,0 +1,106 @@
+#ifndef CAFFE_SAMPLED_SOFTMAX_TAG_LOSS_LAYER_HPP_
+#define CAFFE_SAMPLED_SOFTMAX_TAG_LOSS_LAYER_HPP_
+
+#include <vector>
+
+#include "boost/weak_ptr.hpp"
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/loss_layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Training-time approximation of an InnerProductLayer followed by a
+ *        SoftmaxWithTagLossLayer, for very large tag vocabularies.
+ *
+ * Instead of scoring all @f$ K @f$ tags, every forward pass draws
+ * softmax_tag_loss_param.num_sampled tags from the tag frequency
+ * distribution and shares them as negatives across the batch. Each item is
+ * scored on its own set tags plus these negatives only, with the logits
+ * corrected by the log of the expected number of times a tag is drawn
+ * (log-Q correction), and a tag that is drawn and also set for an item
+ * counts as set only. Forward and backward cost
+ * @f$ O((P + S) D) @f$ per item instead of @f$ O(K D) @f$, and only the
+ * weight rows of the scored tags receive a gradient.
+ *
+ * The layer owns the (K x D) weights and the (K) biases of the inner
+ * product, configured by inner_product_param like an InnerProductLayer. At
+ * test time, use an InnerProductLayer with the same param names to share
+ * them, followed by a full SoftmaxWithTagLossLayer or SoftmaxLayer.
+ *
+ * @param bottom input Blob vector (length 3)
+ *   -# @f$ (N \times D) @f$
+ *      the features @f$ x @f$ (axes from inner_product_param.axis on are
+ *      flattened)
+ *   -# @f$ (N \times P) @f$
+ *      lists of up to @f$ P @f$ distinct set tags per item, padded with -1
+ *      (the sparse_labels format of SoftmaxWithTagLossLayer)
+ *   -# @f$ (K) @f$
+ *      the positive tag frequencies; they define the sampling distribution,
+ *      and tags are weighted by their reciprocal as in
+ *      SoftmaxWithTagLossLayer
+ * @param top output Blob vector (length 1)
+ *   -# @f$ (1 \times 1 \times 1 \times 1) @f$
+ *      the sampled tag loss
+ */
+template <typename Dtype>
+class SampledSoftmaxTagLossLayer : public LossLayer<Dtype> {
+ public:
+  explicit SampledSoftmaxTagLossLayer(const LayerParameter& param)
+      : LossLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "SampledSoftmaxTagLoss"; }
+  virtual inline int ExactNumBottomBlobs() const { return 3; }
+  virtual inline bool DrawsRandomNumbers() const { return true; }
+  virtual inline bool AllowForceBackward(const int bottom_index) const {
+    return bottom_index == 0;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  /// Recompute the class weights and the sampling distribution if the
+  /// frequencies in bottom[2] have changed since the last call.
+  void SetupDistribution(const Blob<Dtype>& freqs);
+  /// Draw the shared negatives into sampled_.
+  void SampleNegatives();
+  /// log of the expected number of times tag c is among the draws
+  Dtype LogExpectedCount(int c) const;
+
+  int M_;  ///< number of items
+  int K_;  ///< number of tags
+  int D_;  ///< feature dimension
+  int P_;  ///< maximum number of set tags per item
+  int num_sampled_;
+  bool bias_term_;
+
+  /// class weights and cumulative sampling distribution of the tags
+  vector<Dtype> class_weights_;
+  vector<double> cdf_;
+  boost::weak_ptr<SyncedMemory> freqs_mem_;
+  int freqs_version_;
+
+  /// distinct tags drawn in the last forward pass
+  vector<int> sampled_;
+  /// their weight rows, gathered, and the gradient for them
+  Blob<Dtype> sampled_weight_;
+  /// (M x S) probabilities of the sampled tags (0 where a sampled tag is set
+  /// for the item), and (M x P) probabilities of the set tags
+  Blob<Dtype> sampled_prob_;
+  Blob<Dtype> set_prob_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_SAMPLED_SOFTMAX_TAG_LOSS_LAYER_HPP_
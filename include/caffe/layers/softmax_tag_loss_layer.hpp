@@ -3,6 +3,8 @@
 
 #include <vector>
 
+#include "boost/weak_ptr.hpp"
+
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
@@ -30,10 +32,15 @@ namespace caffe {
  *      probability distribution over classes using the softmax function
  *      @f$ \hat{p}_{nk} = \exp(x_{nk}) /
  *      \left[\sum_{k'} \exp(x_{nk'})\right] @f$ (see SoftmaxLayer).
- *   -# @f$ (N \times 1 \times 1 \times 1) @f$
- *      the labels @f$ l @f$, an integer-valued Blob with values
- *      @f$ l_n \in [0, 1, 2, ..., K - 1] @f$
- *      indicating the correct class label among the @f$ K @f$ classes
+ *   -# @f$ (N \times C \times H \times W) @f$
+ *      the tags @f$ t @f$, a Blob with values in @f$ \{0, 1\} @f$
+ *      flagging the tags that are set for each item, or, with
+ *      softmax_tag_loss_param { sparse_labels: true },
+ *      @f$ (N \times P \times H \times W) @f$
+ *      lists of up to @f$ P @f$ distinct tag indices in
+ *      @f$ [0, 1, 2, ..., K - 1] @f$ per item, padded with -1
+ *   -# @f$ (K) @f$ (optional)
+ *      the tag frequencies; tags are weighted by their reciprocal
  * @param top output Blob vector (length 1)
  *   -# @f$ (1 \times 1 \times 1 \times 1) @f$
  *      the computed cross-entropy classification loss: @f$ E =
@@ -103,8 +110,12 @@ class SoftmaxWithTagLossLayer : public LossLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// Fill weights_ from the tag frequencies in bottom[2] (or with ones),
+  /// unless they have not changed since the last call.
   void SetupWeights_cpu(const vector<Blob<Dtype>*>& bottom);
   void SetupWeights_gpu(const vector<Blob<Dtype>*>& bottom);
+  bool WeightsUpToDate(const vector<Blob<Dtype>*>& bottom) const;
+  void RememberWeights(const vector<Blob<Dtype>*>& bottom);
 
   /// The internal SoftmaxLayer used to map predictions to a distribution.
   shared_ptr<Layer<Dtype> > softmax_layer_;
@@ -117,8 +128,17 @@ class SoftmaxWithTagLossLayer : public LossLayer<Dtype> {
   /// Whether to normalize the loss by the total number of values present
   /// (otherwise just by the batch size).
   bool normalize_;
+  /// Whether bottom[1] lists tag indices (max_tags_ per item) instead of
+  /// flagging every tag.
+  bool sparse_labels_;
+  int max_tags_;
   /// stores the weights used to balance between tags with different frequencies
   Blob<Dtype> weights_;
+  /// weights_ holds the weights for the frequencies weights_freqs_ had at
+  /// version weights_freqs_version_ (no frequencies: expired, -1)
+  bool weights_valid_;
+  boost::weak_ptr<SyncedMemory> weights_freqs_;
+  int weights_freqs_version_;
 
   int softmax_axis_, outer_num_, inner_num_;
 };
@@ -1,6 +1,7 @@
 #ifndef CAFFE_NET_HPP_
 #define CAFFE_NET_HPP_
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -11,6 +12,7 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/flat_weights.hpp"
 
 namespace caffe {
 
@@ -89,8 +91,72 @@ class Net {
     return loss;
   }
 
+  /**
+   * @brief Lets blobs whose lifetimes do not overlap share memory.
+   *
+   * Computes for the data and the diff of every blob the span of layer steps
+   * from its first write to its last read and packs the spans into as few
+   * buffers as it can. The spans cover the backward pass for TRAIN nets and
+   * for nets with force_backward; other TEST nets are planned for Forward
+   * only.
+   * Net inputs and outputs, the tops of layers without bottoms (whose
+   * memory data layers may swap out) and the diffs of loss blobs keep their
+   * own memory. Any other blob only holds valid data between the layers that
+   * use it, so blobs that are read after Forward have to be net outputs.
+   *
+   * Called by Init if plan_memory is set, and again by Reshape from then on.
+   * Blobs that outgrow their buffer while the net runs fall back to memory of
+   * their own.
+   */
+  void PlanMemory();
+  /// @brief Bytes of blob memory needed without / with the memory plan, both
+  ///        zero unless PlanMemory has been called.
+  inline size_t naive_memory() const { return naive_memory_; }
+  inline size_t planned_memory() const { return planned_memory_; }
+
+  /**
+   * @brief Finds the layers that do not depend on each other, which
+   *        ForwardFromTo and BackwardFromTo run concurrently on the CPU if
+   *        branch_threads is set.
+   *
+   * A layer waits for an earlier layer of the pass when one of them writes
+   * memory the other reads or writes: blob data and diffs, where memory that
+   * blobs share or may share through their layers counts as one (as in
+   * PlanMemory), and parameter diffs. Layers that touch the same memory keep
+   * their order, so the results are the same as in serial order.
+   *
+   * Called by Init and Reshape.
+   */
+  void ScheduleBranches();
+  /// @brief The most layers of the forward pass that can run at once.
+  inline int branch_width() const { return branch_width_; }
+
   /// @brief Updates the network weights based on the diff values computed.
   void Update();
+  /// @brief Returns the sum of squares of the diffs of all learnable params.
+  Dtype sumsq_param_diffs() const;
+  /**
+   * @brief Lays out the data of all learnable params in one host arena, and
+   *        their diffs in another, in the order of learnable_params(), the
+   *        param blobs becoming views into them. Whole-net operations like
+   *        ClearParamDiffs and Update then run as single sweeps on the CPU.
+   */
+  void FlattenParams();
+  /**
+   * @brief Points the learnable params into the given arenas, which hold
+   *        them in the layout of FlattenParams, and keeps them instead of the
+   *        current ones (see CPUParams).
+   */
+  void SetParamArenas(shared_ptr<SyncedMemory> data,
+      shared_ptr<SyncedMemory> diff);
+  inline const shared_ptr<SyncedMemory>& param_data_arena() const {
+    return param_data_arena_;
+  }
+  inline const shared_ptr<SyncedMemory>& param_diff_arena() const {
+    return param_diff_arena_;
+  }
+  /// @brief Whether the learnable params are still views into the arenas.
+  bool params_flat() const;
   /**
    * @brief Shares weight data of owner blobs with shared blobs.
    *
@@ -114,10 +180,36 @@ class Net {
   void CopyTrainedLayersFrom(const string trained_filename);
   void CopyTrainedLayersFromBinaryProto(const string trained_filename);
   void CopyTrainedLayersFromHDF5(const string trained_filename);
+  /**
+   * @brief Maps a flat weights file (see flat_weights.hpp) into memory and
+   *        points the params at their values in it, reading nothing up
+   *        front. The net keeps the file mapped for as long as it lives.
+   *
+   * Params the net lays out in arenas (see FlattenParams), or of another
+   * element type than the file's, are copied instead.
+   */
+  void MapTrainedLayersFrom(const string& filename);
   /// @brief Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false) const;
+  /**
+   * @brief Writes the net to a proto with the given values of its learnable
+   *        params, blobs shaped like learnable_params() (such as copies of
+   *        them taken for a snapshot), in place of their current ones.
+   */
+  void ToProto(NetParameter* param, const vector<Blob<Dtype>*>& values,
+      bool write_diff = false) const;
   /// @brief Writes the net to an HDF5 file.
   void ToHDF5(const string& filename, bool write_diff = false) const;
+  /// @brief Writes the net to an HDF5 file with the given param values (see
+  ///        ToProto).
+  void ToHDF5(const string& filename, const vector<Blob<Dtype>*>& values,
+      bool write_diff = false) const;
+  /// @brief Writes the params of the net to a flat weights file.
+  void ToFlat(const string& filename) const;
+  /// @brief Writes the given param values to a flat weights file (see
+  ///        ToProto).
+  void ToFlat(const string& filename, const vector<Blob<Dtype>*>& values)
+      const;
 
   /// @brief returns the network name.
   inline const string& name() const { return name_; }
@@ -191,6 +283,14 @@ class Net {
     return param_names_index_;
   }
   inline const vector<int>& param_owners() const { return param_owners_; }
+  /// @brief returns the (layer id, index in its blobs) of each param
+  inline const vector<pair<int, int> >& param_layer_indices() const {
+    return param_layer_indices_;
+  }
+  /// @brief returns the index in learnable_params() of each param
+  inline const vector<int>& learnable_param_ids() const {
+    return learnable_param_ids_;
+  }
   inline const vector<string>& param_display_names() const {
     return param_display_names_;
   }
@@ -251,6 +351,11 @@ class Net {
   void add_after_backward(Callback* value) {
     after_backward_.push_back(value);
   }
+  // For a callback that goes away before the net does.
+  void remove_after_backward(Callback* value) {
+    after_backward_.erase(std::remove(after_backward_.begin(),
+        after_backward_.end(), value), after_backward_.end());
+  }
 
  protected:
   // Helpers for Init.
@@ -266,6 +371,13 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Merges the tensors (the data of blob b and its diff, numbered
+  ///        blobs_.size() + b) that share memory or may come to share it.
+  void GroupSharedTensors(vector<int>* parent) const;
+  /// @brief Runs layers start to end of the forward or backward pass on the
+  ///        branch threads as they become ready; returns the forward loss.
+  Dtype RunBranches(const int start, const int end, const bool backward);
+
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -326,8 +438,26 @@ class Net {
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// the arenas holding the data and diffs of learnable_params_, if flattened
+  shared_ptr<SyncedMemory> param_data_arena_;
+  shared_ptr<SyncedMemory> param_diff_arena_;
+  /// the flat weights files the params point into
+  vector<shared_ptr<FlatWeightsFile> > mapped_weights_;
+  size_t param_count_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether the net was set up with force_backward
+  bool force_backward_;
+  /// Whether blob memory is planned, and its size before and after planning
+  bool plan_memory_;
+  size_t naive_memory_;
+  size_t planned_memory_;
+  /// Up to how many layers run at a time, and how many can
+  int branch_threads_;
+  int branch_width_;
+  /// The layers each layer waits for in the forward and backward pass
+  vector<vector<int> > forward_waits_;
+  vector<vector<int> > backward_waits_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
   // Callbacks
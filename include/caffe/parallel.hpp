@@ -1,8 +1,6 @@
 #ifndef CAFFE_PARALLEL_HPP_
 #define CAFFE_PARALLEL_HPP_
 
-#ifdef USE_NCCL
-
 #include <boost/thread.hpp>
 
 #include <string>
@@ -16,7 +14,10 @@
 #include "caffe/solver.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/collective.hpp"
+#ifdef USE_NCCL
 #include "caffe/util/nccl.hpp"
+#endif
 
 namespace caffe {
 
@@ -48,6 +49,251 @@ class Params {
 DISABLE_COPY_AND_ASSIGN(Params);
 };
 
+// Params stored in host memory. The data can be shared with other CPUParams,
+// so that several solvers train one copy of the weights, while each of them
+// computes its gradient into its own diff. The params with a zero lr_mult are
+// not shared: the forward pass may write them, as BatchNorm does its running
+// statistics, so each sharing CPUParams keeps its own copy of them.
+template<typename Dtype>
+class CPUParams : public Params<Dtype> {
+ public:
+  // Copies the values of the root solver's parameters, or uses the data of
+  // `shared` if it is not NULL.
+  CPUParams(shared_ptr<Solver<Dtype> > root_solver,
+            const CPUParams<Dtype>* shared);
+
+  void Configure(Solver<Dtype>* solver) const;
+
+ protected:
+  // Copies the params with a zero lr_mult into state_size_ values, or back.
+  void GetState(Dtype* state) const;
+  void SetState(const Dtype* state) const;
+
+  shared_ptr<SyncedMemory> data_memory_;
+  shared_ptr<SyncedMemory> diff_memory_;
+  // The learnable param ids with a zero lr_mult, their counts, and where
+  // their data is: in data_, or in state_memory_ if the data is shared.
+  vector<int> state_params_;
+  vector<int> state_counts_;
+  vector<Dtype*> state_data_;
+  size_t state_size_;
+  shared_ptr<SyncedMemory> state_memory_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+// Data parallelism on the CPU within one process: replicas of a solver, each
+// on its own thread and share of the OpenMP threads, train one copy of the
+// weights. Their data layers take turns at the records by solver rank, as in
+// the multi-GPU case, so Caffe::solver_count() must be set to the number of
+// replicas before the root solver is created. Once every replica has its
+// gradient, they average them together, each one a slice of the parameters,
+// and the root solver applies the update for all of them. The root also
+// averages every replica's copy of the params with a zero lr_mult, such as
+// the BatchNorm statistics, and hands the mean back to all of them.
+template<typename Dtype>
+class CPUSync : public CPUParams<Dtype>,
+                public Solver<Dtype>::Callback {
+ public:
+  explicit CPUSync(shared_ptr<Solver<Dtype> > root_solver);
+  // Joins the root solver in the replicas created by Run.
+  CPUSync(shared_ptr<Solver<Dtype> > solver, CPUSync<Dtype>* root);
+
+  /**
+   * Trains with `threads` replicas of the root solver, which runs on the
+   * calling thread. The root solver should already be restored if resuming.
+   */
+  void Run(int threads);
+
+  inline shared_ptr<Solver<Dtype> > solver() const { return solver_; }
+  inline boost::barrier* barrier() const { return barrier_; }
+
+ protected:
+  void on_start();
+  void on_gradients_ready();
+  // Averages this replica's share of the gradient blocks into the root diff.
+  void Reduce();
+  // Run by the root: averages the params with a zero lr_mult of every replica
+  // and copies the mean back to them.
+  void ReduceState();
+  SolverAction::Enum GetRequestedAction();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  CPUSync<Dtype>* root_;
+  int rank_;
+  // Owned by the root: every replica by rank, the barrier they meet at, and
+  // whether the root stopped early, for the others to stop too.
+  vector<CPUSync<Dtype>*> syncs_;
+  boost::barrier* barrier_;
+  bool stop_;
+  // Whether the root had stopped when this iteration started
+  bool stopping_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::diff_;
+  using CPUParams<Dtype>::state_params_;
+  using CPUParams<Dtype>::state_data_;
+};
+
+// Hogwild: replicas of a solver, each on its own thread and share of the
+// OpenMP threads, train one copy of the weights without any locking. Each
+// replica computes its gradient at whatever the weights are when it reads
+// them, and applies its own update straight to them. With the solver's
+// sparse_update, a replica only writes the weights it has a nonzero gradient
+// for, so in sparse models such as ones with Embed layers the updates seldom
+// touch the same weights, which costs little accuracy and none of the waiting
+// of CPUSync. The weights that do collide, as every dense layer's do, lose
+// some of the updates: replicas that read the same value and write back their
+// own step keep only the last one. As there, Caffe::solver_count()
+// must be set to the number of replicas before the root solver is created,
+// and every replica takes max_iter iterations. The params with a zero lr_mult
+// are not averaged: the root tests and saves the ones of its own batches.
+template<typename Dtype>
+class Hogwild : public CPUParams<Dtype> {
+ public:
+  explicit Hogwild(shared_ptr<Solver<Dtype> > root_solver);
+
+  /**
+   * Trains with `threads` replicas of the root solver, which runs on the
+   * calling thread, tests and takes the snapshots. The root solver should
+   * already be restored if resuming.
+   */
+  void Run(int threads);
+
+  inline shared_ptr<Solver<Dtype> > solver() const { return solver_; }
+  // Called by a replica when it has taken its iterations.
+  void Finished();
+  // The action function of the replicas, which stop early with the root
+  SolverAction::Enum GetRequestedAction();
+
+ protected:
+  shared_ptr<Solver<Dtype> > solver_;
+  boost::mutex mutex_;
+  boost::condition_variable finished_;
+  int running_;
+  bool stop_;
+};
+
+// Data parallelism across processes, on one machine or several: every rank
+// trains its own copy of the weights, which rank 0 broadcasts at the start,
+// and the ranks sum their gradients with Collective::Allreduce before each of
+// them applies the same update. Caffe::solver_count, solver_rank and
+// multiprocess must be set before the solver is created, so that its data
+// layers take their share of the records.
+template<typename Dtype>
+class CollectiveSync : public Params<Dtype>,
+                       public Solver<Dtype>::Callback {
+ public:
+  CollectiveSync(shared_ptr<Solver<Dtype> > solver,
+                 shared_ptr<Collective> collective);
+
+  // Copies the weights of rank 0 to the other ranks.
+  void Broadcast();
+  // Broadcasts the weights and trains: rank 0 solves, testing and taking
+  // snapshots, while the other ranks step along with it.
+  void Run();
+
+ protected:
+  void on_start() {}
+  void on_gradients_ready();
+  SolverAction::Enum GetRequestedAction();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  shared_ptr<Collective> collective_;
+  shared_ptr<SyncedMemory> data_memory_;
+  // The gradient, followed by a flag rank 0 sets when it has stopped early
+  shared_ptr<SyncedMemory> diff_memory_;
+  bool stopping_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+};
+
+// Asynchronous data parallelism through a parameter server, for workers that
+// should not wait for each other: the server keeps the master weights and the
+// solver history, and applies every gradient a worker pushes with the
+// solver's own update as soon as it arrives. The workers never update their
+// weights themselves; every `period` iterations each one pushes the mean of
+// its gradients since the last push and pulls the weights back. The params
+// with a zero lr_mult, such as the BatchNorm statistics, are the workers' own:
+// a push carries them too, the server keeps the mean of the ones each worker
+// pushed last, and a pull leaves them alone.
+template<typename Dtype>
+class ParamServer : public CPUParams<Dtype> {
+ public:
+  // Serves the weights of `solver` at the port of `address` (HOST:PORT). A
+  // worker can be at most `staleness` pushes ahead of the slowest worker
+  // that is still training; its pull waits until then.
+  ParamServer(shared_ptr<Solver<Dtype> > solver, const string& address,
+              int staleness);
+
+  // Serves `workers` workers until the solver reaches max_iter or is asked
+  // to stop, then takes the final snapshot. The solver should already be
+  // restored if resuming.
+  void Run(int workers);
+
+ protected:
+  void Serve(int worker, int fd);
+  // The fewest pushes of any worker that is still training
+  int MinClock() const;
+  // Sets the params with a zero lr_mult to the mean of the workers' ones.
+  void AverageStates();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  string address_;
+  int staleness_;
+  boost::mutex mutex_;
+  boost::condition_variable clock_changed_;
+  // Pushes from each worker, INT_MAX once it has disconnected
+  vector<int> clocks_;
+  // The params with a zero lr_mult each worker pushed last, if any
+  vector<vector<Dtype> > states_;
+  bool stop_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+  using CPUParams<Dtype>::state_size_;
+};
+
+// A solver that trains as a worker of a ParamServer. Caffe::solver_count and
+// solver_rank can be set to the number of workers and this one's index
+// before the solver is created, so that its data layers take their share of
+// the records.
+template<typename Dtype>
+class ParamWorker : public CPUParams<Dtype>,
+                    public Solver<Dtype>::Callback {
+ public:
+  ParamWorker(shared_ptr<Solver<Dtype> > solver, const string& address,
+              int period);
+
+  // Pulls the weights from the server at `address`, then steps until the
+  // server has stopped.
+  void Run();
+
+ protected:
+  void on_start() {}
+  void on_gradients_ready();
+  SolverAction::Enum GetRequestedAction();
+
+  shared_ptr<Solver<Dtype> > solver_;
+  string address_;
+  int period_;
+  int fd_;
+  // The sum of the gradients not pushed yet, if period_ > 1
+  shared_ptr<SyncedMemory> sum_memory_;
+  Dtype* sum_;
+  // The params with a zero lr_mult, kept through a pull
+  vector<Dtype> state_;
+  int pending_;
+  bool stopping_;
+  using Params<Dtype>::size_;
+  using Params<Dtype>::data_;
+  using Params<Dtype>::diff_;
+  using CPUParams<Dtype>::state_size_;
+};
+
+#ifdef USE_NCCL
+
 // Params stored in GPU memory.
 template<typename Dtype>
 class GPUParams : public Params<Dtype> {
@@ -117,7 +363,8 @@ class NCCL : public GPUParams<Dtype>,
   using Params<Dtype>::diff_;
 };
 
+#endif  // USE_NCCL
+
 }  // namespace caffe
 
-#endif  // USE_NCCL
 #endif  // header
@@ -19,18 +19,68 @@ class SGDSolver : public Solver<Dtype> {
       : Solver<Dtype>(param) { PreSolve(); }
   explicit SGDSolver(const string& param_file)
       : Solver<Dtype>(param_file) { PreSolve(); }
+  // The snapshot thread calls the virtual writers of this class.
+  virtual ~SGDSolver() { this->WaitForSnapshot(); }
   virtual inline const char* type() const { return "SGD"; }
 
+  // The history, unless history_precision keeps it in compact_history_ (on
+  // the CPU), in which case these blobs only give its shapes.
   const vector<shared_ptr<Blob<Dtype> > >& history() { return history_; }
 
  protected:
   void PreSolve();
   Dtype GetLearningRate();
+  virtual void BeginUpdate();
   virtual void ApplyUpdate();
-  virtual void Normalize(int param_id);
-  virtual void Regularize(int param_id);
+  // Normalizes, regularizes and applies the update of one param.
+  void UpdateParam(int param_id, Dtype rate);
+  // The update of params [begin, end) on the CPU, as one multi-threaded
+  // sweep over blocks of them that stay in cache through all its steps:
+  // each block of gradients is scaled, regularized, turned into update
+  // values by ComputeUpdateBlock, and applied to the weights.
+  void FusedUpdate(int begin, int end, Dtype rate, Dtype scale);
+  // The step of FusedUpdate for a block of param_id at offset with sparse
+  // update: only the m elements at the indices `nonzero` in the block, whose
+  // gradients are not zero, are regularized, updated and applied. scratch
+  // is the calling thread's room for them: a block of update values and one
+  // of each history.
+  void SparseUpdateBlock(int param_id, int offset, Dtype rate, Dtype scale,
+      Dtype* w, Dtype* g, const int* nonzero, int m, Dtype* scratch);
+  // Computes the update values of n elements of a param in place of their
+  // gradients g, on the CPU, from the same elements of its history: h[k] of
+  // history_[param_id + k * the number of params]. FusedUpdate calls it from
+  // several threads at once for different blocks. This is the update rule of
+  // a solver on the CPU, and ComputeUpdateValue its rule on the GPU.
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
+  // ComputeUpdateValue on the CPU: ComputeUpdateBlock over the whole param.
+  void ComputeUpdateValueCPU(int param_id, Dtype rate);
+  // Takes the pointers to the history of params [begin, end) for
+  // FusedUpdate.
+  void CacheHistoryData(int begin, int end);
+  // Whether a history blob only holds values >= 0, which reduced precision
+  // then keeps above zero.
+  virtual bool HistoryNonNegative(int history_id) const { return false; }
+  // Allocates compact_history_, if history_precision asks for it.
+  void InitCompactHistory();
+  // Moves the values of a history blob into compact_history_, if the solver
+  // keeps them there.
+  void CompactHistory(int history_id);
+  // Sets a history blob from its codes in a reduced precision.
+  void RestoreCompactHistory(int history_id,
+      SolverParameter::HistoryPrecision precision, const string& codes);
+  // The steps of an update on the GPU. On the CPU, FusedUpdate clips,
+  // normalizes and regularizes the gradients itself, and calls
+  // ComputeUpdateBlock instead of ComputeUpdateValue, so the steps are not
+  // virtual: solvers change the update through ComputeUpdateBlock and
+  // ComputeUpdateValue, which have to implement the same rule.
+  void Normalize(int param_id);
+  void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
-  virtual void ClipGradients();
+  // Returns the factor that scales the gradients down to clip_gradients, or 1.
+  Dtype ClipScale();
+  void ClipGradients();
+  virtual void StageSnapshot(bool copy);
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
@@ -39,8 +89,23 @@ class SGDSolver : public Solver<Dtype> {
   // history maintains the historical momentum data.
   // update maintains update related data and is not needed in snapshots.
   // temp maintains other information that might be needed in computation
-  //   of gradients/updates and is not needed in snapshots
+  //   of gradients/updates and is not needed in snapshots; its blobs are
+  //   only allocated by the steps that use them
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // history_ in the reduced precision of history_precision, on the CPU
+  vector<shared_ptr<SyncedMemory> > compact_history_;
+  // the CPU data of history_ or compact_history_, for FusedUpdate
+  vector<Dtype*> history_data_;
+  vector<void*> compact_history_data_;
+  // The history a snapshot writes, and the copies of it if the snapshot is
+  // written in the background (see Solver::StageSnapshot).
+  vector<Blob<Dtype>*> snapshot_history_;
+  vector<shared_ptr<Blob<Dtype> > > staged_history_;
+  vector<string> snapshot_compact_history_;
+
+  // Updates params during the backward pass when overlap_update is set.
+  class OverlapUpdate;
+  shared_ptr<OverlapUpdate> overlap_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -56,6 +121,8 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -71,6 +138,10 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
+  // the history is the sum of squared gradients
+  virtual bool HistoryNonNegative(int history_id) const { return true; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -91,6 +162,10 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
+  // the history is the average of squared gradients
+  virtual bool HistoryNonNegative(int history_id) const { return true; }
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -115,6 +190,10 @@ class AdaDeltaSolver : public SGDSolver<Dtype> {
  protected:
   void AdaDeltaPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
+  // the histories are the averages of squared gradients and updates
+  virtual bool HistoryNonNegative(int history_id) const { return true; }
 
   DISABLE_COPY_AND_ASSIGN(AdaDeltaSolver);
 };
@@ -139,6 +218,13 @@ class AdamSolver : public SGDSolver<Dtype> {
  protected:
   void AdamPreSolve();
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual void ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+      Dtype** h, int n);
+  // the second history is the average of squared gradients
+  virtual bool HistoryNonNegative(int history_id) const {
+    return history_id >=
+        static_cast<int>(this->net_->learnable_params().size());
+  }
 
   DISABLE_COPY_AND_ASSIGN(AdamSolver);
 };
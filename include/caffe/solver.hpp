@@ -8,6 +8,9 @@
 #include "caffe/solver_factory.hpp"
 #include "caffe/util/benchmark.hpp"
 
+// Forward declared like in internal_thread.hpp
+namespace boost { class thread; }
+
 namespace caffe {
 
 /**
@@ -57,6 +60,10 @@ class Solver {
   virtual void Solve(const char* resume_file = NULL);
   inline void Solve(const string resume_file) { Solve(resume_file.c_str()); }
   void Step(int iters);
+  // Applies a gradient computed elsewhere, which the caller has put in the
+  // net's param diffs, as one iteration of Step: testing, the update, and
+  // snapshots. Returns false once training should stop (see ParamServer).
+  bool ApplyGradient();
   // The Restore method simply dispatches to one of the
   // RestoreSolverStateFrom___ protected methods. You should implement these
   // methods to restore the state from the appropriate snapshot type.
@@ -64,9 +71,14 @@ class Solver {
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
-  // written to disk together with the learned net.
+  // written to disk together with the learned net. With
+  // snapshot_in_background, the files are written on a thread of their own
+  // from a copy of the params and state taken here.
   void Snapshot();
-  virtual ~Solver() {}
+  // Returns once the snapshot being written in the background, if any, is
+  // complete.
+  void WaitForSnapshot();
+  virtual ~Solver() { WaitForSnapshot(); }
   inline const SolverParameter& param() const { return param_; }
   inline shared_ptr<Net<Dtype> > net() { return net_; }
   inline const vector<shared_ptr<Net<Dtype> > >& test_nets() {
@@ -76,6 +88,13 @@ class Solver {
     return test_mean_scores_;
   }
   int iter() const { return iter_; }
+  // Lets a replica go on from the iteration of the solver it joins, for its
+  // learning rate schedule (see Hogwild).
+  void set_iter(int iter) { iter_ = iter; }
+  // Whether Step applies the update; a solver whose weights are shared with
+  // another one can leave the update to it (see CPUSync).
+  inline bool apply_update() const { return apply_update_; }
+  inline void set_apply_update(bool value) { apply_update_ = value; }
 
   // Invoked at specific points during an iteration
   class Callback {
@@ -100,9 +119,27 @@ class Solver {
  protected:
   // Make and apply the update value for the current iteration.
   virtual void ApplyUpdate() = 0;
+  // Called by Step before the last forward and backward pass of an iteration
+  // that ApplyUpdate will end, so that a solver can start on the update of
+  // params whose gradients are final while the pass goes on.
+  virtual void BeginUpdate() {}
+  // The name of a file of the snapshot taken at snapshot_iter_.
   string SnapshotFilename(const string extension);
+  // Snapshot files are written under this name first, and renamed to
+  // filename by CommitSnapshotFile once complete.
+  static string PartialFilename(const string& filename) {
+    return filename + ".partial";
+  }
+  static void CommitSnapshotFile(const string& filename);
+  // Points snapshot_params_ at what the snapshot is to write: the learnable
+  // params themselves, or copies of them if copy is set. Solvers with state
+  // of their own stage it too.
+  virtual void StageSnapshot(bool copy);
+  // Writes the staged snapshot.
+  void WriteSnapshot();
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  string SnapshotToFlat();
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
@@ -129,6 +166,16 @@ class Solver {
   // True iff a request to stop early was received.
   bool requested_early_exit_;
 
+  bool apply_update_;
+
+  // The iteration and step of the snapshot being written, the params it
+  // writes, and the copies of them if it is written in the background.
+  int snapshot_iter_;
+  int snapshot_current_step_;
+  vector<Blob<Dtype>*> snapshot_params_;
+  vector<shared_ptr<Blob<Dtype> > > staged_params_;
+  shared_ptr<boost::thread> snapshot_thread_;
+
   // Timing information, handy to tune e.g. nbr of GPUs
   Timer iteration_timer_;
   float iterations_last_;
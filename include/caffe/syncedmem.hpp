@@ -27,7 +27,10 @@ inline void CaffeMallocHost(void** ptr, size_t size, bool* use_cuda) {
 #ifdef USE_MKL
   *ptr = mkl_malloc(size ? size:1, 64);
 #else
-  *ptr = malloc(size);
+  // aligned to cache lines, for the vectorized loops over whole buffers
+  if (posix_memalign(ptr, 64, size ? size : 1) != 0) {
+    *ptr = NULL;
+  }
 #endif
   *use_cuda = false;
   CHECK(*ptr) << "host allocation of size " << size << " failed";
@@ -68,6 +71,9 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  // Bumped every time a mutable pointer is handed out or the memory is
+  // replaced, so callers can tell whether the contents may have changed.
+  int version() const { return version_; }
 
 #ifndef CPU_ONLY
   void async_gpu_push(const cudaStream_t& stream);
@@ -86,6 +92,7 @@ class SyncedMemory {
   bool cpu_malloc_use_cuda_;
   bool own_gpu_data_;
   int device_;
+  int version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,126 @@
+#ifndef CAFFE_TEST_EPILOGUE_UTIL_H_
+#define CAFFE_TEST_EPILOGUE_UTIL_H_
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/eltwise_layer.hpp"
+#include "caffe/layers/relu_layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ExpectBlobsNear(const Blob<Dtype>& expected, const Blob<Dtype>& actual,
+    bool diff, const char* what) {
+  ASSERT_EQ(expected.count(), actual.count()) << what;
+  const Dtype* e = diff ? expected.cpu_diff() : expected.cpu_data();
+  const Dtype* a = diff ? actual.cpu_diff() : actual.cpu_data();
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(e[i], a[i], 1e-4 + 1e-4 * std::fabs(e[i]))
+        << what << " differed at " << i;
+  }
+}
+
+// Checks the forward and backward pass of a layer of type LayerT with the
+// epilogue of `param` against the layer without it, followed by an Eltwise
+// sum with a residual and a ReLU, on the same inputs and weights. Unlike a
+// gradient check, this does not depend on the pre-activations staying clear
+// of the kink of the ReLU, which the checker cannot see. The bottom, of the
+// shape of `bottom`, and the residual are filled from a fixed seed.
+template <template <typename> class LayerT, typename Dtype>
+void CheckEpilogueMatchesUnfused(const LayerParameter& param,
+    const Blob<Dtype>& bottom) {
+  const EpilogueParameter& epilogue = param.epilogue_param();
+  Caffe::set_random_seed(1701);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> x(bottom.shape());
+  filler.Fill(&x);
+  Blob<Dtype> fused_x;
+  fused_x.CopyFrom(x, false, true);
+
+  // the plain layer, then the sum and the ReLU
+  LayerParameter plain_param(param);
+  plain_param.clear_epilogue_param();
+  LayerT<Dtype> plain(plain_param);
+  Blob<Dtype> plain_top, residual, fused_residual, sum, relu_top;
+  vector<Blob<Dtype>*> bottom_vec(1, &x);
+  vector<Blob<Dtype>*> top_vec(1, &plain_top);
+  plain.SetUp(bottom_vec, top_vec);
+  plain.Forward(bottom_vec, top_vec);
+  Blob<Dtype>* out = &plain_top;
+  shared_ptr<EltwiseLayer<Dtype> > eltwise;
+  vector<Blob<Dtype>*> sum_bottom, sum_top(1, &sum);
+  if (epilogue.sum()) {
+    residual.ReshapeLike(plain_top);
+    filler.Fill(&residual);
+    fused_residual.CopyFrom(residual, false, true);
+    LayerParameter sum_param;
+    sum_param.mutable_eltwise_param()->set_operation(
+        EltwiseParameter_EltwiseOp_SUM);
+    eltwise.reset(new EltwiseLayer<Dtype>(sum_param));
+    sum_bottom.push_back(out);
+    sum_bottom.push_back(&residual);
+    eltwise->SetUp(sum_bottom, sum_top);
+    eltwise->Forward(sum_bottom, sum_top);
+    out = &sum;
+  }
+  shared_ptr<ReLULayer<Dtype> > relu;
+  vector<Blob<Dtype>*> relu_bottom(1, out), relu_top_vec(1, &relu_top);
+  if (epilogue.relu()) {
+    LayerParameter relu_param;
+    relu_param.mutable_relu_param()->set_negative_slope(
+        epilogue.negative_slope());
+    relu.reset(new ReLULayer<Dtype>(relu_param));
+    relu->SetUp(relu_bottom, relu_top_vec);
+    relu->Forward(relu_bottom, relu_top_vec);
+    out = &relu_top;
+  }
+
+  // the fused layer, with the same weights
+  LayerT<Dtype> fused(param);
+  Blob<Dtype> fused_top;
+  vector<Blob<Dtype>*> fused_bottom(1, &fused_x);
+  if (epilogue.sum()) { fused_bottom.push_back(&fused_residual); }
+  vector<Blob<Dtype>*> fused_top_vec(1, &fused_top);
+  fused.SetUp(fused_bottom, fused_top_vec);
+  ASSERT_EQ(plain.blobs().size(), fused.blobs().size());
+  for (int i = 0; i < plain.blobs().size(); ++i) {
+    fused.blobs()[i]->CopyFrom(*plain.blobs()[i]);
+  }
+  fused.Forward(fused_bottom, fused_top_vec);
+  ExpectBlobsNear(*out, fused_top, false, "top");
+
+  // the same top diff back through both
+  Blob<Dtype> top_diff(out->shape());
+  filler.Fill(&top_diff);
+  caffe_copy(out->count(), top_diff.cpu_data(), out->mutable_cpu_diff());
+  caffe_copy(out->count(), top_diff.cpu_data(), fused_top.mutable_cpu_diff());
+  if (relu) {
+    relu->Backward(relu_top_vec, vector<bool>(1, true), relu_bottom);
+  }
+  if (eltwise) {
+    eltwise->Backward(sum_top, vector<bool>(2, true), sum_bottom);
+  }
+  plain.Backward(top_vec, vector<bool>(1, true), bottom_vec);
+  fused.Backward(fused_top_vec, vector<bool>(fused_bottom.size(), true),
+      fused_bottom);
+  ExpectBlobsNear(x, fused_x, true, "bottom diff");
+  if (epilogue.sum()) {
+    ExpectBlobsNear(residual, fused_residual, true, "residual diff");
+  }
+  for (int i = 0; i < plain.blobs().size(); ++i) {
+    ExpectBlobsNear(*plain.blobs()[i], *fused.blobs()[i], true, "param diff");
+  }
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_TEST_EPILOGUE_UTIL_H_
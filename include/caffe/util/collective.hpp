@@ -0,0 +1,117 @@
+#ifndef CAFFE_UTIL_COLLECTIVE_HPP_
+#define CAFFE_UTIL_COLLECTIVE_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A ring of processes (the ranks) that exchange buffers with their
+ *        neighbours, and the collective operations built on that.
+ *
+ * A transport only has to implement SendRecv; Allreduce and Broadcast move
+ * every chunk along the ring, so each rank sends and receives about twice the
+ * size of the buffer whatever the number of ranks.
+ */
+class Collective {
+ public:
+  Collective(int rank, int size);
+  virtual ~Collective() { }
+
+  inline int rank() const { return rank_; }
+  inline int size() const { return size_; }
+
+  /**
+   * @brief Sends send_size bytes to the next rank while receiving recv_size
+   *        bytes from the previous one. Either size may be zero.
+   */
+  virtual void SendRecv(const void* send, size_t send_size, void* recv,
+      size_t recv_size) = 0;
+
+  /// @brief Sums data over all ranks, in place (ring reduce-scatter and
+  ///        all-gather).
+  template <typename Dtype>
+  void Allreduce(Dtype* data, size_t count);
+  /// @brief Copies data from rank 0 to all ranks.
+  template <typename Dtype>
+  void Broadcast(Dtype* data, size_t count);
+  /// @brief Returns once every rank has called it.
+  void Barrier();
+
+ protected:
+  int rank_;
+  int size_;
+  vector<char> buffer_;
+
+  DISABLE_COPY_AND_ASSIGN(Collective);
+};
+
+/**
+ * @brief Ranks on one machine, each of which receives through a ring buffer
+ *        in POSIX shared memory that the previous rank writes into.
+ *
+ * The segments are named after `name`, which must be unique to the job; they
+ * are unlinked as soon as both of their ranks have mapped them.
+ */
+class ShmCollective : public Collective {
+ public:
+  ShmCollective(const string& name, int rank, int size);
+  virtual ~ShmCollective();
+
+  virtual void SendRecv(const void* send, size_t send_size, void* recv,
+      size_t recv_size);
+
+ protected:
+  struct Channel;
+  Channel* Map(const string& name, bool create);
+
+  Channel* in_;
+  Channel* out_;
+};
+
+/**
+ * @brief Ranks connected by TCP sockets, each of which listens at its own
+ *        address for the previous rank and connects to the next one.
+ */
+class TCPCollective : public Collective {
+ public:
+  /// `addresses` holds a host:port for every rank, or only one, the other
+  /// ranks then listening on the next ports of the same host.
+  TCPCollective(const vector<string>& addresses, int rank, int size);
+  virtual ~TCPCollective();
+
+  virtual void SendRecv(const void* send, size_t send_size, void* recv,
+      size_t recv_size);
+
+ protected:
+  int in_;
+  int out_;
+};
+
+/// @brief Splits HOST:PORT.
+void ParseAddress(const string& address, string* host, int* port);
+/// @brief Returns a socket listening on `port` of every interface.
+int ListenTCP(int port, int backlog);
+/// @brief Returns a connection to host:port, retrying for a minute while
+///        nobody listens there yet.
+int ConnectTCP(const string& host, int port);
+/// @brief Returns the next connection made to `listener`.
+int AcceptTCP(int listener);
+/// @brief Sends all of data over a blocking socket.
+void SendAll(int fd, const void* data, size_t size);
+/// @brief Receives size bytes from a blocking socket. Returns false if the
+///        other end closed it instead.
+bool RecvAll(int fd, void* data, size_t size);
+
+/**
+ * @brief Connects to the other ranks as the uri says: shm://NAME for
+ *        shared memory, or tcp://HOST:PORT[,HOST:PORT...] for TCP.
+ */
+Collective* GetCollective(const string& uri, int rank, int size);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_COLLECTIVE_HPP_
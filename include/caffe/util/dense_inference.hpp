@@ -0,0 +1,26 @@
+#ifndef CAFFE_UTIL_DENSE_INFERENCE_HPP_
+#define CAFFE_UTIL_DENSE_INFERENCE_HPP_
+
+#include <string>
+
+#include "caffe/blob.hpp"
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+// Runs dense inference through the RandCatConv layer `layer_name` of `net`,
+// which has a chunk_size: the layers below it run once, it and the layers
+// above it once per chunk of chunk_size valid pixels. The rows of the blob
+// `blob_name` (one per point, e.g. the classifier scores) are written to the
+// pixels they belong to in dense_map, which is reshaped to (N x K x H x W)
+// for K values per row; invalid pixels are zero. Net::Forward cannot run
+// such a net, as it would only produce the first chunk. The net must not
+// plan its memory (plan_memory), as the chunks after the first read the
+// bottoms of the layer again.
+template <typename Dtype>
+void ForwardDense(Net<Dtype>* net, const string& layer_name,
+    const string& blob_name, Blob<Dtype>* dense_map);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DENSE_INFERENCE_HPP_
@@ -0,0 +1,62 @@
+#ifndef CAFFE_UTIL_EPILOGUE_HPP_
+#define CAFFE_UTIL_EPILOGUE_HPP_
+
+#include "caffe/blob.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * @brief The work a Convolution or InnerProduct layer does on its output
+ *        after the matrix multiplication (see EpilogueParameter).
+ *
+ * The bias, the residual and the ReLU are applied in one pass over a block of
+ * output the gemm has just written, while it is still in cache, instead of a
+ * bias gemm and Eltwise and ReLU layers that each stream the whole top
+ * through memory again.
+ */
+template <typename Dtype>
+class Epilogue {
+ public:
+  explicit Epilogue(const EpilogueParameter& param);
+
+  inline bool sum() const { return sum_; }
+  inline bool relu() const { return relu_; }
+  /// @brief Whether there is more to do than adding the bias.
+  inline bool enabled() const { return sum_ || relu_; }
+
+  /**
+   * @brief Computes y = relu(y + bias + residual) for a rows x cols block of
+   *        output. The bias is indexed by row if bias_per_row and by column
+   *        otherwise; bias and residual may be NULL.
+   */
+  void Forward_cpu(const int rows, const int cols, const Dtype* bias,
+      const bool bias_per_row, const Dtype* residual, Dtype* y) const;
+  /**
+   * @brief Returns the gradient with respect to the output before the ReLU,
+   *        which the weight, bias and bottom gradients are computed from, and
+   *        writes it into the residual diff if propagate_residual.
+   */
+  const Dtype* Backward_cpu(const Blob<Dtype>& top,
+      const bool propagate_residual, Blob<Dtype>* residual);
+
+ private:
+  bool sum_;
+  bool relu_;
+  Dtype negative_slope_;
+  /// the gradient before the ReLU, unless it is kept in the residual diff
+  Blob<Dtype> diff_;
+};
+
+// Copies the NetParameter with ReLU and residual Eltwise SUM layers folded
+// into the epilogue of the Convolution or InnerProduct layer whose output
+// they consume, which then takes their place in the net:
+//   Convolution/InnerProduct -> ReLU
+//   Convolution/InnerProduct -> Eltwise SUM [-> ReLU]
+// The intermediate blobs may not be read by any other layer. Returns the
+// number of layers that were folded away.
+int FuseEpilogues(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_EPILOGUE_HPP_
@@ -0,0 +1,84 @@
+#ifndef CAFFE_UTIL_FLAT_WEIGHTS_HPP_
+#define CAFFE_UTIL_FLAT_WEIGHTS_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * A flat weights file holds the params of a net uncompressed, each one at an
+ * aligned offset, so that it can be mapped into memory and used in place:
+ * loading it reads nothing up front, and the processes mapping one file share
+ * its pages. Its layout, in host byte order:
+ *
+ *   header  the magic "CAFFEFLT", then uint32 version, size of an element
+ *           (4 for float, 8 for double) and number of blobs
+ *   index   for every blob: uint32 length of its layer name, the name,
+ *           uint32 index of the blob in the layer and number of axes, int32
+ *           dims, and uint64 offset of its data in the file
+ *   data    the elements of each blob at a multiple of kFlatWeightsAlignment
+ */
+const char kFlatWeightsMagic[] = "CAFFEFLT";
+const uint32_t kFlatWeightsVersion = 1;
+const int kFlatWeightsAlignment = 64;
+
+/// @brief Collects blobs and writes them as a flat weights file.
+template <typename Dtype>
+class FlatWeightsWriter {
+ public:
+  FlatWeightsWriter() {}
+  /// @brief Adds blob index of a layer; data has to stay valid until Write.
+  void Add(const string& layer_name, int index, const vector<int>& shape,
+      const Dtype* data);
+  void Write(const string& filename) const;
+
+ private:
+  vector<string> layer_names_;
+  vector<int> indices_;
+  vector<vector<int> > shapes_;
+  vector<const Dtype*> data_;
+
+  DISABLE_COPY_AND_ASSIGN(FlatWeightsWriter);
+};
+
+/**
+ * @brief A flat weights file mapped into memory, for as long as the object
+ *        lives. The file is only read: the mapping is private, so that a
+ *        process writing to a blob gets a copy of the pages it writes while
+ *        the others go on sharing the file's.
+ */
+class FlatWeightsFile {
+ public:
+  explicit FlatWeightsFile(const string& filename);
+  ~FlatWeightsFile();
+
+  inline int num_blobs() const { return layer_names_.size(); }
+  inline size_t element_size() const { return element_size_; }
+  inline const string& layer_name(int i) const { return layer_names_[i]; }
+  inline int index(int i) const { return indices_[i]; }
+  inline const vector<int>& shape(int i) const { return shapes_[i]; }
+  inline int count(int i) const { return counts_[i]; }
+  void* data(int i) const;
+
+ private:
+  string filename_;
+  void* memory_;
+  size_t size_;
+  size_t element_size_;
+  vector<string> layer_names_;
+  vector<int> indices_;
+  vector<vector<int> > shapes_;
+  vector<int> counts_;
+  vector<uint64_t> offsets_;
+
+  DISABLE_COPY_AND_ASSIGN(FlatWeightsFile);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FLAT_WEIGHTS_HPP_
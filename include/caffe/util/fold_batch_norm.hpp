@@ -0,0 +1,28 @@
+#ifndef CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+#define CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Folds every BatchNorm layer that uses its global statistics (by default
+// only in the TEST phase: that of `param`, unless the layer has its own),
+// together with an optional Scale layer right after it, into the
+// Convolution or InnerProduct layer right before them: the per-channel
+// affine transform they apply is moved into that layer's weights and bias,
+// and the BatchNorm and Scale layers are dropped. The layers have to be
+// adjacent in `param` and the intermediate blobs may not be read by any
+// other layer.
+//
+// `param` is the net definition and `weights` the trained net to take the
+// parameters from by layer name, e.g. a caffemodel or the output of
+// Net::ToProto after CopyTrainedLayersFrom. Writes the folded definition
+// (without parameters) into param_folded and, if weights_folded is not NULL,
+// the same definition with the folded parameters attached, which can be
+// saved as a caffemodel. Returns the number of layers that were folded away.
+int FoldBatchNorm(const NetParameter& param, const NetParameter& weights,
+    NetParameter* param_folded, NetParameter* weights_folded);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FOLD_BATCH_NORM_HPP_
@@ -30,6 +30,9 @@ void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
 string hdf5_load_string(hid_t loc_id, const string& dataset_name);
 void hdf5_save_string(hid_t loc_id, const string& dataset_name,
                       const string& s);
+string hdf5_load_bytes(hid_t loc_id, const string& dataset_name);
+void hdf5_save_bytes(hid_t loc_id, const string& dataset_name,
+                     const string& bytes);
 
 int hdf5_get_num_links(hid_t loc_id);
 string hdf5_get_name_by_idx(hid_t loc_id, int idx);
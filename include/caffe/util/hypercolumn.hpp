@@ -0,0 +1,54 @@
+#ifndef CAFFE_UTIL_HYPERCOLUMN_HPP_
+#define CAFFE_UTIL_HYPERCOLUMN_HPP_
+
+namespace caffe {
+
+// Where one sampled point reads its features from in one hypercolumn blob:
+// the top-left neighbour `pixel` (y * width + x) of image `n`, bilinearly
+// interpolated towards the right / lower neighbour with weight rx / ry when
+// interp_x / interp_y is set.
+template <typename Dtype>
+struct HypercolumnTap {
+  int n;
+  int pixel;
+  bool interp_x;
+  bool interp_y;
+  Dtype rx;
+  Dtype ry;
+};
+
+// Gathers the features of num_taps taps (taps[0], taps[tap_stride], ...)
+// into the rows of data_col, col_stride apart. data_im is either a regular
+// (N x C x H x W) blob, or its (N x H x W x C) transpose if nhwc is set, in
+// which case the channels of a tap are contiguous. copy_only promises that
+// no tap interpolates, e.g. because the blob has pooling factor 1.
+template <typename Dtype>
+void hypercolumn_gather_cpu(const Dtype* data_im, const bool nhwc,
+    const int channels, const int height, const int width,
+    const bool copy_only, const HypercolumnTap<Dtype>* taps,
+    const int tap_stride, const int num_taps, Dtype* data_col,
+    const int col_stride);
+
+// Adjoint of hypercolumn_gather_cpu for a single tap: accumulates the
+// gradient of its features into the (N x C x H x W) diff data_im.
+template <typename Dtype>
+void hypercolumn_scatter_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const HypercolumnTap<Dtype>& tap,
+    Dtype* data_im);
+
+// Transposes (N x C x H x W) data into (N x H x W x C).
+template <typename Dtype>
+void nchw_to_nhwc_cpu(const Dtype* data, const int num, const int channels,
+    const int height, const int width, Dtype* data_nhwc);
+
+// Transposing an image costs about two streaming passes over it, whereas a
+// strided gather misses the cache once per channel and neighbour. The
+// transpose pays off once the taps cover a sizeable part of the image.
+inline bool hypercolumn_use_nhwc(const int taps_per_image,
+    const int channels, const int pixels) {
+  return channels > 1 && 32 * taps_per_image >= pixels;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HYPERCOLUMN_HPP_
@@ -0,0 +1,32 @@
+#ifndef CAFFE_UTIL_MEMORY_PLAN_HPP_
+#define CAFFE_UTIL_MEMORY_PLAN_HPP_
+
+#include <vector>
+
+namespace caffe {
+
+// A request for `size` bytes that have to stay intact from step `begin`
+// through step `end`, both inclusive.
+struct MemoryInterval {
+  size_t size;
+  int begin;
+  int end;
+};
+
+// Packs the intervals into buffers such that no two intervals sharing a
+// buffer overlap in time. Writes the buffer of interval i into
+// (*assignment)[i] and returns the size of every buffer, which is the size of
+// its largest interval. The intervals are placed largest first, each into
+// the smallest compatible buffer, which is close to optimal for the chains
+// and short-lived branches of typical nets.
+std::vector<size_t> PlanMemoryBuffers(
+    const std::vector<MemoryInterval>& intervals,
+    std::vector<int>* assignment);
+
+// Lower bound for any plan: the largest total size of the intervals that are
+// live at the same step.
+size_t PeakLiveMemory(const std::vector<MemoryInterval>& intervals);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEMORY_PLAN_HPP_
@@ -0,0 +1,64 @@
+#ifndef CAFFE_UTIL_REDUCED_PRECISION_HPP_
+#define CAFFE_UTIL_REDUCED_PRECISION_HPP_
+
+#include <stdint.h>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+/**
+ * Values kept in fewer bits than a float (see
+ * SolverParameter.history_precision): FP16 (IEEE half) and BF16 (bfloat16)
+ * take 2 bytes a value, and INT8 one byte, with a float scale for every block
+ * of kReducedBlockSize values, stored ahead of the block.
+ *
+ * Encoding rounds stochastically: a value goes to one of the two nearest codes
+ * with the probabilities that make the expected code the value itself, so that
+ * the small steps of a running average are not rounded away. The random bits
+ * are a hash of a seed and the index of the value, so the codes do not depend
+ * on how the values are split among threads.
+ *
+ * INT8 codes magnitudes on a logarithmic scale below the largest one of the
+ * block, so that small values keep their relative precision: 8 steps an
+ * octave with a sign bit, or 16 for values known to be non-negative.
+ *
+ * Non-negative values, such as averages of squared gradients, are never
+ * rounded from above zero down to zero, which would leave an adaptive solver
+ * dividing by its delta alone.
+ */
+typedef SolverParameter_HistoryPrecision ReducedPrecision;
+
+const int kReducedBlockSize = 256;
+
+/// @brief Returns the bytes taken by count values in precision.
+size_t reduced_precision_size(ReducedPrecision precision, int count);
+
+/**
+ * @brief Encodes n values of x as the values [offset, offset + n) of codes.
+ *        For INT8, offset has to be a multiple of kReducedBlockSize, and so
+ *        does n unless the values run to the end of codes.
+ */
+template <typename Dtype>
+void reduced_precision_encode(ReducedPrecision precision, int n,
+    const Dtype* x, bool nonnegative, uint32_t seed, int offset, void* codes);
+
+/// @brief Decodes the values [offset, offset + n) of codes into x.
+template <typename Dtype>
+void reduced_precision_decode(ReducedPrecision precision, int n,
+    const void* codes, bool nonnegative, int offset, Dtype* x);
+
+/// @brief Returns 32 random-looking bits for (seed, i).
+inline uint32_t hash_bits(uint32_t seed, uint32_t i) {
+  uint32_t h = seed ^ (i * 0x9e3779b9u);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_REDUCED_PRECISION_HPP_
@@ -38,6 +38,25 @@ template <class RandomAccessIterator>
 inline void shuffle(RandomAccessIterator begin, RandomAccessIterator end) {
   shuffle(begin, end, caffe_rng());
 }
+
+// Partial Fisher–Yates: moves k elements drawn uniformly without replacement
+// from [begin, end) to its first k positions in O(k).
+template <class RandomAccessIterator, class RandomGenerator>
+inline void partial_shuffle(RandomAccessIterator begin,
+    RandomAccessIterator end,
+    typename std::iterator_traits<RandomAccessIterator>::difference_type k,
+    RandomGenerator* gen) {
+  typedef typename std::iterator_traits<RandomAccessIterator>::difference_type
+      difference_type;
+  typedef typename boost::uniform_int<difference_type> dist_type;
+
+  difference_type length = std::distance(begin, end);
+  CHECK_LE(k, length);
+  for (difference_type i = 0; i < k; ++i) {
+    dist_type dist(i, length - 1);
+    std::iter_swap(begin + i, begin + dist(*gen));
+  }
+}
 }  // namespace caffe
 
 #endif  // CAFFE_RNG_HPP_
@@ -118,16 +118,22 @@ shared_ptr<Net<Dtype> > Net_Init(string network_file, int phase,
     }
   }
 
-  // Initialize net
+  std::string weights_file_str;
+  if (!weights.is_none()) {
+    weights_file_str = bp::extract<std::string>(weights);
+    CheckFile(weights_file_str);
+  }
+
+  // Initialize net, leaving the params the weights overwrite unfilled
+  Caffe::set_defer_fill(!weights.is_none());
   shared_ptr<Net<Dtype> > net(new Net<Dtype>(network_file,
         static_cast<Phase>(phase), level, &stages_vector));
 
   // Load weights
   if (!weights.is_none()) {
-    std::string weights_file_str = bp::extract<std::string>(weights);
-    CheckFile(weights_file_str);
     net->CopyTrainedLayersFrom(weights_file_str);
   }
+  Caffe::set_defer_fill(false);
 
   return net;
 }
@@ -143,9 +149,11 @@ shared_ptr<Net<Dtype> > Net_Init_Load(
   CheckFile(param_file);
   CheckFile(pretrained_param_file);
 
+  Caffe::set_defer_fill(true);
   shared_ptr<Net<Dtype> > net(new Net<Dtype>(param_file,
       static_cast<Phase>(phase)));
   net->CopyTrainedLayersFrom(pretrained_param_file);
+  Caffe::set_defer_fill(false);
   return net;
 }
 
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <climits>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -83,12 +85,14 @@ const int* Blob<Dtype>::gpu_shape() const {
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_data() const {
   CHECK(data_);
+  FillDeferred();
   return (const Dtype*)data_->cpu_data();
 }
 
 template <typename Dtype>
 void Blob<Dtype>::set_cpu_data(Dtype* data) {
   CHECK(data);
+  cancel_deferred_fill();
   // Make sure CPU and GPU sizes remain equal
   size_t size = count_ * sizeof(Dtype);
   if (data_->size() != size) {
@@ -101,12 +105,14 @@ void Blob<Dtype>::set_cpu_data(Dtype* data) {
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_data() const {
   CHECK(data_);
+  FillDeferred();
   return (const Dtype*)data_->gpu_data();
 }
 
 template <typename Dtype>
 void Blob<Dtype>::set_gpu_data(Dtype* data) {
   CHECK(data);
+  cancel_deferred_fill();
   // Make sure CPU and GPU sizes remain equal
   size_t size = count_ * sizeof(Dtype);
   if (data_->size() != size) {
@@ -131,12 +137,14 @@ const Dtype* Blob<Dtype>::gpu_diff() const {
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_data() {
   CHECK(data_);
+  FillDeferred();
   return static_cast<Dtype*>(data_->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_data() {
   CHECK(data_);
+  FillDeferred();
   return static_cast<Dtype*>(data_->mutable_gpu_data());
 }
 
@@ -155,6 +163,7 @@ Dtype* Blob<Dtype>::mutable_gpu_diff() {
 template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
+  cancel_deferred_fill();
   data_ = other.data();
 }
 
@@ -164,6 +173,22 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::set_data(const shared_ptr<SyncedMemory>& memory) {
+  CHECK_GE(memory->size(), count_ * sizeof(Dtype));
+  CHECK(diff_);
+  data_ = memory;
+  capacity_ = std::min(data_->size(), diff_->size()) / sizeof(Dtype);
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_diff(const shared_ptr<SyncedMemory>& memory) {
+  CHECK_GE(memory->size(), count_ * sizeof(Dtype));
+  CHECK(data_);
+  diff_ = memory;
+  capacity_ = std::min(data_->size(), diff_->size()) / sizeof(Dtype);
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -172,6 +197,7 @@ template <> void Blob<int>::Update() { NOT_IMPLEMENTED; }
 
 template <typename Dtype>
 void Blob<Dtype>::Update() {
+  FillDeferred();
   // We will perform update based on where the data is located.
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
@@ -209,6 +235,7 @@ template <> int Blob<int>::asum_data() const {
 template <typename Dtype>
 Dtype Blob<Dtype>::asum_data() const {
   if (!data_) { return 0; }
+  FillDeferred();
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
     return caffe_cpu_asum(count_, cpu_data());
@@ -281,6 +308,7 @@ Dtype Blob<Dtype>::sumsq_data() const {
   Dtype sumsq;
   const Dtype* data;
   if (!data_) { return 0; }
+  FillDeferred();
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
     data = cpu_data();
@@ -352,6 +380,7 @@ template <typename Dtype>
 void Blob<Dtype>::scale_data(Dtype scale_factor) {
   Dtype* data;
   if (!data_) { return; }
+  FillDeferred();
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
     data = mutable_cpu_data();
@@ -438,6 +467,9 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
       LOG(FATAL) << "Trying to copy blobs of different sizes.";
     }
   }
+  if (!copy_diff) {
+    cancel_deferred_fill();
+  }
   switch (Caffe::mode()) {
   case Caffe::GPU:
     if (copy_diff) {
@@ -486,6 +518,7 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
     CHECK(ShapeEquals(proto)) << "shape mismatch (reshape not set)";
   }
   // copy data
+  cancel_deferred_fill();
   Dtype* data_vec = mutable_cpu_data();
   if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
@@ -553,6 +586,14 @@ void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
   }
 }
 
+template <typename Dtype>
+void Blob<Dtype>::RunDeferredFill() const {
+  // taken first, as filling accesses the data
+  shared_ptr<Filler<Dtype> > filler;
+  filler.swap(deferred_filler_);
+  filler->Fill(const_cast<Blob<Dtype>*>(this));
+}
+
 INSTANTIATE_CLASS(Blob);
 template class Blob<int>;
 template class Blob<unsigned int>;
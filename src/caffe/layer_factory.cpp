@@ -50,7 +50,7 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(
   if (engine == ConvolutionParameter_Engine_DEFAULT) {
     engine = ConvolutionParameter_Engine_CAFFE;
 #ifdef USE_CUDNN
-    if (!use_dilation) {
+    if (!use_dilation && !param.has_epilogue_param()) {
       engine = ConvolutionParameter_Engine_CUDNN;
     }
 #endif
@@ -63,6 +63,10 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(
       LOG(FATAL) << "CuDNN doesn't support the dilated convolution at Layer "
                  << param.name();
     }
+    if (param.has_epilogue_param()) {
+      LOG(FATAL) << "CuDNN doesn't support the epilogue at Layer "
+                 << param.name();
+    }
     return shared_ptr<Layer<Dtype> >(new CuDNNConvolutionLayer<Dtype>(param));
 #endif
   } else {
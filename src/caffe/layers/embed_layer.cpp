@@ -30,14 +30,14 @@ void EmbedLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     weight_shape[1] = N_;
     this->blobs_[0].reset(new Blob<Dtype>(weight_shape));
     // fill the weights
-    shared_ptr<Filler<Dtype> > weight_filler(GetFiller<Dtype>(
+    shared_ptr<Filler<Dtype> > weight_filler(GetParamFiller<Dtype>(
         this->layer_param_.embed_param().weight_filler()));
     weight_filler->Fill(this->blobs_[0].get());
     // If necessary, initialize and fill the bias term
     if (bias_term_) {
       vector<int> bias_shape(1, N_);
       this->blobs_[1].reset(new Blob<Dtype>(bias_shape));
-      shared_ptr<Filler<Dtype> > bias_filler(GetFiller<Dtype>(
+      shared_ptr<Filler<Dtype> > bias_filler(GetParamFiller<Dtype>(
           this->layer_param_.embed_param().bias_filler()));
       bias_filler->Fill(this->blobs_[1].get());
     }
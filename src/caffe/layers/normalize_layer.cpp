@@ -14,10 +14,6 @@ void NormalizeLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   CHECK_GE(bottom[0]->num_axes(), 2)
       << "Number of axes of bottom blob must be >=2.";
-  buffer_.Reshape(1, bottom[0]->channels(),
-                   bottom[0]->height(), bottom[0]->width());
-  buffer_channel_.Reshape(1, bottom[0]->channels(), 1, 1);
-  buffer_spatial_.Reshape(1, 1, bottom[0]->height(), bottom[0]->width());
   NormalizeParameter norm_param = this->layer_param().norm_param();
   across_spatial_ = norm_param.across_spatial();
   if (across_spatial_) {
@@ -27,11 +23,6 @@ void NormalizeLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   eps_ = norm_param.eps();
   int channels = bottom[0]->channels();
-  int spatial_dim = bottom[0]->width() * bottom[0]->height();
-  sum_channel_multiplier_.Reshape(1, channels, 1, 1);
-  caffe_set(channels, Dtype(1), sum_channel_multiplier_.mutable_cpu_data());
-  sum_spatial_multiplier_.Reshape(1, 1, bottom[0]->height(), bottom[0]->width());
-  caffe_set(spatial_dim, Dtype(1), sum_spatial_multiplier_.mutable_cpu_data());
   channel_shared_ = norm_param.channel_shared();
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -44,12 +35,12 @@ void NormalizeLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
     shared_ptr<Filler<Dtype> > scale_filler;
     if (norm_param.has_scale_filler()) {
-      scale_filler.reset(GetFiller<Dtype>(norm_param.scale_filler()));
+      scale_filler.reset(GetParamFiller<Dtype>(norm_param.scale_filler()));
     } else {
       FillerParameter filler_param;
       filler_param.set_type("constant");
       filler_param.set_value(1.0);
-      scale_filler.reset(GetFiller<Dtype>(filler_param));
+      scale_filler.reset(GetParamFiller<Dtype>(filler_param));
     }
     scale_filler->Fill(this->blobs_[0].get());
   }
@@ -75,63 +66,94 @@ void NormalizeLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   CHECK_GE(bottom[0]->num_axes(), 2)
       << "Number of axes of bottom blob must be >=2.";
   top[0]->ReshapeLike(*bottom[0]);
-  buffer_.Reshape(1, bottom[0]->channels(),
-                   bottom[0]->height(), bottom[0]->width());
   if (!across_spatial_) {
     norm_.Reshape(bottom[0]->num(), 1, bottom[0]->height(), bottom[0]->width());
   }
-  int spatial_dim = bottom[0]->height() * bottom[0]->width();
-  if (spatial_dim != sum_spatial_multiplier_.count()) {
-    sum_spatial_multiplier_.Reshape(1, 1, bottom[0]->height(), bottom[0]->width());
-    caffe_set(spatial_dim, Dtype(1), sum_spatial_multiplier_.mutable_cpu_data());
-    buffer_spatial_.Reshape(1, 1, bottom[0]->height(), bottom[0]->width());
-  }
 }
 
+// Spatial positions per task when every position has its own norm: the
+// running sums of a tile stay in L1 while the channels stream through.
+const int kNormalizeTile = 256;
+
 template <typename Dtype>
 void NormalizeLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* scale = this->blobs_[0]->cpu_data();
-  Dtype* buffer_data = buffer_.mutable_cpu_data();
   Dtype* norm_data = norm_.mutable_cpu_data();
-  // add eps to avoid overflow
-  caffe_set<Dtype>(norm_.count(), Dtype(eps_), norm_data);
-  const Dtype* sum_channel_multiplier = sum_channel_multiplier_.cpu_data();
-  const Dtype* sum_spatial_multiplier = sum_spatial_multiplier_.cpu_data();
-  int num = bottom[0]->num();
-  int dim = bottom[0]->count() / num;
-  int spatial_dim = bottom[0]->height() * bottom[0]->width();
-  int channels = bottom[0]->channels();
-  for (int n = 0; n < num; ++n) {
-    caffe_sqr<Dtype>(dim, bottom_data, buffer_data);
-    if (across_spatial_) {
+  const int num = bottom[0]->num();
+  const int dim = bottom[0]->count() / num;
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  const int channels = bottom[0]->channels();
+  if (across_spatial_) {
+    // the sum of squares of every channel map, then one scaling pass
+    vector<Dtype> sumsq(num * channels);
+#pragma omp parallel for
+    for (int task = 0; task < num * channels; ++task) {
+      const Dtype* x = bottom_data + task * spatial_dim;
+      Dtype sum = 0;
+      for (int s = 0; s < spatial_dim; ++s) {
+        sum += x[s] * x[s];
+      }
+      sumsq[task] = sum;
+    }
+    for (int n = 0; n < num; ++n) {
+      Dtype sum = 0;
+      for (int c = 0; c < channels; ++c) {
+        sum += sumsq[n * channels + c];
+      }
       // add eps to avoid overflow
-      norm_data[n] = pow(caffe_cpu_asum<Dtype>(dim, buffer_data)+eps_, Dtype(0.5));
-      caffe_cpu_scale<Dtype>(dim, Dtype(1.0 / norm_data[n]), bottom_data, top_data);
-    } else {
-      caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1), buffer_data,
-          sum_channel_multiplier, Dtype(1), norm_data);
-      // compute norm
-      caffe_powx<Dtype>(spatial_dim, norm_data, Dtype(0.5), norm_data);
-      // scale the layer
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim, 1,
-          Dtype(1), sum_channel_multiplier, norm_data, Dtype(0), buffer_data);
-      caffe_div<Dtype>(dim, bottom_data, buffer_data, top_data);
-      norm_data += spatial_dim;
+      norm_data[n] = sqrt(sum + eps_);
     }
-    // scale the output
-    if (channel_shared_) {
-      caffe_scal<Dtype>(dim, scale[0], top_data);
-    } else {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim, 1,
-                            Dtype(1), scale, sum_spatial_multiplier, Dtype(0),
-                            buffer_data);
-      caffe_mul<Dtype>(dim, top_data, buffer_data, top_data);
+#pragma omp parallel for
+    for (int task = 0; task < num * channels; ++task) {
+      const int n = task / channels;
+      const int c = task % channels;
+      const Dtype factor = (channel_shared_ ? scale[0] : scale[c]) /
+          norm_data[n];
+      const Dtype* x = bottom_data + task * spatial_dim;
+      Dtype* y = top_data + task * spatial_dim;
+      for (int s = 0; s < spatial_dim; ++s) {
+        y[s] = x[s] * factor;
+      }
+    }
+  } else {
+    // every tile of positions: accumulate the squares over the channels,
+    // then scale the same rows, which are still in cache
+    const int tiles = (spatial_dim + kNormalizeTile - 1) / kNormalizeTile;
+#pragma omp parallel for
+    for (int task = 0; task < num * tiles; ++task) {
+      const int n = task / tiles;
+      const int s_begin = (task % tiles) * kNormalizeTile;
+      const int len = std::min(kNormalizeTile, spatial_dim - s_begin);
+      const Dtype* x = bottom_data + n * dim + s_begin;
+      Dtype* y = top_data + n * dim + s_begin;
+      Dtype* norm = norm_data + n * spatial_dim + s_begin;
+      Dtype inv_norm[kNormalizeTile];
+      // add eps to avoid overflow
+      for (int s = 0; s < len; ++s) {
+        inv_norm[s] = eps_;
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* xc = x + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          inv_norm[s] += xc[s] * xc[s];
+        }
+      }
+      for (int s = 0; s < len; ++s) {
+        norm[s] = sqrt(inv_norm[s]);
+        inv_norm[s] = 1 / norm[s];
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* xc = x + c * spatial_dim;
+        Dtype* yc = y + c * spatial_dim;
+        const Dtype scale_c = channel_shared_ ? scale[0] : scale[c];
+        for (int s = 0; s < len; ++s) {
+          yc[s] = xc[s] * inv_norm[s] * scale_c;
+        }
+      }
     }
-    bottom_data += dim;
-    top_data += dim;
   }
 }
 
@@ -139,81 +161,119 @@ template <typename Dtype>
 void NormalizeLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* top_data = top[0]->cpu_data();
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   const Dtype* scale = this->blobs_[0]->cpu_data();
   const Dtype* norm_data = norm_.cpu_data();
-  Dtype* buffer_data = buffer_.mutable_cpu_data();
-  Dtype* buffer_channel = buffer_channel_.mutable_cpu_data();
-  Dtype* buffer_spatial = buffer_spatial_.mutable_cpu_data();
-  const Dtype* sum_channel_multiplier = sum_channel_multiplier_.cpu_data();
-  const Dtype* sum_spatial_multiplier = sum_spatial_multiplier_.cpu_data();
-  int count = top[0]->count();
-  int num = top[0]->num();
-  int dim = count / num;
-  int spatial_dim = top[0]->height() * top[0]->width();
-  int channels = top[0]->channels();
-  
-  // Propagate to param
+  const int count = top[0]->count();
+  const int num = top[0]->num();
+  const int dim = count / num;
+  const int spatial_dim = top[0]->height() * top[0]->width();
+  const int channels = top[0]->channels();
+
+  // With y = s_c * x / |x|, the scale gradient is sum(dy * x / |x|) and,
+  // for g = s_c * dy, the bottom gradient is (g - x * (x . g) / |x|^2) / |x|.
+  // dot[n * channels + c] holds sum(x * dy / |x|) over the positions of
+  // channel c that share a norm; it serves both.
   if (this->param_propagate_down_[0]) {
+    vector<Dtype> dot(num * channels);
+#pragma omp parallel for
+    for (int task = 0; task < num * channels; ++task) {
+      const int n = task / channels;
+      const Dtype* x = bottom_data + task * spatial_dim;
+      const Dtype* dy = top_diff + task * spatial_dim;
+      const Dtype* norm = across_spatial_ ? NULL :
+          norm_data + n * spatial_dim;
+      Dtype sum = 0;
+      if (across_spatial_) {
+        for (int s = 0; s < spatial_dim; ++s) {
+          sum += x[s] * dy[s];
+        }
+        sum /= norm_data[n];
+      } else {
+        for (int s = 0; s < spatial_dim; ++s) {
+          sum += x[s] * dy[s] / norm[s];
+        }
+      }
+      dot[task] = sum;
+    }
     Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-    if (channel_shared_) {
-      scale_diff[0] += caffe_cpu_dot<Dtype>(count, top_data, top_diff) / scale[0];
-    } else {
-      for (int n = 0; n < num; ++n) {
-        caffe_mul<Dtype>(dim, top_data+n*dim, top_diff+n*dim, buffer_data);
-        caffe_cpu_gemv<Dtype>(CblasNoTrans, channels, spatial_dim, Dtype(1),
-            buffer_data, sum_spatial_multiplier, Dtype(0), buffer_channel);
-        // store a / scale[i] in buffer_data temporary
-        caffe_div<Dtype>(channels, buffer_channel, scale, buffer_channel);
-        caffe_add<Dtype>(channels, buffer_channel, scale_diff, scale_diff);
+    for (int n = 0; n < num; ++n) {
+      for (int c = 0; c < channels; ++c) {
+        scale_diff[channel_shared_ ? 0 : c] += dot[n * channels + c];
       }
     }
   }
 
-  // Propagate to bottom
-  if (propagate_down[0]) {
+  if (!propagate_down[0]) {
+    return;
+  }
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  if (across_spatial_) {
+    vector<Dtype> dot(num * channels);
+#pragma omp parallel for
+    for (int task = 0; task < num * channels; ++task) {
+      const int c = task % channels;
+      const Dtype* x = bottom_data + task * spatial_dim;
+      const Dtype* dy = top_diff + task * spatial_dim;
+      Dtype sum = 0;
+      for (int s = 0; s < spatial_dim; ++s) {
+        sum += x[s] * dy[s];
+      }
+      dot[task] = sum * (channel_shared_ ? scale[0] : scale[c]);
+    }
+    vector<Dtype> projection(num);
     for (int n = 0; n < num; ++n) {
-      if (across_spatial_) {
-        Dtype a = caffe_cpu_dot<Dtype>(dim, bottom_data, top_diff);
-        caffe_cpu_scale<Dtype>(dim, a / norm_data[n] / norm_data[n], bottom_data,
-                               bottom_diff);
-        caffe_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
-        caffe_scal<Dtype>(dim, Dtype(1.0 / norm_data[n]), bottom_diff);
-      } else {
-        // dot product between bottom_data and top_diff
-        caffe_mul<Dtype>(dim, bottom_data, top_diff, buffer_data);
-        caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1),
-            buffer_data, sum_channel_multiplier, Dtype(0), buffer_spatial);
-        // scale bottom_diff
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-            1, Dtype(1), sum_channel_multiplier, buffer_spatial, Dtype(0), buffer_data);
-        caffe_mul<Dtype>(dim, bottom_data, buffer_data, bottom_diff);
-        // divide by square of norm
-        caffe_powx<Dtype>(spatial_dim, norm_data, Dtype(2), buffer_spatial);
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-            1, Dtype(1), sum_channel_multiplier, buffer_spatial, Dtype(0), buffer_data);
-        caffe_div<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
-        // subtract
-        caffe_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
-        // divide by norm
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-            1, Dtype(1), sum_channel_multiplier, norm_data, Dtype(0), buffer_data);
-        caffe_div<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
-        norm_data += spatial_dim;
+      Dtype a = 0;
+      for (int c = 0; c < channels; ++c) {
+        a += dot[n * channels + c];
       }
-      // scale the diff
-      if (channel_shared_) {
-        caffe_scal<Dtype>(dim, scale[0], bottom_diff);
-      } else {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-            1, Dtype(1), scale, sum_spatial_multiplier, Dtype(0), buffer_data);
-        caffe_mul<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
+      projection[n] = a / (norm_data[n] * norm_data[n]);
+    }
+#pragma omp parallel for
+    for (int task = 0; task < num * channels; ++task) {
+      const int n = task / channels;
+      const int c = task % channels;
+      const Dtype inv_norm = 1 / norm_data[n];
+      const Dtype scale_c = channel_shared_ ? scale[0] : scale[c];
+      const Dtype* x = bottom_data + task * spatial_dim;
+      const Dtype* dy = top_diff + task * spatial_dim;
+      Dtype* dx = bottom_diff + task * spatial_dim;
+      for (int s = 0; s < spatial_dim; ++s) {
+        dx[s] = (scale_c * dy[s] - x[s] * projection[n]) * inv_norm;
+      }
+    }
+  } else {
+    const int tiles = (spatial_dim + kNormalizeTile - 1) / kNormalizeTile;
+#pragma omp parallel for
+    for (int task = 0; task < num * tiles; ++task) {
+      const int n = task / tiles;
+      const int s_begin = (task % tiles) * kNormalizeTile;
+      const int len = std::min(kNormalizeTile, spatial_dim - s_begin);
+      const Dtype* x = bottom_data + n * dim + s_begin;
+      const Dtype* dy = top_diff + n * dim + s_begin;
+      Dtype* dx = bottom_diff + n * dim + s_begin;
+      const Dtype* norm = norm_data + n * spatial_dim + s_begin;
+      Dtype projection[kNormalizeTile] = {0};
+      for (int c = 0; c < channels; ++c) {
+        const Dtype scale_c = channel_shared_ ? scale[0] : scale[c];
+        const Dtype* xc = x + c * spatial_dim;
+        const Dtype* dyc = dy + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          projection[s] += xc[s] * dyc[s] * scale_c;
+        }
+      }
+      for (int s = 0; s < len; ++s) {
+        projection[s] /= norm[s] * norm[s];
+      }
+      for (int c = 0; c < channels; ++c) {
+        const Dtype scale_c = channel_shared_ ? scale[0] : scale[c];
+        const Dtype* xc = x + c * spatial_dim;
+        const Dtype* dyc = dy + c * spatial_dim;
+        Dtype* dxc = dx + c * spatial_dim;
+        for (int s = 0; s < len; ++s) {
+          dxc[s] = (scale_c * dyc[s] - xc[s] * projection[s]) / norm[s];
+        }
       }
-      bottom_data += dim;
-      top_diff += dim;
-      bottom_diff += dim;
     }
   }
 }
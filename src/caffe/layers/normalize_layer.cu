@@ -42,9 +42,29 @@ __global__ void MulBsx(const int nthreads, const Dtype* A,
   }
 }
 
+template <typename Dtype>
+void NormalizeLayer<Dtype>::ReshapeGPUBuffers(const Blob<Dtype>& bottom) {
+  const int channels = bottom.channels();
+  const int spatial_dim = bottom.height() * bottom.width();
+  buffer_.Reshape(1, channels, bottom.height(), bottom.width());
+  buffer_channel_.Reshape(1, channels, 1, 1);
+  buffer_spatial_.Reshape(1, 1, bottom.height(), bottom.width());
+  if (sum_channel_multiplier_.count() != channels) {
+    sum_channel_multiplier_.Reshape(1, channels, 1, 1);
+    caffe_gpu_set(channels, Dtype(1),
+        sum_channel_multiplier_.mutable_gpu_data());
+  }
+  if (sum_spatial_multiplier_.count() != spatial_dim) {
+    sum_spatial_multiplier_.Reshape(1, 1, bottom.height(), bottom.width());
+    caffe_gpu_set(spatial_dim, Dtype(1),
+        sum_spatial_multiplier_.mutable_gpu_data());
+  }
+}
+
 template <typename Dtype>
 void NormalizeLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  ReshapeGPUBuffers(*bottom[0]);
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
   Dtype* buffer_data = buffer_.mutable_gpu_data();
@@ -103,9 +123,9 @@ void NormalizeLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void NormalizeLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  ReshapeGPUBuffers(*bottom[0]);
   const Dtype* top_diff = top[0]->gpu_diff();
-  const Dtype* top_data = top[0]->gpu_data();
-  const Dtype* bottom_data = bottom[0]->mutable_gpu_data();
+  const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
   const Dtype* norm_data;
   if (across_spatial_) {
@@ -131,22 +151,37 @@ void NormalizeLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   int spatial_dim = top[0]->height() * top[0]->width();
   int channels = top[0]->channels();
 
+  // With y = s_c * x / |x|, the scale gradient is sum(dy * x / |x|) and,
+  // for g = s_c * dy, the bottom gradient is (g - x * (x . g) / |x|^2) / |x|,
+  // as in Backward_cpu.
   // Propagate to param
   if (this->param_propagate_down_[0]) {
-    if (channel_shared_) {
-      Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-      Dtype a;
-      caffe_gpu_dot<Dtype>(count, top_data, top_diff, &a);
-      scale_diff[0] += a / scale[0];
-    } else {
-      Dtype* scale_diff = this->blobs_[0]->mutable_gpu_diff();
-      for (int n = 0; n < num; ++n) {
-        // compute a
-        caffe_gpu_mul<Dtype>(dim, top_data+n*dim, top_diff+n*dim, buffer_data);
-        caffe_gpu_gemv<Dtype>(CblasNoTrans, channels, spatial_dim, Dtype(1),
-            buffer_data, sum_spatial_multiplier, Dtype(0), buffer_channel);
-        // store a / scale[i] in buffer_data temporary
-        caffe_gpu_div<Dtype>(channels, buffer_channel, scale, buffer_channel);
+    Dtype* scale_diff = channel_shared_ ?
+        this->blobs_[0]->mutable_cpu_diff() :
+        this->blobs_[0]->mutable_gpu_diff();
+    const Dtype* norm_n = norm_data;
+    for (int n = 0; n < num; ++n) {
+      // x * dy / |x|, summed over the positions of each channel
+      caffe_gpu_mul<Dtype>(dim, bottom_data + n * dim, top_diff + n * dim,
+          buffer_data);
+      if (!across_spatial_) {
+        DivBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
+            dim, buffer_data, norm_n, channels, spatial_dim, CblasNoTrans,
+            buffer_data);
+        norm_n += spatial_dim;
+      }
+      caffe_gpu_gemv<Dtype>(CblasNoTrans, channels, spatial_dim, Dtype(1),
+          buffer_data, sum_spatial_multiplier, Dtype(0), buffer_channel);
+      if (across_spatial_) {
+        caffe_gpu_scal<Dtype>(channels, Dtype(1.0 / norm_data[n]),
+            buffer_channel);
+      }
+      if (channel_shared_) {
+        Dtype a;
+        caffe_gpu_dot<Dtype>(channels, buffer_channel, sum_channel_multiplier,
+            &a);
+        scale_diff[0] += a;
+      } else {
         caffe_gpu_add<Dtype>(channels, buffer_channel, scale_diff, scale_diff);
       }
     }
@@ -155,43 +190,43 @@ void NormalizeLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   // Propagate to bottom
   if (propagate_down[0]) {
     for (int n = 0; n < num; ++n) {
+      // g = s_c * dy in buffer_data
+      if (channel_shared_) {
+        caffe_gpu_scale<Dtype>(dim, scale[0], top_diff, buffer_data);
+      } else {
+        MulBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
+            dim, top_diff, scale, channels, spatial_dim, CblasTrans,
+            buffer_data);
+      }
       if (across_spatial_) {
         Dtype a;
-        caffe_gpu_dot<Dtype>(dim, bottom_data, top_diff, &a);
+        caffe_gpu_dot<Dtype>(dim, bottom_data, buffer_data, &a);
         caffe_gpu_scale<Dtype>(dim, a / norm_data[n] / norm_data[n],
             bottom_data, bottom_diff);
-        caffe_gpu_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
+        caffe_gpu_sub<Dtype>(dim, buffer_data, bottom_diff, bottom_diff);
         caffe_gpu_scale<Dtype>(dim, Dtype(1.0 / norm_data[n]), bottom_diff,
             bottom_diff);
       } else {
-        // dot product between bottom_data and top_diff
-        caffe_gpu_mul<Dtype>(dim, bottom_data, top_diff, buffer_data);
-        caffe_gpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1), buffer_data,
-            sum_channel_multiplier, Dtype(0), buffer_spatial);
+        // dot product between bottom_data and g
+        caffe_gpu_mul<Dtype>(dim, bottom_data, buffer_data, bottom_diff);
+        caffe_gpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1),
+            bottom_diff, sum_channel_multiplier, Dtype(0), buffer_spatial);
         // scale botom_diff
         MulBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
-            dim, bottom_data, buffer_spatial, channels, spatial_dim, CblasNoTrans,
-            bottom_diff);
+            dim, bottom_data, buffer_spatial, channels, spatial_dim,
+            CblasNoTrans, bottom_diff);
         // divide by square of norm
         caffe_gpu_powx<Dtype>(spatial_dim, norm_data, Dtype(2), buffer_spatial);
         DivBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
-            dim, bottom_diff, buffer_spatial, channels, spatial_dim, CblasNoTrans,
-            bottom_diff);
-        caffe_gpu_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
+            dim, bottom_diff, buffer_spatial, channels, spatial_dim,
+            CblasNoTrans, bottom_diff);
+        caffe_gpu_sub<Dtype>(dim, buffer_data, bottom_diff, bottom_diff);
         // divide by norm
         DivBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
             dim, bottom_diff, norm_data, channels, spatial_dim, CblasNoTrans,
             bottom_diff);
         norm_data += spatial_dim;
       }
-      // scale the diff
-      if (channel_shared_) {
-        caffe_gpu_scal<Dtype>(dim, scale[0], bottom_diff);
-      } else {
-        MulBsx<Dtype><<<CAFFE_GET_BLOCKS(dim), CAFFE_CUDA_NUM_THREADS>>>(
-            dim, bottom_diff, scale, channels, spatial_dim, CblasTrans,
-            bottom_diff);
-      }
       bottom_data += dim;
       top_diff += dim;
       bottom_diff += dim;
@@ -27,12 +27,12 @@ void PReLULayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
     shared_ptr<Filler<Dtype> > filler;
     if (prelu_param.has_filler()) {
-      filler.reset(GetFiller<Dtype>(prelu_param.filler()));
+      filler.reset(GetParamFiller<Dtype>(prelu_param.filler()));
     } else {
       FillerParameter filler_param;
       filler_param.set_type("constant");
       filler_param.set_value(0.25);
-      filler.reset(GetFiller<Dtype>(filler_param));
+      filler.reset(GetParamFiller<Dtype>(filler_param));
     }
     filler->Fill(this->blobs_[0].get());
   }
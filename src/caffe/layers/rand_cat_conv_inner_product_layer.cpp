@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layers/rand_cat_conv_inner_product_layer.hpp"
+#include "caffe/util/hypercolumn.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void RandCatConvInnerProductLayer<Dtype>::LayerSetUp(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  RandCatConvLayer<Dtype>::LayerSetUp(bottom, top);
+  this->ReshapeHypercolumns(bottom);
+  const InnerProductParameter& ip_param =
+      this->layer_param_.inner_product_param();
+  CHECK(!ip_param.transpose())
+      << "RandCatConvInnerProduct does not support transposed weights.";
+  num_output_ = ip_param.num_output();
+  bias_term_ = ip_param.bias_term();
+  tile_size_ = this->layer_param_.rand_cat_conv_param().tile_size();
+  CHECK_GT(tile_size_, 0) << "tile_size must be positive.";
+  CHECK_EQ(this->chunk_size_, 0)
+      << "RandCatConvInnerProduct does not support chunk_size.";
+  // Check if we need to set up the weights
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+  } else {
+    if (bias_term_) {
+      this->blobs_.resize(2);
+    } else {
+      this->blobs_.resize(1);
+    }
+    // Initialize the weights, one row of hypercolumn channels per output
+    vector<int> weight_shape(2);
+    weight_shape[0] = num_output_;
+    weight_shape[1] = this->n_channels_;
+    this->blobs_[0].reset(new Blob<Dtype>(weight_shape));
+    shared_ptr<Filler<Dtype> > weight_filler(GetParamFiller<Dtype>(
+        ip_param.weight_filler()));
+    weight_filler->Fill(this->blobs_[0].get());
+    if (bias_term_) {
+      vector<int> bias_shape(1, num_output_);
+      this->blobs_[1].reset(new Blob<Dtype>(bias_shape));
+      shared_ptr<Filler<Dtype> > bias_filler(GetParamFiller<Dtype>(
+          ip_param.bias_filler()));
+      bias_filler->Fill(this->blobs_[1].get());
+    }
+  }  // parameter initialization
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Dtype>
+void RandCatConvInnerProductLayer<Dtype>::Reshape(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  // top[0] is never reshaped to the (points x n_channels_) RandCatConv shape,
+  // so that the large buffer is not allocated by the way
+  this->ReshapeHypercolumns(bottom);
+  CHECK_EQ(this->blobs_[0]->shape(1), this->n_channels_)
+      << "Input size incompatible with inner product parameters.";
+  vector<int> top_shape(2);
+  top_shape[0] = this->N_ * bottom[this->start_id_]->num();
+  top_shape[1] = num_output_;
+  top[0]->Reshape(top_shape);
+  top_shape[1] = this->label_channels_;
+  top[1]->Reshape(top_shape);
+
+  vector<int> tile_shape(2);
+  tile_shape[0] = tile_size_;
+  tile_shape[1] = this->n_channels_;
+  tile_.Reshape(tile_shape);
+  tile_diff_.Reshape(tile_shape);
+  if (bias_term_) {
+    vector<int> bias_shape(1, tile_size_);
+    bias_multiplier_.Reshape(bias_shape);
+    caffe_set(tile_size_, Dtype(1), bias_multiplier_.mutable_cpu_data());
+  }
+}
+
+template <typename Dtype>
+void RandCatConvInnerProductLayer<Dtype>::GatherTile(
+      const vector<Blob<Dtype>*>& bottom, const int begin, const int rows) {
+  // A tile touches too few pixels for the NHWC transpose to pay off, so the
+  // blobs are read in place.
+  Dtype* tile_data = tile_.mutable_cpu_data();
+  for (int b = 0; b < this->n_hblobs_; b++) {
+    hypercolumn_gather_cpu(bottom[b]->cpu_data(), false,
+        bottom[b]->channels(), this->height_[b], this->width_[b],
+        this->poolf_[b] == 1, this->plan_.data() + begin * this->n_hblobs_ + b,
+        this->n_hblobs_, rows, tile_data + this->channel_offset_[b],
+        this->n_channels_);
+  }
+}
+
+template <typename Dtype>
+void RandCatConvInnerProductLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  this->SamplePoints(bottom);
+  this->ForwardLabels(bottom, 0, this->num_points_, top[1]);
+
+  const int num_points = this->num_points_;
+  const int channels = this->n_channels_;
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_set(top[0]->count() - num_points * num_output_, Dtype(0),
+      top_data + num_points * num_output_);
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  for (int begin = 0; begin < num_points; begin += tile_size_) {
+    const int rows = std::min(tile_size_, num_points - begin);
+    GatherTile(bottom, begin, rows);
+    Dtype* top_tile = top_data + begin * num_output_;
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, rows, num_output_,
+        channels, (Dtype)1., tile_.cpu_data(), weight, (Dtype)0., top_tile);
+    if (bias_term_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, rows, num_output_, 1,
+          (Dtype)1., bias_multiplier_.cpu_data(), this->blobs_[1]->cpu_data(),
+          (Dtype)1., top_tile);
+    }
+  }
+}
+
+template <typename Dtype>
+void RandCatConvInnerProductLayer<Dtype>::Backward_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  bool propagate_hypercolumns = false;
+  for (int b = 0; b < this->n_hblobs_; b++) {
+    propagate_hypercolumns |= propagate_down[b];
+  }
+  if (propagate_hypercolumns) {
+    this->ClearBottomDiffs(propagate_down, bottom);
+  }
+
+  const int num_points = this->num_points_;
+  const int channels = this->n_channels_;
+  const Dtype* top_diff = top[0]->cpu_diff();
+  for (int begin = 0; begin < num_points; begin += tile_size_) {
+    const int rows = std::min(tile_size_, num_points - begin);
+    const Dtype* top_tile = top_diff + begin * num_output_;
+    if (this->param_propagate_down_[0]) {
+      // Gradient with respect to weight
+      GatherTile(bottom, begin, rows);
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_output_, channels,
+          rows, (Dtype)1., top_tile, tile_.cpu_data(), (Dtype)1.,
+          this->blobs_[0]->mutable_cpu_diff());
+    }
+    if (bias_term_ && this->param_propagate_down_[1]) {
+      // Gradient with respect to bias
+      caffe_cpu_gemv<Dtype>(CblasTrans, rows, num_output_, (Dtype)1.,
+          top_tile, bias_multiplier_.cpu_data(), (Dtype)1.,
+          this->blobs_[1]->mutable_cpu_diff());
+    }
+    if (propagate_hypercolumns) {
+      // Gradient with respect to the hypercolumns, scattered right away
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, rows, channels,
+          num_output_, (Dtype)1., top_tile, this->blobs_[0]->cpu_data(),
+          (Dtype)0., tile_diff_.mutable_cpu_data());
+      this->ScatterPoints(tile_diff_.cpu_data(), begin, begin + rows,
+          propagate_down, bottom);
+    }
+  }
+
+  if (propagate_hypercolumns) {
+    this->RememberBottomDiffs(propagate_down, bottom);
+  }
+}
+
+INSTANTIATE_CLASS(RandCatConvInnerProductLayer);
+REGISTER_LAYER_CLASS(RandCatConvInnerProduct);
+
+}  // namespace caffe
@@ -1,12 +1,13 @@
+#include <algorithm>
 #include <vector>
 #include <math.h>
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/hypercolumn.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/layers/rand_cat_conv_layer.hpp"
 #include <iostream>
-//#include "caffe/util/rng.hpp"
-#include <ctime>
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -32,6 +33,10 @@ void RandCatConvLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 	       (bottom[start_id_]->width() - 2*params_.pad_factor());
   }
   label_channels_ = params_.label_channels();
+  chunk_size_ = params_.chunk_size();
+  chunk_ = chunk_size_ > 0 ? -1 : 0;
+  CHECK(chunk_size_ == 0 || !if_rand_)
+      << "chunk_size is only supported for dense inference";
 
   class_balance_.clear();
   full_class_weight_ = 0;
@@ -56,35 +61,42 @@ void RandCatConvLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void RandCatConvLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  ReshapeHypercolumns(bottom);
 
   // set the top-layer to be nxc --
   vector<int> top_shape(2);
-  top_shape[0] = N_*(bottom[start_id_]->num());
+  top_shape[0] = chunk_size_ > 0 ? chunk_size_ : N_*(bottom[start_id_]->num());
+  //LOG(INFO) << "NUM Channels: " << n_channels_;
+  top_shape[1] = n_channels_;
+  top[0]->Reshape(top_shape);
+
+  // set the surface-norm layer to be nx3 --
+  // set the antishadow layer to be nx1 --
+  top_shape[1] = label_channels_;
+  top[1]->Reshape(top_shape);
+}
 
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::ReshapeHypercolumns(
+      const vector<Blob<Dtype>*>& bottom) {
   // compute num-channels for the given bottom-data
   n_channels_ = 0;
   height_ = std::vector<int>(n_hblobs_);
   width_ = std::vector<int>(n_hblobs_);
   pixels_ = std::vector<int>(n_hblobs_);
+  channel_offset_ = std::vector<int>(n_hblobs_);
   for (int i = 0; i < n_hblobs_; i++) {
+	channel_offset_[i] = n_channels_;
 	n_channels_ = n_channels_ + bottom[i]->channels();
 	height_[i] = bottom[i]->height();
     	width_[i] = bottom[i]->width();
     	pixels_[i] = height_[i] * width_[i];
   }
-  //LOG(INFO) << "NUM Channels: " << n_channels_;
-  top_shape[1] = n_channels_;
-  top[0]->Reshape(top_shape);
-
-  // set the surface-norm layer to be nx3 --
-  // set the antishadow layer to be nx1 --
-  top_shape[1] = label_channels_;
-  top[1]->Reshape(top_shape);
 }
 
 template <typename Dtype>
-void RandCatConvLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
+void RandCatConvLayer<Dtype>::SamplePoints(
+      const vector<Blob<Dtype>*>& bottom) {
 
   // At training time, randomly select N_ points per image
   // At test time, take all the points in the image (1 image at test time)
@@ -113,224 +125,155 @@ void RandCatConvLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   // 2) x_pt (the x coordinate of the point)
   // 3) y_pt (the y coordinate of the point)
   rand_points_.clear();
-
-  if(if_rand_) {
-    // generate the list of points --
-    std::srand ( unsigned ( std::time(0) ) );
-    std::vector<int> shuffle_data_points;
-
-    if (if_balanced_) {
-      std::vector<int> cnt_by_label(class_count_, 0);
-      // First collect all points for each label
-      const int num_pixels = (bottom[start_id_]->height())*(bottom[start_id_]->width());
-      const int num_data_points = (bottom[start_id_]->num())*num_pixels;
-      for(int i = 0; i < num_data_points; i++){
-        shuffle_data_points.push_back(i);
-      }
-      // shuffle the points in all images --
-      std::random_shuffle(shuffle_data_points.begin(), shuffle_data_points.end());
-
-      // find the batch_size * N // (class_count) valid-points across all
-      // images in the batch
-      std::vector<int> max_label_counts;
-      for(int i = 0; i < class_count_; i++) {
-        int max_label_count = int((bottom[start_id_]->num()) * N_ * class_balance_[i] / full_class_weight_);
-        max_label_counts.push_back(max_label_count);
+  const int bottom_width = bottom[start_id_]->width();
+  const int num_pixels = (bottom[start_id_]->height())*bottom_width;
+
+  if (if_rand_ && if_balanced_) {
+    // bucket the valid points of the whole batch by label in one pass, then
+    // draw each label's share without replacement across all images
+    std::vector<std::vector<int> > points_by_label(class_count_);
+    const int num_data_points = (bottom[start_id_]->num())*num_pixels;
+    for (int i = 0; i < num_data_points; i++) {
+      if (static_cast<int>(valid_data[i]) != 1) { continue; }
+      const int label_pt = sn_data[i];
+      CHECK_GE(label_pt, 0);
+      CHECK_LT(label_pt, class_count_);
+      points_by_label[label_pt].push_back(i);
+    }
+    for (int l = 0; l < class_count_; l++) {
+      const int max_label_count = int((bottom[start_id_]->num()) * N_ *
+          class_balance_[l] / full_class_weight_);
+      CHECK_GE(points_by_label[l].size(), max_label_count) << "Label (" << l
+          << ") count not enough: " << points_by_label[l].size();
+      partial_shuffle(points_by_label[l].begin(), points_by_label[l].end(),
+          max_label_count, caffe_rng());
+      for (int k = 0; k < max_label_count; k++) {
+        const int i_rnd = points_by_label[l][k];
+        const int j_pt = i_rnd % num_pixels;
+        rand_points_.push_back(i_rnd / num_pixels);
+        rand_points_.push_back(j_pt % bottom_width);
+        rand_points_.push_back(j_pt / bottom_width);
       }
-      for(int i = 0; i < num_data_points; i++) {
-        // find the chosen random point
-        int i_rnd = shuffle_data_points[i];
-        int n = i_rnd / num_pixels;
-        int j_pt = i_rnd % num_pixels;
-
-        int data_pt = valid_data[i_rnd];
-        int label_pt = sn_data[i_rnd];
-        if(data_pt == 1 && cnt_by_label[label_pt] < max_label_counts[label_pt]) {
-          cnt_by_label[label_pt]++;
-          rand_points_.push_back(n);
-          int x_pt = j_pt % (bottom[start_id_]->width());
-          int y_pt = (int) j_pt/(bottom[start_id_]->width());
-
-          //LOG(INFO) << "n: " << n << " X_pt: " << x_pt << " Y_pt: " << y_pt;
-          rand_points_.push_back(x_pt);
-          rand_points_.push_back(y_pt);
-        }
-        bool not_enough = false;
-        for (int l = 0; l < class_count_; ++l) {
-          not_enough |= cnt_by_label[l] < max_label_counts[l];
-        }
-        // If we have enough samples, we can stop sampling
-        if (!not_enough) {
-          LOG(INFO) << "Generated labels";
-          for (int l = 0; l < class_count_; ++l) {
-            LOG(INFO) << "label (" << l << "): " << cnt_by_label[l];
-          }
-          LOG(INFO) << "rand_points_:" << rand_points_.size();
-          break;
+      DLOG(INFO) << "label (" << l << "): " << max_label_count;
+    }
+    // keep the points of an image together, like the other modes do
+    std::vector<int> by_label;
+    by_label.swap(rand_points_);
+    std::vector<int> image_fill(bottom[start_id_]->num() + 1, 0);
+    for (int k = 0; k < by_label.size(); k += 3) {
+      image_fill[by_label[k] + 1]++;
+    }
+    for (int n = 0; n < bottom[start_id_]->num(); n++) {
+      image_fill[n + 1] += image_fill[n];
+    }
+    rand_points_.resize(by_label.size());
+    for (int k = 0; k < by_label.size(); k += 3) {
+      const int dst = 3 * image_fill[by_label[k]]++;
+      std::copy(by_label.begin() + k, by_label.begin() + k + 3,
+          rand_points_.begin() + dst);
+    }
+  } else if (if_rand_) {
+    // find the N-valid-points of each image --
+    std::vector<int> valid_points;
+    for (int i = 0; i < (bottom[start_id_]->num()); i++) {
+      const Dtype* local_valid_data = valid_data + i*num_pixels;
+      valid_points.clear();
+      for (int j = 0; j < num_pixels; j++) {
+        if (static_cast<int>(local_valid_data[j]) == 1) {
+          valid_points.push_back(j);
         }
       }
-      for (int l = 0; l < class_count_; ++l) {
-        CHECK_EQ(cnt_by_label[l], max_label_counts[l]) << "Label (" << l << ") count not enough: " << cnt_by_label[l];
-      }
-    } else {
-      const int num_data_points = (bottom[start_id_]->height())*(bottom[start_id_]->width());
-      for(int i = 0; i < num_data_points; i++){
-        shuffle_data_points.push_back(i);
-      }
-
-      for(int i = 0; i < (bottom[start_id_]->num()); i++) {
-        const Dtype* local_valid_data = valid_data + i*valid_data_bottom->height()*valid_data_bottom->width();
-        // shuffle the points in the image --
-        std::random_shuffle(shuffle_data_points.begin(), shuffle_data_points.end());
-        // find the N-valid-points from a image --
-        int cnt_vp = 0;
-        for(int j = 0; j < num_data_points; j++){
-          int j_pt = shuffle_data_points[j];
-          int data_pt = local_valid_data[j_pt];
-          if(data_pt == 1) {
-            cnt_vp++;
-            rand_points_.push_back(i);
-            int x_pt = j_pt % (bottom[start_id_]->width());
-            int y_pt = (int) j_pt/(bottom[start_id_]->width());
-
-            //LOG(INFO) << "J_pt" << j_pt << " X_pt: " << x_pt << " Y_pt: " << y_pt;
-            rand_points_.push_back(x_pt);
-            rand_points_.push_back(y_pt);
-          }
-          if(cnt_vp >= N_){
-            break;
-          }
-        }
+      const int cnt_vp = std::min<int>(N_, valid_points.size());
+      partial_shuffle(valid_points.begin(), valid_points.end(), cnt_vp,
+          caffe_rng());
+      for (int k = 0; k < cnt_vp; k++) {
+        rand_points_.push_back(i);
+        rand_points_.push_back(valid_points[k] % bottom_width);
+        rand_points_.push_back(valid_points[k] / bottom_width);
       }
     }
-    shuffle_data_points.clear();
   } else {
 	  // considering all the data points are considered --
 	  for (int i = 0; i < (bottom[start_id_]->num()); i++) {
-      const Dtype* local_valid_data = valid_data + i*valid_data_bottom->height()*valid_data_bottom->width();
-      for (int j = 0; j < (bottom[start_id_]->height()*bottom[start_id_]->width()); j++) {
+      const Dtype* local_valid_data = valid_data + i*num_pixels;
+      for (int j = 0; j < num_pixels; j++) {
         int data_pt = local_valid_data[j];
         if(data_pt == 1) {
           rand_points_.push_back(i);
-          int x_pt = j % (bottom[start_id_]->width());
-          int y_pt = (int) j/(bottom[start_id_]->width());
-          rand_points_.push_back(x_pt);
-          rand_points_.push_back(y_pt);
+          rand_points_.push_back(j % bottom_width);
+          rand_points_.push_back(j / bottom_width);
         }
       }
     }
   }
 
-  // TODO - can use memset to initialize to zero --
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  for(int i = 0; i < top[0]->count(); i++) {
-    top_data[i] = 0;
+  BuildSamplingPlan(bottom);
+}
+
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_GE(chunk_, 0) << "Layer " << this->layer_param_.name()
+      << " has a chunk_size: its net has to be run by ForwardDense "
+      << "(util/dense_inference.hpp), not by Net::Forward";
+  // in chunked mode the points are sampled once, with the first chunk
+  int begin = 0;
+  int end = 0;
+  if (chunk_size_ == 0 || chunk_ == 0) {
+    SamplePoints(bottom);
   }
-  // TODO - can use memset to intialize to zero --
-  Dtype* top_sn = top[1]->mutable_cpu_data();
-  for(int i = 0; i < top[1]->count(); i++) {
-    top_sn[i] = 0;
+  if (chunk_size_ > 0) {
+    begin = std::min(chunk_ * chunk_size_, num_points_);
+    end = std::min(begin + chunk_size_, num_points_);
+  } else {
+    end = num_points_;
   }
+  const int rows = end - begin;
+  ForwardLabels(bottom, begin, end, top[1]);
 
-  //
-  const int bottom_width = bottom[start_id_]->width();
-  const int bottom_height = bottom[start_id_]->height();
-  const int bottom_nums = bottom[start_id_]->num();
-
-  // get the data --
-  std::vector<const Dtype*> bottom_layers(n_hblobs_);
-  for (int i = 0; i < n_hblobs_; i++) {
-    bottom_layers[i] = bottom[i]->cpu_data();
+  // every planned row is written below, only the unused tail needs zeroing
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  caffe_set(top[0]->count() - rows * n_channels_, Dtype(0),
+      top_data + rows * n_channels_);
+
+  // get the hypercolumn features for the selected points, one blob at a
+  // time so that a blob worth transposing can go through nhwc_buffer_ --
+  for (int b = 0; b < n_hblobs_; b++) {
+    const int channels = bottom[b]->channels();
+    const Dtype* bottom_data = bottom[b]->cpu_data();
+    // a chunk would pay for the transpose of the whole blob every time
+    const bool nhwc = chunk_size_ == 0 && hypercolumn_use_nhwc(
+        num_points_ / bottom[b]->num(), channels, pixels_[b]);
+    if (nhwc) {
+      nhwc_buffer_.ReshapeLike(*bottom[b]);
+      nchw_to_nhwc_cpu(bottom_data, bottom[b]->num(), channels, height_[b],
+          width_[b], nhwc_buffer_.mutable_cpu_data());
+      bottom_data = nhwc_buffer_.cpu_data();
+    }
+    hypercolumn_gather_cpu(bottom_data, nhwc, channels, height_[b],
+        width_[b], poolf_[b] == 1, plan_.data() + begin * n_hblobs_ + b,
+        n_hblobs_, rows, top_data + channel_offset_[b], n_channels_);
   }
 
-  // get the hypercolumn features for the selected points --
-  int i = 0; int j = 0;
-  int n, ch, tx1, tx2, ty1, ty2;
-  Dtype tx, ty, rx, ry;
-  Dtype x_pt, y_pt;
-  int s = 0; int s_sn = 0;
-  for(; i < N_*bottom_nums; i++) {
-    n = int(rand_points_[j++]);
-    x_pt = int(rand_points_[j++]);
-    y_pt = int(rand_points_[j++]);
-
-    // then find the corresponding locations
-   	for (int b = 0; b < n_hblobs_; b++) {
-      //LOG(INFO) << "n: " << n << " X_pt: " << x_pt << " Y_pt: " << y_pt << " b: " << b;
-      tx = (x_pt-padf_[b])/poolf_[b];
-      ty = (y_pt-padf_[b])/poolf_[b];
-      tx1 = static_cast<int>(floor(tx));
-      ty1 = static_cast<int>(floor(ty));
-      tx2 = static_cast<int>(ceil(tx));
-      ty2 = static_cast<int>(ceil(ty));
-      // check if they are within the size limit
-      // CHECK_GE(tx1, 0);
-      tx1 = tx1 > 0 ? tx1 : 0;
-      tx2 = tx2 > 0 ? tx2 : 0;
-      //if(tx2 == width_[b]){
-      //	tx2 = tx1;
-      //}
+}
 
-      CHECK_LT(tx2, width_[b]) << "n: " << n << " X_pt: " << x_pt << " Y_pt: " << y_pt << " b: " << b;
-      // CHECK_GE(ty1, 0);
-      ty1 = ty1 > 0 ? ty1 : 0;
-      ty2 = ty2 > 0 ? ty2 : 0;
-      //if(ty2 == height_[b]){
-      //	ty2 = ty1;
-      //}
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::ForwardLabels(
+      const vector<Blob<Dtype>*>& bottom, const int begin, const int end,
+      Blob<Dtype>* top_label) {
+  const Dtype* sn_data = bottom[end_id_+2]->cpu_data();
+  const int bottom_width = bottom[start_id_]->width();
+  const int bottom_height = bottom[start_id_]->height();
+  Dtype* top_sn = top_label->mutable_cpu_data();
+  caffe_set(top_label->count() - (end - begin) * label_channels_, Dtype(0),
+      top_sn + (end - begin) * label_channels_);
+  top_sn -= begin * label_channels_;
 
-      //LOG(INFO) << "TY1" << ty1 << "TY2: " << ty2 << " Height: " << height_[b];
-      //CHECK_LT(ty2, height_[b]);
-      CHECK_LT(n, bottom[b]->num());
-      ch = bottom[b]->channels();
-
-      // just check different cases for this thing..
-      if ((tx1 == tx2) && (ty1 == ty2)) {
-        int init = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-        top_data[s++] = bottom_layers[b][init];
-        for (int c = 1; c < ch; c++) {
-          init += pixels_[b];
-          top_data[s++] = bottom_layers[b][init];
-        }
-      } else if (ty1 == ty2) {
-        rx = tx - tx1;
-        int init1 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-        int init2 = init1 + 1;
-        top_data[s++] = bottom_layers[b][init1] * (1.-rx) + bottom_layers[b][init2] * rx;
-        for (int c = 1; c < ch; c++) {
-          init1 += pixels_[b];
-          init2 += pixels_[b];
-          top_data[s++] = bottom_layers[b][init1] * (1.-rx) + bottom_layers[b][init2] * rx;
-        }
-      } else if (tx1 == tx2) {
-        ry = ty - ty1;
-        int init1 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-        int init2 = init1 + width_[b];
-        top_data[s++] = bottom_layers[b][init1] * (1.-ry) + bottom_layers[b][init2] * ry;
-        for (int c = 1; c < ch; c++) {
-          init1 += pixels_[b];
-          init2 += pixels_[b];
-          top_data[s++] = bottom_layers[b][init1] * (1.-ry) + bottom_layers[b][init2] * ry;
-        }
-      } else {
-        rx = tx - tx1;
-        ry = ty - ty1;
-        int init11 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-        int init12 = init11 + 1;
-        int init21 = init11 + width_[b];
-        int init22 = init21 + 1;
-        top_data[s++] = (bottom_layers[b][init11] * (1.-ry) + bottom_layers[b][init21] * ry) * (1.-rx) +
-                  (bottom_layers[b][init12] * (1.-ry) + bottom_layers[b][init22] * ry) * rx;
-        for (int c = 1; c < ch; c++) {
-            init11 += pixels_[b];
-            init12 += pixels_[b];
-            init21 += pixels_[b];
-            init22 += pixels_[b];
-            top_data[s++] = (bottom_layers[b][init11] * (1.-ry) + bottom_layers[b][init21] * ry) * (1.-rx) +
-                      (bottom_layers[b][init12] * (1.-ry) + bottom_layers[b][init22] * ry) * rx;
-        }
-      }
-    }
+#pragma omp parallel for
+  for (int i = begin; i < end; i++) {
+    const int n = rand_points_[3 * i];
+    const int x_pt = rand_points_[3 * i + 1];
+    const int y_pt = rand_points_[3 * i + 2];
 
     // TODO: This is hard-coded right now
     // label 0: normal/depth discontinuity, negative label
@@ -338,7 +281,7 @@ void RandCatConvLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     // label 2: constant shading region, positive label
     // and accumulate the surface normals (hard-coded for surface normals)
     // and accumulate the antishadow (hard-coded for antishadow)
-    for(int bc = 0; bc < label_channels_; bc++){
+    for (int bc = 0; bc < label_channels_; bc++) {
       int init_sn = n*label_channels_*bottom_width*bottom_height +
               bc*bottom_width*bottom_width + y_pt*bottom_width + x_pt;
 
@@ -346,125 +289,179 @@ void RandCatConvLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
         int label = sn_data[init_sn];
         CHECK_GE(label, 0);
         CHECK_LT(label, class_count_);
-        top_sn[s_sn++] = label;
+        top_sn[i * label_channels_ + bc] = label;
       } else {
-        top_sn[s_sn++] = sn_data[init_sn];
+        top_sn[i * label_channels_ + bc] = sn_data[init_sn];
       }
     }
   }
 }
 
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::BuildSamplingPlan(
+      const vector<Blob<Dtype>*>& bottom) {
+  const int bottom_nums = bottom[start_id_]->num();
+  num_points_ = rand_points_.size() / 3;
+  CHECK_LE(num_points_, N_ * bottom_nums);
+  plan_.resize(num_points_ * n_hblobs_);
+
+  // find the corresponding locations of every point in every blob
+#pragma omp parallel for
+  for (int i = 0; i < num_points_; i++) {
+    const int n = rand_points_[3 * i];
+    const Dtype x_pt = rand_points_[3 * i + 1];
+    const Dtype y_pt = rand_points_[3 * i + 2];
+    for (int b = 0; b < n_hblobs_; b++) {
+      const Dtype tx = (x_pt - padf_[b]) / poolf_[b];
+      const Dtype ty = (y_pt - padf_[b]) / poolf_[b];
+      int tx1 = static_cast<int>(floor(tx));
+      int ty1 = static_cast<int>(floor(ty));
+      int tx2 = static_cast<int>(ceil(tx));
+      int ty2 = static_cast<int>(ceil(ty));
+      // check if they are within the size limit
+      tx1 = tx1 > 0 ? tx1 : 0;
+      tx2 = tx2 > 0 ? tx2 : 0;
+      CHECK_LT(tx2, width_[b]) << "n: " << n << " X_pt: " << x_pt
+          << " Y_pt: " << y_pt << " b: " << b;
+      ty1 = ty1 > 0 ? ty1 : 0;
+      ty2 = ty2 > 0 ? ty2 : 0;
+      CHECK_LT(n, bottom[b]->num());
+
+      HypercolumnTap<Dtype>& tap = plan_[i * n_hblobs_ + b];
+      tap.n = n;
+      tap.pixel = ty1 * width_[b] + tx1;
+      tap.interp_x = tx1 != tx2;
+      tap.interp_y = ty1 != ty2;
+      tap.rx = tap.interp_x ? tx - tx1 : Dtype(0);
+      tap.ry = tap.interp_y ? ty - ty1 : Dtype(0);
+    }
+  }
+
+  // the points of an image are contiguous, so that backward can give every
+  // image to a single thread and accumulate without conflicts
+  image_start_.assign(bottom_nums + 1, 0);
+  for (int i = 0; i < num_points_; i++) {
+    CHECK(i == 0 || rand_points_[3 * i] >= rand_points_[3 * (i - 1)]);
+    image_start_[rand_points_[3 * i] + 1]++;
+  }
+  for (int n = 0; n < bottom_nums; n++) {
+    image_start_[n + 1] += image_start_[n];
+  }
+}
+
 template <typename Dtype>
 void RandCatConvLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK_EQ(chunk_size_, 0) << "Chunked dense mode is for inference only";
+  ClearBottomDiffs(propagate_down, bottom);
+  ScatterPoints(top[0]->cpu_diff(), 0, num_points_, propagate_down, bottom);
+  RememberBottomDiffs(propagate_down, bottom);
+}
+
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::ClearBottomDiffs(
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  const int bottom_nums = bottom[start_id_]->num();
+  CHECK_EQ(plan_.size(), num_points_ * n_hblobs_)
+      << "Backward called without a sampling plan from Forward";
+  dirty_lo_.resize(n_hblobs_);
+  dirty_hi_.resize(n_hblobs_);
+  dirty_mem_.resize(n_hblobs_);
+  dirty_version_.resize(n_hblobs_);
+  dirty_shape_.resize(n_hblobs_);
+
+  // Only the spans we wrote last time need clearing, unless somebody else
+  // (e.g. an in-place layer) has written the diff since or it was reshaped.
+  std::vector<Dtype*> bottom_layers(n_hblobs_);
+  std::vector<int> sparse_clear(n_hblobs_, 0);
+  for (int b = 0; b < n_hblobs_; b++) {
+    if (!propagate_down[b]) { continue; }
+    const shared_ptr<SyncedMemory>& diff_mem = bottom[b]->diff();
+    sparse_clear[b] = dirty_mem_[b].lock() == diff_mem &&
+        dirty_version_[b] == diff_mem->version() &&
+        dirty_shape_[b] == bottom[b]->shape();
+    bottom_layers[b] = bottom[b]->mutable_cpu_diff();
+    if (!sparse_clear[b]) {
+      dirty_lo_[b].assign(bottom_nums * height_[b], width_[b]);
+      dirty_hi_[b].assign(bottom_nums * height_[b], -1);
+    }
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (int task = 0; task < n_hblobs_ * bottom_nums; task++) {
+    const int b = task / bottom_nums;
+    const int n = task % bottom_nums;
+    if (!propagate_down[b]) { continue; }
+    const int channels = bottom[b]->channels();
+    Dtype* diff = bottom_layers[b] + n * channels * pixels_[b];
+    if (!sparse_clear[b]) {
+      caffe_set(channels * pixels_[b], Dtype(0), diff);
+      continue;
+    }
+    int* lo = &dirty_lo_[b][n * height_[b]];
+    int* hi = &dirty_hi_[b][n * height_[b]];
+    for (int y = 0; y < height_[b]; y++) {
+      if (lo[y] > hi[y]) { continue; }
+      for (int c = 0; c < channels; c++) {
+        caffe_set(hi[y] - lo[y] + 1, Dtype(0),
+            diff + c * pixels_[b] + y * width_[b] + lo[y]);
+      }
+      lo[y] = width_[b];
+      hi[y] = -1;
+    }
+  }
+}
 
-    if(propagate_down[0]) {
-	   //
-	  const int bottom_nums = bottom[start_id_]->num();
-	  const Dtype* top_diff = top[0]->cpu_diff();
-	  std::vector<Dtype*> bottom_layers(n_hblobs_);
-  	  for (int i = 0; i < n_hblobs_; i++) {
-    		bottom_layers[i] = bottom[i]->mutable_cpu_diff();
-		for(int j = 0; j < bottom[i]->count(); j++){
-                        bottom_layers[i][j] = 0;
-                }
- 	  }
-
-	  // back-propagate to the layers --
-	  int i = 0; int j = 0;
-  	  int n, ch, tx1, tx2, ty1, ty2;
- 	  Dtype tx, ty, rx, ry;
-  	  Dtype x_pt, y_pt;
-  	  int s = 0;
-  	  for(; i < N_*bottom_nums; i++) {
-        	n = int(rand_points_[j++]);
-        	x_pt = int(rand_points_[j++]);
-        	y_pt = int(rand_points_[j++]);
-        	// then find the corresponding locations
-        	for (int b = 0; b < n_hblobs_; b++) {
-                	tx = (x_pt-padf_[b])/poolf_[b];
-               	 	ty = (y_pt-padf_[b])/poolf_[b];
-                	tx1 = static_cast<int>(floor(tx));
-                	ty1 = static_cast<int>(floor(ty));
-                	tx2 = static_cast<int>(ceil(tx));
-                	ty2 = static_cast<int>(ceil(ty));
-                	// check if they are within the size limit
-                	// CHECK_GE(tx1, 0);
-                	tx1 = tx1 > 0 ? tx1 : 0;
-                	tx2 = tx2 > 0 ? tx2 : 0;
-                	//if(tx2 == width_[b]){
-                        //	tx2 = tx1;
-                	//}
-                	CHECK_LT(tx2, width_[b]);
-
-                	// CHECK_GE(ty1, 0);
-                	ty1 = ty1 > 0 ? ty1 : 0;
-                	ty2 = ty2 > 0 ? ty2 : 0;
-                	//if(ty2 == height_[b]){
-                        //	ty2 = ty1;
-                	//}
-
-                	//CHECK_LT(ty2, height_[b]);
-                	CHECK_LT(n, bottom[b]->num());
-                	ch = bottom[b]->channels();
-
-		        // just check different cases for this thing..
-        		if ((tx1 == tx2) && (ty1 == ty2)) {
-          			int init = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-          			bottom_layers[b][init] += top_diff[s++];
-          			for (int c = 1; c < ch; c++) {
-            				init += pixels_[b];
-            				bottom_layers[b][init] += top_diff[s++];
-          			}
-        		} else if (ty1 == ty2) {
-          			rx = tx - tx1;
-          			int init1 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-          			int init2 = init1 + 1;
-          			bottom_layers[b][init1] += top_diff[s] * (1.-rx);
-          			bottom_layers[b][init2] += top_diff[s++] * rx;
-          			for (int c = 1; c < ch; c++) {
-            				init1 += pixels_[b];
-            				init2 += pixels_[b];
-            				bottom_layers[b][init1] += top_diff[s] * (1.-rx);
-            				bottom_layers[b][init2] += top_diff[s++] * rx;
-          			}
-			} else if (tx1 == tx2) {
-          			ry = ty - ty1;
-		          	int init1 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-          			int init2 = init1 + width_[b];
-          			bottom_layers[b][init1] += top_diff[s] * (1.-ry);
-          			bottom_layers[b][init2] += top_diff[s++] * ry;
-         			for (int c = 1; c < ch; c++) {
-            				init1 += pixels_[b];
-            				init2 += pixels_[b];
-            				bottom_layers[b][init1] += top_diff[s] * (1.-ry);
-            				bottom_layers[b][init2] += top_diff[s++] * ry;
-          			}
-        		} else {
-          			rx = tx - tx1;
-          			ry = ty - ty1;
-          			int init11 = n * ch * pixels_[b] + ty1 * width_[b] + tx1;
-          			int init12 = init11 + 1;
-          			int init21 = init11 + width_[b];
-          			int init22 = init21 + 1;
-          			bottom_layers[b][init11] += top_diff[s] * (1.-ry) * (1.-rx);
-          			bottom_layers[b][init21] += top_diff[s] * ry * (1.-rx);
-          			bottom_layers[b][init12] += top_diff[s] * (1.-ry) * rx;
-          			bottom_layers[b][init22] += top_diff[s++] * ry * rx;
-          			for (int c = 1; c < ch; c++) {
-            				init11 += pixels_[b];
-            				init12 += pixels_[b];
-            				init21 += pixels_[b];
-           				init22 += pixels_[b];
-            				bottom_layers[b][init11] += top_diff[s] * (1.-ry) * (1.-rx);
-           				bottom_layers[b][init21] += top_diff[s] * ry * (1.-rx);
-            				bottom_layers[b][init12] += top_diff[s] * (1.-ry) * rx;
-            				bottom_layers[b][init22] += top_diff[s++] * ry * rx;
-          			}
-        		}
-		  }
-	   }
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::ScatterPoints(const Dtype* col_diff,
+      const int begin, const int end, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  const int bottom_nums = bottom[start_id_]->num();
+  std::vector<Dtype*> bottom_layers(n_hblobs_);
+  for (int b = 0; b < n_hblobs_; b++) {
+    if (propagate_down[b]) {
+      bottom_layers[b] = bottom[b]->mutable_cpu_diff();
+    }
+  }
+
+  // back-propagate to the layers --
+  // each (blob, image) pair owns a disjoint slice of the bottom diffs
+#pragma omp parallel for schedule(dynamic)
+  for (int task = 0; task < n_hblobs_ * bottom_nums; task++) {
+    const int b = task / bottom_nums;
+    const int n = task % bottom_nums;
+    const int first = std::max(begin, image_start_[n]);
+    const int last = std::min(end, image_start_[n + 1]);
+    if (!propagate_down[b] || first >= last) { continue; }
+    int* lo = &dirty_lo_[b][n * height_[b]];
+    int* hi = &dirty_hi_[b][n * height_[b]];
+    for (int i = first; i < last; i++) {
+      const HypercolumnTap<Dtype>& tap = plan_[i * n_hblobs_ + b];
+      hypercolumn_scatter_cpu(
+          col_diff + (i - begin) * n_channels_ + channel_offset_[b],
+          bottom[b]->channels(), height_[b], width_[b], tap, bottom_layers[b]);
+      // remember which columns of which rows this point wrote
+      const int y = tap.pixel / width_[b];
+      const int x = tap.pixel % width_[b];
+      const int x_end = tap.interp_x ? x + 1 : x;
+      const int y_end = tap.interp_y && y + 1 < height_[b] ? y + 1 : y;
+      for (int r = y; r <= y_end; r++) {
+        lo[r] = std::min(lo[r], x);
+        hi[r] = std::max(hi[r], x_end);
+      }
     }
+  }
+}
+
+template <typename Dtype>
+void RandCatConvLayer<Dtype>::RememberBottomDiffs(
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  for (int b = 0; b < n_hblobs_; b++) {
+    if (!propagate_down[b]) { continue; }
+    dirty_mem_[b] = bottom[b]->diff();
+    dirty_version_[b] = bottom[b]->diff()->version();
+    dirty_shape_[b] = bottom[b]->shape();
+  }
 }
 
 INSTANTIATE_CLASS(RandCatConvLayer);
@@ -1,12 +1,13 @@
+#include <algorithm>
 #include <vector>
 #include <math.h>
 #include "caffe/layer.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/hypercolumn.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/layers/rand_cat_layer.hpp"
 #include <iostream>
-//#include "caffe/util/rng.hpp"
-#include <ctime>
+#include "caffe/util/rng.hpp"
 
 namespace caffe {
 
@@ -65,33 +66,30 @@ void RandCatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* valid_data = bottom[end_id_+1]->cpu_data();
   rand_points_.clear();
   if(if_rand_) {
-    // generate the list of points --
-    std::srand ( unsigned ( std::time(0) ) );
-    std::vector<int> shuffle_data_points;
+    // find the N-valid-points of each image; a valid mask with a single
+    // image is shared by the whole batch --
     const int num_data_points = (bottom[start_id_]->height())*(bottom[start_id_]->width());
-    for(int i = 0; i < num_data_points; i++){
-      shuffle_data_points.push_back(i);
-    }
-
-	  for(int i = 0; i < (bottom[start_id_]->num()); i++) {
-      // shuffle the points in the image --
-      std::random_shuffle(shuffle_data_points.begin(), shuffle_data_points.end());
-      // find the N-valid-points from a image --
-      int cnt_vp = 0;
-      for(int j = 0; j < num_data_points; j++){
-        int j_pt = shuffle_data_points[j];
-        int data_pt = valid_data[j_pt];
-        if(data_pt == 1) {
-          cnt_vp++;
-          rand_points_.push_back(i);
-          rand_points_.push_back(j_pt);
-        }
-        if(cnt_vp >= N_){
-          break;
+    const bool shared_mask = bottom[end_id_+1]->num() == 1;
+    std::vector<int> valid_points;
+    for(int i = 0; i < (bottom[start_id_]->num()); i++) {
+      if (i == 0 || !shared_mask) {
+        const Dtype* local_valid_data =
+            valid_data + (shared_mask ? 0 : i*num_data_points);
+        valid_points.clear();
+        for (int j = 0; j < num_data_points; j++) {
+          if (static_cast<int>(local_valid_data[j]) == 1) {
+            valid_points.push_back(j);
+          }
         }
       }
-	  }
-	  shuffle_data_points.clear();
+      const int cnt_vp = std::min<int>(N_, valid_points.size());
+      partial_shuffle(valid_points.begin(), valid_points.end(), cnt_vp,
+          caffe_rng());
+      for (int k = 0; k < cnt_vp; k++) {
+        rand_points_.push_back(i);
+        rand_points_.push_back(valid_points[k]);
+      }
+    }
   } else {
 	  // considering all the data points are considered --
 	  for (int i = 0; i < (bottom[start_id_]->num()); i++) {
@@ -102,50 +100,55 @@ void RandCatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     }
   }
 
-  // TODO - can use memset to initialize to zero --
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  for(int i = 0; i < top[0]->count(); i++) {
-                top_data[i] = 0;
-  }
-  // TODO - can use memset to intialize to zero --
-  Dtype* top_sn = top[1]->mutable_cpu_data();
-  for(int i = 0; i < top[1]->count(); i++) {
-               top_sn[i] = 0;
-  }
-
-  //
   const int bottom_width = bottom[start_id_]->width();
   const int bottom_height = bottom[start_id_]->height();
   const int bottom_nums = bottom[start_id_]->num();
 
-  // get the data --
-  std::vector<const Dtype*> bottom_layers(n_hblobs_);
-  for (int i = 0; i < n_hblobs_; i++) {
-    bottom_layers[i] = bottom[i]->cpu_data();
+  // every bottom blob is sampled at the same pixel, without interpolation
+  const int num_points = rand_points_.size() / 2;
+  CHECK_LE(num_points, N_ * bottom_nums);
+  taps_.resize(num_points);
+  for (int i = 0; i < num_points; i++) {
+    taps_[i].n = rand_points_[2 * i];
+    taps_[i].pixel = rand_points_[2 * i + 1];
+    taps_[i].interp_x = taps_[i].interp_y = false;
+    taps_[i].rx = taps_[i].ry = 0;
   }
-  const Dtype* sn_data = bottom[end_id_+2]->cpu_data();
+
+  // rows past the sampled points stay zero
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* top_sn = top[1]->mutable_cpu_data();
+  caffe_set(top[0]->count() - num_points * n_channels_, Dtype(0),
+      top_data + num_points * n_channels_);
+  caffe_set(top[1]->count() - num_points * 3, Dtype(0),
+      top_sn + num_points * 3);
 
   // get the hypercolumn features for the selected points --
-  int i = 0; int j = 0;
-  int n, xy_l;
-  int s = 0; int s_sn = 0;
-  for(; i < N_*bottom_nums; i++) {
-    n = int(rand_points_[j++]);
-    xy_l = int(rand_points_[j++]);
-    // then find the corresponding locations
-   	for (int b = 0; b < n_hblobs_; b++) {
-      int init = n *(bottom[b]->channels())*bottom_width*bottom_height + xy_l;
-      top_data[s++] = bottom_layers[b][init];
-      for (int c = 1; c < bottom[b]->channels(); c++) {
-        init += bottom_width*bottom_height;
-        top_data[s++] = bottom_layers[b][init];
-      }
+  int channel_offset = 0;
+  for (int b = 0; b < n_hblobs_; b++) {
+    const int channels = bottom[b]->channels();
+    const Dtype* bottom_data = bottom[b]->cpu_data();
+    const bool nhwc = hypercolumn_use_nhwc(num_points / bottom_nums,
+        channels, bottom_width * bottom_height);
+    if (nhwc) {
+      nhwc_buffer_.ReshapeLike(*bottom[b]);
+      nchw_to_nhwc_cpu(bottom_data, bottom_nums, channels, bottom_height,
+          bottom_width, nhwc_buffer_.mutable_cpu_data());
+      bottom_data = nhwc_buffer_.cpu_data();
     }
-    // and accumulate the surface normals (hard-coded for surface normals)
+    hypercolumn_gather_cpu(bottom_data, nhwc, channels, bottom_height,
+        bottom_width, true, taps_.data(), 1, num_points,
+        top_data + channel_offset, n_channels_);
+    channel_offset += channels;
+  }
+
+  // and accumulate the surface normals (hard-coded for surface normals)
+  const Dtype* sn_data = bottom[end_id_+2]->cpu_data();
+  for (int i = 0; i < num_points; i++) {
     for(int bc = 0; bc < 3; bc++){
-      int init_sn = n*3*bottom_width*bottom_height +
-              bc*bottom_width*bottom_width + xy_l;
-      top_sn[s_sn++] = sn_data[init_sn];
+      int init_sn = taps_[i].n*3*bottom_width*bottom_height +
+              bc*bottom_width*bottom_width + taps_[i].pixel;
+      top_sn[i * 3 + bc] = sn_data[init_sn];
     }
   }
 }
@@ -153,39 +156,26 @@ void RandCatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void RandCatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if(propagate_down[0]) {
-    //
-    const int bottom_width = bottom[start_id_]->width();
-    const int bottom_height = bottom[start_id_]->height();
-    const int bottom_nums = bottom[start_id_]->num();
-
-    //
-    const Dtype* top_diff = top[0]->cpu_diff();
-    std::vector<Dtype*> bottom_layers(n_hblobs_);
-    for (int i = 0; i < n_hblobs_; i++) {
-      bottom_layers[i] = bottom[i]->mutable_cpu_diff();
-      for(int j = 0; j < bottom[i]->count(); j++){
-        bottom_layers[i][j] = 0;
-      }
-    }
-
-    // back-propagate to the layers --
-    int i = 0; int j = 0;
-    int n, xy_l;
-    int s = 0;
-    for(; i < N_*bottom_nums; i++) {
-      n = int(rand_points_[j++]);
-      xy_l = int(rand_points_[j++]);
-      // then find the corresponding locations
-      for (int b = 0; b < n_hblobs_; b++) {
-        int init = n * (bottom[b]->channels())*bottom_width*bottom_height + xy_l;
-        bottom_layers[b][init] = top_diff[s++];
-        for (int c = 1; c < bottom[b]->channels(); c++) {
-          init += bottom_width*bottom_height;
-          bottom_layers[b][init] = top_diff[s++];
-        }
+  const int bottom_width = bottom[start_id_]->width();
+  const int bottom_height = bottom[start_id_]->height();
+  const Dtype* top_diff = top[0]->cpu_diff();
+
+  // back-propagate to the layers --
+  // points are distinct within an image, so scattering into zeros is the
+  // same as assigning
+  int channel_offset = 0;
+  for (int b = 0; b < n_hblobs_; b++) {
+    const int channels = bottom[b]->channels();
+    if (propagate_down[b]) {
+      Dtype* bottom_diff = bottom[b]->mutable_cpu_diff();
+      caffe_set(bottom[b]->count(), Dtype(0), bottom_diff);
+#pragma omp parallel for
+      for (int i = 0; i < taps_.size(); i++) {
+        hypercolumn_scatter_cpu(top_diff + i * n_channels_ + channel_offset,
+            channels, bottom_height, bottom_width, taps_[i], bottom_diff);
       }
     }
+    channel_offset += channels;
   }
 }
 
@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "caffe/filler.hpp"
+#include "caffe/layers/sampled_softmax_tag_loss_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  LossLayer<Dtype>::LayerSetUp(bottom, top);
+  const InnerProductParameter& ip_param =
+      this->layer_param_.inner_product_param();
+  CHECK(!ip_param.transpose())
+      << this->type() << " does not support transposed weights.";
+  K_ = ip_param.num_output();
+  bias_term_ = ip_param.bias_term();
+  const int axis = bottom[0]->CanonicalAxisIndex(ip_param.axis());
+  D_ = bottom[0]->count(axis);
+  num_sampled_ = this->layer_param_.softmax_tag_loss_param().num_sampled();
+  CHECK_GT(num_sampled_, 0) << "num_sampled must be positive.";
+  freqs_version_ = -1;
+  // The parameters have the shapes of an InnerProductLayer's, so that one
+  // can share them at test time.
+  if (this->blobs_.size() > 0) {
+    LOG(INFO) << "Skipping parameter initialization";
+  } else {
+    if (bias_term_) {
+      this->blobs_.resize(2);
+    } else {
+      this->blobs_.resize(1);
+    }
+    vector<int> weight_shape(2);
+    weight_shape[0] = K_;
+    weight_shape[1] = D_;
+    this->blobs_[0].reset(new Blob<Dtype>(weight_shape));
+    shared_ptr<Filler<Dtype> > weight_filler(GetParamFiller<Dtype>(
+        ip_param.weight_filler()));
+    weight_filler->Fill(this->blobs_[0].get());
+    if (bias_term_) {
+      vector<int> bias_shape(1, K_);
+      this->blobs_[1].reset(new Blob<Dtype>(bias_shape));
+      shared_ptr<Filler<Dtype> > bias_filler(GetParamFiller<Dtype>(
+          ip_param.bias_filler()));
+      bias_filler->Fill(this->blobs_[1].get());
+    }
+  }  // parameter initialization
+  this->param_propagate_down_.resize(this->blobs_.size(), true);
+}
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  LossLayer<Dtype>::Reshape(bottom, top);
+  const int axis = bottom[0]->CanonicalAxisIndex(
+      this->layer_param_.inner_product_param().axis());
+  CHECK_EQ(D_, bottom[0]->count(axis))
+      << "Input size incompatible with inner product parameters.";
+  M_ = bottom[0]->count(0, axis);
+  CHECK_EQ(bottom[1]->count() % M_, 0)
+      << "Tag lists must hold the same number of tags for every item.";
+  P_ = bottom[1]->count() / M_;
+  CHECK_EQ(bottom[2]->count(), K_)
+      << "Number of tag frequencies must match num_output "
+      << "(the number of tags).";
+  vector<int> set_shape(2);
+  set_shape[0] = M_;
+  set_shape[1] = P_;
+  set_prob_.Reshape(set_shape);
+}
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::SetupDistribution(
+    const Blob<Dtype>& freqs) {
+  // The frequencies are unchanged as long as nobody asked for write access.
+  const shared_ptr<SyncedMemory>& freqs_mem = freqs.data();
+  if (freqs_mem_.lock() == freqs_mem &&
+      freqs_version_ == freqs_mem->version()) {
+    return;
+  }
+  const Dtype* freqs_data = freqs.cpu_data();
+  class_weights_.resize(K_);
+  cdf_.resize(K_);
+  double weight_sum = 0;
+  double freq_sum = 0;
+  for (int c = 0; c < K_; ++c) {
+    CHECK_GT(freqs_data[c], 0) << "Tag frequencies must be positive.";
+    class_weights_[c] = 1 / freqs_data[c];
+    weight_sum += class_weights_[c];
+    freq_sum += freqs_data[c];
+    cdf_[c] = freq_sum;
+  }
+  // As in SoftmaxWithTagLossLayer, the weights sum up to the number of tags.
+  for (int c = 0; c < K_; ++c) {
+    class_weights_[c] *= K_ / weight_sum;
+    cdf_[c] /= freq_sum;
+  }
+  freqs_mem_ = freqs_mem;
+  freqs_version_ = freqs_mem->version();
+}
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::SampleNegatives() {
+  vector<Dtype> draws(num_sampled_);
+  caffe_rng_uniform<Dtype>(num_sampled_, Dtype(0), Dtype(1), draws.data());
+  sampled_.resize(num_sampled_);
+  for (int k = 0; k < num_sampled_; ++k) {
+    const int c = std::upper_bound(cdf_.begin(), cdf_.end(),
+        static_cast<double>(draws[k])) - cdf_.begin();
+    sampled_[k] = std::min(c, K_ - 1);
+  }
+  std::sort(sampled_.begin(), sampled_.end());
+  sampled_.erase(std::unique(sampled_.begin(), sampled_.end()),
+      sampled_.end());
+}
+
+template <typename Dtype>
+Dtype SampledSoftmaxTagLossLayer<Dtype>::LogExpectedCount(int c) const {
+  // probability that tag c is among num_sampled_ draws with replacement
+  const double q = cdf_[c] - (c > 0 ? cdf_[c - 1] : 0.);
+  const double expected = q >= 1 ? 1. : -expm1(num_sampled_ * log1p(-q));
+  return log(std::max(expected, static_cast<double>(FLT_MIN)));
+}
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  SetupDistribution(*bottom[2]);
+  SampleNegatives();
+  const int num_negatives = sampled_.size();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* label = bottom[1]->cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+
+  // score all items against the shared negatives with one GEMM
+  vector<int> sampled_shape(2);
+  sampled_shape[0] = num_negatives;
+  sampled_shape[1] = D_;
+  sampled_weight_.Reshape(sampled_shape);
+  Dtype* sampled_weight = sampled_weight_.mutable_cpu_data();
+  for (int k = 0; k < num_negatives; ++k) {
+    caffe_copy(D_, weight + sampled_[k] * D_, sampled_weight + k * D_);
+  }
+  sampled_shape[0] = M_;
+  sampled_shape[1] = num_negatives;
+  sampled_prob_.Reshape(sampled_shape);
+  Dtype* sampled_prob = sampled_prob_.mutable_cpu_data();
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, num_negatives, D_,
+      (Dtype)1., bottom_data, sampled_weight, (Dtype)0., sampled_prob);
+  // bias and log-Q correction of the negatives
+  vector<Dtype> sampled_offset(num_negatives);
+  for (int k = 0; k < num_negatives; ++k) {
+    sampled_offset[k] = (bias ? bias[sampled_[k]] : Dtype(0)) -
+        LogExpectedCount(sampled_[k]);
+  }
+
+  Dtype* set_prob = set_prob_.mutable_cpu_data();
+  vector<Dtype> item_loss(M_);
+#pragma omp parallel for
+  for (int i = 0; i < M_; ++i) {
+    const Dtype* tags = label + i * P_;
+    const Dtype* x = bottom_data + i * D_;
+    Dtype* set_logit = set_prob + i * P_;
+    Dtype* sampled_logit = sampled_prob + i * num_negatives;
+    // corrected logits, -FLT_MAX for padding and for negatives that are set
+    Dtype max_logit = -FLT_MAX;
+    for (int p = 0; p < P_; ++p) {
+      const int tag = static_cast<int>(tags[p]);
+      if (tag < 0) {
+        set_logit[p] = -FLT_MAX;
+        continue;
+      }
+      DCHECK_LT(tag, K_);
+      set_logit[p] = caffe_cpu_dot(D_, x, weight + tag * D_) +
+          (bias ? bias[tag] : Dtype(0)) - LogExpectedCount(tag);
+      max_logit = std::max(max_logit, set_logit[p]);
+    }
+    for (int k = 0; k < num_negatives; ++k) {
+      bool is_set = false;
+      for (int p = 0; p < P_; ++p) {
+        is_set |= static_cast<int>(tags[p]) == sampled_[k];
+      }
+      sampled_logit[k] = is_set ? -FLT_MAX :
+          sampled_logit[k] + sampled_offset[k];
+      max_logit = std::max(max_logit, sampled_logit[k]);
+    }
+    Dtype sum_exp = 0;
+    for (int p = 0; p < P_; ++p) {
+      set_logit[p] = set_logit[p] == -FLT_MAX ? Dtype(0) :
+          exp(set_logit[p] - max_logit);
+      sum_exp += set_logit[p];
+    }
+    for (int k = 0; k < num_negatives; ++k) {
+      sampled_logit[k] = sampled_logit[k] == -FLT_MAX ? Dtype(0) :
+          exp(sampled_logit[k] - max_logit);
+      sum_exp += sampled_logit[k];
+    }
+    // normalize into probabilities and take the weighted loss of the set tags
+    Dtype closs = 0;
+    int ccount = 0;
+    for (int p = 0; p < P_; ++p) {
+      set_logit[p] /= sum_exp;
+      const int tag = static_cast<int>(tags[p]);
+      if (tag < 0) { continue; }
+      closs -= log(std::max(set_logit[p], Dtype(FLT_MIN))) *
+          class_weights_[tag];
+      ++ccount;
+    }
+    caffe_scal(num_negatives, Dtype(1) / sum_exp, sampled_logit);
+    item_loss[i] = ccount > 0 ? closs / ccount : Dtype(0);
+  }
+  Dtype loss = 0;
+  for (int i = 0; i < M_; ++i) {
+    loss += item_loss[i];
+  }
+  top[0]->mutable_cpu_data()[0] = loss / M_;
+}
+
+template <typename Dtype>
+void SampledSoftmaxTagLossLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  if (propagate_down[1] || propagate_down[2]) {
+    LOG(FATAL) << this->type()
+               << " Layer cannot backpropagate to label inputs.";
+  }
+  const int num_negatives = sampled_.size();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  const Dtype* label = bottom[1]->cpu_data();
+  const Dtype scale = top[0]->cpu_diff()[0] / M_;
+
+  // gradient of the loss w.r.t. the scored logits, as in
+  // SoftmaxWithTagLossLayer: (p_c * sum_weights - [c set] * w_c) / ccount
+  const Dtype* sampled_prob = sampled_prob_.cpu_data();
+  const Dtype* set_prob = set_prob_.cpu_data();
+  Dtype* sampled_diff = sampled_prob_.mutable_cpu_diff();
+  Dtype* set_diff = set_prob_.mutable_cpu_diff();
+#pragma omp parallel for
+  for (int i = 0; i < M_; ++i) {
+    const Dtype* tags = label + i * P_;
+    int ccount = 0;
+    Dtype sum_weights = 0;
+    for (int p = 0; p < P_; ++p) {
+      const int tag = static_cast<int>(tags[p]);
+      if (tag < 0) { continue; }
+      ++ccount;
+      sum_weights += class_weights_[tag];
+    }
+    const Dtype item_scale = ccount > 0 ? scale / ccount : Dtype(0);
+    for (int k = 0; k < num_negatives; ++k) {
+      sampled_diff[i * num_negatives + k] =
+          sampled_prob[i * num_negatives + k] * sum_weights * item_scale;
+    }
+    for (int p = 0; p < P_; ++p) {
+      const int tag = static_cast<int>(tags[p]);
+      set_diff[i * P_ + p] = tag < 0 ? Dtype(0) :
+          (set_prob[i * P_ + p] * sum_weights - class_weights_[tag]) *
+          item_scale;
+    }
+  }
+
+  if (propagate_down[0]) {
+    // Gradient with respect to bottom data
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, D_, num_negatives,
+        (Dtype)1., sampled_diff, sampled_weight_.cpu_data(), (Dtype)0.,
+        bottom_diff);
+#pragma omp parallel for
+    for (int i = 0; i < M_; ++i) {
+      for (int p = 0; p < P_; ++p) {
+        const int tag = static_cast<int>(label[i * P_ + p]);
+        if (tag < 0) { continue; }
+        caffe_axpy(D_, set_diff[i * P_ + p], weight + tag * D_,
+            bottom_diff + i * D_);
+      }
+    }
+  }
+  if (this->param_propagate_down_[0]) {
+    // Gradient with respect to the weight rows of the scored tags only
+    Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+    Dtype* sampled_weight_diff = sampled_weight_.mutable_cpu_diff();
+    caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, num_negatives, D_, M_,
+        (Dtype)1., sampled_diff, bottom_data, (Dtype)0., sampled_weight_diff);
+    for (int k = 0; k < num_negatives; ++k) {
+      caffe_axpy(D_, Dtype(1), sampled_weight_diff + k * D_,
+          weight_diff + sampled_[k] * D_);
+    }
+    for (int i = 0; i < M_; ++i) {
+      for (int p = 0; p < P_; ++p) {
+        const int tag = static_cast<int>(label[i * P_ + p]);
+        if (tag < 0) { continue; }
+        caffe_axpy(D_, set_diff[i * P_ + p], bottom_data + i * D_,
+            weight_diff + tag * D_);
+      }
+    }
+  }
+  if (bias_term_ && this->param_propagate_down_[1]) {
+    // Gradient with respect to bias
+    Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+    for (int i = 0; i < M_; ++i) {
+      for (int k = 0; k < num_negatives; ++k) {
+        bias_diff[sampled_[k]] += sampled_diff[i * num_negatives + k];
+      }
+      for (int p = 0; p < P_; ++p) {
+        const int tag = static_cast<int>(label[i * P_ + p]);
+        if (tag < 0) { continue; }
+        bias_diff[tag] += set_diff[i * P_ + p];
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(SampledSoftmaxTagLossLayer);
+REGISTER_LAYER_CLASS(SampledSoftmaxTagLoss);
+
+}  // namespace caffe
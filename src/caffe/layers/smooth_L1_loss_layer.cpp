@@ -5,13 +5,52 @@
 // Written by Ross Girshick
 // ------------------------------------------------------------------
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "caffe/fast_rcnn_layers.hpp"
 
 namespace caffe {
 
+// Elements per OpenMP task. Partial losses are summed per task and then
+// serially, so the loss does not depend on the number of threads.
+const int kSmoothL1Block = 4096;
+
+// The weighted difference d = w * (b0 - b1) is recomputed from the bottoms in
+// both passes instead of being kept in diff_ / errors_: one streaming read of
+// the inputs is cheaper than writing and re-reading a blob of the same size.
+// Both kernels are written without branches so that the inner loops vectorize:
+//   f(d)  = m * (|d| - 0.5 * m)  with m = min(|d|, 1)
+//   f'(d) = max(-1, min(d, 1))
+template <typename Dtype, bool kWeighted>
+Dtype smooth_l1_forward_block(const int n, const Dtype* b0, const Dtype* b1,
+    const Dtype* w) {
+  Dtype loss = 0;
+  for (int i = 0; i < n; ++i) {
+    const Dtype d = kWeighted ? w[i] * (b0[i] - b1[i]) : b0[i] - b1[i];
+    const Dtype a = std::abs(d);
+    const Dtype m = std::min(a, Dtype(1));
+    loss += m * (a - Dtype(0.5) * m);
+  }
+  return loss;
+}
+
+// Writes alpha * df/d(b0) into out.
+template <typename Dtype, bool kWeighted>
+void smooth_l1_backward_block(const int n, const Dtype* b0, const Dtype* b1,
+    const Dtype* w, const Dtype alpha, Dtype* out) {
+  for (int i = 0; i < n; ++i) {
+    const Dtype d = kWeighted ? w[i] * (b0[i] - b1[i]) : b0[i] - b1[i];
+    const Dtype df = std::max(Dtype(-1), std::min(d, Dtype(1)));
+    out[i] = kWeighted ? alpha * w[i] * df : alpha * df;
+  }
+}
+
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::LayerSetUp(
   const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  LossLayer<Dtype>::LayerSetUp(bottom, top);
   has_weights_ = (bottom.size() == 3);
 }
 
@@ -36,13 +75,61 @@ void SmoothL1LossLayer<Dtype>::Reshape(
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  const int count = bottom[0]->count();
+  const Dtype* b0 = bottom[0]->cpu_data();
+  const Dtype* b1 = bottom[1]->cpu_data();
+  const Dtype* w = has_weights_ ? bottom[2]->cpu_data() : NULL;
+  const int tasks = (count + kSmoothL1Block - 1) / kSmoothL1Block;
+  vector<Dtype> task_loss(tasks);
+#pragma omp parallel for
+  for (int t = 0; t < tasks; ++t) {
+    const int begin = t * kSmoothL1Block;
+    const int n = std::min(kSmoothL1Block, count - begin);
+    task_loss[t] = has_weights_ ?
+        smooth_l1_forward_block<Dtype, true>(n, b0 + begin, b1 + begin,
+            w + begin) :
+        smooth_l1_forward_block<Dtype, false>(n, b0 + begin, b1 + begin, w);
+  }
+  Dtype loss = 0;
+  for (int t = 0; t < tasks; ++t) {
+    loss += task_loss[t];
+  }
+  top[0]->mutable_cpu_data()[0] = loss / bottom[0]->num();
 }
 
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  if (!propagate_down[0] && !propagate_down[1]) { return; }
+  const int count = bottom[0]->count();
+  const Dtype* b0 = bottom[0]->cpu_data();
+  const Dtype* b1 = bottom[1]->cpu_data();
+  const Dtype* w = has_weights_ ? bottom[2]->cpu_data() : NULL;
+  Dtype* g0 = propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL;
+  Dtype* g1 = propagate_down[1] ? bottom[1]->mutable_cpu_diff() : NULL;
+  // the two gradients only differ in sign: evaluate into one of them and
+  // negate it into the other while the block is still in cache
+  Dtype* out = g0 ? g0 : g1;
+  const Dtype scale = top[0]->cpu_diff()[0] / bottom[0]->num();
+  const Dtype alpha = g0 ? scale : -scale;
+  const int tasks = (count + kSmoothL1Block - 1) / kSmoothL1Block;
+#pragma omp parallel for
+  for (int t = 0; t < tasks; ++t) {
+    const int begin = t * kSmoothL1Block;
+    const int n = std::min(kSmoothL1Block, count - begin);
+    if (has_weights_) {
+      smooth_l1_backward_block<Dtype, true>(n, b0 + begin, b1 + begin,
+          w + begin, alpha, out + begin);
+    } else {
+      smooth_l1_backward_block<Dtype, false>(n, b0 + begin, b1 + begin, w,
+          alpha, out + begin);
+    }
+    if (g0 && g1) {
+      for (int i = begin; i < begin + n; ++i) {
+        g1[i] = -g0[i];
+      }
+    }
+  }
 }
 
 #ifdef CPU_ONLY
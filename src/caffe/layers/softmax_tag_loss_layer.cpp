@@ -9,6 +9,9 @@
 
 namespace caffe {
 
+// Number of spatial positions handled together by the CPU passes.
+const int kInnerBlock = 64;
+
 template <typename Dtype>
 void SoftmaxWithTagLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -23,6 +26,8 @@ void SoftmaxWithTagLossLayer<Dtype>::LayerSetUp(
   softmax_layer_->SetUp(softmax_bottom_vec_, softmax_top_vec_);
 
   normalize_ = this->layer_param_.loss_param().normalize();
+  sparse_labels_ = this->layer_param_.softmax_tag_loss_param().sparse_labels();
+  weights_valid_ = false;
 }
 
 template <typename Dtype>
@@ -34,11 +39,25 @@ void SoftmaxWithTagLossLayer<Dtype>::Reshape(
       bottom[0]->CanonicalAxisIndex(this->layer_param_.softmax_param().axis());
   outer_num_ = bottom[0]->count(0, softmax_axis_);
   inner_num_ = bottom[0]->count(softmax_axis_ + 1);
-  CHECK_EQ(bottom[0]->count(), bottom[1]->count())
-      << "Number of input tags must match number of predictions; "
-      << "e.g., if prediction shape is (N, C, H, W), "
-      << "label count (number of labels) must be N*C*H*W, "
-      << "with integer values in {0, 1}.";
+  if (sparse_labels_) {
+    CHECK_EQ(bottom[0]->num_axes(), bottom[1]->num_axes())
+        << "Tag lists must have the axes of the predictions; e.g., if "
+        << "prediction shape is (N, C, H, W), label shape must be "
+        << "(N, P, H, W) for up to P tags per item.";
+    for (int i = 0; i < bottom[0]->num_axes(); ++i) {
+      if (i != softmax_axis_) {
+        CHECK_EQ(bottom[0]->shape(i), bottom[1]->shape(i))
+            << "Tag lists must match the predictions outside the softmax axis.";
+      }
+    }
+    max_tags_ = bottom[1]->shape(softmax_axis_);
+  } else {
+    CHECK_EQ(bottom[0]->count(), bottom[1]->count())
+        << "Number of input tags must match number of predictions; "
+        << "e.g., if prediction shape is (N, C, H, W), "
+        << "label count (number of labels) must be N*C*H*W, "
+        << "with integer values in {0, 1}.";
+  }
   if (bottom.size() > 2) {
     CHECK_EQ(bottom[0]->count() / (outer_num_ * inner_num_), bottom[2]->count())
         << "Number of tag frequencies must match length of softmax axis (the number of tags).";
@@ -46,7 +65,10 @@ void SoftmaxWithTagLossLayer<Dtype>::Reshape(
   // Reshape weights to the size equal to the number of possible different tags
   vector<int> weights_shape(4, 1);
   weights_shape[softmax_axis_] = prob_.shape(softmax_axis_);
-  weights_.Reshape(weights_shape);
+  if (weights_shape != weights_.shape()) {
+    weights_.Reshape(weights_shape);
+    weights_valid_ = false;
+  }
 
   if (top.size() >= 2) {
     // softmax output
@@ -54,8 +76,39 @@ void SoftmaxWithTagLossLayer<Dtype>::Reshape(
   }
 }
 
+template <typename Dtype>
+bool SoftmaxWithTagLossLayer<Dtype>::WeightsUpToDate(
+    const vector<Blob<Dtype>*>& bottom) const {
+  if (!weights_valid_) {
+    return false;
+  }
+  if (bottom.size() <= 2) {
+    return weights_freqs_.expired() && weights_freqs_version_ < 0;
+  }
+  // The frequencies are unchanged as long as nobody asked for write access.
+  const shared_ptr<SyncedMemory>& freqs = bottom[2]->data();
+  return weights_freqs_.lock() == freqs &&
+      weights_freqs_version_ == freqs->version();
+}
+
+template <typename Dtype>
+void SoftmaxWithTagLossLayer<Dtype>::RememberWeights(
+    const vector<Blob<Dtype>*>& bottom) {
+  weights_valid_ = true;
+  if (bottom.size() > 2) {
+    weights_freqs_ = bottom[2]->data();
+    weights_freqs_version_ = bottom[2]->data()->version();
+  } else {
+    weights_freqs_.reset();
+    weights_freqs_version_ = -1;
+  }
+}
+
 template <typename Dtype>
 void SoftmaxWithTagLossLayer<Dtype>::SetupWeights_cpu(const vector<Blob<Dtype>*>& bottom) {
+  if (WeightsUpToDate(bottom)) {
+    return;
+  }
   Dtype* weights_ptr = weights_.mutable_cpu_data();
   int class_num = prob_.shape(softmax_axis_);
   if (bottom.size() > 2) {
@@ -73,11 +126,15 @@ void SoftmaxWithTagLossLayer<Dtype>::SetupWeights_cpu(const vector<Blob<Dtype>*>
   } else {
     caffe_set(class_num, (Dtype)1, weights_ptr);
   }
+  RememberWeights(bottom);
 }
 
 template <typename Dtype>
 void SoftmaxWithTagLossLayer<Dtype>::SetupWeights_gpu(const vector<Blob<Dtype>*>& bottom) {
 #ifndef CPU_ONLY
+  if (WeightsUpToDate(bottom)) {
+    return;
+  }
   Dtype* weights_ptr = weights_.mutable_gpu_data();
   int class_num = prob_.shape(softmax_axis_);
   if (bottom.size() > 2) {
@@ -97,6 +154,7 @@ void SoftmaxWithTagLossLayer<Dtype>::SetupWeights_gpu(const vector<Blob<Dtype>*>
   } else {
     caffe_gpu_set(class_num, (Dtype)1, weights_ptr);
   }
+  RememberWeights(bottom);
 #endif
 }
 
@@ -107,29 +165,64 @@ void SoftmaxWithTagLossLayer<Dtype>::Forward_cpu(
   softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
   const Dtype* prob_data = prob_.cpu_data();
   const Dtype* label = bottom[1]->cpu_data();
-  int dim = prob_.count() / outer_num_;
-  int class_num = prob_.shape(softmax_axis_);
-  Dtype loss = 0;
+  const int dim = prob_.count() / outer_num_;
+  const int class_num = prob_.shape(softmax_axis_);
   SetupWeights_cpu(bottom);
   const Dtype* weights_ptr = weights_.cpu_data();
+  const int blocks = (inner_num_ + kInnerBlock - 1) / kInnerBlock;
 
-  for (int i = 0; i < outer_num_; ++i) {
-	for (int j = 0; j < inner_num_; j++) {
-		Dtype closs = 0;
-		int ccount = 0;
-		for (int label_value = 0; label_value < class_num; ++label_value) {
-			const int ind = i * dim + label_value * inner_num_ + j;
-			const int tag = static_cast<int>(label[ind]);
-			DCHECK_GE(tag, 0);
-			DCHECK_LT(tag, 1);
-			if (tag == 1) {
-				closs -= log(std::max(prob_data[ind], Dtype(FLT_MIN))) * weights_ptr[label_value];
-				++ccount;
-			}
-		}
-		if (ccount == 0) continue;
-		loss += closs / ccount;
-	}
+  // Every task covers a block of up to kInnerBlock spatial positions of one
+  // item, walking the tags in memory order. The log is only taken for the
+  // tags that are set. The partial losses are summed up in task order, so
+  // that the loss does not depend on the thread schedule.
+  std::vector<Dtype> task_loss(outer_num_ * blocks);
+#pragma omp parallel for
+  for (int task = 0; task < outer_num_ * blocks; ++task) {
+    const int i = task / blocks;
+    const int j_begin = (task % blocks) * kInnerBlock;
+    const int len = std::min(kInnerBlock, inner_num_ - j_begin);
+    Dtype closs[kInnerBlock] = {0};
+    int ccount[kInnerBlock] = {0};
+    if (sparse_labels_) {
+      const Dtype* prob = prob_data + i * dim + j_begin;
+      for (int p = 0; p < max_tags_; ++p) {
+        const Dtype* tag = label + (i * max_tags_ + p) * inner_num_ + j_begin;
+        for (int j = 0; j < len; ++j) {
+          const int tag_value = static_cast<int>(tag[j]);
+          if (tag_value < 0) { continue; }
+          DCHECK_LT(tag_value, class_num);
+          closs[j] -= log(std::max(prob[tag_value * inner_num_ + j],
+              Dtype(FLT_MIN))) * weights_ptr[tag_value];
+          ++ccount[j];
+        }
+      }
+    } else {
+      for (int label_value = 0; label_value < class_num; ++label_value) {
+        const int offset = i * dim + label_value * inner_num_ + j_begin;
+        const Dtype* tag = label + offset;
+        const Dtype* prob = prob_data + offset;
+        const Dtype weight = weights_ptr[label_value];
+        for (int j = 0; j < len; ++j) {
+          DCHECK_GE(static_cast<int>(tag[j]), 0);
+          DCHECK_LE(static_cast<int>(tag[j]), 1);
+          if (static_cast<int>(tag[j]) == 1) {
+            closs[j] -= log(std::max(prob[j], Dtype(FLT_MIN))) * weight;
+            ++ccount[j];
+          }
+        }
+      }
+    }
+    Dtype block_loss = 0;
+    for (int j = 0; j < len; ++j) {
+      if (ccount[j] > 0) {
+        block_loss += closs[j] / ccount[j];
+      }
+    }
+    task_loss[task] = block_loss;
+  }
+  Dtype loss = 0;
+  for (int task = 0; task < task_loss.size(); ++task) {
+    loss += task_loss[task];
   }
   if (normalize_) {
     top[0]->mutable_cpu_data()[0] = loss / (outer_num_ * inner_num_);
@@ -156,47 +249,89 @@ void SoftmaxWithTagLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& to
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const Dtype* prob_data = prob_.cpu_data();
-    caffe_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
-    int class_num = prob_.shape(softmax_axis_);
-    int dim = prob_.count() / outer_num_;
+    const int class_num = prob_.shape(softmax_axis_);
+    const int dim = prob_.count() / outer_num_;
     SetupWeights_cpu(bottom);
     const Dtype* weights_ptr = weights_.cpu_data();
-	for (int i = 0; i < outer_num_; ++i) {
-		for (int j = 0; j < inner_num_; j++) {
-			int ccount = 0;
-			Dtype sum_weights = 0;
-			// First count how many attributes we have for this item
-			for (int label_value = 0; label_value < class_num; ++label_value) {
-				const int ind = i * dim + label_value * inner_num_ + j;
-				const int tag = static_cast<int>(label[ind]);
-				DCHECK_GE(tag, 0);
-				DCHECK_LT(tag, 1);
-				if (tag == 1) {
-					++ccount;
-					sum_weights += weights_ptr[label_value];
-				}
-			}
-			for (int label_value = 0; label_value < class_num; ++label_value) {
-				const int ind = i * dim + label_value * inner_num_ + j;
-				const int tag = static_cast<int>(label[ind]);
-				DCHECK_GE(tag, 0);
-				DCHECK_LT(tag, 1);
-				bottom_diff[ind] *= sum_weights / ccount;
-				if (tag == 1) {
-					bottom_diff[ind] -= 1.0 / ccount * weights_ptr[label_value];
-				} else if (ccount == 0) {
-					bottom_diff[ind] = 0;
-				}
-			}
-        }
-    }
     // Scale gradient
     const Dtype loss_weight = top[0]->cpu_diff()[0];
-    if (normalize_) {
-      caffe_scal(prob_.count(), loss_weight / (outer_num_ * inner_num_), bottom_diff);
-    } else {
-      caffe_scal(prob_.count(), loss_weight / outer_num_, bottom_diff);
+    const Dtype scale = normalize_ ?
+        loss_weight / (outer_num_ * inner_num_) : loss_weight / outer_num_;
+    const int blocks = (inner_num_ + kInnerBlock - 1) / kInnerBlock;
+
+#pragma omp parallel for
+    for (int task = 0; task < outer_num_ * blocks; ++task) {
+      const int i = task / blocks;
+      const int j_begin = (task % blocks) * kInnerBlock;
+      const int len = std::min(kInnerBlock, inner_num_ - j_begin);
+      // First count how many attributes we have for each item
+      Dtype sum_weights[kInnerBlock] = {0};
+      int ccount[kInnerBlock] = {0};
+      if (sparse_labels_) {
+        for (int p = 0; p < max_tags_; ++p) {
+          const Dtype* tag =
+              label + (i * max_tags_ + p) * inner_num_ + j_begin;
+          for (int j = 0; j < len; ++j) {
+            const int tag_value = static_cast<int>(tag[j]);
+            if (tag_value < 0) { continue; }
+            ++ccount[j];
+            sum_weights[j] += weights_ptr[tag_value];
+          }
+        }
+      } else {
+        for (int label_value = 0; label_value < class_num; ++label_value) {
+          const Dtype* tag =
+              label + i * dim + label_value * inner_num_ + j_begin;
+          const Dtype weight = weights_ptr[label_value];
+          for (int j = 0; j < len; ++j) {
+            const int set = static_cast<int>(tag[j]) == 1;
+            ccount[j] += set;
+            sum_weights[j] += set * weight;
+          }
+        }
+      }
+      // d loss / d x_c = (p_c * sum_weights - [tag_c] * w_c) / ccount
+      Dtype prob_scale[kInnerBlock];
+      Dtype tag_scale[kInnerBlock];
+      for (int j = 0; j < len; ++j) {
+        const Dtype item_scale = ccount[j] > 0 ? scale / ccount[j] : Dtype(0);
+        prob_scale[j] = sum_weights[j] * item_scale;
+        tag_scale[j] = item_scale;
+      }
+      if (sparse_labels_) {
+        for (int label_value = 0; label_value < class_num; ++label_value) {
+          const int offset = i * dim + label_value * inner_num_ + j_begin;
+          const Dtype* prob = prob_data + offset;
+          Dtype* diff = bottom_diff + offset;
+          for (int j = 0; j < len; ++j) {
+            diff[j] = prob[j] * prob_scale[j];
+          }
+        }
+        Dtype* diff = bottom_diff + i * dim + j_begin;
+        for (int p = 0; p < max_tags_; ++p) {
+          const Dtype* tag =
+              label + (i * max_tags_ + p) * inner_num_ + j_begin;
+          for (int j = 0; j < len; ++j) {
+            const int tag_value = static_cast<int>(tag[j]);
+            if (tag_value < 0) { continue; }
+            diff[tag_value * inner_num_ + j] -=
+                weights_ptr[tag_value] * tag_scale[j];
+          }
+        }
+      } else {
+        for (int label_value = 0; label_value < class_num; ++label_value) {
+          const int offset = i * dim + label_value * inner_num_ + j_begin;
+          const Dtype* tag = label + offset;
+          const Dtype* prob = prob_data + offset;
+          Dtype* diff = bottom_diff + offset;
+          const Dtype weight = weights_ptr[label_value];
+          for (int j = 0; j < len; ++j) {
+            diff[j] = prob[j] * prob_scale[j] -
+                (static_cast<int>(tag[j]) == 1) * weight * tag_scale[j];
+          }
+        }
+      }
     }
   }
 }
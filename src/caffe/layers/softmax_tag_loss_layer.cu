@@ -44,6 +44,11 @@ __global__ void SoftmaxTagLossForwardGPU(const int nthreads,
 template <typename Dtype>
 void SoftmaxWithTagLossLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (sparse_labels_) {
+    // tag lists are only implemented on the CPU
+    Forward_cpu(bottom, top);
+    return;
+  }
   softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
   const Dtype* prob_data = prob_.gpu_data();
   const Dtype* label = bottom[1]->gpu_data();
@@ -114,6 +119,10 @@ void SoftmaxWithTagLossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& to
     LOG(FATAL) << this->type()
                << " Layer cannot backpropagate to label inputs.";
   }
+  if (sparse_labels_) {
+    Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
   if (propagate_down[0]) {
     Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
     const Dtype* prob_data = prob_.gpu_data();
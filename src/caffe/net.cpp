@@ -1,20 +1,31 @@
 #include <algorithm>
+#include <climits>
+#include <cstdlib>
 #include <map>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/thread/mutex.hpp"
 #include "hdf5.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/epilogue.hpp"
+#include "caffe/util/flat_weights.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/memory_plan.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -50,6 +61,11 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // the current NetState.
   NetParameter filtered_param;
   FilterNet(in_param, &filtered_param);
+  if (filtered_param.fuse_epilogues()) {
+    // Fold ReLU and residual sums into the layers whose output they consume.
+    const NetParameter unfused_param(filtered_param);
+    FuseEpilogues(unfused_param, &filtered_param);
+  }
   LOG_IF(INFO, Caffe::root_solver())
       << "Initializing net from parameters: " << std::endl
       << filtered_param.DebugString();
@@ -253,7 +269,23 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  param_count_ = 0;
   debug_info_ = param.debug_info();
+  force_backward_ = param.force_backward();
+  plan_memory_ = false;
+  naive_memory_ = planned_memory_ = 0;
+  if (param.plan_memory()) {
+    PlanMemory();
+  }
+  branch_threads_ = param.branch_threads();
+#ifdef _OPENMP
+  if (branch_threads_ == 0) { branch_threads_ = omp_get_max_threads(); }
+#endif
+  CHECK_GE(branch_threads_, 0) << "branch_threads must be non-negative.";
+  ScheduleBranches();
+  LOG_IF(INFO, Caffe::root_solver() && branch_threads_ > 1)
+      << "Running up to " << std::min(branch_threads_, branch_width_)
+      << " layers at a time";
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
@@ -518,6 +550,10 @@ template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
+  if (branch_threads_ > 1 && branch_width_ > 1 && start < end &&
+      Caffe::mode() == Caffe::CPU) {
+    return RunBranches(start, end, false);
+  }
   Dtype loss = 0;
   for (int i = start; i <= end; ++i) {
     for (int c = 0; c < before_forward_.size(); ++c) {
@@ -569,6 +605,11 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  if (branch_threads_ > 1 && branch_width_ > 1 && start > end &&
+      Caffe::mode() == Caffe::CPU) {
+    RunBranches(start, end, true);
+    return;
+  }
   for (int i = start; i >= end; --i) {
     for (int c = 0; c < before_backward_.size(); ++c) {
       before_backward_[c]->run(i);
@@ -729,6 +770,375 @@ void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
   }
+  if (plan_memory_) {
+    PlanMemory();
+  }
+  ScheduleBranches();
+}
+
+// Helpers for Net::PlanMemory: union-find over the planned tensors.
+static int FindTensor(vector<int>* parent, int t) {
+  while ((*parent)[t] != t) {
+    t = (*parent)[t] = (*parent)[(*parent)[t]];
+  }
+  return t;
+}
+
+static void MergeTensors(vector<int>* parent, int a, int b) {
+  (*parent)[FindTensor(parent, a)] = FindTensor(parent, b);
+}
+
+template <typename Dtype>
+void Net<Dtype>::GroupSharedTensors(vector<int>* parent) const {
+  const int num_blobs = blobs_.size();
+  parent->resize(2 * num_blobs);
+  for (int t = 0; t < parent->size(); ++t) { (*parent)[t] = t; }
+  map<SyncedMemory*, int> memory_tensor;
+  for (int b = 0; b < num_blobs; ++b) {
+    if (blobs_[b]->count() == 0) { continue; }
+    SyncedMemory* memory[2] = { blobs_[b]->data().get(),
+                                blobs_[b]->diff().get() };
+    for (int j = 0; j < 2; ++j) {
+      map<SyncedMemory*, int>::iterator it = memory_tensor.find(memory[j]);
+      if (it == memory_tensor.end()) {
+        memory_tensor[memory[j]] = j * num_blobs + b;
+      } else {
+        MergeTensors(parent, j * num_blobs + b, it->second);
+      }
+    }
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    const bool share_data = layers_[i]->TopSharesBottomData();
+    const bool share_diff = layers_[i]->TopSharesBottomDiff();
+    if (!share_data && !share_diff) { continue; }
+    const int bottom = bottom_id_vecs_[i][0];
+    for (int k = 0; k < top_id_vecs_[i].size(); ++k) {
+      if (share_data) {
+        MergeTensors(parent, top_id_vecs_[i][k], bottom);
+      }
+      if (share_diff) {
+        MergeTensors(parent, num_blobs + top_id_vecs_[i][k],
+            num_blobs + bottom);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanMemory() {
+  plan_memory_ = true;
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  // TEST nets are planned for Forward only, unless they force backward
+  bool backward = false;
+  for (int i = 0; i < num_layers; ++i) {
+    backward = backward || layer_need_backward_[i];
+  }
+  backward = backward && (phase_ == TRAIN || force_backward_);
+  // Layer i runs forward at step i and backward at step 2 * num_layers - 1 - i.
+  // Tensor b is the data of blob b, tensor num_blobs + b its diff.
+  vector<int> begin(2 * num_blobs, INT_MAX), end(2 * num_blobs, -1);
+  vector<bool> written(2 * num_blobs, false), pinned(2 * num_blobs, false);
+  for (int i = 0; i < num_layers; ++i) {
+    const bool layer_backward = backward && layer_need_backward_[i];
+    const int back_step = 2 * num_layers - 1 - i;
+    for (int k = 0; k < bottom_id_vecs_[i].size(); ++k) {
+      const int b = bottom_id_vecs_[i][k];
+      begin[b] = std::min(begin[b], i);
+      end[b] = std::max(end[b], layer_backward ? back_step : i);
+      if (layer_backward && bottom_need_backward_[i][k]) {
+        const int d = num_blobs + b;
+        begin[d] = std::min(begin[d], back_step);
+        end[d] = std::max(end[d], back_step);
+        written[d] = true;
+      }
+    }
+    for (int k = 0; k < top_id_vecs_[i].size(); ++k) {
+      const int b = top_id_vecs_[i][k];
+      begin[b] = std::min(begin[b], i);
+      end[b] = std::max(end[b], layer_backward ? back_step : i);
+      pinned[b] = pinned[b] || bottom_vecs_[i].empty();
+      const int d = num_blobs + b;
+      if (layer_backward) {
+        begin[d] = std::min(begin[d], back_step);
+        end[d] = std::max(end[d], back_step);
+      }
+      // loss weights live in the diff from SetUp on
+      pinned[d] = pinned[d] || layers_[i]->loss(k) != 0;
+    }
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[net_output_blob_indices_[i]] = true;
+    pinned[num_blobs + net_output_blob_indices_[i]] = true;
+  }
+  // a diff that is read but never written has to stay zero
+  for (int b = 0; b < num_blobs; ++b) {
+    pinned[num_blobs + b] = pinned[num_blobs + b] || !written[num_blobs + b];
+  }
+  // Blobs that already share memory, or that their layer may make share
+  // memory later on, are planned as one tensor.
+  vector<int> parent;
+  GroupSharedTensors(&parent);
+  // Collect one interval per group of tensors, sized for all of its members.
+  vector<int> group_interval(2 * num_blobs, -1);
+  vector<MemoryInterval> intervals;
+  vector<bool> interval_pinned;
+  for (int t = 0; t < 2 * num_blobs; ++t) {
+    if (blobs_[t % num_blobs]->count() == 0) { continue; }
+    const int root = FindTensor(&parent, t);
+    if (group_interval[root] < 0) {
+      group_interval[root] = intervals.size();
+      MemoryInterval interval = { 0, INT_MAX, -1 };
+      intervals.push_back(interval);
+      interval_pinned.push_back(false);
+    }
+    MemoryInterval& interval = intervals[group_interval[root]];
+    interval.size = std::max(interval.size,
+        blobs_[t % num_blobs]->count() * sizeof(Dtype));
+    interval.begin = std::min(interval.begin, begin[t]);
+    interval.end = std::max(interval.end, end[t]);
+    interval_pinned[group_interval[root]] =
+        interval_pinned[group_interval[root]] || pinned[t];
+  }
+  // Groups that are never used (the diffs when there is no backward pass)
+  // are left alone; they are not even allocated.
+  vector<MemoryInterval> used, planned;
+  vector<int> planned_interval(intervals.size(), -1);
+  naive_memory_ = planned_memory_ = 0;
+  for (int k = 0; k < intervals.size(); ++k) {
+    if (intervals[k].end < 0) { continue; }
+    used.push_back(intervals[k]);
+    naive_memory_ += intervals[k].size;
+    if (interval_pinned[k]) {
+      planned_memory_ += intervals[k].size;
+    } else {
+      planned_interval[k] = planned.size();
+      planned.push_back(intervals[k]);
+    }
+  }
+  vector<int> assignment;
+  const vector<size_t> buffer_sizes = PlanMemoryBuffers(planned, &assignment);
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_sizes.size());
+  for (int k = 0; k < buffers.size(); ++k) {
+    buffers[k].reset(new SyncedMemory(buffer_sizes[k]));
+    planned_memory_ += buffer_sizes[k];
+  }
+  for (int t = 0; t < 2 * num_blobs; ++t) {
+    if (blobs_[t % num_blobs]->count() == 0) { continue; }
+    const int k = planned_interval[group_interval[FindTensor(&parent, t)]];
+    if (k < 0) { continue; }
+    if (t < num_blobs) {
+      blobs_[t]->set_data(buffers[assignment[k]]);
+    } else {
+      blobs_[t - num_blobs]->set_diff(buffers[assignment[k]]);
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Memory plan for " << (backward ? "training" : "inference") << ": "
+      << planned_memory_ << " bytes for blobs that need " << naive_memory_
+      << " bytes unplanned (" << PeakLiveMemory(used)
+      << " bytes live at the peak)";
+}
+
+// Helper for Net::ScheduleBranches: makes `layer` wait for the last writer of
+// every tensor it touches and for the readers since then of every tensor it
+// writes, and records its own accesses.
+static void WaitForAccesses(const int layer, const vector<int>& reads,
+    const vector<int>& writes, vector<int>* last_writer,
+    vector<vector<int> >* readers, vector<int>* waits) {
+  set<int> after;
+  for (int k = 0; k < reads.size(); ++k) {
+    if ((*last_writer)[reads[k]] >= 0) {
+      after.insert((*last_writer)[reads[k]]);
+    }
+  }
+  for (int k = 0; k < writes.size(); ++k) {
+    const int t = writes[k];
+    if ((*last_writer)[t] >= 0) { after.insert((*last_writer)[t]); }
+    after.insert((*readers)[t].begin(), (*readers)[t].end());
+  }
+  after.erase(layer);
+  waits->assign(after.begin(), after.end());
+  for (int k = 0; k < reads.size(); ++k) {
+    (*readers)[reads[k]].push_back(layer);
+  }
+  for (int k = 0; k < writes.size(); ++k) {
+    (*last_writer)[writes[k]] = layer;
+    (*readers)[writes[k]].clear();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ScheduleBranches() {
+  const int num_layers = layers_.size();
+  const int num_blobs = blobs_.size();
+  vector<int> parent;
+  GroupSharedTensors(&parent);
+  // parameter diffs come after the blob tensors; shared ones count once
+  map<SyncedMemory*, int> param_tensor;
+  for (int i = 0; i < params_.size(); ++i) {
+    SyncedMemory* diff = params_[i]->diff().get();
+    if (!param_tensor.count(diff)) {
+      const int t = 2 * num_blobs + param_tensor.size();
+      param_tensor[diff] = t;
+    }
+  }
+  const int num_tensors = 2 * num_blobs + param_tensor.size();
+  vector<vector<int> > forward_reads(num_layers), forward_writes(num_layers);
+  vector<vector<int> > backward_reads(num_layers), backward_writes(num_layers);
+  for (int i = 0; i < num_layers; ++i) {
+    for (int k = 0; k < bottom_id_vecs_[i].size(); ++k) {
+      const int b = bottom_id_vecs_[i][k];
+      forward_reads[i].push_back(FindTensor(&parent, b));
+      backward_reads[i].push_back(FindTensor(&parent, b));
+      if (bottom_need_backward_[i][k]) {
+        backward_writes[i].push_back(FindTensor(&parent, num_blobs + b));
+      }
+    }
+    for (int k = 0; k < top_id_vecs_[i].size(); ++k) {
+      const int b = top_id_vecs_[i][k];
+      forward_writes[i].push_back(FindTensor(&parent, b));
+      backward_reads[i].push_back(FindTensor(&parent, b));
+      backward_reads[i].push_back(FindTensor(&parent, num_blobs + b));
+    }
+    for (int k = 0; k < layers_[i]->blobs().size(); ++k) {
+      backward_writes[i].push_back(
+          param_tensor[layers_[i]->blobs()[k]->diff().get()]);
+    }
+    if (!layer_need_backward_[i]) {
+      backward_reads[i].clear();
+      backward_writes[i].clear();
+    }
+  }
+  forward_waits_.resize(num_layers);
+  backward_waits_.resize(num_layers);
+  vector<int> last_writer(num_tensors, -1);
+  vector<vector<int> > readers(num_tensors);
+  for (int i = 0; i < num_layers; ++i) {
+    WaitForAccesses(i, forward_reads[i], forward_writes[i], &last_writer,
+        &readers, &forward_waits_[i]);
+  }
+  last_writer.assign(num_tensors, -1);
+  readers.assign(num_tensors, vector<int>());
+  for (int i = num_layers - 1; i >= 0; --i) {
+    WaitForAccesses(i, backward_reads[i], backward_writes[i], &last_writer,
+        &readers, &backward_waits_[i]);
+  }
+  // the layers that draw random numbers take turns in the serial order
+  int last_random = -1;
+  for (int i = 0; i < num_layers; ++i) {
+    if (!layers_[i]->DrawsRandomNumbers()) { continue; }
+    if (last_random >= 0 && std::find(forward_waits_[i].begin(),
+        forward_waits_[i].end(), last_random) == forward_waits_[i].end()) {
+      forward_waits_[i].push_back(last_random);
+    }
+    last_random = i;
+  }
+  // the widest level of the forward pass bounds how many layers run at once
+  vector<int> level(num_layers, 0), level_size(num_layers + 1, 0);
+  branch_width_ = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    for (int k = 0; k < forward_waits_[i].size(); ++k) {
+      level[i] = std::max(level[i], level[forward_waits_[i][k]] + 1);
+    }
+    branch_width_ = std::max(branch_width_, ++level_size[level[i]]);
+  }
+}
+
+template <typename Dtype>
+Dtype Net<Dtype>::RunBranches(const int start, const int end,
+    const bool backward) {
+  const int first = std::min(start, end);
+  const int num = std::abs(end - start) + 1;
+  const vector<vector<int> >& waits =
+      backward ? backward_waits_ : forward_waits_;
+  vector<int> waiting(num, 0);
+  vector<vector<int> > next(num);
+  for (int i = first; i < first + num; ++i) {
+    for (int k = 0; k < waits[i].size(); ++k) {
+      const int j = waits[i][k];
+      if (j < first || j >= first + num) { continue; }
+      ++waiting[i - first];
+      next[j - first].push_back(i);
+    }
+  }
+  BlockingQueue<int> ready;
+  for (int n = 0; n < num; ++n) {
+    const int i = backward ? start - n : start + n;
+    if (waiting[i - first] == 0) { ready.push(i); }
+  }
+  vector<Dtype> losses(num, 0);
+  int done = 0;
+  boost::mutex mutex;  // guards the counts and serializes the callbacks
+  const int workers = std::min(num, std::min(branch_threads_, branch_width_));
+  // the worker threads run with the caller's settings
+  const Caffe::Brew mode = Caffe::mode();
+  const int solver_count = Caffe::solver_count();
+  const int solver_rank = Caffe::solver_rank();
+  const bool multiprocess = Caffe::multiprocess();
+  const shared_ptr<Caffe::RNG> rng = Caffe::shared_rng_stream();
+#ifdef _OPENMP
+  const int layer_threads = std::max(1, omp_get_max_threads() / workers);
+  const int max_active_levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(std::max(max_active_levels, 2));
+#pragma omp parallel num_threads(workers)
+#endif
+  {
+    Caffe::set_mode(mode);
+    Caffe::set_solver_count(solver_count);
+    Caffe::set_solver_rank(solver_rank);
+    Caffe::set_multiprocess(multiprocess);
+    const shared_ptr<Caffe::RNG> own_rng = Caffe::shared_rng_stream();
+#ifdef _OPENMP
+    omp_set_num_threads(layer_threads);
+#endif
+    for (int i = ready.pop(); i >= 0; i = ready.pop()) {
+      {
+        boost::mutex::scoped_lock lock(mutex);
+        const vector<Callback*>& before =
+            backward ? before_backward_ : before_forward_;
+        for (int c = 0; c < before.size(); ++c) {
+          before[c]->run(i);
+        }
+      }
+      if (!backward && layers_[i]->DrawsRandomNumbers()) {
+        Caffe::set_rng_stream(rng);
+        losses[i - first] = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+        Caffe::set_rng_stream(own_rng);
+      } else if (!backward) {
+        losses[i - first] = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+      } else if (layer_need_backward_[i]) {
+        layers_[i]->Backward(
+            top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      }
+      boost::mutex::scoped_lock lock(mutex);
+      if (debug_info_ && !backward) { ForwardDebugInfo(i); }
+      if (debug_info_ && backward && layer_need_backward_[i]) {
+        BackwardDebugInfo(i);
+      }
+      const vector<Callback*>& after =
+          backward ? after_backward_ : after_forward_;
+      for (int c = 0; c < after.size(); ++c) {
+        after[c]->run(i);
+      }
+      for (int k = 0; k < next[i - first].size(); ++k) {
+        const int j = next[i - first][k];
+        if (--waiting[j - first] == 0) { ready.push(j); }
+      }
+      if (++done == num) {
+        for (int w = 0; w < workers; ++w) { ready.push(-1); }
+      }
+    }
+  }
+#ifdef _OPENMP
+  omp_set_max_active_levels(max_active_levels);
+#endif
+  // sum up in layer order, as the serial pass does
+  Dtype loss = 0;
+  for (int n = 0; n < num; ++n) {
+    loss += losses[n];
+  }
+  return loss;
 }
 
 template <typename Dtype>
@@ -774,6 +1184,9 @@ void Net<Dtype>::CopyTrainedLayersFrom(const string trained_filename) {
   if (trained_filename.size() >= 3 &&
       trained_filename.compare(trained_filename.size() - 3, 3, ".h5") == 0) {
     CopyTrainedLayersFromHDF5(trained_filename);
+  } else if (trained_filename.size() >= 5 && trained_filename.compare(
+      trained_filename.size() - 5, 5, ".flat") == 0) {
+    MapTrainedLayersFrom(trained_filename);
   } else {
     CopyTrainedLayersFromBinaryProto(trained_filename);
   }
@@ -837,6 +1250,71 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
   H5Fclose(file_hid);
 }
 
+namespace {
+
+template <typename Dtype, typename Stype>
+void copy_converted(int n, const void* source, Dtype* target) {
+  const Stype* x = static_cast<const Stype*>(source);
+  for (int i = 0; i < n; ++i) {
+    target[i] = static_cast<Dtype>(x[i]);
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+void Net<Dtype>::MapTrainedLayersFrom(const string& filename) {
+  shared_ptr<FlatWeightsFile> file(new FlatWeightsFile(filename));
+  bool mapped = false;
+  for (int i = 0; i < file->num_blobs(); ++i) {
+    const string& source_layer_name = file->layer_name(i);
+    if (!layer_names_index_.count(source_layer_name)) {
+      if (i == 0 || file->layer_name(i - 1) != source_layer_name) {
+        LOG(INFO) << "Ignoring source layer " << source_layer_name;
+      }
+      continue;
+    }
+    const int target_layer_id = layer_names_index_[source_layer_name];
+    DLOG(INFO) << "Mapping source layer " << source_layer_name;
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    const int j = file->index(i);
+    CHECK_LT(j, target_blobs.size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    Blob<Dtype>* target_blob = target_blobs[j].get();
+    if (target_blob->shape() != file->shape(i)) {
+      Blob<Dtype> source_blob(file->shape(i));
+      LOG(FATAL) << "Cannot copy param " << j << " weights from layer '"
+          << source_layer_name << "'; shape mismatch.  Source param shape is "
+          << source_blob.shape_string() << "; target param shape is "
+          << target_blob->shape_string() << ". "
+          << "To learn this layer's parameters from scratch rather than "
+          << "copying from a saved net, rename the layer.";
+    }
+    if (param_owners_[param_id_vecs_[target_layer_id][j]] != -1) {
+      // its memory is that of its owner
+      continue;
+    }
+    const int count = target_blob->count();
+    target_blob->cancel_deferred_fill();
+    if (file->element_size() == sizeof(Dtype) && !param_data_arena_ &&
+        target_blob->data()->size() == count * sizeof(Dtype)) {
+      // the params sharing this one share its SyncedMemory, and follow it
+      target_blob->data()->set_cpu_data(file->data(i));
+      mapped = true;
+    } else if (file->element_size() == sizeof(float)) {
+      copy_converted<Dtype, float>(count, file->data(i),
+          target_blob->mutable_cpu_data());
+    } else {
+      copy_converted<Dtype, double>(count, file->data(i),
+          target_blob->mutable_cpu_data());
+    }
+  }
+  if (mapped) {
+    mapped_weights_.push_back(file);
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   param->Clear();
@@ -849,8 +1327,45 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToProto(NetParameter* param,
+    const vector<Blob<Dtype>*>& values, bool write_diff) const {
+  CHECK_EQ(values.size(), learnable_params_.size())
+      << "Expected a value for every learnable param.";
+  param->Clear();
+  param->set_name(name_);
+  for (int i = 0; i < layers_.size(); ++i) {
+    LayerParameter* layer_param = param->add_layer();
+    layer_param->CopyFrom(layers_[i]->layer_param());
+    layer_param->clear_blobs();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = layers_[i]->blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      const Blob<Dtype>* value =
+          values[learnable_param_ids_[param_id_vecs_[i][j]]];
+      CHECK_EQ(value->count(), blobs[j]->count());
+      BlobProto* blob_proto = layer_param->add_blobs();
+      value->ToProto(blob_proto, write_diff);
+      // a shared param may be shaped differently than its owner
+      if (value->shape() != blobs[j]->shape()) {
+        blob_proto->mutable_shape()->Clear();
+        for (int k = 0; k < blobs[j]->num_axes(); ++k) {
+          blob_proto->mutable_shape()->add_dim(blobs[j]->shape(k));
+        }
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
+  ToHDF5(filename, learnable_params_, write_diff);
+}
+
+template <typename Dtype>
+void Net<Dtype>::ToHDF5(const string& filename,
+    const vector<Blob<Dtype>*>& values, bool write_diff) const {
+  CHECK_EQ(values.size(), learnable_params_.size())
+      << "Expected a value for every learnable param.";
   hid_t file_hid = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
@@ -883,15 +1398,16 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
       ostringstream dataset_name;
       dataset_name << param_id;
       const int net_param_id = param_id_vecs_[layer_id][param_id];
+      const Blob<Dtype>& value = *values[learnable_param_ids_[net_param_id]];
       if (param_owners_[net_param_id] == -1) {
         // Only save params that own themselves
         hdf5_save_nd_dataset<Dtype>(layer_data_hid, dataset_name.str(),
-            *params_[net_param_id]);
+            value);
       }
       if (write_diff) {
         // Write diffs regardless of weight-sharing
         hdf5_save_nd_dataset<Dtype>(layer_diff_hid, dataset_name.str(),
-            *params_[net_param_id], true);
+            value, true);
       }
     }
     H5Gclose(layer_data_hid);
@@ -906,15 +1422,151 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
   H5Fclose(file_hid);
 }
 
+template <typename Dtype>
+void Net<Dtype>::ToFlat(const string& filename) const {
+  ToFlat(filename, learnable_params_);
+}
+
+template <typename Dtype>
+void Net<Dtype>::ToFlat(const string& filename,
+    const vector<Blob<Dtype>*>& values) const {
+  CHECK_EQ(values.size(), learnable_params_.size())
+      << "Expected a value for every learnable param.";
+  FlatWeightsWriter<Dtype> writer;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const int num_params = layers_[layer_id]->blobs().size();
+    for (int param_id = 0; param_id < num_params; ++param_id) {
+      const int net_param_id = param_id_vecs_[layer_id][param_id];
+      // Only save params that own themselves, like ToHDF5
+      if (param_owners_[net_param_id] == -1) {
+        const Blob<Dtype>* value =
+            values[learnable_param_ids_[net_param_id]];
+        writer.Add(layer_names_[layer_id], param_id, value->shape(),
+            value->cpu_data());
+      }
+    }
+  }
+  writer.Write(filename);
+}
+
 template <typename Dtype>
 void Net<Dtype>::Update() {
+  if (Caffe::mode() == Caffe::CPU && params_flat()) {
+    caffe_axpy(static_cast<int>(param_count_), Dtype(-1),
+        static_cast<const Dtype*>(param_diff_arena_->cpu_data()),
+        static_cast<Dtype*>(param_data_arena_->mutable_cpu_data()));
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     learnable_params_[i]->Update();
   }
 }
 
+template <typename Dtype>
+Dtype Net<Dtype>::sumsq_param_diffs() const {
+  if (Caffe::mode() != Caffe::CPU || !params_flat()) {
+    Dtype sumsq = 0;
+    for (int i = 0; i < learnable_params_.size(); ++i) {
+      sumsq += learnable_params_[i]->sumsq_diff();
+    }
+    return sumsq;
+  }
+  // partial sums over blocks, added up in order, so that the result does not
+  // depend on the number of threads
+  const Dtype* diff = static_cast<const Dtype*>(param_diff_arena_->cpu_data());
+  const int kBlockSize = 4096;
+  const int num_blocks = (param_count_ + kBlockSize - 1) / kBlockSize;
+  vector<Dtype> sums(num_blocks);
+#ifdef _OPENMP
+#pragma omp parallel for if (num_blocks > 1)
+#endif
+  for (int b = 0; b < num_blocks; ++b) {
+    const size_t offset = static_cast<size_t>(b) * kBlockSize;
+    const int n = static_cast<int>(std::min<size_t>(kBlockSize,
+                                                    param_count_ - offset));
+    const Dtype* block = diff + offset;
+    Dtype sum = 0;
+    for (int i = 0; i < n; ++i) {
+      sum += block[i] * block[i];
+    }
+    sums[b] = sum;
+  }
+  Dtype sumsq = 0;
+  for (int b = 0; b < num_blocks; ++b) {
+    sumsq += sums[b];
+  }
+  return sumsq;
+}
+
+template <typename Dtype>
+void Net<Dtype>::FlattenParams() {
+  size_t count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    count += learnable_params_[i]->count();
+  }
+  // at least one element, like the buffers of Params
+  const size_t size = std::max<size_t>(count, 1) * sizeof(Dtype);
+  shared_ptr<SyncedMemory> data(new SyncedMemory(size));
+  shared_ptr<SyncedMemory> diff(new SyncedMemory(size));
+  Dtype* data_ptr = static_cast<Dtype*>(data->mutable_cpu_data());
+  Dtype* diff_ptr = static_cast<Dtype*>(diff->mutable_cpu_data());
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    const Blob<Dtype>* blob = learnable_params_[i];
+    caffe_copy(blob->count(), blob->cpu_data(), data_ptr);
+    caffe_copy(blob->count(), blob->cpu_diff(), diff_ptr);
+    data_ptr += blob->count();
+    diff_ptr += blob->count();
+  }
+  SetParamArenas(data, diff);
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetParamArenas(shared_ptr<SyncedMemory> data,
+    shared_ptr<SyncedMemory> diff) {
+  size_t count = 0;
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    count += learnable_params_[i]->count();
+  }
+  CHECK_GE(data->size(), count * sizeof(Dtype)) << "Param arena too small.";
+  CHECK_GE(diff->size(), count * sizeof(Dtype)) << "Param arena too small.";
+  Dtype* data_ptr = static_cast<Dtype*>(data->mutable_cpu_data());
+  Dtype* diff_ptr = static_cast<Dtype*>(diff->mutable_cpu_data());
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    // the params sharing this one share its SyncedMemory, and follow it
+    learnable_params_[i]->data()->set_cpu_data(data_ptr);
+    learnable_params_[i]->diff()->set_cpu_data(diff_ptr);
+    data_ptr += learnable_params_[i]->count();
+    diff_ptr += learnable_params_[i]->count();
+  }
+  param_data_arena_ = data;
+  param_diff_arena_ = diff;
+  param_count_ = count;
+}
+
+template <typename Dtype>
+bool Net<Dtype>::params_flat() const {
+  if (!param_data_arena_) { return false; }
+  // a param may have been reshaped or shared with another blob since
+  const Dtype* data = static_cast<const Dtype*>(param_data_arena_->cpu_data());
+  const Dtype* diff = static_cast<const Dtype*>(param_diff_arena_->cpu_data());
+  for (int i = 0; i < learnable_params_.size(); ++i) {
+    if (learnable_params_[i]->cpu_data() != data ||
+        learnable_params_[i]->cpu_diff() != diff) {
+      return false;
+    }
+    data += learnable_params_[i]->count();
+    diff += learnable_params_[i]->count();
+  }
+  return true;
+}
+
 template <typename Dtype>
 void Net<Dtype>::ClearParamDiffs() {
+  if (Caffe::mode() == Caffe::CPU && params_flat()) {
+    caffe_set(static_cast<int>(param_count_), Dtype(0),
+        static_cast<Dtype*>(param_diff_arena_->mutable_cpu_data()));
+    return;
+  }
   for (int i = 0; i < learnable_params_.size(); ++i) {
     Blob<Dtype>* blob = learnable_params_[i];
     switch (Caffe::mode()) {
@@ -1,12 +1,23 @@
 #ifdef USE_NCCL
-
 #include <cuda_runtime.h>
+#endif
 #include <glog/logging.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "boost/bind.hpp"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "caffe/caffe.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/sgd_solvers.hpp"
@@ -15,9 +26,7 @@ namespace caffe {
 
 enum Op {
   copy,
-  replace_cpu,
   replace_gpu,
-  replace_cpu_diff,
   replace_gpu_diff
 };
 
@@ -35,15 +44,9 @@ static void apply_buffers(const vector<Blob<Dtype>*>& blobs,
                    ptr);
         break;
       }
-      case replace_cpu:
-        blobs[i]->data()->set_cpu_data(ptr);
-        break;
       case replace_gpu:
         blobs[i]->data()->set_gpu_data(ptr);
         break;
-      case replace_cpu_diff:
-        blobs[i]->diff()->set_cpu_data(ptr);
-        break;
       case replace_gpu_diff:
         blobs[i]->diff()->set_gpu_data(ptr);
         break;
@@ -72,6 +75,663 @@ Params<Dtype>::Params(shared_ptr<Solver<Dtype> > root_solver)
     diff_() {
 }
 
+template<typename Dtype>
+CPUParams<Dtype>::CPUParams(shared_ptr<Solver<Dtype> > root_solver,
+                            const CPUParams<Dtype>* shared)
+  : Params<Dtype>(root_solver) {
+  // a flattened net already has its params in buffers of this layout
+  const Net<Dtype>& net = *root_solver->net();
+  const bool flat = net.params_flat();
+  if (shared) {
+    CHECK_EQ(size_, shared->size());
+    data_memory_ = shared->data_memory_;
+  } else if (flat) {
+    data_memory_ = net.param_data_arena();
+  } else {
+    data_memory_.reset(new SyncedMemory(size_ * sizeof(Dtype)));
+  }
+  data_ = static_cast<Dtype*>(data_memory_->mutable_cpu_data());
+  if (!shared && !flat) {
+    apply_buffers(net.learnable_params(), data_, size_, copy);
+  }
+  const vector<Blob<Dtype>*>& params = net.learnable_params();
+  state_size_ = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    if (net.params_lr()[i] == 0) {
+      state_params_.push_back(i);
+      state_counts_.push_back(params[i]->count());
+      state_size_ += params[i]->count();
+    }
+  }
+  Dtype* state = NULL;
+  if (shared && state_size_) {
+    // a copy of the shared values
+    state_memory_.reset(new SyncedMemory(state_size_ * sizeof(Dtype)));
+    state = static_cast<Dtype*>(state_memory_->mutable_cpu_data());
+  }
+  size_t offset = 0;
+  for (int i = 0, j = 0; i < params.size(); ++i) {
+    if (j < state_params_.size() && state_params_[j] == i) {
+      if (state) {
+        caffe_copy(params[i]->count(), data_ + offset, state);
+        state_data_.push_back(state);
+        state += params[i]->count();
+      } else {
+        state_data_.push_back(data_ + offset);
+      }
+      ++j;
+    }
+    offset += params[i]->count();
+  }
+  if (flat) {
+    diff_memory_ = net.param_diff_arena();
+  } else {
+    diff_memory_.reset(new SyncedMemory(size_ * sizeof(Dtype)));
+  }
+  diff_ = static_cast<Dtype*>(diff_memory_->mutable_cpu_data());
+  caffe_set(static_cast<int>(size_), Dtype(0), diff_);
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::Configure(Solver<Dtype>* solver) const {
+  solver->net()->SetParamArenas(data_memory_, diff_memory_);
+  if (state_memory_) {
+    const vector<Blob<Dtype>*>& params = solver->net()->learnable_params();
+    for (int j = 0; j < state_params_.size(); ++j) {
+      params[state_params_[j]]->data()->set_cpu_data(state_data_[j]);
+    }
+  }
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::GetState(Dtype* state) const {
+  for (int j = 0; j < state_params_.size(); ++j) {
+    caffe_copy(state_counts_[j], state_data_[j], state);
+    state += state_counts_[j];
+  }
+}
+
+template<typename Dtype>
+void CPUParams<Dtype>::SetState(const Dtype* state) const {
+  for (int j = 0; j < state_params_.size(); ++j) {
+    caffe_copy(state_counts_[j], state, state_data_[j]);
+    state += state_counts_[j];
+  }
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > root_solver)
+  : CPUParams<Dtype>(root_solver, NULL),
+    solver_(root_solver), root_(this), rank_(0), barrier_(), stop_(false),
+    stopping_(false) {
+  this->Configure(root_solver.get());
+}
+
+template<typename Dtype>
+CPUSync<Dtype>::CPUSync(shared_ptr<Solver<Dtype> > solver,
+                        CPUSync<Dtype>* root)
+  : CPUParams<Dtype>(solver, root),
+    solver_(solver), root_(root), rank_(Caffe::solver_rank()), barrier_(),
+    stop_(false), stopping_(false) {
+  CHECK_GT(rank_, 0);
+  CHECK_LT(rank_, root->syncs_.size());
+  this->Configure(solver.get());
+  // the root solver updates the shared weights, and decides when to stop
+  solver->set_apply_update(false);
+  solver->SetActionFunction(
+      boost::bind(&CPUSync<Dtype>::GetRequestedAction, this));
+  root->syncs_[rank_] = this;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_start() {
+  // Wait for the root to update the weights
+  root_->barrier_->wait();
+  stopping_ = root_->stop_;
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::on_gradients_ready() {
+  if (stopping_) {  // the root has stopped already
+    return;
+  }
+  root_->barrier_->wait();
+  Reduce();
+  if (rank_ == 0) {
+    ReduceState();
+  }
+  root_->barrier_->wait();
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::Reduce() {
+  const vector<CPUSync<Dtype>*>& syncs = root_->syncs_;
+  const int count = syncs.size();
+  // Blocks that stay in cache while the gradient of every replica is added
+  const int kBlockSize = 4096;
+  const int num_blocks = (size_ + kBlockSize - 1) / kBlockSize;
+  const int begin = num_blocks * rank_ / count;
+  const int end = num_blocks * (rank_ + 1) / count;
+  const Dtype scale = Dtype(1) / count;
+  Dtype* sum = root_->diff_;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int b = begin; b < end; ++b) {
+    const size_t offset = static_cast<size_t>(b) * kBlockSize;
+    const int n = static_cast<int>(std::min<size_t>(kBlockSize,
+                                                    size_ - offset));
+    Dtype* block = sum + offset;
+    for (int r = 1; r < count; ++r) {
+      const Dtype* other = syncs[r]->diff_ + offset;
+      for (int i = 0; i < n; ++i) {
+        block[i] += other[i];
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      block[i] *= scale;
+    }
+  }
+}
+
+template<typename Dtype>
+void CPUSync<Dtype>::ReduceState() {
+  const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+  const int count = syncs_.size();
+  for (int j = 0; j < state_params_.size(); ++j) {
+    const int n = params[state_params_[j]]->count();
+    Dtype* mean = state_data_[j];
+    // frozen weights are left alone, rather than rounded a bit each time
+    bool same = true;
+    for (int r = 1; r < count && same; ++r) {
+      same = memcmp(syncs_[r]->state_data_[j], mean, n * sizeof(Dtype)) == 0;
+    }
+    if (same) { continue; }
+    for (int r = 1; r < count; ++r) {
+      caffe_axpy(n, Dtype(1), syncs_[r]->state_data_[j], mean);
+    }
+    caffe_scal(n, Dtype(1) / count, mean);
+    for (int r = 1; r < count; ++r) {
+      caffe_copy(n, mean, syncs_[r]->state_data_[j]);
+    }
+  }
+}
+
+template<typename Dtype>
+SolverAction::Enum CPUSync<Dtype>::GetRequestedAction() {
+  return stopping_ ? SolverAction::STOP : SolverAction::NONE;
+}
+
+// Creates a solver like the root one for a replica on another thread.
+template<typename Dtype>
+static shared_ptr<Solver<Dtype> > CreateReplica(
+    const Solver<Dtype>* root_solver) {
+  SolverParameter param(root_solver->param());
+  param.set_type(root_solver->type());
+  // Only the root solver tests
+  param.clear_test_net();
+  param.clear_test_net_param();
+  param.clear_test_iter();
+  shared_ptr<Solver<Dtype> > s(SolverRegistry<Dtype>::CreateSolver(param));
+  CHECK_EQ(s->type(), root_solver->type());
+  return s;
+}
+
+// The OpenMP threads for each of `replicas` threads
+static int ReplicaOMPThreads(int replicas) {
+#ifdef _OPENMP
+  return std::max(1, omp_get_max_threads() / replicas);
+#else
+  return 1;
+#endif
+}
+
+template<typename Dtype>
+class CPUWorker : public InternalThread {
+ public:
+  CPUWorker(CPUSync<Dtype>* root, int omp_threads)
+    : root_(root), omp_threads_(omp_threads) {
+  }
+  virtual ~CPUWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads_);
+#endif
+    const Solver<Dtype>* root_solver = root_->solver().get();
+    shared_ptr<Solver<Dtype> > s = CreateReplica(root_solver);
+    const int iters = s->param().max_iter() - root_solver->iter();
+    CPUSync<Dtype> sync(s, root_);
+    s->add_callback(&sync);
+    // Wait for the other replicas
+    root_->barrier()->wait();
+    s->Step(iters);
+    root_->barrier()->wait();
+  }
+
+  CPUSync<Dtype>* root_;
+  int omp_threads_;
+};
+
+template<typename Dtype>
+void CPUSync<Dtype>::Run(int threads) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_EQ(root_, this) << "Run the root solver's CPUSync.";
+  CHECK_EQ(Caffe::solver_count(), threads)
+      << "Set the solver count before creating the root solver.";
+  boost::barrier barrier(threads);
+  barrier_ = &barrier;
+  stop_ = false;
+  syncs_.assign(threads, NULL);
+  syncs_[0] = this;
+#ifdef _OPENMP
+  const int max_threads = omp_get_max_threads();
+#endif
+  const int omp_threads = ReplicaOMPThreads(threads);
+  LOG(INFO) << "Training " << threads << " replicas with " << omp_threads
+            << " OpenMP threads each";
+  // Create workers
+  vector<shared_ptr<CPUWorker<Dtype> > > workers(threads);
+  for (int i = 1; i < threads; ++i) {
+    Caffe::set_solver_rank(i);
+    workers[i].reset(new CPUWorker<Dtype>(this, omp_threads));
+    workers[i]->StartInternalThread();
+  }
+  Caffe::set_solver_rank(0);
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads);
+#endif
+  solver_->add_callback(this);
+  // Wait for workers
+  barrier.wait();
+  solver_->Solve();
+  if (solver_->iter() < solver_->param().max_iter()) {
+    // Stopped early: the workers are waiting to start another iteration,
+    // which they give up once they are let through
+    stop_ = true;
+    barrier.wait();
+  }
+  barrier.wait();
+  for (int i = 1; i < threads; ++i) {
+    workers[i]->StopInternalThread();
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(max_threads);
+#endif
+  barrier_ = NULL;
+}
+
+template<typename Dtype>
+Hogwild<Dtype>::Hogwild(shared_ptr<Solver<Dtype> > root_solver)
+  : CPUParams<Dtype>(root_solver, NULL), solver_(root_solver), running_(0),
+    stop_(false) {
+  this->Configure(root_solver.get());
+}
+
+template<typename Dtype>
+void Hogwild<Dtype>::Finished() {
+  boost::mutex::scoped_lock lock(mutex_);
+  --running_;
+  finished_.notify_all();
+}
+
+template<typename Dtype>
+SolverAction::Enum Hogwild<Dtype>::GetRequestedAction() {
+  boost::mutex::scoped_lock lock(mutex_);
+  return stop_ ? SolverAction::STOP : SolverAction::NONE;
+}
+
+template<typename Dtype>
+class HogwildWorker : public InternalThread {
+ public:
+  HogwildWorker(Hogwild<Dtype>* root, int omp_threads, int iter)
+    : root_(root), omp_threads_(omp_threads), iter_(iter) {
+  }
+  virtual ~HogwildWorker() {}
+
+ protected:
+  void InternalThreadEntry() {
+#ifdef _OPENMP
+    omp_set_num_threads(omp_threads_);
+#endif
+    const Solver<Dtype>* root_solver = root_->solver().get();
+    shared_ptr<Solver<Dtype> > s = CreateReplica(root_solver);
+    s->set_iter(iter_);
+    // the weights of the root, and a gradient of its own
+    CPUParams<Dtype> params(s, root_);
+    params.Configure(s.get());
+    s->SetActionFunction(
+        boost::bind(&Hogwild<Dtype>::GetRequestedAction, root_));
+    s->Step(s->param().max_iter() - s->iter());
+    root_->Finished();
+  }
+
+  Hogwild<Dtype>* root_;
+  int omp_threads_;
+  // The iteration of the root when training started
+  int iter_;
+};
+
+template<typename Dtype>
+void Hogwild<Dtype>::Run(int threads) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_EQ(Caffe::solver_count(), threads)
+      << "Set the solver count before creating the root solver.";
+#ifdef _OPENMP
+  const int max_threads = omp_get_max_threads();
+#endif
+  const int omp_threads = ReplicaOMPThreads(threads);
+  LOG(INFO) << "Training " << threads << " Hogwild replicas with "
+            << omp_threads << " OpenMP threads each";
+  LOG_IF(WARNING, !solver_->param().sparse_update())
+      << "Without sparse_update, every Hogwild replica writes every weight.";
+  running_ = threads - 1;
+  stop_ = false;
+  vector<shared_ptr<HogwildWorker<Dtype> > > workers(threads);
+  for (int i = 1; i < threads; ++i) {
+    Caffe::set_solver_rank(i);
+    workers[i].reset(new HogwildWorker<Dtype>(this, omp_threads,
+        solver_->iter()));
+    workers[i]->StartInternalThread();
+  }
+  Caffe::set_solver_rank(0);
+#ifdef _OPENMP
+  omp_set_num_threads(omp_threads);
+#endif
+  solver_->Step(solver_->param().max_iter() - solver_->iter());
+  {
+    // the replicas stop updating before the final snapshot, early if the
+    // root has stopped early
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = solver_->iter() < solver_->param().max_iter();
+    while (running_ > 0) {
+      finished_.wait(lock);
+    }
+  }
+  for (int i = 1; i < threads; ++i) {
+    workers[i]->StopInternalThread();
+  }
+#ifdef _OPENMP
+  omp_set_num_threads(max_threads);
+#endif
+  const SolverParameter& param = solver_->param();
+  if (param.snapshot_after_train()
+      && (!param.snapshot() || solver_->iter() % param.snapshot() != 0)) {
+    solver_->Snapshot();
+  }
+}
+
+template<typename Dtype>
+CollectiveSync<Dtype>::CollectiveSync(shared_ptr<Solver<Dtype> > solver,
+                                      shared_ptr<Collective> collective)
+  : Params<Dtype>(solver), solver_(solver), collective_(collective),
+    stopping_(false) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_EQ(Caffe::solver_count(), collective->size());
+  CHECK_EQ(Caffe::solver_rank(), collective->rank());
+  if (solver->net()->params_flat()) {
+    data_memory_ = solver->net()->param_data_arena();
+    data_ = static_cast<Dtype*>(data_memory_->mutable_cpu_data());
+  } else {
+    data_memory_.reset(new SyncedMemory(size_ * sizeof(Dtype)));
+    data_ = static_cast<Dtype*>(data_memory_->mutable_cpu_data());
+    apply_buffers(solver->net()->learnable_params(), data_, size_, copy);
+  }
+  diff_memory_.reset(new SyncedMemory((size_ + 1) * sizeof(Dtype)));
+  diff_ = static_cast<Dtype*>(diff_memory_->mutable_cpu_data());
+  caffe_set(static_cast<int>(size_ + 1), Dtype(0), diff_);
+  solver->net()->SetParamArenas(data_memory_, diff_memory_);
+  if (collective->rank() > 0) {
+    // rank 0 decides when to stop
+    solver->SetActionFunction(
+        boost::bind(&CollectiveSync<Dtype>::GetRequestedAction, this));
+  }
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::Broadcast() {
+  collective_->Broadcast(data_, size_);
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::on_gradients_ready() {
+  diff_[size_] = 0;
+  collective_->Allreduce(diff_, size_ + 1);
+  if (diff_[size_] != 0) {
+    // rank 0 has stopped, and did not compute a gradient
+    stopping_ = true;
+    solver_->set_apply_update(false);
+    return;
+  }
+  caffe_scal(static_cast<int>(size_), Dtype(1) / collective_->size(), diff_);
+}
+
+template<typename Dtype>
+SolverAction::Enum CollectiveSync<Dtype>::GetRequestedAction() {
+  return stopping_ ? SolverAction::STOP : SolverAction::NONE;
+}
+
+template<typename Dtype>
+void CollectiveSync<Dtype>::Run() {
+  Broadcast();
+  solver_->add_callback(this);
+  if (collective_->rank() == 0) {
+    solver_->Solve();
+    if (solver_->iter() < solver_->param().max_iter()) {
+      // Stopped early: the other ranks are waiting for this iteration's
+      // gradient, so send them the flag instead
+      caffe_set(static_cast<int>(size_), Dtype(0), diff_);
+      diff_[size_] = 1;
+      collective_->Allreduce(diff_, size_ + 1);
+    }
+  } else {
+    solver_->Step(solver_->param().max_iter() - solver_->iter());
+  }
+  collective_->Barrier();
+}
+
+template<typename Dtype>
+ParamServer<Dtype>::ParamServer(shared_ptr<Solver<Dtype> > solver,
+                                const string& address, int staleness)
+  : CPUParams<Dtype>(solver, NULL), solver_(solver), address_(address),
+    staleness_(staleness), stop_(false) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_GE(staleness_, 0);
+  this->Configure(solver.get());
+}
+
+template<typename Dtype>
+int ParamServer<Dtype>::MinClock() const {
+  return *std::min_element(clocks_.begin(), clocks_.end());
+}
+
+template<typename Dtype>
+void ParamServer<Dtype>::Run(int workers) {
+  CHECK_GT(workers, 0);
+  string host;
+  int port;
+  ParseAddress(address_, &host, &port);
+  const int listener = ListenTCP(port, workers);
+  LOG(INFO) << "Serving " << size_ << " parameters to " << workers
+      << " workers on port " << port;
+  clocks_.assign(workers, 0);
+  states_.assign(workers, vector<Dtype>());
+  stop_ = solver_->iter() >= solver_->param().max_iter();
+  boost::thread_group threads;
+  for (int worker = 0; worker < workers; ++worker) {
+    const int fd = AcceptTCP(listener);
+    threads.create_thread(
+        boost::bind(&ParamServer<Dtype>::Serve, this, worker, fd));
+  }
+  close(listener);
+  threads.join_all();
+  const SolverParameter& param = solver_->param();
+  if (param.snapshot_after_train()
+      && (!param.snapshot() || solver_->iter() % param.snapshot() != 0)) {
+    solver_->Snapshot();
+  }
+}
+
+template<typename Dtype>
+void ParamServer<Dtype>::AverageStates() {
+  vector<Dtype> mean(state_size_, Dtype(0));
+  this->GetState(&mean[0]);
+  // frozen weights are left alone, rather than rounded a bit each time
+  bool same = true;
+  int count = 0;
+  for (int w = 0; w < states_.size(); ++w) {
+    if (states_[w].empty()) { continue; }
+    same = same && states_[w] == mean;
+    ++count;
+  }
+  if (same || !count) { return; }
+  caffe_set(static_cast<int>(state_size_), Dtype(0), &mean[0]);
+  for (int w = 0; w < states_.size(); ++w) {
+    if (states_[w].empty()) { continue; }
+    caffe_axpy(static_cast<int>(state_size_), Dtype(1), &states_[w][0],
+        &mean[0]);
+  }
+  caffe_scal(static_cast<int>(state_size_), Dtype(1) / count, &mean[0]);
+  this->SetState(&mean[0]);
+}
+
+template<typename Dtype>
+void ParamServer<Dtype>::Serve(int worker, int fd) {
+  const size_t bytes = size_ * sizeof(Dtype);
+  // the gradient and the state pushed, then the weights pulled
+  vector<Dtype> buffer(size_ + state_size_);
+  uint64_t size = 0;
+  if (RecvAll(fd, &size, sizeof(size))) {
+    CHECK_EQ(size, size_) << "Worker " << worker << " trains another net.";
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      caffe_copy(size_, data_, &buffer[0]);
+    }
+    SendAll(fd, &buffer[0], bytes);
+    while (RecvAll(fd, &buffer[0], buffer.size() * sizeof(Dtype))) {
+      int32_t stop;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (!stop_) {
+          caffe_copy(size_, &buffer[0], diff_);
+          if (state_size_) {
+            // before the update, which may test or snapshot
+            states_[worker].assign(buffer.begin() + size_, buffer.end());
+            AverageStates();
+          }
+          stop_ = !solver_->ApplyGradient();
+          ++clocks_[worker];
+          const SolverParameter& param = solver_->param();
+          if (param.display() && solver_->iter() % param.display() == 0) {
+            LOG(INFO) << "Iteration " << solver_->iter() << ", pushes per "
+                << "worker from " << MinClock() << " to "
+                << *std::max_element(clocks_.begin(), clocks_.end());
+          }
+          clock_changed_.notify_all();
+          while (!stop_ && clocks_[worker] > MinClock() + staleness_) {
+            clock_changed_.wait(lock);
+          }
+        }
+        stop = stop_;
+        if (!stop) {
+          caffe_copy(size_, data_, &buffer[0]);
+        }
+      }
+      SendAll(fd, &stop, sizeof(stop));
+      if (stop) { break; }
+      SendAll(fd, &buffer[0], bytes);
+    }
+  }
+  close(fd);
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!stop_) {
+    LOG(WARNING) << "Worker " << worker << " disconnected.";
+  }
+  // the others no longer wait for it
+  clocks_[worker] = INT_MAX;
+  clock_changed_.notify_all();
+}
+
+template<typename Dtype>
+ParamWorker<Dtype>::ParamWorker(shared_ptr<Solver<Dtype> > solver,
+                                const string& address, int period)
+  : CPUParams<Dtype>(solver, NULL), solver_(solver), address_(address),
+    period_(period), fd_(-1), sum_(), pending_(0), stopping_(false) {
+  CHECK_EQ(Caffe::mode(), Caffe::CPU);
+  CHECK_GT(period_, 0);
+  this->Configure(solver.get());
+  if (period_ > 1) {
+    sum_memory_.reset(new SyncedMemory(size_ * sizeof(Dtype)));
+    sum_ = static_cast<Dtype*>(sum_memory_->mutable_cpu_data());
+    caffe_set(static_cast<int>(size_), Dtype(0), sum_);
+  }
+  state_.resize(state_size_);
+  // the server updates the weights, and decides when to stop
+  solver->set_apply_update(false);
+  solver->SetActionFunction(
+      boost::bind(&ParamWorker<Dtype>::GetRequestedAction, this));
+}
+
+template<typename Dtype>
+void ParamWorker<Dtype>::on_gradients_ready() {
+  const Dtype* gradient = diff_;
+  if (period_ > 1) {
+    caffe_axpy(static_cast<int>(size_), Dtype(1), diff_, sum_);
+    if (++pending_ < period_) {
+      return;
+    }
+    caffe_scal(static_cast<int>(size_), Dtype(1) / period_, sum_);
+    gradient = sum_;
+    pending_ = 0;
+  }
+  SendAll(fd_, gradient, size_ * sizeof(Dtype));
+  if (state_size_) {
+    this->GetState(&state_[0]);
+    SendAll(fd_, &state_[0], state_size_ * sizeof(Dtype));
+  }
+  if (period_ > 1) {
+    caffe_set(static_cast<int>(size_), Dtype(0), sum_);
+  }
+  int32_t stop;
+  CHECK(RecvAll(fd_, &stop, sizeof(stop)))
+      << "The parameter server closed the connection.";
+  if (stop) {
+    stopping_ = true;
+    return;
+  }
+  CHECK(RecvAll(fd_, data_, size_ * sizeof(Dtype)))
+      << "The parameter server closed the connection.";
+  if (state_size_) {
+    this->SetState(&state_[0]);
+  }
+}
+
+template<typename Dtype>
+SolverAction::Enum ParamWorker<Dtype>::GetRequestedAction() {
+  return stopping_ ? SolverAction::STOP : SolverAction::NONE;
+}
+
+template<typename Dtype>
+void ParamWorker<Dtype>::Run() {
+  string host;
+  int port;
+  ParseAddress(address_, &host, &port);
+  fd_ = ConnectTCP(host, port);
+  const uint64_t size = size_;
+  SendAll(fd_, &size, sizeof(size));
+  if (RecvAll(fd_, data_, size_ * sizeof(Dtype))) {
+    solver_->add_callback(this);
+    solver_->Step(INT_MAX - solver_->iter());
+  } else {
+    LOG(INFO) << "The parameter server has stopped already.";
+  }
+  close(fd_);
+  fd_ = -1;
+}
+
+#ifdef USE_NCCL
+
 template<typename Dtype>
 GPUParams<Dtype>::GPUParams(shared_ptr<Solver<Dtype> > root_solver, int device)
   : Params<Dtype>(root_solver) {
@@ -361,11 +1021,18 @@ void NCCL<Dtype>::Run(const vector<int>& gpus, const char* restore) {
   }
 }
 
-INSTANTIATE_CLASS(Params);
 INSTANTIATE_CLASS(GPUParams);
 INSTANTIATE_CLASS(Worker);
 INSTANTIATE_CLASS(NCCL);
 
-}  // namespace caffe
-
 #endif  // USE_NCCL
+
+INSTANTIATE_CLASS(Params);
+INSTANTIATE_CLASS(CPUParams);
+INSTANTIATE_CLASS(CPUSync);
+INSTANTIATE_CLASS(Hogwild);
+INSTANTIATE_CLASS(CollectiveSync);
+INSTANTIATE_CLASS(ParamServer);
+INSTANTIATE_CLASS(ParamWorker);
+
+}  // namespace caffe
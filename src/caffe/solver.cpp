@@ -3,10 +3,12 @@
 #include <string>
 #include <vector>
 
+#include "boost/thread.hpp"
 #include "caffe/solver.hpp"
 #include "caffe/util/format.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -27,13 +29,15 @@ SolverAction::Enum Solver<Dtype>::GetRequestedAction() {
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
-    : net_(), callbacks_(), requested_early_exit_(false) {
+    : net_(), callbacks_(), requested_early_exit_(false),
+      apply_update_(true), snapshot_iter_(0), snapshot_current_step_(0) {
   Init(param);
 }
 
 template <typename Dtype>
 Solver<Dtype>::Solver(const string& param_file)
-    : net_(), callbacks_(), requested_early_exit_(false) {
+    : net_(), callbacks_(), requested_early_exit_(false),
+      apply_update_(true), snapshot_iter_(0), snapshot_current_step_(0) {
   SolverParameter param;
   ReadSolverParamsFromTextFileOrDie(param_file, &param);
   Init(param);
@@ -98,6 +102,10 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
   net_.reset(new Net<Dtype>(net_param));
+  // lets the update sweep over all the params at once
+  if (Caffe::mode() == Caffe::CPU) {
+    net_->FlattenParams();
+  }
 }
 
 template <typename Dtype>
@@ -209,6 +217,10 @@ void Solver<Dtype>::Step(int iters) {
     // accumulate the loss and gradient
     Dtype loss = 0;
     for (int i = 0; i < param_.iter_size(); ++i) {
+      // callbacks may change the gradients before the update
+      if (i == param_.iter_size() - 1 && apply_update_ && callbacks_.empty()) {
+        BeginUpdate();
+      }
       loss += net_->ForwardBackward();
     }
     loss /= param_.iter_size();
@@ -245,7 +257,9 @@ void Solver<Dtype>::Step(int iters) {
     for (int i = 0; i < callbacks_.size(); ++i) {
       callbacks_[i]->on_gradients_ready();
     }
-    ApplyUpdate();
+    if (apply_update_) {
+      ApplyUpdate();
+    }
 
     // Increment the internal iter_ counter -- its value should always indicate
     // the number of times the weights have been updated.
@@ -268,6 +282,25 @@ void Solver<Dtype>::Step(int iters) {
   }
 }
 
+template <typename Dtype>
+bool Solver<Dtype>::ApplyGradient() {
+  if (param_.test_interval() && iter_ % param_.test_interval() == 0
+      && (iter_ > 0 || param_.test_initialization())) {
+    TestAll();
+  }
+  ApplyUpdate();
+  ++iter_;
+  SolverAction::Enum request = GetRequestedAction();
+  if ((param_.snapshot() && iter_ % param_.snapshot() == 0) ||
+      request == SolverAction::SNAPSHOT) {
+    Snapshot();
+  }
+  if (SolverAction::STOP == request) {
+    requested_early_exit_ = true;
+  }
+  return !requested_early_exit_ && iter_ < param_.max_iter();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Solve(const char* resume_file) {
   CHECK(Caffe::root_solver());
@@ -292,6 +325,7 @@ void Solver<Dtype>::Solve(const char* resume_file) {
       && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
     Snapshot();
   }
+  WaitForSnapshot();
   if (requested_early_exit_) {
     LOG(INFO) << "Optimization stopped early.";
     return;
@@ -408,6 +442,59 @@ void Solver<Dtype>::Test(const int test_net_id) {
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
   CHECK(Caffe::root_solver());
+  WaitForSnapshot();
+  snapshot_iter_ = iter_;
+  snapshot_current_step_ = current_step_;
+  if (!param_.snapshot_in_background()) {
+    StageSnapshot(false);
+    WriteSnapshot();
+    return;
+  }
+  StageSnapshot(true);
+  snapshot_thread_.reset(new boost::thread(&Solver<Dtype>::WriteSnapshot,
+      this));
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WaitForSnapshot() {
+  if (snapshot_thread_) {
+    snapshot_thread_->join();
+    snapshot_thread_.reset();
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::StageSnapshot(bool copy) {
+  const vector<Blob<Dtype>*>& params = net_->learnable_params();
+  if (!copy) {
+    snapshot_params_ = params;
+    return;
+  }
+  // the copies are kept for the next snapshot, which reuses their memory
+  staged_params_.resize(params.size());
+  snapshot_params_.resize(params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    if (!staged_params_[i]) {
+      staged_params_[i].reset(new Blob<Dtype>());
+    }
+    Blob<Dtype>* staged = staged_params_[i].get();
+    staged->ReshapeLike(*params[i]);
+    caffe_copy(params[i]->count(), params[i]->cpu_data(),
+        staged->mutable_cpu_data());
+    if (param_.snapshot_diff()) {
+      caffe_copy(params[i]->count(), params[i]->cpu_diff(),
+          staged->mutable_cpu_diff());
+    }
+    snapshot_params_[i] = staged;
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshot() {
+  // the staged copies are on the host, whatever the mode of training
+  if (param_.snapshot_in_background()) {
+    Caffe::set_mode(Caffe::CPU);
+  }
   string model_filename;
   switch (param_.snapshot_format()) {
   case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
@@ -419,10 +506,20 @@ void Solver<Dtype>::Snapshot() {
   default:
     LOG(FATAL) << "Unsupported snapshot format.";
   }
+  if (param_.snapshot_flat_weights()) {
+    SnapshotToFlat();
+  }
 
   SnapshotSolverState(model_filename);
 }
 
+template <typename Dtype>
+void Solver<Dtype>::CommitSnapshotFile(const string& filename) {
+  CHECK_EQ(std::rename(PartialFilename(filename).c_str(), filename.c_str()),
+      0) << "Couldn't rename " << PartialFilename(filename) << " to "
+      << filename << ".";
+}
+
 template <typename Dtype>
 void Solver<Dtype>::CheckSnapshotWritePermissions() {
   if (Caffe::root_solver() && param_.snapshot()) {
@@ -443,8 +540,8 @@ void Solver<Dtype>::CheckSnapshotWritePermissions() {
 
 template <typename Dtype>
 string Solver<Dtype>::SnapshotFilename(const string extension) {
-  return param_.snapshot_prefix() + "_iter_" + caffe::format_int(iter_)
-    + extension;
+  return param_.snapshot_prefix() + "_iter_"
+    + caffe::format_int(snapshot_iter_) + extension;
 }
 
 template <typename Dtype>
@@ -452,8 +549,9 @@ string Solver<Dtype>::SnapshotToBinaryProto() {
   string model_filename = SnapshotFilename(".caffemodel");
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
   NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  net_->ToProto(&net_param, snapshot_params_, param_.snapshot_diff());
+  WriteProtoToBinaryFile(net_param, PartialFilename(model_filename));
+  CommitSnapshotFile(model_filename);
   return model_filename;
 }
 
@@ -461,12 +559,25 @@ template <typename Dtype>
 string Solver<Dtype>::SnapshotToHDF5() {
   string model_filename = SnapshotFilename(".caffemodel.h5");
   LOG(INFO) << "Snapshotting to HDF5 file " << model_filename;
-  net_->ToHDF5(model_filename, param_.snapshot_diff());
+  net_->ToHDF5(PartialFilename(model_filename), snapshot_params_,
+      param_.snapshot_diff());
+  CommitSnapshotFile(model_filename);
+  return model_filename;
+}
+
+template <typename Dtype>
+string Solver<Dtype>::SnapshotToFlat() {
+  string model_filename = SnapshotFilename(".caffemodel.flat");
+  LOG(INFO) << "Snapshotting to flat weights file " << model_filename;
+  net_->ToFlat(PartialFilename(model_filename), snapshot_params_);
+  CommitSnapshotFile(model_filename);
   return model_filename;
 }
 
 template <typename Dtype>
 void Solver<Dtype>::Restore(const char* state_file) {
+  // the state may be that of a snapshot still being written
+  WaitForSnapshot();
   string state_filename(state_file);
   if (state_filename.size() >= 3 &&
       state_filename.compare(state_filename.size() - 3, 3, ".h5") == 0) {
@@ -4,6 +4,24 @@
 
 namespace caffe {
 
+template <typename Dtype>
+static void nesterov_update_cpu(int N, Dtype* g, Dtype* h, Dtype momentum,
+    Dtype local_rate) {
+  for (int i = 0; i < N; ++i) {
+    const Dtype hi = h[i];
+    const Dtype hi_new = h[i] = momentum * hi + local_rate * g[i];
+    g[i] = (1 + momentum) * hi_new - momentum * hi;
+  }
+}
+
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeUpdateBlock(int param_id, Dtype rate,
+    Dtype* g, Dtype** h, int n) {
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  nesterov_update_cpu(n, g, h[0], momentum, local_rate);
+}
+
 #ifndef CPU_ONLY
 template <typename Dtype>
 void nesterov_update_gpu(int N, Dtype* g, Dtype* h, Dtype momentum,
@@ -12,47 +30,22 @@ void nesterov_update_gpu(int N, Dtype* g, Dtype* h, Dtype momentum,
 
 template <typename Dtype>
 void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
+  if (Caffe::mode() == Caffe::CPU) {
+    this->ComputeUpdateValueCPU(param_id, rate);
+    return;
+  }
+#ifndef CPU_ONLY
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   const vector<float>& net_params_lr = this->net_->params_lr();
   Dtype momentum = this->param_.momentum();
   Dtype local_rate = rate * net_params_lr[param_id];
-  switch (Caffe::mode()) {
-  case Caffe::CPU: {
-    // save history momentum for stepping back
-    caffe_copy(net_params[param_id]->count(),
-        this->history_[param_id]->cpu_data(),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // update history
-    caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-              net_params[param_id]->cpu_diff(), momentum,
-              this->history_[param_id]->mutable_cpu_data());
-
-    // compute update: step back then over step
-    caffe_cpu_axpby(net_params[param_id]->count(), Dtype(1) + momentum,
-        this->history_[param_id]->cpu_data(), -momentum,
-        this->update_[param_id]->mutable_cpu_data());
-
-    // copy
-    caffe_copy(net_params[param_id]->count(),
-        this->update_[param_id]->cpu_data(),
-        net_params[param_id]->mutable_cpu_diff());
-    break;
-  }
-  case Caffe::GPU: {
-#ifndef CPU_ONLY
-    nesterov_update_gpu(net_params[param_id]->count(),
-        net_params[param_id]->mutable_gpu_diff(),
-        this->history_[param_id]->mutable_gpu_data(),
-        momentum, local_rate);
+  nesterov_update_gpu(net_params[param_id]->count(),
+      net_params[param_id]->mutable_gpu_diff(),
+      this->history_[param_id]->mutable_gpu_data(),
+      momentum, local_rate);
 #else
-    NO_GPU;
+  NO_GPU;
 #endif
-    break;
-  }
-  default:
-    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
-  }
 }
 
 INSTANTIATE_CLASS(NesterovSolver);
@@ -1,9 +1,29 @@
+#include <cmath>
 #include <vector>
 
 #include "caffe/sgd_solvers.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+static void rmsprop_update_cpu(int N, Dtype* g, Dtype* h, Dtype rms_decay,
+    Dtype delta, Dtype local_rate) {
+  for (int i = 0; i < N; ++i) {
+    const Dtype gi = g[i];
+    const Dtype hi = h[i] = rms_decay * h[i] + (1 - rms_decay) * gi * gi;
+    g[i] = local_rate * gi / (std::sqrt(hi) + delta);
+  }
+}
+
+template <typename Dtype>
+void RMSPropSolver<Dtype>::ComputeUpdateBlock(int param_id, Dtype rate,
+    Dtype* g, Dtype** h, int n) {
+  const Dtype delta = this->param_.delta();
+  const Dtype rms_decay = this->param_.rms_decay();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  rmsprop_update_cpu(n, g, h[0], rms_decay, delta, local_rate);
+}
+
 #ifndef CPU_ONLY
 template <typename Dtype>
 void rmsprop_update_gpu(int N, Dtype* g, Dtype* h, Dtype rms_decay,
@@ -12,6 +32,11 @@ void rmsprop_update_gpu(int N, Dtype* g, Dtype* h, Dtype rms_decay,
 
 template <typename Dtype>
 void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
+  if (Caffe::mode() == Caffe::CPU) {
+    this->ComputeUpdateValueCPU(param_id, rate);
+    return;
+  }
+#ifndef CPU_ONLY
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   const vector<float>& net_params_lr = this->net_->params_lr();
 
@@ -20,48 +45,13 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   Dtype rms_decay = this->param_.rms_decay();
   Dtype local_rate = rate * net_params_lr[param_id];
 
-  switch (Caffe::mode()) {
-  case Caffe::CPU:
-    // compute square of gradient in update
-    caffe_powx(net_params[param_id]->count(),
-        net_params[param_id]->cpu_diff(), Dtype(2),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // update history
-    caffe_cpu_axpby(net_params[param_id] -> count(),
-        Dtype(1-rms_decay), this->update_[param_id]->cpu_data(),
-        rms_decay, this->history_[param_id]-> mutable_cpu_data());
-
-    // prepare update
-    caffe_powx(net_params[param_id]->count(),
-        this->history_[param_id]->cpu_data(), Dtype(0.5),
-        this->update_[param_id]->mutable_cpu_data());
-
-    caffe_add_scalar(net_params[param_id]->count(),
-        delta, this->update_[param_id]->mutable_cpu_data());
-
-    caffe_div(net_params[param_id]->count(),
-        net_params[param_id]->cpu_diff(), this->update_[param_id]->cpu_data(),
-        this->update_[param_id]->mutable_cpu_data());
-
-    // scale and copy
-    caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-        this->update_[param_id]->cpu_data(), Dtype(0),
-        net_params[param_id]->mutable_cpu_diff());
-    break;
-  case Caffe::GPU:
-#ifndef CPU_ONLY
-    rmsprop_update_gpu(net_params[param_id]->count(),
-        net_params[param_id]->mutable_gpu_diff(),
-        this->history_[param_id]->mutable_gpu_data(),
-        rms_decay, delta, local_rate);
+  rmsprop_update_gpu(net_params[param_id]->count(),
+      net_params[param_id]->mutable_gpu_diff(),
+      this->history_[param_id]->mutable_gpu_data(),
+      rms_decay, delta, local_rate);
 #else
-    NO_GPU;
+  NO_GPU;
 #endif
-    break;
-  default:
-    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
-  }
 }
 
 INSTANTIATE_CLASS(RMSPropSolver);
@@ -1,9 +1,17 @@
+#include <string.h>
+
+#include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "boost/thread.hpp"
+
 #include "caffe/sgd_solvers.hpp"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/reduced_precision.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -73,38 +81,167 @@ void SGDSolver<Dtype>::PreSolve() {
     const vector<int>& shape = net_params[i]->shape();
     history_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
     update_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
-    temp_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(shape)));
   }
+  temp_.resize(net_params.size());
 }
 
 template <typename Dtype>
-void SGDSolver<Dtype>::ClipGradients() {
+Dtype SGDSolver<Dtype>::ClipScale() {
   const Dtype clip_gradients = this->param_.clip_gradients();
-  if (clip_gradients < 0) { return; }
+  if (clip_gradients < 0) { return 1; }
+  const Dtype l2norm_diff = std::sqrt(this->net_->sumsq_param_diffs());
+  if (l2norm_diff <= clip_gradients) { return 1; }
+  Dtype scale_factor = clip_gradients / l2norm_diff;
+  LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
+      << l2norm_diff << " > " << clip_gradients << ") "
+      << "by scale factor " << scale_factor;
+  return scale_factor;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ClipGradients() {
+  const Dtype scale_factor = ClipScale();
+  if (scale_factor == 1) { return; }
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  Dtype sumsq_diff = 0;
   for (int i = 0; i < net_params.size(); ++i) {
-    sumsq_diff += net_params[i]->sumsq_diff();
-  }
-  const Dtype l2norm_diff = std::sqrt(sumsq_diff);
-  if (l2norm_diff > clip_gradients) {
-    Dtype scale_factor = clip_gradients / l2norm_diff;
-    LOG(INFO) << "Gradient clipping: scaling down gradients (L2 norm "
-        << l2norm_diff << " > " << clip_gradients << ") "
-        << "by scale factor " << scale_factor;
-    for (int i = 0; i < net_params.size(); ++i) {
-      net_params[i]->scale_diff(scale_factor);
+    net_params[i]->scale_diff(scale_factor);
+  }
+}
+
+// Updates each learnable param on a thread of its own as soon as the backward
+// pass has run all the layers that use it, its owner and those sharing it,
+// which an after_backward callback counts down. The params are independent,
+// so the order of their updates does not change the result.
+template <typename Dtype>
+class SGDSolver<Dtype>::OverlapUpdate : public Net<Dtype>::Callback {
+ public:
+  explicit OverlapUpdate(SGDSolver<Dtype>* solver)
+      : solver_(solver), active_(false), rate_(0), remaining_(0) {
+    const Net<Dtype>& net = *solver->net_;
+    layer_params_.resize(net.layers().size());
+    uses_.resize(net.learnable_params().size(), 0);
+    for (int i = 0; i < net.params().size(); ++i) {
+      const int learnable_id = net.learnable_param_ids()[i];
+      layer_params_[net.param_layer_indices()[i].first].push_back(learnable_id);
+      ++uses_[learnable_id];
+    }
+    solver->net_->add_after_backward(this);
+    thread_.reset(new boost::thread(&OverlapUpdate::Run, this));
+  }
+  ~OverlapUpdate() {
+    solver_->net_->remove_after_backward(this);
+    ready_.push(-1);
+    thread_->join();
+    CHECK(!thread_->joinable()) << "The update thread is still running.";
+  }
+
+  inline bool active() const { return active_; }
+  inline Dtype rate() const { return rate_; }
+
+  // Starts counting down the layers of the coming backward pass.
+  void Begin(Dtype rate) {
+    boost::mutex::scoped_lock lock(mutex_);
+    rate_ = rate;
+    pending_ = uses_;
+    remaining_ = uses_.size();
+    active_ = true;
+  }
+  // Returns once all the params are updated.
+  void Wait() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (remaining_ > 0) {
+      done_.wait(lock);
     }
+    active_ = false;
+  }
+
+ protected:
+  // Called after the backward of each layer, one layer at a time.
+  virtual void run(int layer) {
+    if (!active_) { return; }
+    const vector<int>& params = layer_params_[layer];
+    for (int k = 0; k < params.size(); ++k) {
+      if (--pending_[params[k]] == 0) {
+        ready_.push(params[k]);
+      }
+    }
+  }
+
+  void Run() {
+    Caffe::set_mode(Caffe::CPU);
+    for (int param_id = ready_.pop(); param_id >= 0;
+         param_id = ready_.pop()) {
+      solver_->UpdateParam(param_id, rate_);
+      boost::mutex::scoped_lock lock(mutex_);
+      if (--remaining_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  SGDSolver<Dtype>* solver_;
+  // the learnable params of each layer, and the number of layers using each
+  vector<vector<int> > layer_params_;
+  vector<int> uses_;
+  // the layers each param still waits for in this pass
+  vector<int> pending_;
+  bool active_;
+  Dtype rate_;
+  BlockingQueue<int> ready_;
+  int remaining_;
+  boost::mutex mutex_;
+  boost::condition_variable done_;
+  shared_ptr<boost::thread> thread_;
+};
+
+template <typename Dtype>
+void SGDSolver<Dtype>::BeginUpdate() {
+  // clipping needs all the gradients first, and the debug info of the
+  // backward pass reads the params
+  if (!this->param_.overlap_update() || this->param_.clip_gradients() >= 0 ||
+      this->param_.debug_info() || Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  if (!overlap_) {
+    overlap_.reset(new OverlapUpdate(this));
+  }
+  overlap_->Begin(GetLearningRate());
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::UpdateParam(int param_id, Dtype rate) {
+  if (Caffe::mode() == Caffe::CPU) {
+    FusedUpdate(param_id, param_id + 1, rate,
+        Dtype(1) / this->param_.iter_size());
+    return;
   }
+  Normalize(param_id);
+  Regularize(param_id);
+  ComputeUpdateValue(param_id, rate);
+  this->net_->learnable_params()[param_id]->Update();
 }
 
 template <typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate() {
-  Dtype rate = GetLearningRate();
+  const bool overlapped = overlap_ && overlap_->active();
+  Dtype rate = overlapped ? overlap_->rate() : GetLearningRate();
   if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
     LOG_IF(INFO, Caffe::root_solver()) << "Iteration " << this->iter_
         << ", lr = " << rate;
   }
+  if (overlapped) {
+    overlap_->Wait();
+    return;
+  }
+  if (Caffe::mode() == Caffe::CPU) {
+    // clipping and the normalization of accumulated gradients, at once
+    const Dtype scale = ClipScale() / this->param_.iter_size();
+    FusedUpdate(0, this->net_->learnable_params().size(), rate, scale);
+    return;
+  }
+  CHECK_EQ(this->param_.history_precision(),
+      SolverParameter_HistoryPrecision_FULL)
+      << "Reduced precision history is only kept on the CPU.";
   ClipGradients();
   for (int param_id = 0; param_id < this->net_->learnable_params().size();
        ++param_id) {
@@ -115,6 +252,234 @@ void SGDSolver<Dtype>::ApplyUpdate() {
   this->net_->Update();
 }
 
+// the most history blobs a param has, in any solver
+const int kMaxHistory = 2;
+// the elements of a param that FusedUpdate updates together
+const int kBlockSize = 4096;
+
+template <typename Dtype>
+void SGDSolver<Dtype>::FusedUpdate(int begin, int end, Dtype rate,
+    Dtype scale) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const Dtype weight_decay = this->param_.weight_decay();
+  const string& regularization_type = this->param_.regularization_type();
+  const bool l1 = regularization_type == "L1";
+  if (weight_decay && !l1 && regularization_type != "L2") {
+    LOG(FATAL) << "Unknown regularization type: " << regularization_type;
+  }
+  // The threads only get the pointers taken here, as getting them from the
+  // blobs changes their state.
+  const int num_params = net_params.size();
+  const int num_history = num_params ? history_.size() / num_params : 0;
+  CHECK_LE(num_history, kMaxHistory);
+  const ReducedPrecision precision = this->param_.history_precision();
+  const bool compact = precision != SolverParameter_HistoryPrecision_FULL;
+  const bool sparse = this->param_.sparse_update();
+  CHECK(!sparse || !compact)
+      << "sparse_update needs a FULL history_precision.";
+  vector<Dtype*> data(end - begin);
+  vector<Dtype*> diff(end - begin);
+  vector<pair<int, int> > blocks;
+  for (int param_id = begin; param_id < end; ++param_id) {
+    data[param_id - begin] = net_params[param_id]->mutable_cpu_data();
+    diff[param_id - begin] = net_params[param_id]->mutable_cpu_diff();
+    for (int offset = 0; offset < net_params[param_id]->count();
+         offset += kBlockSize) {
+      blocks.push_back(std::make_pair(param_id, offset));
+    }
+  }
+  CacheHistoryData(begin, end);
+  const int num_blocks = blocks.size();
+#ifdef _OPENMP
+#pragma omp parallel if (num_blocks > 1)
+#endif
+  {
+    // each thread's room for a block of decoded or gathered history, and of
+    // sparse update values and their indices
+    vector<Dtype> scratch(
+        compact || sparse ? (1 + kMaxHistory) * kBlockSize : 0);
+    vector<int> nonzero(sparse ? kBlockSize : 0);
+#ifdef _OPENMP
+#pragma omp for
+#endif
+    for (int b = 0; b < num_blocks; ++b) {
+      const int param_id = blocks[b].first;
+      const int offset = blocks[b].second;
+      const int n =
+          std::min(kBlockSize, net_params[param_id]->count() - offset);
+      Dtype* w = data[param_id - begin] + offset;
+      Dtype* g = diff[param_id - begin] + offset;
+      if (sparse) {
+        int m = 0;
+        for (int i = 0; i < n; ++i) {
+          if (g[i] != Dtype(0)) {
+            nonzero[m++] = i;
+          }
+        }
+        if (m < n) {
+          SparseUpdateBlock(param_id, offset, rate, scale, w, g, &nonzero[0], m,
+              &scratch[0]);
+          continue;
+        }
+      }
+      if (scale != Dtype(1)) {
+        for (int i = 0; i < n; ++i) {
+          g[i] *= scale;
+        }
+      }
+      const Dtype local_decay =
+          weight_decay * net_params_weight_decay[param_id];
+      if (local_decay && l1) {
+        for (int i = 0; i < n; ++i) {
+          g[i] += local_decay * ((Dtype(0) < w[i]) - (w[i] < Dtype(0)));
+        }
+      } else if (local_decay) {
+        for (int i = 0; i < n; ++i) {
+          g[i] += local_decay * w[i];
+        }
+      }
+      // reduced precision history is decoded into the scratch blocks, and
+      // encoded back after the update
+      Dtype* h[kMaxHistory];
+      for (int k = 0; k < num_history; ++k) {
+        const int history_id = param_id + k * num_params;
+        if (compact) {
+          h[k] = &scratch[k * kBlockSize];
+          reduced_precision_decode(precision, n,
+              compact_history_data_[history_id], HistoryNonNegative(history_id),
+              offset, h[k]);
+        } else {
+          h[k] = history_data_[history_id] + offset;
+        }
+      }
+      ComputeUpdateBlock(param_id, rate, g, h, n);
+      for (int k = 0; compact && k < num_history; ++k) {
+        const int history_id = param_id + k * num_params;
+        reduced_precision_encode(precision, n, h[k],
+            HistoryNonNegative(history_id), hash_bits(this->iter_, history_id),
+            offset, compact_history_data_[history_id]);
+      }
+      for (int i = 0; i < n; ++i) {
+        w[i] -= g[i];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::SparseUpdateBlock(int param_id, int offset,
+    Dtype rate, Dtype scale, Dtype* w, Dtype* g, const int* nonzero, int m,
+    Dtype* scratch) {
+  if (m == 0) { return; }
+  const int num_params = this->net_->learnable_params().size();
+  const int num_history = history_.size() / num_params;
+  const Dtype weight_decay = this->param_.weight_decay() *
+      this->net_->params_weight_decay()[param_id];
+  const bool l1 = this->param_.regularization_type() == "L1";
+  // the nonzero gradients and their history, gathered
+  Dtype* update = scratch;
+  Dtype* gathered[kMaxHistory];
+  for (int k = 0; k < num_history; ++k) {
+    gathered[k] = scratch + (1 + k) * kBlockSize;
+  }
+  Dtype* h[kMaxHistory];
+  for (int j = 0; j < m; ++j) {
+    const int i = nonzero[j];
+    update[j] = g[i] * scale;
+    if (weight_decay && l1) {
+      update[j] += weight_decay * ((Dtype(0) < w[i]) - (w[i] < Dtype(0)));
+    } else if (weight_decay) {
+      update[j] += weight_decay * w[i];
+    }
+  }
+  for (int k = 0; k < num_history; ++k) {
+    const Dtype* history = history_data_[param_id + k * num_params] + offset;
+    for (int j = 0; j < m; ++j) {
+      gathered[k][j] = history[nonzero[j]];
+    }
+    h[k] = gathered[k];
+  }
+  ComputeUpdateBlock(param_id, rate, update, h, m);
+  for (int k = 0; k < num_history; ++k) {
+    Dtype* history = history_data_[param_id + k * num_params] + offset;
+    for (int j = 0; j < m; ++j) {
+      history[nonzero[j]] = gathered[k][j];
+    }
+  }
+  for (int j = 0; j < m; ++j) {
+    const int i = nonzero[j];
+    g[i] = update[j];
+    w[i] -= update[j];
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::CacheHistoryData(int begin, int end) {
+  // the history of param i is at i, and at i + the number of params, ...
+  const int num_params = this->net_->learnable_params().size();
+  const bool compact = this->param_.history_precision() !=
+      SolverParameter_HistoryPrecision_FULL;
+  InitCompactHistory();
+  history_data_.resize(history_.size());
+  compact_history_data_.resize(history_.size());
+  for (int param_id = begin; param_id < end; ++param_id) {
+    for (int i = param_id; i < history_.size(); i += num_params) {
+      if (compact) {
+        compact_history_data_[i] = compact_history_[i]->mutable_cpu_data();
+      } else {
+        history_data_[i] = history_[i]->mutable_cpu_data();
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::InitCompactHistory() {
+  const ReducedPrecision precision = this->param_.history_precision();
+  if (precision == SolverParameter_HistoryPrecision_FULL ||
+      compact_history_.size() == history_.size()) {
+    return;
+  }
+  // zeros, as the history blobs start
+  compact_history_.clear();
+  for (int i = 0; i < history_.size(); ++i) {
+    compact_history_.push_back(shared_ptr<SyncedMemory>(new SyncedMemory(
+        reduced_precision_size(precision, history_[i]->count()))));
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::CompactHistory(int history_id) {
+  const ReducedPrecision precision = this->param_.history_precision();
+  if (precision == SolverParameter_HistoryPrecision_FULL) { return; }
+  InitCompactHistory();
+  shared_ptr<Blob<Dtype> >& history = history_[history_id];
+  reduced_precision_encode(precision, history->count(), history->cpu_data(),
+      HistoryNonNegative(history_id), hash_bits(this->iter_, history_id), 0,
+      compact_history_[history_id]->mutable_cpu_data());
+  // a new blob frees the memory of the values
+  history.reset(new Blob<Dtype>(history->shape()));
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::RestoreCompactHistory(int history_id,
+    SolverParameter::HistoryPrecision precision, const string& codes) {
+  Blob<Dtype>* history = history_[history_id].get();
+  CHECK_EQ(codes.size(), reduced_precision_size(precision, history->count()))
+      << "Incorrect size of history blob " << history_id << ".";
+  if (precision == this->param_.history_precision()) {
+    InitCompactHistory();
+    memcpy(compact_history_[history_id]->mutable_cpu_data(), codes.data(),
+        codes.size());
+    return;
+  }
+  reduced_precision_decode(precision, history->count(), codes.data(),
+      HistoryNonNegative(history_id), 0, history->mutable_cpu_data());
+  CompactHistory(history_id);
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
   if (this->param_.iter_size() == 1) { return; }
@@ -159,6 +524,10 @@ void SGDSolver<Dtype>::Regularize(int param_id) {
             net_params[param_id]->cpu_data(),
             net_params[param_id]->mutable_cpu_diff());
       } else if (regularization_type == "L1") {
+        if (!temp_[param_id]) {
+          temp_[param_id].reset(
+              new Blob<Dtype>(net_params[param_id]->shape()));
+        }
         caffe_cpu_sign(net_params[param_id]->count(),
             net_params[param_id]->cpu_data(),
             temp_[param_id]->mutable_cpu_data());
@@ -182,6 +551,10 @@ void SGDSolver<Dtype>::Regularize(int param_id) {
             net_params[param_id]->gpu_data(),
             net_params[param_id]->mutable_gpu_diff());
       } else if (regularization_type == "L1") {
+        if (!temp_[param_id]) {
+          temp_[param_id].reset(
+              new Blob<Dtype>(net_params[param_id]->shape()));
+        }
         caffe_gpu_sign(net_params[param_id]->count(),
             net_params[param_id]->gpu_data(),
             temp_[param_id]->mutable_gpu_data());
@@ -203,6 +576,38 @@ void SGDSolver<Dtype>::Regularize(int param_id) {
   }
 }
 
+template <typename Dtype>
+static void sgd_update_cpu(int N, Dtype* g, Dtype* h, Dtype momentum,
+    Dtype local_rate) {
+  for (int i = 0; i < N; ++i) {
+    g[i] = h[i] = momentum * h[i] + local_rate * g[i];
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateBlock(int param_id, Dtype rate, Dtype* g,
+    Dtype** h, int n) {
+  const Dtype momentum = this->param_.momentum();
+  const Dtype local_rate = rate * this->net_->params_lr()[param_id];
+  sgd_update_cpu(n, g, h[0], momentum, local_rate);
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValueCPU(int param_id, Dtype rate) {
+  CHECK_EQ(this->param_.history_precision(),
+      SolverParameter_HistoryPrecision_FULL)
+      << "Reduced precision history is only updated by FusedUpdate.";
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  const int num_params = net_params.size();
+  Dtype* h[kMaxHistory];
+  for (int i = param_id, k = 0; i < history_.size(); i += num_params, ++k) {
+    CHECK_LT(k, kMaxHistory);
+    h[k] = history_[i]->mutable_cpu_data();
+  }
+  ComputeUpdateBlock(param_id, rate, net_params[param_id]->mutable_cpu_diff(),
+      h, net_params[param_id]->count());
+}
+
 #ifndef CPU_ONLY
 template <typename Dtype>
 void sgd_update_gpu(int N, Dtype* g, Dtype* h, Dtype momentum,
@@ -211,34 +616,53 @@ void sgd_update_gpu(int N, Dtype* g, Dtype* h, Dtype momentum,
 
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
+  if (Caffe::mode() == Caffe::CPU) {
+    ComputeUpdateValueCPU(param_id, rate);
+    return;
+  }
+#ifndef CPU_ONLY
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
   const vector<float>& net_params_lr = this->net_->params_lr();
   Dtype momentum = this->param_.momentum();
   Dtype local_rate = rate * net_params_lr[param_id];
   // Compute the update to history, then copy it to the parameter diff.
-  switch (Caffe::mode()) {
-  case Caffe::CPU: {
-    caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-              net_params[param_id]->cpu_diff(), momentum,
-              history_[param_id]->mutable_cpu_data());
-    caffe_copy(net_params[param_id]->count(),
-        history_[param_id]->cpu_data(),
-        net_params[param_id]->mutable_cpu_diff());
-    break;
-  }
-  case Caffe::GPU: {
-#ifndef CPU_ONLY
-    sgd_update_gpu(net_params[param_id]->count(),
-        net_params[param_id]->mutable_gpu_diff(),
-        history_[param_id]->mutable_gpu_data(),
-        momentum, local_rate);
+  sgd_update_gpu(net_params[param_id]->count(),
+      net_params[param_id]->mutable_gpu_diff(),
+      history_[param_id]->mutable_gpu_data(),
+      momentum, local_rate);
 #else
-    NO_GPU;
+  NO_GPU;
 #endif
-    break;
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::StageSnapshot(bool copy) {
+  Solver<Dtype>::StageSnapshot(copy);
+  if (this->param_.history_precision() !=
+      SolverParameter_HistoryPrecision_FULL) {
+    InitCompactHistory();
+    snapshot_compact_history_.resize(compact_history_.size());
+    for (int i = 0; i < compact_history_.size(); ++i) {
+      snapshot_compact_history_[i].assign(
+          static_cast<const char*>(compact_history_[i]->cpu_data()),
+          compact_history_[i]->size());
+    }
+    return;
   }
-  default:
-    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  snapshot_history_.resize(history_.size());
+  staged_history_.resize(copy ? history_.size() : 0);
+  for (int i = 0; i < history_.size(); ++i) {
+    if (!copy) {
+      snapshot_history_[i] = history_[i].get();
+      continue;
+    }
+    if (!staged_history_[i]) {
+      staged_history_[i].reset(new Blob<Dtype>());
+    }
+    staged_history_[i]->ReshapeLike(*history_[i]);
+    caffe_copy(history_[i]->count(), history_[i]->cpu_data(),
+        staged_history_[i]->mutable_cpu_data());
+    snapshot_history_[i] = staged_history_[i].get();
   }
 }
 
@@ -260,19 +684,29 @@ template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
     const string& model_filename) {
   SolverState state;
-  state.set_iter(this->iter_);
+  state.set_iter(this->snapshot_iter_);
   state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
+  state.set_current_step(this->snapshot_current_step_);
   state.clear_history();
-  for (int i = 0; i < history_.size(); ++i) {
-    // Add history
-    BlobProto* history_blob = state.add_history();
-    history_[i]->ToProto(history_blob);
+  const ReducedPrecision precision = this->param_.history_precision();
+  if (precision != SolverParameter_HistoryPrecision_FULL) {
+    state.set_history_precision(precision);
+    for (int i = 0; i < snapshot_compact_history_.size(); ++i) {
+      state.add_compact_history(snapshot_compact_history_[i]);
+    }
+  } else {
+    for (int i = 0; i < snapshot_history_.size(); ++i) {
+      // Add history
+      BlobProto* history_blob = state.add_history();
+      snapshot_history_[i]->ToProto(history_blob);
+    }
   }
   string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
   LOG(INFO)
     << "Snapshotting solver state to binary proto file " << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  WriteProtoToBinaryFile(state,
+      Solver<Dtype>::PartialFilename(snapshot_filename).c_str());
+  Solver<Dtype>::CommitSnapshotFile(snapshot_filename);
 }
 
 template <typename Dtype>
@@ -281,24 +715,39 @@ void SGDSolver<Dtype>::SnapshotSolverStateToHDF5(
   string snapshot_filename =
       Solver<Dtype>::SnapshotFilename(".solverstate.h5");
   LOG(INFO) << "Snapshotting solver state to HDF5 file " << snapshot_filename;
-  hid_t file_hid = H5Fcreate(snapshot_filename.c_str(), H5F_ACC_TRUNC,
-      H5P_DEFAULT, H5P_DEFAULT);
+  hid_t file_hid = H5Fcreate(
+      Solver<Dtype>::PartialFilename(snapshot_filename).c_str(),
+      H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
   CHECK_GE(file_hid, 0)
       << "Couldn't open " << snapshot_filename << " to save solver state.";
-  hdf5_save_int(file_hid, "iter", this->iter_);
+  hdf5_save_int(file_hid, "iter", this->snapshot_iter_);
   hdf5_save_string(file_hid, "learned_net", model_filename);
-  hdf5_save_int(file_hid, "current_step", this->current_step_);
-  hid_t history_hid = H5Gcreate2(file_hid, "history", H5P_DEFAULT, H5P_DEFAULT,
+  hdf5_save_int(file_hid, "current_step", this->snapshot_current_step_);
+  const ReducedPrecision precision = this->param_.history_precision();
+  const bool compact = precision != SolverParameter_HistoryPrecision_FULL;
+  if (compact) {
+    hdf5_save_int(file_hid, "history_precision", precision);
+  }
+  hid_t history_hid = H5Gcreate2(file_hid,
+      compact ? "compact_history" : "history", H5P_DEFAULT, H5P_DEFAULT,
       H5P_DEFAULT);
   CHECK_GE(history_hid, 0)
       << "Error saving solver state to " << snapshot_filename << ".";
-  for (int i = 0; i < history_.size(); ++i) {
+  const int num_history = compact ? snapshot_compact_history_.size()
+      : snapshot_history_.size();
+  for (int i = 0; i < num_history; ++i) {
     ostringstream oss;
     oss << i;
-    hdf5_save_nd_dataset<Dtype>(history_hid, oss.str(), *history_[i]);
+    if (compact) {
+      hdf5_save_bytes(history_hid, oss.str(), snapshot_compact_history_[i]);
+    } else {
+      hdf5_save_nd_dataset<Dtype>(history_hid, oss.str(),
+          *snapshot_history_[i]);
+    }
   }
   H5Gclose(history_hid);
   H5Fclose(file_hid);
+  Solver<Dtype>::CommitSnapshotFile(snapshot_filename);
 }
 
 template <typename Dtype>
@@ -313,11 +762,21 @@ void SGDSolver<Dtype>::RestoreSolverStateFromBinaryProto(
     this->net_->CopyTrainedLayersFrom(net_param);
   }
   this->current_step_ = state.current_step();
+  LOG(INFO) << "SGDSolver: restoring history";
+  if (state.history_precision() != SolverParameter_HistoryPrecision_FULL) {
+    CHECK_EQ(state.compact_history_size(), history_.size())
+        << "Incorrect length of history blobs.";
+    for (int i = 0; i < history_.size(); ++i) {
+      RestoreCompactHistory(i, state.history_precision(),
+          state.compact_history(i));
+    }
+    return;
+  }
   CHECK_EQ(state.history_size(), history_.size())
       << "Incorrect length of history blobs.";
-  LOG(INFO) << "SGDSolver: restoring history";
   for (int i = 0; i < history_.size(); ++i) {
     history_[i]->FromProto(state.history(i));
+    CompactHistory(i);
   }
 }
 
@@ -331,7 +790,14 @@ void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
     this->net_->CopyTrainedLayersFrom(learned_net);
   }
   this->current_step_ = hdf5_load_int(file_hid, "current_step");
-  hid_t history_hid = H5Gopen2(file_hid, "history", H5P_DEFAULT);
+  ReducedPrecision precision = SolverParameter_HistoryPrecision_FULL;
+  if (H5LTfind_dataset(file_hid, "history_precision")) {
+    precision = static_cast<ReducedPrecision>(
+        hdf5_load_int(file_hid, "history_precision"));
+  }
+  const bool compact = precision != SolverParameter_HistoryPrecision_FULL;
+  hid_t history_hid = H5Gopen2(file_hid,
+      compact ? "compact_history" : "history", H5P_DEFAULT);
   CHECK_GE(history_hid, 0) << "Error reading history from " << state_file;
   int state_history_size = hdf5_get_num_links(history_hid);
   CHECK_EQ(state_history_size, history_.size())
@@ -339,8 +805,14 @@ void SGDSolver<Dtype>::RestoreSolverStateFromHDF5(const string& state_file) {
   for (int i = 0; i < history_.size(); ++i) {
     ostringstream oss;
     oss << i;
-    hdf5_load_nd_dataset<Dtype>(history_hid, oss.str().c_str(), 0,
-                                kMaxBlobAxes, history_[i].get());
+    if (compact) {
+      RestoreCompactHistory(i, precision,
+          hdf5_load_bytes(history_hid, oss.str()));
+    } else {
+      hdf5_load_nd_dataset<Dtype>(history_hid, oss.str().c_str(), 0,
+                                  kMaxBlobAxes, history_[i].get());
+      CompactHistory(i);
+    }
   }
   H5Gclose(history_hid);
   H5Fclose(file_hid);
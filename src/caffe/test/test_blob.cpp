@@ -112,6 +112,36 @@ TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   EXPECT_FALSE(this->blob_->ShapeEquals(blob_proto));
 }
 
+TYPED_TEST(BlobSimpleTest, TestDeferredFill) {
+  typedef TypeParam Dtype;
+  FillerParameter filler_param;
+  filler_param.set_type("constant");
+  filler_param.set_value(3);
+  Caffe::set_defer_fill(true);
+  shared_ptr<Filler<Dtype> > filler(GetParamFiller<Dtype>(filler_param));
+  Caffe::set_defer_fill(false);
+  // The values are filled when first read.
+  filler->Fill(this->blob_preshaped_);
+  EXPECT_TRUE(this->blob_preshaped_->fill_deferred());
+  const Dtype* data = this->blob_preshaped_->cpu_data();
+  EXPECT_FALSE(this->blob_preshaped_->fill_deferred());
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    EXPECT_EQ(3, data[i]);
+  }
+  // Values loaded first are kept.
+  BlobProto blob_proto;
+  Blob<Dtype> source(2, 3, 4, 5);
+  caffe_set(source.count(), Dtype(5), source.mutable_cpu_data());
+  source.ToProto(&blob_proto);
+  filler->Fill(this->blob_preshaped_);
+  this->blob_preshaped_->FromProto(blob_proto);
+  EXPECT_FALSE(this->blob_preshaped_->fill_deferred());
+  data = this->blob_preshaped_->cpu_data();
+  for (int i = 0; i < this->blob_preshaped_->count(); ++i) {
+    EXPECT_EQ(5, data[i]);
+  }
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -0,0 +1,221 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "boost/lexical_cast.hpp"
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/solver_factory.hpp"
+#include "caffe/util/collective.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class CollectiveTest : public ::testing::Test {
+ protected:
+  // Sums and broadcasts buffers of a few sizes, some smaller than the number
+  // of ranks and some larger than a broadcast piece, as one rank of a ring.
+  static void RunRank(const string& uri, int rank, int size,
+      vector<int>* errors) {
+    shared_ptr<Collective> collective(GetCollective(uri, rank, size));
+    EXPECT_EQ(rank, collective->rank());
+    EXPECT_EQ(size, collective->size());
+    const int counts[] = { 1, 7, 300007 };
+    for (int c = 0; c < 3; ++c) {
+      const int count = counts[c];
+      vector<Dtype> data(count);
+      for (int i = 0; i < count; ++i) {
+        data[i] = (rank + 1) * (i % 13);
+      }
+      collective->Allreduce(&data[0], count);
+      // 1 + 2 + ... + size
+      const Dtype scale = size * (size + 1) / 2;
+      for (int i = 0; i < count; ++i) {
+        if (data[i] != scale * (i % 13)) { ++(*errors)[rank]; }
+      }
+      for (int i = 0; i < count; ++i) {
+        data[i] = rank == 0 ? i % 101 : -1;
+      }
+      collective->Broadcast(&data[0], count);
+      for (int i = 0; i < count; ++i) {
+        if (data[i] != i % 101) { ++(*errors)[rank]; }
+      }
+    }
+    collective->Barrier();
+  }
+
+  // Runs every rank on its own thread.
+  void RunRanks(const string& uri, int size) {
+    vector<int> errors(size, 0);
+    boost::thread_group ranks;
+    for (int rank = 0; rank < size; ++rank) {
+      ranks.create_thread(boost::bind(&CollectiveTest::RunRank, uri, rank,
+          size, &errors));
+    }
+    ranks.join_all();
+    for (int rank = 0; rank < size; ++rank) {
+      EXPECT_EQ(0, errors[rank]) << "rank " << rank;
+    }
+  }
+
+  // The least squares problem of the solver tests, on batches of batch_size.
+  static SolverParameter LeastSquaresSolver(int batch_size) {
+    SolverParameter param;
+    const string proto =
+        "max_iter: 10 "
+        "base_lr: 0.01 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "weight_decay: 0.004 "
+        "snapshot_after_train: false "
+        "solver_mode: CPU "
+        "net_param { "
+        "  name: 'TestNetwork' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'HDF5Data' "
+        "    hdf5_data_param { "
+        "      source: '" CMAKE_SOURCE_DIR
+        "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT "' "
+        "      batch_size: " + boost::lexical_cast<string>(batch_size) + " "
+        "    } "
+        "    top: 'data' "
+        "    top: 'targets' "
+        "  } "
+        "  layer { "
+        "    name: 'innerprod' "
+        "    type: 'InnerProduct' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "      weight_filler { type: 'gaussian' std: 1.0 } "
+        "      bias_filler { type: 'gaussian' std: 1.0 } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'innerprod' "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'innerprod' "
+        "    bottom: 'targets' "
+        "  } "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    return param;
+  }
+
+  static SolverAction::Enum StopAt(Solver<Dtype>* solver, int iter) {
+    return solver->iter() >= iter ? SolverAction::STOP : SolverAction::NONE;
+  }
+
+  // Trains as one rank of a CollectiveSync, from weights of its own that the
+  // broadcast of rank 0 replaces. Rank 0 stops after stop_iter iterations
+  // if it is positive.
+  static void RunSolverRank(const SolverParameter& param, const string& uri,
+      int rank, int size, int stop_iter, shared_ptr<Solver<Dtype> >* solver) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(size);
+    Caffe::set_solver_rank(rank);
+    Caffe::set_multiprocess(true);
+    Caffe::set_random_seed(1701 + rank);
+    solver->reset(SolverRegistry<Dtype>::CreateSolver(param));
+    if (rank == 0 && stop_iter > 0) {
+      (*solver)->SetActionFunction(
+          boost::bind(&CollectiveTest::StopAt, solver->get(), stop_iter));
+    }
+    shared_ptr<Collective> collective(GetCollective(uri, rank, size));
+    CollectiveSync<Dtype> sync(*solver, collective);
+    sync.Run();
+  }
+
+  // Trains every rank on its own thread, each on its share of the batches.
+  void RunSolverRanks(const string& uri, int size, int stop_iter,
+      vector<shared_ptr<Solver<Dtype> > >* solvers) {
+    const SolverParameter param = LeastSquaresSolver(2);
+    solvers->resize(size);
+    boost::thread_group ranks;
+    for (int rank = 0; rank < size; ++rank) {
+      ranks.create_thread(boost::bind(&CollectiveTest::RunSolverRank, param,
+          uri, rank, size, stop_iter, &(*solvers)[rank]));
+    }
+    ranks.join_all();
+  }
+
+  void ExpectSameParams(Solver<Dtype>* expected, Solver<Dtype>* actual) {
+    const vector<Blob<Dtype>*>& expected_params =
+        expected->net()->learnable_params();
+    const vector<Blob<Dtype>*>& params = actual->net()->learnable_params();
+    ASSERT_EQ(expected_params.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        const Dtype value = expected_params[i]->cpu_data()[j];
+        EXPECT_NEAR(value, params[i]->cpu_data()[j],
+            1e-5 + 1e-5 * std::fabs(value))
+            << "param " << i << " differed at dim " << j;
+      }
+    }
+  }
+
+  string UniqueName() const {
+    return "caffe_test_" + boost::lexical_cast<string>(getpid());
+  }
+
+  string LocalAddress(int offset) const {
+    return "127.0.0.1:" + boost::lexical_cast<string>(
+        20000 + (getpid() % 2000) * 10 + offset);
+  }
+};
+
+TYPED_TEST_CASE(CollectiveTest, TestDtypes);
+
+TYPED_TEST(CollectiveTest, TestSingleRank) {
+  this->RunRanks("shm://" + this->UniqueName(), 1);
+}
+
+TYPED_TEST(CollectiveTest, TestShm) {
+  this->RunRanks("shm://" + this->UniqueName(), 3);
+}
+
+TYPED_TEST(CollectiveTest, TestTCP) {
+  this->RunRanks("tcp://" + this->LocalAddress(0), 3);
+}
+
+TYPED_TEST(CollectiveTest, TestTCPAddresses) {
+  this->RunRanks("tcp://" + this->LocalAddress(5) + "," +
+      this->LocalAddress(3), 2);
+}
+
+TYPED_TEST(CollectiveTest, TestSyncMatchesCombinedBatch) {
+  // the two ranks take every other example, so the mean of their gradients
+  // is that of one solver on both their batches
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_random_seed(1701);
+  shared_ptr<Solver<TypeParam> > serial(SolverRegistry<TypeParam>::
+      CreateSolver(this->LeastSquaresSolver(4)));
+  serial->Solve();
+  vector<shared_ptr<Solver<TypeParam> > > solvers;
+  this->RunSolverRanks("shm://" + this->UniqueName(), 2, 0, &solvers);
+  for (int rank = 0; rank < 2; ++rank) {
+    EXPECT_EQ(serial->iter(), solvers[rank]->iter()) << "rank " << rank;
+    this->ExpectSameParams(serial.get(), solvers[rank].get());
+  }
+}
+
+TYPED_TEST(CollectiveTest, TestSyncEarlyStop) {
+  // rank 1 stops with rank 0, without an update of its own
+  vector<shared_ptr<Solver<TypeParam> > > solvers;
+  this->RunSolverRanks("shm://" + this->UniqueName(), 2, 3, &solvers);
+  EXPECT_EQ(3, solvers[0]->iter());
+  EXPECT_LT(solvers[1]->iter(), solvers[1]->param().max_iter());
+  this->ExpectSameParams(solvers[0].get(), solvers[1].get());
+}
+
+}  // namespace caffe
@@ -12,6 +12,7 @@
 #endif
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_epilogue_util.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
 namespace caffe {
@@ -811,6 +812,88 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestEpilogue) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> plain_layer(layer_param);
+  plain_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  plain_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // relu(conv(x) + residual) with the same weights
+  Blob<Dtype> residual(this->blob_top_->shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&residual);
+  EpilogueParameter* epilogue_param = layer_param.mutable_epilogue_param();
+  epilogue_param->set_sum(true);
+  epilogue_param->set_relu(true);
+  epilogue_param->set_negative_slope(0.25);
+  ConvolutionLayer<Dtype> layer(layer_param);
+  this->blob_bottom_vec_.push_back(&residual);
+  this->blob_top_vec_[0] = this->blob_top_2_;
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.blobs()[0]->CopyFrom(*plain_layer.blobs()[0]);
+  layer.blobs()[1]->CopyFrom(*plain_layer.blobs()[1]);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ASSERT_EQ(this->blob_top_->count(), this->blob_top_2_->count());
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    Dtype expected = this->blob_top_->cpu_data()[i] + residual.cpu_data()[i];
+    if (expected < 0) { expected *= 0.25; }
+    EXPECT_NEAR(expected, this->blob_top_2_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestEpilogueReLUMatchesUnfused) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  layer_param.mutable_epilogue_param()->set_relu(true);
+  CheckEpilogueMatchesUnfused<ConvolutionLayer>(layer_param,
+      *this->blob_bottom_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestEpilogueResidualMatchesUnfused) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  layer_param.mutable_epilogue_param()->set_sum(true);
+  CheckEpilogueMatchesUnfused<ConvolutionLayer>(layer_param,
+      *this->blob_bottom_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestEpilogueResidualReLUMatchesUnfused) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  EpilogueParameter* epilogue_param = layer_param.mutable_epilogue_param();
+  epilogue_param->set_sum(true);
+  epilogue_param->set_relu(true);
+  epilogue_param->set_negative_slope(0.1);
+  CheckEpilogueMatchesUnfused<ConvolutionLayer>(layer_param,
+      *this->blob_bottom_);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/epilogue.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class FuseEpiloguesTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // conv -> ReLU in place, a residual block with a 1x1 shortcut and a ReLU
+  // with a new top, and an InnerProduct -> ReLU in place before the loss.
+  virtual void SetUp() {
+    const string proto =
+        "name: 'EpilogueNetwork' "
+        "force_backward: true "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape: { dim: 2 dim: 3 dim: 5 dim: 4 } } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'conv2a' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2a' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv2b' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2b' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv2a' "
+        "  bottom: 'conv2b' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'sum' "
+        "  top: 'relu2' "
+        "  relu_param { negative_slope: 0.1 } "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'relu2' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu3' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip' "
+        "  top: 'ip' "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'Reduction' "
+        "  bottom: 'ip' "
+        "  top: 'loss' "
+        "  reduction_param { operation: SUMSQ } "
+        "  loss_weight: 1 "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+  }
+
+  // Checks that the net with fused epilogues computes the same loss and
+  // gradients as the net as written, given the same weights and input.
+  void CheckSameAsUnfused() {
+    Net<Dtype> net(param_);
+    NetParameter fused_param(param_);
+    fused_param.set_fuse_epilogues(true);
+    Net<Dtype> fused_net(fused_param);
+    NetParameter weights;
+    net.ToProto(&weights);
+    fused_net.CopyTrainedLayersFrom(weights);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(net.input_blobs()[0]);
+    fused_net.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+    const Dtype loss = net.ForwardBackward();
+    const Dtype fused_loss = fused_net.ForwardBackward();
+    EXPECT_NEAR(loss, fused_loss, 1e-4 * std::max(Dtype(1), loss));
+    const vector<string>& names = fused_net.layer_names();
+    for (int i = 0; i < names.size(); ++i) {
+      // the split layers are named after the blobs they split
+      if (fused_net.layers()[i]->blobs().empty()) { continue; }
+      const vector<shared_ptr<Blob<Dtype> > >& blobs =
+          net.layer_by_name(names[i])->blobs();
+      const vector<shared_ptr<Blob<Dtype> > >& fused_blobs =
+          fused_net.layers()[i]->blobs();
+      ASSERT_EQ(blobs.size(), fused_blobs.size());
+      for (int j = 0; j < blobs.size(); ++j) {
+        for (int k = 0; k < blobs[j]->count(); ++k) {
+          EXPECT_NEAR(blobs[j]->cpu_diff()[k], fused_blobs[j]->cpu_diff()[k],
+              1e-4 * std::max(Dtype(1), std::fabs(blobs[j]->cpu_diff()[k])));
+        }
+      }
+    }
+    const Blob<Dtype>* input = net.input_blobs()[0];
+    const Blob<Dtype>* fused_input = fused_net.input_blobs()[0];
+    for (int k = 0; k < input->count(); ++k) {
+      EXPECT_NEAR(input->cpu_diff()[k], fused_input->cpu_diff()[k], 1e-4);
+    }
+  }
+
+  NetParameter param_;
+};
+
+TYPED_TEST_CASE(FuseEpiloguesTest, TestDtypesAndDevices);
+
+TYPED_TEST(FuseEpiloguesTest, TestFuse) {
+  NetParameter fused_param;
+  EXPECT_EQ(4, FuseEpilogues(this->param_, &fused_param));
+  ASSERT_EQ(this->param_.layer_size() - 4, fused_param.layer_size());
+  const LayerParameter& conv1 = fused_param.layer(1);
+  EXPECT_EQ("conv1", conv1.name());
+  EXPECT_TRUE(conv1.epilogue_param().relu());
+  EXPECT_FALSE(conv1.epilogue_param().sum());
+  // the main branch moves after the shortcut, which it adds
+  const LayerParameter& conv2a = fused_param.layer(3);
+  EXPECT_EQ("conv2a", conv2a.name());
+  ASSERT_EQ(2, conv2a.bottom_size());
+  EXPECT_EQ("conv2b", conv2a.bottom(1));
+  EXPECT_EQ("relu2", conv2a.top(0));
+  EXPECT_TRUE(conv2a.epilogue_param().sum());
+  EXPECT_TRUE(conv2a.epilogue_param().relu());
+  EXPECT_FLOAT_EQ(0.1, conv2a.epilogue_param().negative_slope());
+  EXPECT_EQ("ip", fused_param.layer(4).name());
+  EXPECT_TRUE(fused_param.layer(4).epilogue_param().relu());
+  this->CheckSameAsUnfused();
+}
+
+TYPED_TEST(FuseEpiloguesTest, TestFuseShortcutWhenBranchIsRead) {
+  // the main branch output is also read elsewhere, so the shortcut conv
+  // takes the sum with the main branch as its residual instead
+  LayerParameter* tap = this->param_.add_layer();
+  tap->set_name("tap");
+  tap->set_type("Reduction");
+  tap->add_bottom("conv2a");
+  tap->add_top("tap");
+  tap->add_loss_weight(1);
+  NetParameter fused_param;
+  EXPECT_EQ(4, FuseEpilogues(this->param_, &fused_param));
+  const LayerParameter& conv2b = fused_param.layer(3);
+  EXPECT_EQ("conv2b", conv2b.name());
+  ASSERT_EQ(2, conv2b.bottom_size());
+  EXPECT_EQ("conv2a", conv2b.bottom(1));
+  EXPECT_TRUE(conv2b.epilogue_param().sum());
+  EXPECT_FALSE(fused_param.layer(2).has_epilogue_param());
+  this->CheckSameAsUnfused();
+}
+
+TYPED_TEST(FuseEpiloguesTest, TestNoFuseWeightedSum) {
+  // only a plain sum is an epilogue, so the residual block stays as it is
+  EltwiseParameter* eltwise_param =
+      this->param_.mutable_layer(5)->mutable_eltwise_param();
+  eltwise_param->add_coeff(1);
+  eltwise_param->add_coeff(-1);
+  NetParameter fused_param;
+  EXPECT_EQ(2, FuseEpilogues(this->param_, &fused_param));
+  ASSERT_EQ(this->param_.layer_size() - 2, fused_param.layer_size());
+  EXPECT_EQ("sum", fused_param.layer(4).name());
+  EXPECT_EQ("relu2", fused_param.layer(5).name());
+  EXPECT_FALSE(fused_param.layer(2).has_epilogue_param());
+  EXPECT_FALSE(fused_param.layer(3).has_epilogue_param());
+  this->CheckSameAsUnfused();
+}
+
+}  // namespace caffe
@@ -0,0 +1,173 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class FoldBatchNormTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // conv -> BatchNorm -> Scale, all in-place, and an InnerProduct without
+  // bias followed by a BatchNorm with a new top and no Scale.
+  virtual void SetUp() {
+    const string proto =
+        "name: 'FoldNetwork' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  input_param { shape: { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "    bias_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv_bn' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "} "
+        "layer { "
+        "  name: 'conv_scale' "
+        "  type: 'Scale' "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "  scale_param { "
+        "    bias_term: true "
+        "    filler { type: 'gaussian' std: 1 } "
+        "    bias_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv' "
+        "  top: 'conv' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'conv' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 5 "
+        "    bias_term: false "
+        "    weight_filler { type: 'gaussian' std: 0.3 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'ip_bn' "
+        "  type: 'BatchNorm' "
+        "  bottom: 'ip' "
+        "  top: 'ip_bn' "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    param_.mutable_state()->set_phase(TEST);
+    net_.reset(new Net<Dtype>(param_));
+    // made-up statistics, stored scaled like BatchNormLayer does
+    FillerParameter filler_param;
+    filler_param.set_min(0.5);
+    filler_param.set_max(2);
+    UniformFiller<Dtype> filler(filler_param);
+    GaussianFiller<Dtype> mean_filler((FillerParameter()));
+    const char* bn_names[] = { "conv_bn", "ip_bn" };
+    for (int i = 0; i < 2; ++i) {
+      Layer<Dtype>* bn = net_->layer_by_name(bn_names[i]).get();
+      mean_filler.Fill(bn->blobs()[0].get());
+      filler.Fill(bn->blobs()[1].get());
+      caffe_scal(bn->blobs()[0]->count(), Dtype(3),
+          bn->blobs()[0]->mutable_cpu_data());
+      caffe_scal(bn->blobs()[1]->count(), Dtype(3),
+          bn->blobs()[1]->mutable_cpu_data());
+      bn->blobs()[2]->mutable_cpu_data()[0] = 3;
+    }
+    filler.Fill(net_->input_blobs()[0]);
+  }
+
+  NetParameter param_;
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(FoldBatchNormTest, TestDtypesAndDevices);
+
+TYPED_TEST(FoldBatchNormTest, TestFold) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->net_->Forward();
+  const Blob<Dtype>* output = this->net_->output_blobs()[0];
+
+  NetParameter weights, folded_param, folded_weights;
+  this->net_->ToProto(&weights);
+  const int num_folded = FoldBatchNorm(this->param_, weights, &folded_param,
+      &folded_weights);
+  EXPECT_EQ(3, num_folded);
+  EXPECT_EQ(this->param_.layer_size() - 3, folded_param.layer_size());
+  for (int i = 0; i < folded_param.layer_size(); ++i) {
+    EXPECT_NE("BatchNorm", folded_param.layer(i).type());
+    EXPECT_NE("Scale", folded_param.layer(i).type());
+    EXPECT_EQ(0, folded_param.layer(i).blobs_size());
+  }
+  EXPECT_TRUE(folded_param.layer(3).inner_product_param().bias_term());
+  EXPECT_EQ("ip_bn", folded_param.layer(3).top(0));
+
+  Net<Dtype> folded_net(folded_param);
+  folded_net.CopyTrainedLayersFrom(folded_weights);
+  folded_net.input_blobs()[0]->CopyFrom(*this->net_->input_blobs()[0]);
+  folded_net.Forward();
+  const Blob<Dtype>* folded_output = folded_net.output_blobs()[0];
+  ASSERT_EQ(output->shape(), folded_output->shape());
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_NEAR(output->cpu_data()[i], folded_output->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(FoldBatchNormTest, TestNoFoldWhenShared) {
+  // the pre-BatchNorm activation is also read elsewhere: leave it alone
+  LayerParameter* tap = this->param_.add_layer();
+  tap->set_name("tap");
+  tap->set_type("Flatten");
+  tap->add_bottom("ip");
+  tap->add_top("ip_flat");
+  NetParameter weights, folded_param;
+  this->net_->ToProto(&weights);
+  const int num_folded = FoldBatchNorm(this->param_, weights, &folded_param,
+      NULL);
+  EXPECT_EQ(2, num_folded);
+  EXPECT_EQ("BatchNorm", folded_param.layer(4).type());
+}
+
+TYPED_TEST(FoldBatchNormTest, TestNoFoldInTrainPhase) {
+  // in the TRAIN phase BatchNorm uses the batch statistics, unless it is
+  // told to use the global ones
+  this->param_.mutable_state()->set_phase(TRAIN);
+  NetParameter weights, folded_param;
+  this->net_->ToProto(&weights);
+  EXPECT_EQ(0, FoldBatchNorm(this->param_, weights, &folded_param, NULL));
+  this->param_.mutable_layer(6)->mutable_batch_norm_param()->
+      set_use_global_stats(true);
+  EXPECT_EQ(1, FoldBatchNorm(this->param_, weights, &folded_param, NULL));
+  EXPECT_EQ("BatchNorm", folded_param.layer(2).type());
+}
+
+}  // namespace caffe
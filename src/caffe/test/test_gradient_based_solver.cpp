@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,7 +27,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      share_(false) {
+      share_(false), batch_norm_(false), overlap_(false), clip_gradients_(-1),
+      history_precision_("FULL"), snapshot_in_background_(false) {
         input_file_ = new string(
         CMAKE_SOURCE_DIR "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT);
       }
@@ -39,11 +41,18 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
 #ifdef USE_NCCL
   shared_ptr<NCCL<Dtype> > nccl_;
 #endif
+  shared_ptr<CPUSync<Dtype> > cpu_sync_;
   int seed_;
   // Dimensions are determined by generate_sample_data.py
   // TODO this is brittle and the hdf5 file should be checked instead.
   int num_, channels_, height_, width_;
   bool share_;
+  // Whether the data goes through a BatchNorm layer first
+  bool batch_norm_;
+  bool overlap_;
+  Dtype clip_gradients_;
+  string history_precision_;
+  bool snapshot_in_background_;
   Dtype delta_;  // Stability constant for RMSProp, AdaGrad, AdaDelta and Adam
 
   // Test data: check out generate_sample_data.py in the same directory.
@@ -88,6 +97,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "iter_size: " << iter_size << " "
        "device_id: " << device_id << " "
        "layer_wise_reduce: " << (!share_) << " "
+       "overlap_update: " << overlap_ << " "
+       "clip_gradients: " << clip_gradients_ << " "
+       "history_precision: " << history_precision_ << " "
+       "snapshot_in_background: " << snapshot_in_background_ << " "
        "net_param { "
        "  name: 'TestNetwork' "
        "  layer { "
@@ -113,6 +126,15 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
          "    } "
          "  } ";
     }
+    if (batch_norm_) {
+      proto <<
+         "  layer { "
+         "    name: 'bn' "
+         "    type: 'BatchNorm' "
+         "    bottom: 'data' "
+         "    top: 'normed' "
+         "  } ";
+    }
     proto <<
        "  layer { "
        "    name: 'innerprod' "
@@ -130,7 +152,8 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
        "        std: 1.0 "
        "      } "
        "    } "
-       "    bottom: '" << string(share_ ? "data1": "data") << "' "
+       "    bottom: '" << string(share_ ? "data1" :
+                             (batch_norm_ ? "normed" : "data")) << "' "
        "    top: '" << string(share_ ? "innerprod1": "innerprod") << "' "
        "  } ";
     if (share_) {
@@ -194,6 +217,12 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
     if (devices == 1) {
       this->solver_->Solve();
+    } else if (Caffe::mode() == Caffe::CPU) {
+      LOG(INFO) << "Multi-thread test on " << devices << " threads";
+      Caffe::set_solver_count(devices);
+      this->cpu_sync_.reset(new CPUSync<Dtype>(this->solver_));
+      this->cpu_sync_->Run(devices);
+      Caffe::set_solver_count(1);
     } else {
       LOG(INFO) << "Multi-GPU test on " << devices << " devices";
       vector<int> gpus;
@@ -461,6 +490,10 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     const int kIterSize = 1;
     // Test over all numbers of devices.
     int available_devices = 1;
+    if (Caffe::mode() == Caffe::CPU) {
+      // replicas on threads
+      available_devices = 2;
+    }
 #ifdef USE_NCCL
     if (Caffe::mode() == Caffe::GPU) {
       CUDA_CHECK(cudaGetDeviceCount(&available_devices));
@@ -507,6 +540,160 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Test that clipping scales the gradient down to the given L2 norm: the
+  // step of an iteration without momentum or weight decay is clipped to half
+  // its length.
+  void TestClipGradients(const Dtype learning_rate) {
+    vector<shared_ptr<Blob<Dtype> > > initial, unclipped;
+    RunLeastSquaresSolver(learning_rate, 0, 0, 0);
+    CopyParams(&initial);
+    RunLeastSquaresSolver(learning_rate, 0, 0, 1);
+    CopyParams(&unclipped);
+    Dtype sumsq = 0;
+    for (int i = 0; i < initial.size(); ++i) {
+      for (int j = 0; j < initial[i]->count(); ++j) {
+        const Dtype step =
+            initial[i]->cpu_data()[j] - unclipped[i]->cpu_data()[j];
+        sumsq += step * step;
+      }
+    }
+    clip_gradients_ = std::sqrt(sumsq) / learning_rate / 2;
+    RunLeastSquaresSolver(learning_rate, 0, 0, 1);
+    clip_gradients_ = -1;
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    ASSERT_EQ(initial.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        const Dtype step =
+            initial[i]->cpu_data()[j] - unclipped[i]->cpu_data()[j];
+        const Dtype clipped_step =
+            initial[i]->cpu_data()[j] - params[i]->cpu_data()[j];
+        EXPECT_NEAR(step / 2, clipped_step, 1e-4 * std::fabs(step) + 1e-6)
+            << "param " << i << " differed at dim " << j;
+      }
+    }
+  }
+
+  void CopyParams(vector<shared_ptr<Blob<Dtype> > >* copies) {
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    copies->clear();
+    for (int i = 0; i < params.size(); ++i) {
+      copies->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      (*copies)[i]->CopyFrom(*params[i], false, true);
+    }
+  }
+
+  // Test that updating the params during the backward pass (overlap_update)
+  // gives exactly the params and history of updating them after it.
+  void TestOverlapUpdate(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters, const int iter_size) {
+    const int kDevices = 1;
+    overlap_ = false;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, kDevices);
+    vector<shared_ptr<Blob<Dtype> > > param_copies;
+    CopyParams(&param_copies);
+    vector<shared_ptr<Blob<Dtype> > > history_copies;
+    const vector<shared_ptr<Blob<Dtype> > >& orig_history = solver_->history();
+    for (int i = 0; i < orig_history.size(); ++i) {
+      history_copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      history_copies[i]->CopyFrom(*orig_history[i], false, true);
+    }
+
+    overlap_ = true;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        iter_size, kDevices);
+    overlap_ = false;
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    ASSERT_EQ(param_copies.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(param_copies[i]->cpu_data()[j], params[i]->cpu_data()[j])
+            << "param " << i << " data differed at dim " << j;
+      }
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& history = solver_->history();
+    ASSERT_EQ(history_copies.size(), history.size());
+    for (int i = 0; i < history.size(); ++i) {
+      for (int j = 0; j < history[i]->count(); ++j) {
+        EXPECT_EQ(history_copies[i]->cpu_data()[j], history[i]->cpu_data()[j])
+            << "history blob " << i << " data differed at dim " << j;
+      }
+    }
+    // the net no longer calls the solver once the solver is gone
+    shared_ptr<Net<Dtype> > net = solver_->net();
+    EXPECT_EQ(1, net->after_backward().size());
+    solver_.reset();
+    EXPECT_EQ(0, net->after_backward().size());
+    net->ForwardBackward();
+  }
+
+  // Test that the replicas on threads keep the running statistics of
+  // BatchNorm as one solver would with their batches together: the mean of
+  // the data, and the count, do not depend on the weights.
+  void TestBatchNormThreads(const int num_iters) {
+    const int kNum = num_;
+    const int kDevices = 2;
+    batch_norm_ = true;
+    num_ = kNum * kDevices;
+    RunLeastSquaresSolver(1.0, 0, 0, num_iters);
+    vector<shared_ptr<Blob<Dtype> > > expected;
+    const vector<shared_ptr<Blob<Dtype> > >& serial_stats =
+        solver_->net()->layer_by_name("bn")->blobs();
+    for (int i = 0; i < serial_stats.size(); ++i) {
+      expected.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      expected[i]->CopyFrom(*serial_stats[i], false, true);
+    }
+    num_ = kNum;
+    RunLeastSquaresSolver(1.0, 0, 0, num_iters, 1, kDevices);
+    batch_norm_ = false;
+    const vector<shared_ptr<Blob<Dtype> > >& stats =
+        solver_->net()->layer_by_name("bn")->blobs();
+    ASSERT_EQ(3, stats.size());
+    // the variance is corrected by the batch size, so differs
+    const int kCompared[] = {0, 2};
+    for (int k = 0; k < 2; ++k) {
+      const int i = kCompared[k];
+      for (int j = 0; j < stats[i]->count(); ++j) {
+        const Dtype e = expected[i]->cpu_data()[j];
+        EXPECT_NEAR(e, stats[i]->cpu_data()[j], 1e-4 * std::fabs(e) + 1e-5)
+            << "statistic " << i << " differed at dim " << j;
+      }
+    }
+  }
+
+  // Test that keeping the history in reduced precision changes the steps
+  // the params take by no more than a tolerance relative to the longest one.
+  void TestReducedPrecisionHistory(const char* precision,
+      const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters, const Dtype tolerance) {
+    vector<shared_ptr<Blob<Dtype> > > initial, full;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, 0);
+    CopyParams(&initial);
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    CopyParams(&full);
+    history_precision_ = precision;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters);
+    history_precision_ = "FULL";
+    Dtype max_step = 0;
+    for (int i = 0; i < initial.size(); ++i) {
+      for (int j = 0; j < initial[i]->count(); ++j) {
+        max_step = std::max(max_step,
+            std::fabs(initial[i]->cpu_data()[j] - full[i]->cpu_data()[j]));
+      }
+    }
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    ASSERT_EQ(initial.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_NEAR(initial[i]->cpu_data()[j] - full[i]->cpu_data()[j],
+            initial[i]->cpu_data()[j] - params[i]->cpu_data()[j],
+            tolerance * max_step)
+            << precision << " param " << i << " differed at dim " << j;
+      }
+    }
+  }
+
   void TestSnapshot(const Dtype learning_rate = 1.0,
       const Dtype weight_decay = 0.0, const Dtype momentum = 0.0,
       const int num_iters = 1) {
@@ -547,6 +734,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     snapshot = true;
     string snapshot_name = RunLeastSquaresSolver(learning_rate, weight_decay,
         momentum, num_iters, kIterSize, kDevices, snapshot);
+    // The snapshot is complete, under its own name.
+    EXPECT_TRUE(std::ifstream(snapshot_name.c_str()).good());
+    EXPECT_FALSE(std::ifstream((snapshot_name + ".partial").c_str()).good());
 
     // Reinitialize the solver and run for num_iters more iterations.
     snapshot = false;
@@ -691,6 +881,12 @@ TYPED_TEST(SGDSolverTest, TestLeastSquaresUpdateWithEverythingAccumShare) {
       kIterSize);
 }
 
+TYPED_TEST(SGDSolverTest, TestClipGradients) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  this->TestClipGradients(kLearningRate);
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshot) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -702,6 +898,18 @@ TYPED_TEST(SGDSolverTest, TestSnapshot) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestSnapshotInBackground) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_in_background_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+}
+
 TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   typedef typename TypeParam::Dtype Dtype;
   const Dtype kLearningRate = 0.01;
@@ -714,6 +922,24 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestBatchNormThreads) {
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const int kNumIters = 3;
+  this->TestBatchNormThreads(kNumIters);
+}
+
+TYPED_TEST(SGDSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -814,6 +1040,18 @@ TYPED_TEST(AdaGradSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -948,6 +1186,18 @@ TYPED_TEST(NesterovSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
 template <typename TypeParam>
 class AdaDeltaSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1077,6 +1327,51 @@ TYPED_TEST(AdaDeltaSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdaDeltaSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(AdaDeltaSolverTest, TestReducedPrecisionHistory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // only kept on the CPU
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  // not FP16, whose range the squared updates that AdaDelta averages fall
+  // below
+  this->TestReducedPrecisionHistory("BF16", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 2e-2);
+  this->TestReducedPrecisionHistory("INT8", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 1e-1);
+}
+
+TYPED_TEST(AdaDeltaSolverTest, TestSnapshotReducedPrecision) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.95;
+  const int kNumIters = 4;
+  const char* precisions[] = { "FP16", "BF16", "INT8" };
+  for (int p = 0; p < 3; ++p) {
+    this->history_precision_ = precisions[p];
+    for (int i = 1; i <= kNumIters; ++i) {
+      this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+    }
+  }
+  this->history_precision_ = "FULL";
+}
+
 template <typename TypeParam>
 class AdamSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1179,6 +1474,72 @@ TYPED_TEST(AdamSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdamSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(AdamSolverTest, TestReducedPrecisionHistory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // only kept on the CPU
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->TestReducedPrecisionHistory("FP16", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 1e-2);
+  this->TestReducedPrecisionHistory("BF16", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 2e-2);
+  this->TestReducedPrecisionHistory("INT8", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 1e-1);
+}
+
+TYPED_TEST(AdamSolverTest, TestSnapshotReducedPrecision) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  const char* precisions[] = { "FP16", "BF16", "INT8" };
+  for (int p = 0; p < 3; ++p) {
+    this->history_precision_ = precisions[p];
+    for (int i = 1; i <= kNumIters; ++i) {
+      this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+    }
+  }
+  this->history_precision_ = "FULL";
+}
+
+TYPED_TEST(AdamSolverTest, TestSnapshotInBackground) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->snapshot_in_background_ = true;
+  for (int i = 1; i <= kNumIters; ++i) {
+    this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+  }
+  // and the copy of a history kept in reduced precision
+  if (Caffe::mode() == Caffe::CPU) {
+    this->history_precision_ = "INT8";
+    for (int i = 1; i <= kNumIters; ++i) {
+      this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+    }
+    this->history_precision_ = "FULL";
+  }
+  this->snapshot_in_background_ = false;
+}
+
 template <typename TypeParam>
 class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1282,4 +1643,49 @@ TYPED_TEST(RMSPropSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(RMSPropSolverTest, TestOverlapUpdateShare) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const int kIterSize = 2;
+  this->share_ = true;
+  this->TestOverlapUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters,
+      kIterSize);
+}
+
+TYPED_TEST(RMSPropSolverTest, TestReducedPrecisionHistory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // only kept on the CPU
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->TestReducedPrecisionHistory("FP16", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 1e-2);
+  this->TestReducedPrecisionHistory("BF16", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 2e-2);
+  this->TestReducedPrecisionHistory("INT8", kLearningRate, kWeightDecay,
+      kMomentum, kNumIters, 1e-1);
+}
+
+TYPED_TEST(RMSPropSolverTest, TestSnapshotReducedPrecision) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) { return; }
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  const char* precisions[] = { "FP16", "BF16", "INT8" };
+  for (int p = 0; p < 3; ++p) {
+    this->history_precision_ = precisions[p];
+    for (int i = 1; i <= kNumIters; ++i) {
+      this->TestSnapshot(kLearningRate, kWeightDecay, kMomentum, i);
+    }
+  }
+  this->history_precision_ = "FULL";
+}
+
 }  // namespace caffe
@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/solver_factory.hpp"
+#include "caffe/util/hdf5.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class HogwildTest : public ::testing::Test {
+ protected:
+  HogwildTest()
+      : num_features_(1000), num_examples_(2048), num_active_(4),
+        data_(new Blob<Dtype>(num_examples_, num_active_, 1, 1)),
+        targets_(new Blob<Dtype>(num_examples_, 1, 1, 1)) {}
+
+  // A sparse linear regression: every example has a few of many features,
+  // and its target is the sum of their weights.
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_random_seed(1701);
+    weights_.resize(num_features_);
+    caffe_rng_gaussian<Dtype>(num_features_, 0, 1, &weights_[0]);
+    vector<Dtype> features(data_->count());
+    caffe_rng_uniform<Dtype>(data_->count(), 0, num_features_, &features[0]);
+    Dtype* data = data_->mutable_cpu_data();
+    Dtype* targets = targets_->mutable_cpu_data();
+    for (int n = 0; n < num_examples_; ++n) {
+      targets[n] = 0;
+      for (int k = 0; k < num_active_; ++k) {
+        const int i = n * num_active_ + k;
+        data[i] = std::min(static_cast<int>(features[i]), num_features_ - 1);
+        targets[n] += weights_[static_cast<int>(data[i])];
+      }
+    }
+    MakeTempFilename(&data_file_);
+    hid_t file_id = H5Fcreate(data_file_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    ASSERT_GE(file_id, 0) << "Failed to create " << data_file_;
+    hdf5_save_nd_dataset(file_id, "data", *data_);
+    hdf5_save_nd_dataset(file_id, "targets", *targets_);
+    ASSERT_GE(H5Fclose(file_id), 0);
+    MakeTempFilename(&list_file_);
+    std::ofstream list(list_file_.c_str());
+    list << data_file_ << std::endl;
+  }
+
+  SolverParameter SolverParam(int max_iter) {
+    std::ostringstream proto;
+    proto <<
+        "max_iter: " << max_iter << " "
+        "base_lr: 2 "
+        "lr_policy: 'fixed' "
+        "snapshot_after_train: false "
+        "solver_mode: CPU "
+        "sparse_update: true "
+        "net_param { "
+        "  name: 'SparseRegression' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'HDF5Data' "
+        "    hdf5_data_param { "
+        "      source: '" << list_file_ << "' "
+        "      batch_size: 16 "
+        "    } "
+        "    top: 'data' "
+        "    top: 'targets' "
+        "  } "
+        "  layer { "
+        "    name: 'embed' "
+        "    type: 'Embed' "
+        "    embed_param { "
+        "      input_dim: " << num_features_ << " "
+        "      num_output: 1 "
+        "      bias_term: false "
+        "      weight_filler { type: 'constant' value: 0 } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'embed' "
+        "  } "
+        "  layer { "
+        "    name: 'sum' "
+        "    type: 'Reduction' "
+        "    reduction_param { axis: 1 } "
+        "    bottom: 'embed' "
+        "    top: 'sum' "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'sum' "
+        "    bottom: 'targets' "
+        "  } "
+        "} ";
+    SolverParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    return param;
+  }
+
+  // The rows of the Embed layer that the first `num_batches` batches look up
+  vector<bool> RowsLookedUp(int num_batches) {
+    vector<bool> rows(num_features_, false);
+    const Dtype* data = data_->cpu_data();
+    for (int i = 0; i < num_batches * 16 * num_active_; ++i) {
+      rows[static_cast<int>(data[i])] = true;
+    }
+    return rows;
+  }
+
+  // Trains with `threads` Hogwild replicas, and returns the root solver.
+  shared_ptr<Solver<Dtype> > RunHogwild(int threads, int max_iter) {
+    Caffe::set_solver_count(threads);
+    shared_ptr<Solver<Dtype> > solver(
+        SolverRegistry<Dtype>::CreateSolver(SolverParam(max_iter)));
+    hogwild_.reset(new Hogwild<Dtype>(solver));
+    hogwild_->Run(threads);
+    Caffe::set_solver_count(1);
+    return solver;
+  }
+
+  // The Euclidean loss over the whole data set
+  Dtype DatasetLoss(Solver<Dtype>* solver) {
+    const Dtype* weights =
+        solver->net()->layer_by_name("embed")->blobs()[0]->cpu_data();
+    const Dtype* data = data_->cpu_data();
+    Dtype loss = 0;
+    for (int n = 0; n < num_examples_; ++n) {
+      Dtype error = -targets_->cpu_data()[n];
+      for (int k = 0; k < num_active_; ++k) {
+        error += weights[static_cast<int>(data[n * num_active_ + k])];
+      }
+      loss += error * error / 2;
+    }
+    return loss / num_examples_;
+  }
+
+  const int num_features_;
+  const int num_examples_;
+  const int num_active_;
+  shared_ptr<Blob<Dtype> > data_;
+  shared_ptr<Blob<Dtype> > targets_;
+  vector<Dtype> weights_;
+  string data_file_;
+  string list_file_;
+  shared_ptr<Hogwild<Dtype> > hogwild_;
+};
+
+TYPED_TEST_CASE(HogwildTest, TestDtypes);
+
+TYPED_TEST(HogwildTest, TestOneReplicaMatchesSerial) {
+  shared_ptr<Solver<TypeParam> > serial(
+      SolverRegistry<TypeParam>::CreateSolver(this->SolverParam(50)));
+  serial->Solve();
+  shared_ptr<Solver<TypeParam> > solver = this->RunHogwild(1, 50);
+  EXPECT_EQ(50, solver->iter());
+  const Blob<TypeParam>& expected =
+      *serial->net()->layer_by_name("embed")->blobs()[0];
+  const Blob<TypeParam>& weights =
+      *solver->net()->layer_by_name("embed")->blobs()[0];
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_EQ(expected.cpu_data()[i], weights.cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(HogwildTest, TestSparseUpdateSkipsRowsNotLookedUp) {
+  // the rows not looked up would decay, and keep moving with momentum, if
+  // the update were dense
+  SolverParameter param = this->SolverParam(1);
+  param.set_momentum(0.9);
+  param.set_weight_decay(0.1);
+  param.mutable_net_param()->mutable_layer(1)->mutable_embed_param()->
+      mutable_weight_filler()->set_value(1);
+  param.set_sparse_update(false);
+  shared_ptr<Solver<TypeParam> > dense(
+      SolverRegistry<TypeParam>::CreateSolver(param));
+  dense->Solve();
+  param.set_sparse_update(true);
+  shared_ptr<Solver<TypeParam> > sparse(
+      SolverRegistry<TypeParam>::CreateSolver(param));
+  sparse->Solve();
+  const vector<bool> rows = this->RowsLookedUp(1);
+  const TypeParam* dense_weights =
+      dense->net()->layer_by_name("embed")->blobs()[0]->cpu_data();
+  const TypeParam* sparse_weights =
+      sparse->net()->layer_by_name("embed")->blobs()[0]->cpu_data();
+  for (int i = 0; i < this->num_features_; ++i) {
+    if (rows[i]) {
+      EXPECT_NEAR(dense_weights[i], sparse_weights[i], 1e-6) << "row " << i;
+    } else {
+      EXPECT_NE(1, dense_weights[i]) << "row " << i;
+      EXPECT_EQ(1, sparse_weights[i]) << "row " << i;
+    }
+  }
+  // and stay as they were over more iterations
+  const int kNumIters = 3;
+  sparse->Step(kNumIters - 1);
+  const vector<bool> later_rows = this->RowsLookedUp(kNumIters);
+  for (int i = 0; i < this->num_features_; ++i) {
+    if (!later_rows[i]) {
+      EXPECT_EQ(1, sparse_weights[i]) << "row " << i;
+    }
+  }
+}
+
+TYPED_TEST(HogwildTest, TestConvergesOnSparseProblem) {
+  // four replicas, each taking 1000 iterations: about 30 passes over the
+  // data set in all, while many of their updates overlap
+  shared_ptr<Solver<TypeParam> > initial(
+      SolverRegistry<TypeParam>::CreateSolver(this->SolverParam(0)));
+  const TypeParam initial_loss = this->DatasetLoss(initial.get());
+  shared_ptr<Solver<TypeParam> > solver = this->RunHogwild(4, 1000);
+  EXPECT_EQ(1000, solver->iter());
+  EXPECT_LT(this->DatasetLoss(solver.get()), initial_loss / 100);
+}
+
+}  // namespace caffe
@@ -0,0 +1,94 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/hypercolumn.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class HypercolumnTest : public ::testing::Test {
+ protected:
+  HypercolumnTest()
+      : blob_(new Blob<Dtype>(2, 5, 4, 6)) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_);
+    // one tap of every interpolation case in both images
+    for (int n = 0; n < 2; ++n) {
+      for (int k = 0; k < 4; ++k) {
+        HypercolumnTap<Dtype> tap;
+        tap.n = n;
+        tap.pixel = k * 7 % 18;
+        tap.interp_x = k & 1;
+        tap.interp_y = k & 2;
+        tap.rx = tap.interp_x ? 0.25 : 0;
+        tap.ry = tap.interp_y ? 0.75 : 0;
+        taps_.push_back(tap);
+      }
+    }
+  }
+  virtual ~HypercolumnTest() { delete blob_; }
+
+  Dtype Expected(const HypercolumnTap<Dtype>& tap, int c) {
+    const int y = tap.pixel / 6, x = tap.pixel % 6;
+    const int x2 = tap.interp_x ? x + 1 : x, y2 = tap.interp_y ? y + 1 : y;
+    return (blob_->data_at(tap.n, c, y, x) * (1 - tap.ry) +
+        blob_->data_at(tap.n, c, y2, x) * tap.ry) * (1 - tap.rx) +
+        (blob_->data_at(tap.n, c, y, x2) * (1 - tap.ry) +
+        blob_->data_at(tap.n, c, y2, x2) * tap.ry) * tap.rx;
+  }
+
+  Blob<Dtype>* const blob_;
+  vector<HypercolumnTap<Dtype> > taps_;
+};
+
+TYPED_TEST_CASE(HypercolumnTest, TestDtypes);
+
+TYPED_TEST(HypercolumnTest, TestGather) {
+  Blob<TypeParam> nhwc;
+  nhwc.ReshapeLike(*this->blob_);
+  nchw_to_nhwc_cpu(this->blob_->cpu_data(), 2, 5, 4, 6,
+      nhwc.mutable_cpu_data());
+  for (int layout = 0; layout < 2; ++layout) {
+    vector<TypeParam> col(this->taps_.size() * 5);
+    hypercolumn_gather_cpu(layout ? nhwc.cpu_data() : this->blob_->cpu_data(),
+        layout == 1, 5, 4, 6, false, this->taps_.data(), 1,
+        this->taps_.size(), col.data(), 5);
+    for (int i = 0; i < this->taps_.size(); ++i) {
+      for (int c = 0; c < 5; ++c) {
+        EXPECT_NEAR(col[i * 5 + c], this->Expected(this->taps_[i], c), 1e-5);
+      }
+    }
+  }
+}
+
+TYPED_TEST(HypercolumnTest, TestScatter) {
+  // the scatter is the adjoint of the gather: <gather(x), y> = <x, scatter(y)>
+  vector<TypeParam> col(this->taps_.size() * 5);
+  vector<TypeParam> grad(this->blob_->count(), 0);
+  for (int i = 0; i < col.size(); ++i) {
+    col[i] = i % 7 - 3;
+  }
+  TypeParam lhs = 0;
+  for (int i = 0; i < this->taps_.size(); ++i) {
+    hypercolumn_scatter_cpu(col.data() + i * 5, 5, 4, 6, this->taps_[i],
+        grad.data());
+    for (int c = 0; c < 5; ++c) {
+      lhs += col[i * 5 + c] * this->Expected(this->taps_[i], c);
+    }
+  }
+  TypeParam rhs = 0;
+  for (int i = 0; i < grad.size(); ++i) {
+    rhs += grad[i] * this->blob_->cpu_data()[i];
+  }
+  EXPECT_NEAR(lhs, rhs, 1e-4);
+}
+
+}  // namespace caffe
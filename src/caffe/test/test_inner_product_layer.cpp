@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -8,6 +9,7 @@
 #include "caffe/layers/inner_product_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_epilogue_util.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
 namespace caffe {
@@ -292,6 +294,70 @@ TYPED_TEST(InnerProductLayerTest, TestGradientTranspose) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestEpilogue) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_);
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> plain_layer(layer_param);
+  plain_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  plain_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> plain_top;
+  plain_top.CopyFrom(*this->blob_top_, false, true);
+  // relu(W * x + b + residual) with the same weights
+  Blob<Dtype> residual(plain_top.shape());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&residual);
+  EpilogueParameter* epilogue_param = layer_param.mutable_epilogue_param();
+  epilogue_param->set_sum(true);
+  epilogue_param->set_relu(true);
+  InnerProductLayer<Dtype> layer(layer_param);
+  this->blob_bottom_vec_.push_back(&residual);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.blobs()[0]->CopyFrom(*plain_layer.blobs()[0]);
+  layer.blobs()[1]->CopyFrom(*plain_layer.blobs()[1]);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < plain_top.count(); ++i) {
+    const Dtype expected = std::max(Dtype(0),
+        plain_top.cpu_data()[i] + residual.cpu_data()[i]);
+    EXPECT_NEAR(expected, this->blob_top_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestEpilogueReLUMatchesUnfused) {
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  EpilogueParameter* epilogue_param = layer_param.mutable_epilogue_param();
+  epilogue_param->set_relu(true);
+  epilogue_param->set_negative_slope(0.1);
+  CheckEpilogueMatchesUnfused<InnerProductLayer>(layer_param,
+      *this->blob_bottom_);
+}
+
+TYPED_TEST(InnerProductLayerTest, TestEpilogueResidualReLUMatchesUnfused) {
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->set_transpose(true);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  EpilogueParameter* epilogue_param = layer_param.mutable_epilogue_param();
+  epilogue_param->set_sum(true);
+  epilogue_param->set_relu(true);
+  CheckEpilogueMatchesUnfused<InnerProductLayer>(layer_param,
+      *this->blob_bottom_);
+}
+
 TYPED_TEST(InnerProductLayerTest, TestBackwardTranspose) {
   typedef typename TypeParam::Dtype Dtype;
   this->blob_bottom_vec_.push_back(this->blob_bottom_);
@@ -629,6 +629,273 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  // A net with an in-place layer, a fan-out, a view and two outputs, built
+  // twice with the same weights: into net_ and, with its memory planned,
+  // into planned_net_.
+  virtual void InitPlannedNets(Phase phase) {
+    const string& proto =
+        "name: 'PlannedNetwork' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  top: 'label' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 9 dim: 9 } "
+        "    shape: { dim: 2 dim: 4 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'conv2a' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2a' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'conv2b' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conv2b' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'sum' "
+        "  type: 'Eltwise' "
+        "  bottom: 'conv2a' "
+        "  bottom: 'conv2b' "
+        "  top: 'sum' "
+        "} "
+        "layer { "
+        "  name: 'pool' "
+        "  type: 'Pooling' "
+        "  bottom: 'sum' "
+        "  top: 'pool' "
+        "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+        "} "
+        "layer { "
+        "  name: 'flat' "
+        "  type: 'Flatten' "
+        "  bottom: 'pool' "
+        "  top: 'flat' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'flat' "
+        "  top: 'ip1' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu2' "
+        "  type: 'ReLU' "
+        "  bottom: 'ip1' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip2' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} "
+        "layer { "
+        "  name: 'prob' "
+        "  type: 'Softmax' "
+        "  bottom: 'ip2' "
+        "  top: 'prob' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(phase);
+    net_.reset(new Net<Dtype>(param));
+    param.set_plan_memory(true);
+    planned_net_.reset(new Net<Dtype>(param));
+    planned_net_->ShareTrainedLayersWith(net_.get());
+  }
+
+  // An inception-like net of three towers, two of which share their weights,
+  // built twice with the same weights: into net_ and, with its memory planned
+  // and its towers run at once, into planned_net_.
+  virtual void InitBranchNets(Phase phase, bool dropout = false) {
+    string proto =
+        "name: 'BranchNetwork' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Input' "
+        "  top: 'data' "
+        "  top: 'label' "
+        "  input_param { "
+        "    shape: { dim: 2 dim: 3 dim: 8 dim: 8 } "
+        "    shape: { dim: 2 dim: 6 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'tower1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'tower1' "
+        "  param { name: 'shared_w' } "
+        "  param { name: 'shared_b' } "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'tower1' "
+        "  top: 'tower1' "
+        "} "
+        "layer { "
+        "  name: 'tower2' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'tower2' "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'pool3' "
+        "  type: 'Pooling' "
+        "  bottom: 'data' "
+        "  top: 'pool3' "
+        "  pooling_param { pool: MAX kernel_size: 3 stride: 1 pad: 1 } "
+        "} "
+        "layer { "
+        "  name: 'tower3' "
+        "  type: 'Convolution' "
+        "  bottom: 'pool3' "
+        "  top: 'tower3' "
+        "  param { name: 'shared_w' } "
+        "  param { name: 'shared_b' } "
+        "  convolution_param { "
+        "    num_output: 4 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "    bias_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} ";
+    if (dropout) {
+      const char* towers[] = { "tower1", "tower2", "tower3" };
+      for (int i = 0; i < 3; ++i) {
+        const string tower(towers[i]);
+        proto += "layer { name: 'drop_" + tower + "' type: 'Dropout' "
+            "bottom: '" + tower + "' top: '" + tower + "' } ";
+      }
+    }
+    proto +=
+        "layer { "
+        "  name: 'concat' "
+        "  type: 'Concat' "
+        "  bottom: 'tower1' "
+        "  bottom: 'tower2' "
+        "  bottom: 'tower3' "
+        "  top: 'concat' "
+        "} "
+        "layer { "
+        "  name: 'ip' "
+        "  type: 'InnerProduct' "
+        "  bottom: 'concat' "
+        "  top: 'ip' "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip' "
+        "  bottom: 'label' "
+        "  top: 'loss' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.mutable_state()->set_phase(phase);
+    net_.reset(new Net<Dtype>(param));
+    param.set_plan_memory(true);
+    param.set_branch_threads(4);
+    planned_net_.reset(new Net<Dtype>(param));
+    planned_net_->ShareTrainedLayersWith(net_.get());
+  }
+
+  // Fills the inputs of both nets with the same random values.
+  virtual void FillPlannedNetInputs() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    for (int i = 0; i < net_->num_inputs(); ++i) {
+      Blob<Dtype>* input = net_->input_blobs()[i];
+      Blob<Dtype>* planned_input = planned_net_->input_blobs()[i];
+      filler.Fill(input);
+      planned_input->ReshapeLike(*input);
+      caffe_copy(input->count(), input->cpu_data(),
+          planned_input->mutable_cpu_data());
+    }
+  }
+
+  // Checks that both nets produced the same outputs.
+  virtual void ExpectSameOutputs() {
+    ASSERT_EQ(net_->num_outputs(), planned_net_->num_outputs());
+    for (int i = 0; i < net_->num_outputs(); ++i) {
+      const Blob<Dtype>* output = net_->output_blobs()[i];
+      const Blob<Dtype>* planned_output = planned_net_->output_blobs()[i];
+      ASSERT_EQ(output->count(), planned_output->count());
+      for (int j = 0; j < output->count(); ++j) {
+        EXPECT_EQ(output->cpu_data()[j], planned_output->cpu_data()[j]);
+      }
+    }
+  }
+
   virtual void InitSkipPropNet(bool test_skip_true) {
     string proto =
       "name: 'SkipPropTestNetwork' "
@@ -841,6 +1108,7 @@ class NetTest : public MultiDeviceTest<TypeParam> {
 
   int seed_;
   shared_ptr<Net<Dtype> > net_;
+  shared_ptr<Net<Dtype> > planned_net_;
 };
 
 TYPED_TEST_CASE(NetTest, TestDtypesAndDevices);
@@ -1297,6 +1565,59 @@ TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   }
 }
 
+TYPED_TEST(NetTest, TestFlattenParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->Forward();
+  this->net_->Backward();
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  vector<shared_ptr<Blob<Dtype> > > copies;
+  Dtype sumsq = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    copies[i]->CopyFrom(*params[i], false, true);
+    copies[i]->CopyFrom(*params[i], true, true);
+    sumsq += params[i]->sumsq_diff();
+  }
+  EXPECT_FALSE(this->net_->params_flat());
+  this->net_->FlattenParams();
+  EXPECT_TRUE(this->net_->params_flat());
+  // the params keep their values, one after the other in the arenas, and the
+  // shared weights stay shared
+  const Dtype* data =
+      static_cast<const Dtype*>(this->net_->param_data_arena()->cpu_data());
+  const Dtype* diff =
+      static_cast<const Dtype*>(this->net_->param_diff_arena()->cpu_data());
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(data, params[i]->cpu_data());
+    EXPECT_EQ(diff, params[i]->cpu_diff());
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(copies[i]->cpu_data()[j], data[j]);
+      EXPECT_EQ(copies[i]->cpu_diff()[j], diff[j]);
+    }
+    data += params[i]->count();
+    diff += params[i]->count();
+  }
+  EXPECT_EQ(this->net_->layers()[1]->blobs()[0]->cpu_data(),
+      this->net_->layers()[2]->blobs()[0]->cpu_data());
+  EXPECT_EQ(this->net_->layers()[1]->blobs()[0]->cpu_diff(),
+      this->net_->layers()[2]->blobs()[0]->cpu_diff());
+  EXPECT_NEAR(sumsq, this->net_->sumsq_param_diffs(), sumsq * 1e-5);
+  this->net_->Update();
+  for (int i = 0; i < params.size(); ++i) {
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(copies[i]->cpu_data()[j] - copies[i]->cpu_diff()[j],
+          params[i]->cpu_data()[j]);
+    }
+  }
+  this->net_->ClearParamDiffs();
+  EXPECT_EQ(0, this->net_->sumsq_param_diffs());
+  // a param that gets memory of its own is no longer in the arenas
+  params[0]->data()->set_cpu_data(copies[0]->mutable_cpu_data());
+  EXPECT_FALSE(this->net_->params_flat());
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsResume) {
   typedef typename TypeParam::Dtype Dtype;
 
@@ -1342,6 +1663,81 @@ TYPED_TEST(NetTest, TestSharedWeightsResume) {
   }
 }
 
+TYPED_TEST(NetTest, TestFlatWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->ForwardBackward();
+  this->net_->Update();
+  string filename;
+  MakeTempFilename(&filename);
+  filename += ".caffemodel.flat";
+  this->net_->ToFlat(filename);
+  vector<shared_ptr<Blob<Dtype> > > copies;
+  for (int i = 0; i < this->net_->learnable_params().size(); ++i) {
+    copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    copies[i]->CopyFrom(*this->net_->learnable_params()[i], false, true);
+  }
+
+  // A net initialized differently maps the file, its params pointing into it.
+  Caffe::set_random_seed(this->seed_ + 1);
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  ASSERT_EQ(copies.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_EQ(0, reinterpret_cast<size_t>(params[i]->cpu_data()) %
+        kFlatWeightsAlignment);
+    for (int j = 0; j < params[i]->count(); ++j) {
+      EXPECT_EQ(copies[i]->cpu_data()[j], params[i]->cpu_data()[j])
+          << "param " << i << " differed at dim " << j;
+    }
+  }
+  EXPECT_EQ(this->net_->layers()[1]->blobs()[0]->cpu_data(),
+      this->net_->layers()[2]->blobs()[0]->cpu_data());
+
+  // Writing to a mapped param leaves the file as it was.
+  params[0]->mutable_cpu_data()[0] += 1;
+  this->net_->ForwardBackward();
+  this->net_->Update();
+  shared_ptr<Net<Dtype> > mapped = this->net_;
+  this->InitDiffDataSharedWeightsNet();
+  this->net_->CopyTrainedLayersFrom(filename);
+  for (int i = 0; i < copies.size(); ++i) {
+    for (int j = 0; j < copies[i]->count(); ++j) {
+      EXPECT_EQ(copies[i]->cpu_data()[j],
+          this->net_->learnable_params()[i]->cpu_data()[j])
+          << "param " << i << " differed at dim " << j;
+    }
+  }
+  EXPECT_NE(copies[0]->cpu_data()[0],
+      mapped->learnable_params()[0]->cpu_data()[0]);
+}
+
+TYPED_TEST(NetTest, TestFlatWeightsFloat) {
+  typedef typename TypeParam::Dtype Dtype;
+  // weights of one layer in float, mapped by a float net and converted by a
+  // double one
+  Caffe::set_random_seed(this->seed_);
+  this->InitDiffDataSharedWeightsNet();
+  const Blob<Dtype>& weights = *this->net_->layers()[1]->blobs()[0];
+  vector<float> values(weights.count());
+  for (int i = 0; i < values.size(); ++i) {
+    values[i] = i;
+  }
+  FlatWeightsWriter<float> writer;
+  writer.Add("innerproduct1", 0, weights.shape(), &values[0]);
+  string filename;
+  MakeTempFilename(&filename);
+  writer.Write(filename);
+  this->net_->MapTrainedLayersFrom(filename);
+  for (int i = 0; i < values.size(); ++i) {
+    EXPECT_EQ(values[i], weights.cpu_data()[i]);
+    // the layer sharing them follows
+    EXPECT_EQ(values[i], this->net_->layers()[2]->blobs()[0]->cpu_data()[i]);
+  }
+}
+
 TYPED_TEST(NetTest, TestParamPropagateDown) {
   typedef typename TypeParam::Dtype Dtype;
   const bool kBiasTerm = true, kForceBackward = false;
@@ -2446,6 +2842,138 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestPlanMemoryForward) {
+  this->InitPlannedNets(caffe::TEST);
+  EXPECT_EQ(0, this->net_->planned_memory());
+  EXPECT_LT(this->planned_net_->planned_memory(),
+      this->planned_net_->naive_memory());
+  for (int iter = 0; iter < 2; ++iter) {
+    this->FillPlannedNetInputs();
+    this->net_->Forward();
+    this->planned_net_->Forward();
+    this->ExpectSameOutputs();
+  }
+  // a larger input outgrows the plan; reshaping the net plans it again
+  const size_t planned_memory = this->planned_net_->planned_memory();
+  this->net_->input_blobs()[0]->Reshape(3, 3, 9, 9);
+  this->net_->input_blobs()[1]->Reshape(3, 4, 1, 1);
+  this->net_->Reshape();
+  this->FillPlannedNetInputs();
+  this->planned_net_->Reshape();
+  EXPECT_GT(this->planned_net_->planned_memory(), planned_memory);
+  this->net_->Forward();
+  this->planned_net_->Forward();
+  this->ExpectSameOutputs();
+}
+
+TYPED_TEST(NetTest, TestPlanMemoryBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitPlannedNets(caffe::TRAIN);
+  EXPECT_LT(this->planned_net_->planned_memory(),
+      this->planned_net_->naive_memory());
+  for (int iter = 0; iter < 2; ++iter) {
+    this->FillPlannedNetInputs();
+    this->net_->ClearParamDiffs();
+    this->planned_net_->ClearParamDiffs();
+    Dtype loss = this->net_->ForwardBackward();
+    Dtype planned_loss = this->planned_net_->ForwardBackward();
+    EXPECT_EQ(loss, planned_loss);
+    this->ExpectSameOutputs();
+    const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+    const vector<Blob<Dtype>*>& planned_params =
+        this->planned_net_->learnable_params();
+    ASSERT_EQ(params.size(), planned_params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], planned_params[i]->cpu_diff()[j]);
+      }
+    }
+  }
+}
+
+// Records the order in which the callbacks of a net run.
+template <typename Dtype>
+class RecordingCallback : public Net<Dtype>::Callback {
+ public:
+  RecordingCallback(bool after, vector<pair<int, bool> >* calls)
+      : after_(after), calls_(calls) {}
+
+ protected:
+  virtual void run(int layer) {
+    calls_->push_back(std::make_pair(layer, after_));
+  }
+
+ private:
+  bool after_;
+  vector<pair<int, bool> >* calls_;
+};
+
+TYPED_TEST(NetTest, TestBranchesForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitBranchNets(caffe::TEST);
+  // the three towers
+  EXPECT_EQ(3, this->planned_net_->branch_width());
+  for (int iter = 0; iter < 2; ++iter) {
+    this->FillPlannedNetInputs();
+    this->net_->Forward();
+    this->planned_net_->Forward();
+    this->ExpectSameOutputs();
+  }
+  // every layer is called back once before and once after it runs
+  vector<pair<int, bool> > calls;
+  RecordingCallback<Dtype> before(false, &calls), after(true, &calls);
+  this->planned_net_->add_before_forward(&before);
+  this->planned_net_->add_after_forward(&after);
+  this->planned_net_->Forward();
+  const int num_layers = this->planned_net_->layers().size();
+  ASSERT_EQ(2 * num_layers, calls.size());
+  vector<int> before_at(num_layers, -1), after_at(num_layers, -1);
+  for (int k = 0; k < calls.size(); ++k) {
+    vector<int>& at = calls[k].second ? after_at : before_at;
+    EXPECT_EQ(-1, at[calls[k].first]);
+    at[calls[k].first] = k;
+  }
+  for (int i = 0; i < num_layers; ++i) {
+    EXPECT_GE(before_at[i], 0);
+    EXPECT_GT(after_at[i], before_at[i]);
+  }
+  // the towers drop out what the serial pass does with the same seed
+  this->InitBranchNets(caffe::TRAIN, true);
+  for (int iter = 0; iter < 2; ++iter) {
+    this->FillPlannedNetInputs();
+    Caffe::set_random_seed(1701 + iter);
+    this->net_->Forward();
+    Caffe::set_random_seed(1701 + iter);
+    this->planned_net_->Forward();
+    this->ExpectSameOutputs();
+  }
+}
+
+TYPED_TEST(NetTest, TestBranchesBackward) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitBranchNets(caffe::TRAIN);
+  EXPECT_GT(this->planned_net_->branch_width(), 1);
+  for (int iter = 0; iter < 2; ++iter) {
+    this->FillPlannedNetInputs();
+    this->net_->ClearParamDiffs();
+    this->planned_net_->ClearParamDiffs();
+    Dtype loss = this->net_->ForwardBackward();
+    Dtype branch_loss = this->planned_net_->ForwardBackward();
+    EXPECT_EQ(loss, branch_loss);
+    // layers that accumulate into the same diffs run in the serial order, so
+    // the gradients are exactly the same
+    const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+    const vector<Blob<Dtype>*>& branch_params =
+        this->planned_net_->learnable_params();
+    ASSERT_EQ(params.size(), branch_params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], branch_params[i]->cpu_diff()[j]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2601,4 +3129,32 @@ TYPED_TEST(NetTest, TestAllInOneNetDeploy) {
   ASSERT_TRUE(found_data);
 }
 
+TYPED_TEST(NetTest, TestDeferredFill) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_random_seed(this->seed_);
+  this->InitUnsharedWeightsNet();
+  NetParameter weights;
+  this->net_->ToProto(&weights);
+  Caffe::set_random_seed(this->seed_);
+  const Dtype loss = this->net_->ForwardBackward();
+
+  // The params are left unfilled until the weights are loaded over them, and
+  // the data is filled as ever.
+  Caffe::set_defer_fill(true);
+  this->InitUnsharedWeightsNet();
+  Caffe::set_defer_fill(false);
+  this->net_->ForwardFromTo(0, 0);
+  EXPECT_FALSE(this->net_->blob_by_name("data")->fill_deferred());
+  const vector<Blob<Dtype>*>& params = this->net_->learnable_params();
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_TRUE(params[i]->fill_deferred()) << "param " << i;
+  }
+  this->net_->CopyTrainedLayersFrom(weights);
+  for (int i = 0; i < params.size(); ++i) {
+    EXPECT_FALSE(params[i]->fill_deferred()) << "param " << i;
+  }
+  Caffe::set_random_seed(this->seed_);
+  EXPECT_EQ(loss, this->net_->ForwardBackward());
+}
+
 }  // namespace caffe
@@ -0,0 +1,120 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/normalize_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class NormalizeLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  NormalizeLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~NormalizeLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  void SetLayerParam(LayerParameter* layer_param, bool across_spatial,
+      bool channel_shared) {
+    NormalizeParameter* norm_param = layer_param->mutable_norm_param();
+    norm_param->set_across_spatial(across_spatial);
+    norm_param->set_channel_shared(channel_shared);
+    norm_param->set_fix_scale(false);
+    norm_param->mutable_scale_filler()->set_type("gaussian");
+  }
+
+  void TestForward(bool across_spatial, bool channel_shared) {
+    LayerParameter layer_param;
+    SetLayerParam(&layer_param, across_spatial, channel_shared);
+    NormalizeLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    const Blob<Dtype>& scale = *layer.blobs()[0];
+    const Blob<Dtype>& x = *blob_bottom_;
+    for (int n = 0; n < x.num(); ++n) {
+      for (int h = 0; h < x.height(); ++h) {
+        for (int w = 0; w < x.width(); ++w) {
+          Dtype sumsq = 1e-10;
+          for (int c = 0; c < x.channels(); ++c) {
+            if (across_spatial) {
+              for (int i = 0; i < x.height() * x.width(); ++i) {
+                const Dtype v = x.cpu_data()[x.offset(n, c) + i];
+                sumsq += v * v;
+              }
+            } else {
+              sumsq += x.data_at(n, c, h, w) * x.data_at(n, c, h, w);
+            }
+          }
+          for (int c = 0; c < x.channels(); ++c) {
+            const Dtype s = scale.cpu_data()[channel_shared ? 0 : c];
+            EXPECT_NEAR(blob_top_->data_at(n, c, h, w),
+                x.data_at(n, c, h, w) * s / sqrt(sumsq), 1e-5);
+          }
+        }
+      }
+    }
+  }
+
+  void TestGradient(bool across_spatial, bool channel_shared) {
+    LayerParameter layer_param;
+    SetLayerParam(&layer_param, across_spatial, channel_shared);
+    NormalizeLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, blob_bottom_vec_,
+        blob_top_vec_);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(NormalizeLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(NormalizeLayerTest, TestForwardAcrossSpatial) {
+  this->TestForward(true, true);
+  this->TestForward(true, false);
+}
+
+TYPED_TEST(NormalizeLayerTest, TestForwardPerPosition) {
+  this->TestForward(false, true);
+  this->TestForward(false, false);
+}
+
+TYPED_TEST(NormalizeLayerTest, TestForwardPerPositionLarge) {
+  typedef typename TypeParam::Dtype Dtype;
+  // more positions than one tile of the CPU kernel
+  this->blob_bottom_->Reshape(2, 3, 17, 17);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->TestForward(false, false);
+}
+
+TYPED_TEST(NormalizeLayerTest, TestGradientAcrossSpatial) {
+  this->TestGradient(true, true);
+  this->TestGradient(true, false);
+}
+
+TYPED_TEST(NormalizeLayerTest, TestGradientPerPosition) {
+  this->TestGradient(false, true);
+  this->TestGradient(false, false);
+}
+
+}  // namespace caffe
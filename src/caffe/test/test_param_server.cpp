@@ -0,0 +1,199 @@
+#include <unistd.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "boost/lexical_cast.hpp"
+#include "boost/thread.hpp"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/parallel.hpp"
+#include "caffe/sgd_solvers.hpp"
+#include "caffe/solver_factory.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ParamServerTest : public ::testing::Test {
+ protected:
+  // The least squares problem of the solver tests, with momentum and weight
+  // decay so that the server has a history to keep.
+  ParamServerTest() {
+    const string proto =
+        "max_iter: 10 "
+        "base_lr: 0.001 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "weight_decay: 0.004 "
+        "snapshot_after_train: false "
+        "solver_mode: CPU "
+        "net_param { "
+        "  name: 'TestNetwork' "
+        "  layer { "
+        "    name: 'data' "
+        "    type: 'HDF5Data' "
+        "    hdf5_data_param { "
+        "      source: '" CMAKE_SOURCE_DIR
+        "caffe/test/test_data/solver_data_list.txt" CMAKE_EXT "' "
+        "      batch_size: 2 "
+        "    } "
+        "    top: 'data' "
+        "    top: 'targets' "
+        "  } "
+        "  layer { "
+        "    name: 'innerprod' "
+        "    type: 'InnerProduct' "
+        "    inner_product_param { "
+        "      num_output: 1 "
+        "      weight_filler { type: 'gaussian' std: 1.0 } "
+        "      bias_filler { type: 'gaussian' std: 1.0 } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'innerprod' "
+        "  } "
+        "  layer { "
+        "    name: 'loss' "
+        "    type: 'EuclideanLoss' "
+        "    bottom: 'innerprod' "
+        "    bottom: 'targets' "
+        "  } "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param_));
+    address_ = "127.0.0.1:" + boost::lexical_cast<string>(
+        20000 + (getpid() % 2000) * 10 + 8);
+  }
+
+  virtual void SetUp() {
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  shared_ptr<Solver<Dtype> > NewSolver(const SolverParameter& param) {
+    Caffe::set_random_seed(1701);
+    return shared_ptr<Solver<Dtype> >(
+        SolverRegistry<Dtype>::CreateSolver(param));
+  }
+
+  static void RunWorker(const SolverParameter& param, const string& address,
+      int rank, int workers, int period) {
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_solver_count(workers);
+    Caffe::set_solver_rank(rank);
+    shared_ptr<Solver<Dtype> > solver(
+        SolverRegistry<Dtype>::CreateSolver(param));
+    ParamWorker<Dtype> worker(solver, address, period);
+    worker.Run();
+  }
+
+  // Trains with a server on this thread and the workers on their own, and
+  // returns the solver of the server, whose weights server_ holds.
+  shared_ptr<Solver<Dtype> > RunAsync(int workers, int period,
+      int staleness) {
+    shared_ptr<Solver<Dtype> > solver = NewSolver(param_);
+    server_.reset(new ParamServer<Dtype>(solver, address_, staleness));
+    boost::thread_group threads;
+    for (int rank = 0; rank < workers; ++rank) {
+      threads.create_thread(boost::bind(&ParamServerTest::RunWorker,
+          param_, address_, rank, workers, period));
+    }
+    server_->Run(workers);
+    threads.join_all();
+    return solver;
+  }
+
+  // The mean loss over the 8 examples of the data set
+  Dtype DatasetLoss(Solver<Dtype>* solver) {
+    Dtype loss = 0;
+    for (int i = 0; i < 4; ++i) {
+      Dtype batch_loss;
+      solver->net()->Forward(&batch_loss);
+      loss += batch_loss / 4;
+    }
+    return loss;
+  }
+
+  void ExpectSameParams(Solver<Dtype>* expected, Solver<Dtype>* actual,
+      Dtype tolerance) {
+    const vector<Blob<Dtype>*>& expected_params =
+        expected->net()->learnable_params();
+    const vector<Blob<Dtype>*>& params = actual->net()->learnable_params();
+    ASSERT_EQ(expected_params.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_NEAR(expected_params[i]->cpu_data()[j],
+            params[i]->cpu_data()[j], tolerance)
+            << "param " << i << " differed at dim " << j;
+      }
+    }
+  }
+
+  SolverParameter param_;
+  string address_;
+  shared_ptr<ParamServer<Dtype> > server_;
+};
+
+TYPED_TEST_CASE(ParamServerTest, TestDtypes);
+
+TYPED_TEST(ParamServerTest, TestOneWorkerMatchesSerial) {
+  // with nobody else pushing, every gradient is computed at the weights it
+  // updates, so the updates are exactly those of the solver on its own
+  shared_ptr<Solver<TypeParam> > serial = this->NewSolver(this->param_);
+  serial->Solve();
+  shared_ptr<Solver<TypeParam> > server = this->RunAsync(1, 1, 0);
+  EXPECT_EQ(this->param_.max_iter(), server->iter());
+  this->ExpectSameParams(serial.get(), server.get(), 0);
+}
+
+TYPED_TEST(ParamServerTest, TestBatchNormOneWorkerMatchesSerial) {
+  // the running statistics are the worker's, which the server takes from its
+  // pushes, and which its pulls leave alone
+  NetParameter* net_param = this->param_.mutable_net_param();
+  net_param->mutable_layer(1)->set_bottom(0, "normed");
+  LayerParameter* bn = net_param->add_layer();
+  bn->set_name("bn");
+  bn->set_type("BatchNorm");
+  bn->add_bottom("data");
+  bn->add_top("normed");
+  net_param->mutable_layer()->SwapElements(3, 2);
+  net_param->mutable_layer()->SwapElements(2, 1);
+  shared_ptr<Solver<TypeParam> > serial = this->NewSolver(this->param_);
+  serial->Solve();
+  shared_ptr<Solver<TypeParam> > server = this->RunAsync(1, 1, 0);
+  EXPECT_EQ(this->param_.max_iter(), server->iter());
+  const vector<shared_ptr<Blob<TypeParam> > >& stats =
+      server->net()->layer_by_name("bn")->blobs();
+  ASSERT_EQ(3, stats.size());
+  EXPECT_NE(0, stats[2]->cpu_data()[0]);
+  this->ExpectSameParams(serial.get(), server.get(), 0);
+}
+
+TYPED_TEST(ParamServerTest, TestPeriodMatchesIterSize) {
+  // pushing the mean of two gradients is one update of a solver that
+  // accumulates them
+  SolverParameter param(this->param_);
+  param.set_iter_size(2);
+  shared_ptr<Solver<TypeParam> > serial = this->NewSolver(param);
+  serial->Solve();
+  shared_ptr<Solver<TypeParam> > server = this->RunAsync(1, 2, 0);
+  EXPECT_EQ(this->param_.max_iter(), server->iter());
+  this->ExpectSameParams(serial.get(), server.get(), 1e-5);
+}
+
+TYPED_TEST(ParamServerTest, TestWorkersConverge) {
+  // stale gradients and momentum do not mix well
+  this->param_.set_momentum(0);
+  this->param_.set_max_iter(100);
+  shared_ptr<Solver<TypeParam> > initial = this->NewSolver(this->param_);
+  const TypeParam initial_loss = this->DatasetLoss(initial.get());
+  shared_ptr<Solver<TypeParam> > server = this->RunAsync(3, 1, 1);
+  EXPECT_EQ(this->param_.max_iter(), server->iter());
+  const TypeParam loss = this->DatasetLoss(server.get());
+  EXPECT_TRUE(std::isfinite(loss));
+  EXPECT_LT(loss, initial_loss / 10);
+}
+
+}  // namespace caffe
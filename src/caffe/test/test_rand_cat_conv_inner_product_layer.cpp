@@ -0,0 +1,163 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/layers/rand_cat_conv_inner_product_layer.hpp"
+#include "caffe/layers/rand_cat_conv_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RandCatConvInnerProductLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RandCatConvInnerProductLayerTest()
+      : blob_bottom_0_(new Blob<Dtype>(2, 3, 6, 6)),
+        blob_bottom_1_(new Blob<Dtype>(2, 4, 4, 4)),
+        blob_bottom_valid_(new Blob<Dtype>(2, 1, 6, 6)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 6, 6)),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_0_);
+    filler.Fill(this->blob_bottom_1_);
+    // leave a few invalid points so that images have different counts
+    caffe_set(blob_bottom_valid_->count(), Dtype(1),
+        blob_bottom_valid_->mutable_cpu_data());
+    for (int i = 0; i < blob_bottom_valid_->count(); i += 5) {
+      blob_bottom_valid_->mutable_cpu_data()[i] = 0;
+    }
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 3;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_0_);
+    blob_bottom_vec_.push_back(blob_bottom_1_);
+    blob_bottom_vec_.push_back(blob_bottom_valid_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+  }
+
+  virtual ~RandCatConvInnerProductLayerTest() {
+    delete blob_bottom_0_; delete blob_bottom_1_;
+    delete blob_bottom_valid_; delete blob_bottom_label_;
+    delete blob_top_data_; delete blob_top_label_;
+  }
+
+  void SetLayerParam(LayerParameter* layer_param, bool rand_selection) {
+    RandCatConvParameter* param = layer_param->mutable_rand_cat_conv_param();
+    param->set_rand_selection(rand_selection);
+    param->set_num_output(5);
+    param->set_label_channels(1);
+    param->add_pooling_factor(1);
+    param->add_pooling_factor(2);
+    // tiles that do not line up with the images
+    param->set_tile_size(7);
+    InnerProductParameter* ip_param =
+        layer_param->mutable_inner_product_param();
+    ip_param->set_num_output(4);
+    ip_param->mutable_weight_filler()->set_type("gaussian");
+    ip_param->mutable_bias_filler()->set_type("gaussian");
+  }
+
+  // Runs RandCatConv followed by InnerProduct with the weights of the fused
+  // layer and checks that both give the same outputs.
+  void CheckAgainstUnfused(bool rand_selection) {
+    LayerParameter layer_param;
+    SetLayerParam(&layer_param, rand_selection);
+    RandCatConvInnerProductLayer<Dtype> fused(layer_param);
+    fused.SetUp(blob_bottom_vec_, blob_top_vec_);
+    Caffe::set_random_seed(1701);
+    fused.Forward(blob_bottom_vec_, blob_top_vec_);
+
+    Blob<Dtype> cat_data, cat_label, ip_data;
+    vector<Blob<Dtype>*> cat_top_vec, ip_bottom_vec, ip_top_vec;
+    cat_top_vec.push_back(&cat_data);
+    cat_top_vec.push_back(&cat_label);
+    ip_bottom_vec.push_back(&cat_data);
+    ip_top_vec.push_back(&ip_data);
+    RandCatConvLayer<Dtype> cat(layer_param);
+    cat.SetUp(blob_bottom_vec_, cat_top_vec);
+    InnerProductLayer<Dtype> ip(layer_param);
+    ip.SetUp(ip_bottom_vec, ip_top_vec);
+    ip.blobs()[0]->CopyFrom(*fused.blobs()[0]);
+    ip.blobs()[1]->CopyFrom(*fused.blobs()[1]);
+    Caffe::set_random_seed(1701);
+    cat.Forward(blob_bottom_vec_, cat_top_vec);
+    ip.Forward(ip_bottom_vec, ip_top_vec);
+
+    ASSERT_EQ(blob_top_data_->shape(), ip_data.shape());
+    ASSERT_EQ(blob_top_label_->shape(), cat_label.shape());
+    for (int i = 0; i < blob_top_label_->count(); ++i) {
+      EXPECT_EQ(cat_label.cpu_data()[i], blob_top_label_->cpu_data()[i]);
+    }
+    // rows past the sampled points are zero in the fused layer, but hold
+    // the bias in the unfused pair
+    const int num_points = rand_selection ? 10 :
+        static_cast<int>(blob_bottom_valid_->asum_data());
+    for (int i = 0; i < num_points * 4; ++i) {
+      EXPECT_NEAR(ip_data.cpu_data()[i], blob_top_data_->cpu_data()[i], 1e-4);
+    }
+    for (int i = num_points * 4; i < blob_top_data_->count(); ++i) {
+      EXPECT_EQ(0, blob_top_data_->cpu_data()[i]);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_0_;
+  Blob<Dtype>* const blob_bottom_1_;
+  Blob<Dtype>* const blob_bottom_valid_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RandCatConvInnerProductLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RandCatConvInnerProductLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, true);
+  RandCatConvInnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 10);
+  EXPECT_EQ(this->blob_top_data_->channels(), 4);
+  EXPECT_EQ(this->blob_top_label_->num(), 10);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+  ASSERT_EQ(layer.blobs().size(), 2);
+  EXPECT_EQ(layer.blobs()[0]->num(), 4);
+  EXPECT_EQ(layer.blobs()[0]->channels(), 7);
+}
+
+TYPED_TEST(RandCatConvInnerProductLayerTest, TestForwardDense) {
+  this->CheckAgainstUnfused(false);
+}
+
+TYPED_TEST(RandCatConvInnerProductLayerTest, TestForwardRandom) {
+  this->CheckAgainstUnfused(true);
+}
+
+TYPED_TEST(RandCatConvInnerProductLayerTest, TestGradientDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  RandCatConvInnerProductLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+}  // namespace caffe
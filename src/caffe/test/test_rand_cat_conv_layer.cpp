@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/rand_cat_conv_layer.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/dense_inference.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RandCatConvLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RandCatConvLayerTest()
+      : blob_bottom_0_(new Blob<Dtype>(2, 3, 6, 6)),
+        blob_bottom_1_(new Blob<Dtype>(2, 4, 4, 4)),
+        blob_bottom_valid_(new Blob<Dtype>(2, 1, 6, 6)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 6, 6)),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_0_);
+    filler.Fill(this->blob_bottom_1_);
+    caffe_set(blob_bottom_valid_->count(), Dtype(1),
+        blob_bottom_valid_->mutable_cpu_data());
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 3;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_0_);
+    blob_bottom_vec_.push_back(blob_bottom_1_);
+    blob_bottom_vec_.push_back(blob_bottom_valid_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+  }
+
+  virtual ~RandCatConvLayerTest() {
+    delete blob_bottom_0_; delete blob_bottom_1_;
+    delete blob_bottom_valid_; delete blob_bottom_label_;
+    delete blob_top_data_; delete blob_top_label_;
+  }
+
+  void SetLayerParam(LayerParameter* layer_param, bool rand_selection) {
+    RandCatConvParameter* param = layer_param->mutable_rand_cat_conv_param();
+    param->set_rand_selection(rand_selection);
+    param->set_num_output(5);
+    param->set_label_channels(1);
+    param->add_pooling_factor(1);
+    param->add_pooling_factor(2);
+  }
+
+  // Bilinear lookup of channel c at image point (x, y) in a blob pooled by
+  // poolf, the way the layer maps image coordinates to feature coordinates.
+  Dtype Interpolate(const Blob<Dtype>* blob, int poolf, int n, int c,
+      int x, int y) {
+    const Dtype pad = (poolf - 1.0) / 2;
+    const Dtype tx = (x - pad) / poolf;
+    const Dtype ty = (y - pad) / poolf;
+    const int x1 = std::max(0, static_cast<int>(floor(tx)));
+    const int y1 = std::max(0, static_cast<int>(floor(ty)));
+    const int x2 = std::max(0, static_cast<int>(ceil(tx)));
+    const int y2 = std::max(0, static_cast<int>(ceil(ty)));
+    const Dtype rx = x1 == x2 ? 0 : tx - x1;
+    const Dtype ry = y1 == y2 ? 0 : ty - y1;
+    return (blob->data_at(n, c, y1, x1) * (1 - ry) +
+        blob->data_at(n, c, y2, x1) * ry) * (1 - rx) +
+        (blob->data_at(n, c, y1, x2) * (1 - ry) +
+        blob->data_at(n, c, y2, x2) * ry) * rx;
+  }
+
+  Blob<Dtype>* const blob_bottom_0_;
+  Blob<Dtype>* const blob_bottom_1_;
+  Blob<Dtype>* const blob_bottom_valid_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RandCatConvLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RandCatConvLayerTest, TestSetupDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_data_->num(), 2 * 36);
+  EXPECT_EQ(this->blob_top_data_->channels(), 3 + 4);
+  EXPECT_EQ(this->blob_top_label_->num(), 2 * 36);
+  EXPECT_EQ(this->blob_top_label_->channels(), 1);
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestForwardDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* top_data = this->blob_top_data_->cpu_data();
+  const Dtype* top_label = this->blob_top_label_->cpu_data();
+  int i = 0;
+  for (int n = 0; n < 2; ++n) {
+    for (int y = 0; y < 6; ++y) {
+      for (int x = 0; x < 6; ++x, ++i) {
+        for (int c = 0; c < 3; ++c) {
+          EXPECT_NEAR(top_data[i * 7 + c],
+              this->Interpolate(this->blob_bottom_0_, 1, n, c, x, y), 1e-5);
+        }
+        for (int c = 0; c < 4; ++c) {
+          EXPECT_NEAR(top_data[i * 7 + 3 + c],
+              this->Interpolate(this->blob_bottom_1_, 2, n, c, x, y), 1e-5);
+        }
+        EXPECT_EQ(top_label[i], this->blob_bottom_label_->data_at(n, 0, y, x));
+      }
+    }
+  }
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestForwardDenseChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // a few invalid pixels, so that chunks do not line up with the images
+  for (int i = 0; i < this->blob_bottom_valid_->count(); i += 4) {
+    this->blob_bottom_valid_->mutable_cpu_data()[i] = 0;
+  }
+  const string proto_prefix =
+      "name: 'dense' "
+      "layer { name: 'input' type: 'Input' "
+      "  top: 'h0' top: 'h1' top: 'valid' top: 'label' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 6 } "
+      "    shape { dim: 2 dim: 4 dim: 4 dim: 4 } "
+      "    shape { dim: 2 dim: 1 dim: 6 dim: 6 } "
+      "    shape { dim: 2 dim: 1 dim: 6 dim: 6 } } } "
+      "layer { name: 'cat' type: 'RandCatConv' "
+      "  bottom: 'h0' bottom: 'h1' bottom: 'valid' bottom: 'label' "
+      "  top: 'hc' top: 'hc_label' "
+      "  rand_cat_conv_param { rand_selection: false label_channels: 1 "
+      "    pooling_factor: 1 pooling_factor: 2 ";
+  const string proto_suffix = " } } "
+      "layer { name: 'fc' type: 'InnerProduct' bottom: 'hc' top: 'score' "
+      "  inner_product_param { num_output: 4 "
+      "    weight_filler { type: 'gaussian' } "
+      "    bias_filler { type: 'gaussian' } } } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      proto_prefix + proto_suffix, &param));
+  Net<Dtype> full_net(param);
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      proto_prefix + "chunk_size: 7" + proto_suffix, &param));
+  Net<Dtype> chunked_net(param);
+  chunked_net.ShareTrainedLayersWith(&full_net);
+  const char* inputs[] = {"h0", "h1", "valid", "label"};
+  for (int i = 0; i < 4; ++i) {
+    full_net.blob_by_name(inputs[i])->CopyFrom(*this->blob_bottom_vec_[i]);
+    chunked_net.blob_by_name(inputs[i])->CopyFrom(*this->blob_bottom_vec_[i]);
+  }
+  EXPECT_EQ(chunked_net.blob_by_name("score")->num(), 7);
+
+  full_net.Forward();
+  Blob<Dtype> dense_map;
+  ForwardDense(&chunked_net, "cat", "score", &dense_map);
+  ASSERT_EQ(dense_map.num(), 2);
+  ASSERT_EQ(dense_map.channels(), 4);
+  ASSERT_EQ(dense_map.height(), 6);
+  ASSERT_EQ(dense_map.width(), 6);
+  const Dtype* score = full_net.blob_by_name("score")->cpu_data();
+  int i = 0;
+  for (int n = 0; n < 2; ++n) {
+    for (int y = 0; y < 6; ++y) {
+      for (int x = 0; x < 6; ++x) {
+        const bool valid = this->blob_bottom_valid_->data_at(n, 0, y, x);
+        for (int k = 0; k < 4; ++k) {
+          EXPECT_NEAR(dense_map.data_at(n, k, y, x),
+              valid ? score[i * 4 + k] : Dtype(0), 1e-5);
+        }
+        i += valid;
+      }
+    }
+  }
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestForwardRandom) {
+  typedef typename TypeParam::Dtype Dtype;
+  // only the left half of every image is valid
+  for (int i = 0; i < this->blob_bottom_valid_->count(); ++i) {
+    this->blob_bottom_valid_->mutable_cpu_data()[i] = (i % 6) < 3;
+  }
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, true);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* top_data = this->blob_top_data_->cpu_data();
+  const Dtype* top_label = this->blob_top_label_->cpu_data();
+  for (int i = 0; i < this->blob_top_data_->num(); ++i) {
+    // every row must be the hypercolumn of a valid pixel of its own image
+    const int n = i / 5;
+    int matches = 0;
+    for (int y = 0; y < 6; ++y) {
+      for (int x = 0; x < 3; ++x) {
+        bool match = true;
+        for (int c = 0; c < 3; ++c) {
+          match &= top_data[i * 7 + c] ==
+              this->blob_bottom_0_->data_at(n, c, y, x);
+        }
+        if (match) {
+          ++matches;
+          EXPECT_EQ(top_label[i],
+              this->blob_bottom_label_->data_at(n, 0, y, x));
+          for (int c = 0; c < 4; ++c) {
+            EXPECT_NEAR(top_data[i * 7 + 3 + c],
+                this->Interpolate(this->blob_bottom_1_, 2, n, c, x, y), 1e-5);
+          }
+        }
+      }
+    }
+    EXPECT_EQ(matches, 1);
+  }
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestForwardRandomSeeded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, true);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Caffe::set_random_seed(1701);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> first;
+  first.CopyFrom(*this->blob_top_data_, false, true);
+  Caffe::set_random_seed(1701);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < first.count(); ++i) {
+    EXPECT_EQ(first.cpu_data()[i], this->blob_top_data_->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestForwardBalanced) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, true);
+  RandCatConvParameter* param = layer_param.mutable_rand_cat_conv_param();
+  param->set_balanced(true);
+  param->set_num_output(6);
+  param->add_class_weight(1);
+  param->add_class_weight(1);
+  param->add_class_weight(1);
+  // make sure every label has enough valid points
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    this->blob_bottom_label_->mutable_cpu_data()[i] = i % 3;
+  }
+  RandCatConvLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<int> label_count(3, 0);
+  for (int i = 0; i < this->blob_top_label_->count(); ++i) {
+    label_count[static_cast<int>(this->blob_top_label_->cpu_data()[i])]++;
+  }
+  for (int l = 0; l < 3; ++l) {
+    EXPECT_EQ(label_count[l], 2 * 6 / 3);
+  }
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestGradientDense) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+TYPED_TEST(RandCatConvLayerTest, TestBackwardReuse) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param, false);
+  RandCatConvLayer<Dtype> layer(layer_param);
+  vector<bool> propagate_down(this->blob_bottom_vec_.size(), true);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  // a first pass over every pixel leaves the whole bottom diff dirty
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  filler.Fill(this->blob_top_data_);
+  caffe_copy(this->blob_top_data_->count(), this->blob_top_data_->cpu_data(),
+      this->blob_top_data_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  // the second pass only samples the top-left corner of each image
+  for (int i = 0; i < this->blob_bottom_valid_->count(); ++i) {
+    this->blob_bottom_valid_->mutable_cpu_data()[i] =
+        (i % 6) < 2 && (i / 6) % 6 < 2;
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      // somebody else writing the diff must force a full clear
+      caffe_set(this->blob_bottom_1_->count(), Dtype(7),
+          this->blob_bottom_1_->mutable_cpu_diff());
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_set(this->blob_top_data_->count(), Dtype(1),
+        this->blob_top_data_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    // pixels 0 and 1 map to features -0.25 and 0.25 of the pooled blob
+    const Dtype weight[4] = {1.75, 0.25, 0, 0};
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 4; ++c) {
+        for (int y = 0; y < 4; ++y) {
+          for (int x = 0; x < 4; ++x) {
+            const Dtype expected = weight[x] * weight[y];
+            EXPECT_NEAR(this->blob_bottom_1_->diff_at(n, c, y, x), expected,
+                1e-5);
+          }
+        }
+      }
+      for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < 6; ++y) {
+          for (int x = 0; x < 6; ++x) {
+            const Dtype expected = (x < 2 && y < 2) ? Dtype(1) : Dtype(0);
+            EXPECT_EQ(this->blob_bottom_0_->diff_at(n, c, y, x), expected);
+          }
+        }
+      }
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/reduced_precision.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class ReducedPrecisionTest : public ::testing::Test {
+ protected:
+  // Encodes x and decodes it again.
+  vector<Dtype> RoundTrip(ReducedPrecision precision, const vector<Dtype>& x,
+      bool nonnegative, uint32_t seed) {
+    vector<char> codes(reduced_precision_size(precision, x.size()));
+    reduced_precision_encode(precision, x.size(), &x[0], nonnegative, seed, 0,
+        &codes[0]);
+    vector<Dtype> y(x.size());
+    reduced_precision_decode(precision, x.size(), &codes[0], nonnegative, 0,
+        &y[0]);
+    return y;
+  }
+
+  // Checks that the mean of many stochastic roundings of x is x, and that
+  // each one is within step of it.
+  void CheckUnbiased(ReducedPrecision precision, Dtype x, Dtype step) {
+    const int kTrials = 10000;
+    vector<Dtype> xs(kTrials, x);
+    vector<Dtype> ys = RoundTrip(precision, xs, false, 1701);
+    Dtype mean = 0;
+    for (int i = 0; i < kTrials; ++i) {
+      EXPECT_LE(std::fabs(ys[i] - x), step);
+      mean += ys[i] / kTrials;
+    }
+    // the standard deviation of the mean is at most step / 200
+    EXPECT_NEAR(x, mean, step / 40);
+  }
+};
+
+TYPED_TEST_CASE(ReducedPrecisionTest, TestDtypes);
+
+TYPED_TEST(ReducedPrecisionTest, TestSize) {
+  EXPECT_EQ(2000u, reduced_precision_size(
+      SolverParameter_HistoryPrecision_FP16, 1000));
+  EXPECT_EQ(2000u, reduced_precision_size(
+      SolverParameter_HistoryPrecision_BF16, 1000));
+  // four blocks, with a float scale each
+  EXPECT_EQ(1016u, reduced_precision_size(
+      SolverParameter_HistoryPrecision_INT8, 1000));
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestExactValues) {
+  typedef TypeParam Dtype;
+  // values all formats represent, including the smallest half subnormal
+  vector<Dtype> x;
+  x.push_back(0);
+  x.push_back(1.5);
+  x.push_back(-2.25);
+  x.push_back(0.125);
+  x.push_back(std::pow(Dtype(2), -24));
+  vector<Dtype> y = this->RoundTrip(SolverParameter_HistoryPrecision_FP16, x,
+      false, 1);
+  for (int i = 0; i < x.size(); ++i) {
+    EXPECT_EQ(x[i], y[i]);
+  }
+  y = this->RoundTrip(SolverParameter_HistoryPrecision_BF16, x, false, 1);
+  for (int i = 0; i < x.size(); ++i) {
+    EXPECT_EQ(x[i], y[i]);
+  }
+  // INT8 keeps zero, the largest value of the block, and its halves
+  y = this->RoundTrip(SolverParameter_HistoryPrecision_INT8, x, false, 1);
+  EXPECT_EQ(0, y[0]);
+  EXPECT_EQ(x[2], y[2]);
+  vector<Dtype> halves(1, 4);
+  halves.push_back(-2);
+  halves.push_back(0.5);
+  y = this->RoundTrip(SolverParameter_HistoryPrecision_INT8, halves, false, 1);
+  for (int i = 0; i < halves.size(); ++i) {
+    EXPECT_EQ(halves[i], y[i]);
+  }
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestFP16Saturates) {
+  typedef TypeParam Dtype;
+  vector<Dtype> x(1, 1e6);
+  x.push_back(-1e6);
+  vector<Dtype> y = this->RoundTrip(SolverParameter_HistoryPrecision_FP16, x,
+      false, 1);
+  EXPECT_EQ(65504, y[0]);
+  EXPECT_EQ(-65504, y[1]);
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestStochasticRoundingUnbiased) {
+  typedef TypeParam Dtype;
+  // a quarter of the way between two codes
+  this->CheckUnbiased(SolverParameter_HistoryPrecision_FP16,
+      Dtype(1) + std::pow(Dtype(2), -12), std::pow(Dtype(2), -10));
+  this->CheckUnbiased(SolverParameter_HistoryPrecision_FP16,
+      std::pow(Dtype(2), -26), std::pow(Dtype(2), -24));
+  this->CheckUnbiased(SolverParameter_HistoryPrecision_BF16,
+      Dtype(1) + std::pow(Dtype(2), -9), std::pow(Dtype(2), -7));
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestINT8Blocks) {
+  typedef TypeParam Dtype;
+  // two blocks of very different scales, the second one partial
+  const int kCount = kReducedBlockSize + 100;
+  vector<Dtype> x(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    x[i] = (i < kReducedBlockSize ? 100 : 0.01) * std::sin(Dtype(i));
+  }
+  vector<Dtype> y = this->RoundTrip(SolverParameter_HistoryPrecision_INT8, x,
+      false, 1);
+  // within a step of 2^(1/8), or of the smallest code, 2^-15.875 of the
+  // largest value
+  for (int i = 0; i < kCount; ++i) {
+    const Dtype max_x = i < kReducedBlockSize ? 100 : 0.01;
+    EXPECT_LE(std::fabs(x[i] - y[i]),
+        0.091 * std::fabs(x[i]) + max_x * std::pow(Dtype(2), -15.875))
+        << "at " << i;
+  }
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestNonNegativeStaysPositive) {
+  typedef TypeParam Dtype;
+  // values far below the resolution next to the largest one, or below the
+  // smallest half
+  vector<Dtype> x(kReducedBlockSize, 1e-12);
+  x[0] = 1;
+  const ReducedPrecision precisions[] = {
+    SolverParameter_HistoryPrecision_FP16,
+    SolverParameter_HistoryPrecision_BF16,
+    SolverParameter_HistoryPrecision_INT8
+  };
+  for (int p = 0; p < 3; ++p) {
+    vector<Dtype> y = this->RoundTrip(precisions[p], x, true, 1);
+    for (int i = 0; i < x.size(); ++i) {
+      EXPECT_GT(y[i], 0) << "precision " << precisions[p] << " at " << i;
+    }
+    EXPECT_NEAR(1, y[0], 1e-2);
+  }
+}
+
+TYPED_TEST(ReducedPrecisionTest, TestBlocksMatchWhole) {
+  typedef TypeParam Dtype;
+  // encoding in blocks, as threads do, gives the codes of encoding at once
+  const int kCount = 4 * kReducedBlockSize + 7;
+  vector<Dtype> x(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    x[i] = std::cos(Dtype(i)) / (i + 1);
+  }
+  const ReducedPrecision precisions[] = {
+    SolverParameter_HistoryPrecision_FP16,
+    SolverParameter_HistoryPrecision_BF16,
+    SolverParameter_HistoryPrecision_INT8
+  };
+  for (int p = 0; p < 3; ++p) {
+    const size_t size = reduced_precision_size(precisions[p], kCount);
+    vector<char> whole(size);
+    vector<char> blocks(size);
+    reduced_precision_encode(precisions[p], kCount, &x[0], false, 7, 0,
+        &whole[0]);
+    for (int offset = 0; offset < kCount; offset += 2 * kReducedBlockSize) {
+      const int n = std::min(2 * kReducedBlockSize, kCount - offset);
+      reduced_precision_encode(precisions[p], n, &x[offset], false, 7, offset,
+          &blocks[0]);
+    }
+    EXPECT_TRUE(whole == blocks) << "precision " << precisions[p];
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,152 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/sampled_softmax_tag_loss_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class SampledSoftmaxTagLossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  SampledSoftmaxTagLossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(6, 4, 1, 1)),
+        blob_bottom_label_(new Blob<Dtype>(6, 3, 1, 1)),
+        blob_bottom_freqs_(new Blob<Dtype>(20, 1, 1, 1)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    // one to three distinct set tags per item, padded with -1
+    Dtype* label = blob_bottom_label_->mutable_cpu_data();
+    for (int i = 0; i < 6; ++i) {
+      for (int p = 0; p < 3; ++p) {
+        label[i * 3 + p] = p <= i % 3 ? (i * 7 + p * 5) % 20 : -1;
+      }
+    }
+    for (int c = 0; c < 20; ++c) {
+      blob_bottom_freqs_->mutable_cpu_data()[c] = caffe_rng_rand() % 100 + 1;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_bottom_vec_.push_back(blob_bottom_freqs_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~SampledSoftmaxTagLossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_bottom_freqs_;
+    delete blob_top_loss_;
+  }
+
+  void SetLayerParam(LayerParameter* layer_param) {
+    InnerProductParameter* ip_param =
+        layer_param->mutable_inner_product_param();
+    ip_param->set_num_output(20);
+    ip_param->mutable_weight_filler()->set_type("gaussian");
+    ip_param->mutable_bias_filler()->set_type("gaussian");
+    layer_param->mutable_softmax_tag_loss_param()->set_num_sampled(5);
+  }
+
+  // Forward pass with the sampling seeded, so that every call draws the
+  // same negatives.
+  Dtype SeededForward(Layer<Dtype>* layer) {
+    Caffe::set_random_seed(1701);
+    return layer->Forward(blob_bottom_vec_, blob_top_vec_);
+  }
+
+  // Compares the analytic gradient of blob against central differences.
+  void CheckGradient(Layer<Dtype>* layer, Blob<Dtype>* blob) {
+    const Dtype kStep = 1e-2;
+    for (int j = 0; j < blob->count(); ++j) {
+      const Dtype analytic = blob->cpu_diff()[j];
+      const Dtype value = blob->cpu_data()[j];
+      blob->mutable_cpu_data()[j] = value + kStep;
+      const Dtype positive = SeededForward(layer);
+      blob->mutable_cpu_data()[j] = value - kStep;
+      const Dtype negative = SeededForward(layer);
+      blob->mutable_cpu_data()[j] = value;
+      EXPECT_NEAR(analytic, (positive - negative) / (2 * kStep), 1e-2)
+          << "element " << j;
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_bottom_freqs_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SampledSoftmaxTagLossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SampledSoftmaxTagLossLayerTest, TestSetup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param);
+  SampledSoftmaxTagLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // same parameter shapes as an InnerProductLayer, to share them at test time
+  ASSERT_EQ(layer.blobs().size(), 2);
+  EXPECT_EQ(layer.blobs()[0]->shape(0), 20);
+  EXPECT_EQ(layer.blobs()[0]->shape(1), 4);
+  EXPECT_EQ(layer.blobs()[1]->shape(0), 20);
+}
+
+TYPED_TEST(SampledSoftmaxTagLossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param);
+  SampledSoftmaxTagLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->SeededForward(&layer);
+  vector<bool> propagate_down(3, false);
+  propagate_down[0] = true;
+  this->blob_top_loss_->mutable_cpu_diff()[0] = 1;
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    caffe_set(layer.blobs()[i]->count(), Dtype(0),
+        layer.blobs()[i]->mutable_cpu_diff());
+  }
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  this->CheckGradient(&layer, this->blob_bottom_data_);
+  this->CheckGradient(&layer, layer.blobs()[0].get());
+  this->CheckGradient(&layer, layer.blobs()[1].get());
+}
+
+TYPED_TEST(SampledSoftmaxTagLossLayerTest, TestSparseWeightGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetLayerParam(&layer_param);
+  SampledSoftmaxTagLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<bool> propagate_down(3, false);
+  this->blob_top_loss_->mutable_cpu_diff()[0] = 1;
+  caffe_set(layer.blobs()[0]->count(), Dtype(0),
+      layer.blobs()[0]->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  // only the set tags and the (at most 5) negatives receive a gradient
+  vector<bool> is_set(20, false);
+  for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+    const int tag = this->blob_bottom_label_->cpu_data()[i];
+    if (tag >= 0) { is_set[tag] = true; }
+  }
+  int negatives = 0;
+  for (int c = 0; c < 20; ++c) {
+    const Dtype row_asum = caffe_cpu_asum(4,
+        layer.blobs()[0]->cpu_diff() + c * 4);
+    negatives += row_asum > 0 && !is_set[c];
+  }
+  EXPECT_LE(negatives, 5);
+}
+
+}  // namespace caffe
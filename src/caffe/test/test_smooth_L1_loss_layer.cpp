@@ -0,0 +1,141 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/fast_rcnn_layers.hpp"
+#include "caffe/filler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class SmoothL1LossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  SmoothL1LossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(4, 3, 5, 7)),
+        blob_bottom_label_(new Blob<Dtype>(4, 3, 5, 7)),
+        blob_bottom_weights_(new Blob<Dtype>(4, 3, 5, 7)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    // a wide filler so that both branches of the smooth L1 are exercised
+    FillerParameter filler_param;
+    filler_param.set_std(1.5);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    filler.Fill(this->blob_bottom_label_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    FillerParameter weights_param;
+    weights_param.set_min(0);
+    weights_param.set_max(2);
+    UniformFiller<Dtype> weights_filler(weights_param);
+    weights_filler.Fill(this->blob_bottom_weights_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~SmoothL1LossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_bottom_weights_;
+    delete blob_top_loss_;
+  }
+
+  Dtype ReferenceLoss(bool weighted) {
+    const Dtype* data = blob_bottom_data_->cpu_data();
+    const Dtype* label = blob_bottom_label_->cpu_data();
+    const Dtype* weights = blob_bottom_weights_->cpu_data();
+    Dtype loss = 0;
+    for (int i = 0; i < blob_bottom_data_->count(); ++i) {
+      const Dtype d = (weighted ? weights[i] : 1) * (data[i] - label[i]);
+      loss += std::abs(d) < 1 ? 0.5 * d * d : std::abs(d) - 0.5;
+    }
+    return loss / blob_bottom_data_->num();
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_bottom_weights_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SmoothL1LossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(this->ReferenceLoss(false), loss, 1e-4);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForwardWeighted) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_weights_);
+  LayerParameter layer_param;
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NEAR(this->ReferenceLoss(true), loss, 1e-4);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForwardLarge) {
+  typedef typename TypeParam::Dtype Dtype;
+  // more than one block of the CPU kernel, with a partial last block
+  this->blob_bottom_data_->Reshape(3, 3, 41, 37);
+  this->blob_bottom_label_->Reshape(3, 3, 41, 37);
+  this->blob_bottom_weights_->Reshape(3, 3, 41, 37);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_data_);
+  filler.Fill(this->blob_bottom_label_);
+  filler.Fill(this->blob_bottom_weights_);
+  this->blob_bottom_vec_.push_back(this->blob_bottom_weights_);
+  LayerParameter layer_param;
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype loss =
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype expected = this->ReferenceLoss(true);
+  EXPECT_NEAR(expected, loss, 1e-5 * std::abs(expected));
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  const Dtype kLossWeight = 3.7;
+  layer_param.add_loss_weight(kLossWeight);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestGradientWeighted) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_weights_);
+  LayerParameter layer_param;
+  const Dtype kLossWeight = 3.7;
+  layer_param.add_loss_weight(kLossWeight);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+}  // namespace caffe
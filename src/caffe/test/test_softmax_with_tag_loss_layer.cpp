@@ -9,7 +9,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
-#include "caffe/vision_layers.hpp"
+#include "caffe/layers/softmax_loss_layer.hpp"
+#include "caffe/layers/softmax_tag_loss_layer.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -199,4 +200,75 @@ TYPED_TEST(SoftmaxWithTagLossLayerTest, TestGradientUnnormalized) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(SoftmaxWithTagLossLayerTest, TestFrequencyChange) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  SoftmaxWithTagLossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype first_loss = this->blob_top_loss_->cpu_data()[0];
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(first_loss, this->blob_top_loss_->cpu_data()[0]);
+  // new frequencies must not be hidden by the cached weights
+  this->blob_bottom_freqs_->mutable_cpu_data()[0] *= 50;
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype new_loss = this->blob_top_loss_->cpu_data()[0];
+  SoftmaxWithTagLossLayer<Dtype> fresh_layer(layer_param);
+  fresh_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  fresh_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_NE(first_loss, new_loss);
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], new_loss, 1e-4);
+}
+
+TYPED_TEST(SoftmaxWithTagLossLayerTest, TestSparseLabels) {
+  typedef typename TypeParam::Dtype Dtype;
+  // list the set tags of every item, padded with -1
+  Blob<Dtype> tag_lists(10, 4, 2, 3);
+  caffe_set(tag_lists.count(), Dtype(-1), tag_lists.mutable_cpu_data());
+  for (int i = 0; i < 10; ++i) {
+    for (int y = 0; y < 2; ++y) {
+      for (int x = 0; x < 3; ++x) {
+        int p = 0;
+        // at most 4 of the 5 tags, so that the lists stay shorter than K
+        for (int c = 0; c < 4; ++c) {
+          if (this->blob_bottom_label_->data_at(i, c, y, x) == 1) {
+            tag_lists.mutable_cpu_data()[tag_lists.offset(i, p++, y, x)] = c;
+          }
+        }
+        this->blob_bottom_label_->mutable_cpu_data()[
+            this->blob_bottom_label_->offset(i, 4, y, x)] = 0;
+      }
+    }
+  }
+  vector<Blob<Dtype>*> sparse_bottom_vec(this->blob_bottom_vec_);
+  sparse_bottom_vec[1] = &tag_lists;
+  vector<bool> propagate_down(3, false);
+  propagate_down[0] = true;
+
+  LayerParameter layer_param;
+  SoftmaxWithTagLossLayer<Dtype> dense_layer(layer_param);
+  dense_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  dense_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype dense_loss = this->blob_top_loss_->cpu_data()[0];
+  dense_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  Blob<Dtype> dense_grad;
+  dense_grad.CopyFrom(*this->blob_bottom_data_, true, true);
+
+  layer_param.mutable_softmax_tag_loss_param()->set_sparse_labels(true);
+  SoftmaxWithTagLossLayer<Dtype> sparse_layer(layer_param);
+  sparse_layer.SetUp(sparse_bottom_vec, this->blob_top_vec_);
+  sparse_layer.Forward(sparse_bottom_vec, this->blob_top_vec_);
+  EXPECT_NEAR(dense_loss, this->blob_top_loss_->cpu_data()[0], 1e-4);
+  sparse_layer.Backward(this->blob_top_vec_, propagate_down,
+      sparse_bottom_vec);
+  for (int i = 0; i < this->blob_bottom_data_->count(); ++i) {
+    EXPECT_NEAR(dense_grad.cpu_diff()[i],
+        this->blob_bottom_data_->cpu_diff()[i], 1e-4);
+  }
+  GradientChecker<Dtype> checker(1e-2, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&sparse_layer, sparse_bottom_vec,
+      this->blob_top_vec_, 0);
+}
+
 }  // namespace caffe
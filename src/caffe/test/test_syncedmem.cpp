@@ -50,6 +50,21 @@ TEST_F(SyncedMemoryTest, TestAllocationGPU) {
 
 #endif
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  const int initial = mem.version();
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), initial);
+  mem.mutable_cpu_data();
+  const int written = mem.version();
+  EXPECT_NE(written, initial);
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), written);
+  char other[10];
+  mem.set_cpu_data(other);
+  EXPECT_NE(mem.version(), written);
+}
+
 TEST_F(SyncedMemoryTest, TestCPUWrite) {
   SyncedMemory mem(10);
   void* cpu_data = mem.mutable_cpu_data();
@@ -0,0 +1,412 @@
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
+
+#include "caffe/util/collective.hpp"
+
+namespace caffe {
+
+Collective::Collective(int rank, int size)
+    : rank_(rank), size_(size) {
+  CHECK_GT(size_, 0);
+  CHECK_GE(rank_, 0);
+  CHECK_LT(rank_, size_);
+}
+
+template <typename Dtype>
+void Collective::Allreduce(Dtype* data, size_t count) {
+  if (size_ == 1 || count == 0) { return; }
+  // chunk c is [offset[c], offset[c + 1])
+  vector<size_t> offset(size_ + 1);
+  size_t max_chunk = 0;
+  for (int c = 0; c <= size_; ++c) {
+    offset[c] = count * c / size_;
+    if (c > 0) { max_chunk = std::max(max_chunk, offset[c] - offset[c - 1]); }
+  }
+  buffer_.resize(std::max<size_t>(1, max_chunk * sizeof(Dtype)));
+  Dtype* incoming = reinterpret_cast<Dtype*>(&buffer_[0]);
+  // Reduce-scatter: after step s, chunk rank - s - 1 holds the sum over
+  // s + 2 ranks, so in the end this rank holds all of chunk rank + 1.
+  for (int s = 0; s < size_ - 1; ++s) {
+    const int send_chunk = (rank_ - s + size_) % size_;
+    const int recv_chunk = (rank_ - s - 1 + size_) % size_;
+    const size_t recv_count = offset[recv_chunk + 1] - offset[recv_chunk];
+    SendRecv(data + offset[send_chunk],
+        (offset[send_chunk + 1] - offset[send_chunk]) * sizeof(Dtype),
+        incoming, recv_count * sizeof(Dtype));
+    Dtype* sum = data + offset[recv_chunk];
+    for (size_t i = 0; i < recv_count; ++i) {
+      sum[i] += incoming[i];
+    }
+  }
+  // All-gather: pass the summed chunks on around the ring.
+  for (int s = 0; s < size_ - 1; ++s) {
+    const int send_chunk = (rank_ + 1 - s + size_) % size_;
+    const int recv_chunk = (rank_ - s + size_) % size_;
+    SendRecv(data + offset[send_chunk],
+        (offset[send_chunk + 1] - offset[send_chunk]) * sizeof(Dtype),
+        data + offset[recv_chunk],
+        (offset[recv_chunk + 1] - offset[recv_chunk]) * sizeof(Dtype));
+  }
+}
+
+template <typename Dtype>
+void Collective::Broadcast(Dtype* data, size_t count) {
+  if (size_ == 1 || count == 0) { return; }
+  // Pipelined: every rank passes a piece on while receiving the next one.
+  const size_t kPieceSize = 1 << 20;
+  char* bytes = reinterpret_cast<char*>(data);
+  const size_t total = count * sizeof(Dtype);
+  const size_t num_pieces = (total + kPieceSize - 1) / kPieceSize;
+  const bool forward = rank_ + 1 < size_;
+  for (size_t k = 0; k <= num_pieces; ++k) {
+    // receive piece k while sending piece k - 1 on
+    const size_t begin = std::min(total, k * kPieceSize);
+    const size_t end = std::min(total, begin + kPieceSize);
+    if (rank_ == 0) {
+      SendRecv(bytes + begin, end - begin, NULL, 0);
+    } else {
+      const size_t previous = k > 0 ? (k - 1) * kPieceSize : begin;
+      SendRecv(bytes + previous, forward ? begin - previous : 0,
+          bytes + begin, end - begin);
+    }
+  }
+}
+
+void Collective::Barrier() {
+  if (size_ == 1) { return; }
+  // A token around the ring once to gather every rank and once to let them go
+  char token = 0;
+  for (int round = 0; round < 2; ++round) {
+    if (rank_ == 0) {
+      SendRecv(&token, 1, NULL, 0);
+      SendRecv(NULL, 0, &token, 1);
+    } else {
+      SendRecv(NULL, 0, &token, 1);
+      SendRecv(&token, 1, NULL, 0);
+    }
+  }
+}
+
+template void Collective::Allreduce<float>(float* data, size_t count);
+template void Collective::Allreduce<double>(double* data, size_t count);
+template void Collective::Broadcast<float>(float* data, size_t count);
+template void Collective::Broadcast<double>(double* data, size_t count);
+
+// A single-producer, single-consumer ring buffer. The counts of bytes written
+// and read only grow, and each is only changed by one of the two ranks.
+static const size_t kChannelCapacity = 1 << 22;
+
+struct ShmCollective::Channel {
+  uint64_t written;
+  char written_padding[56];
+  uint64_t read;
+  char read_padding[56];
+  int attached;
+  char data[kChannelCapacity];
+};
+
+static string ShmName(const string& name, int rank) {
+  return "/" + name + "_" + boost::lexical_cast<string>(rank);
+}
+
+ShmCollective::ShmCollective(const string& name, int rank, int size)
+    : Collective(rank, size), in_(NULL), out_(NULL) {
+  if (size_ == 1) { return; }
+  const string in_name = ShmName(name, rank_);
+  in_ = Map(in_name, true);
+  out_ = Map(ShmName(name, (rank_ + 1) % size_), false);
+  __atomic_store_n(&out_->attached, 1, __ATOMIC_RELEASE);
+  while (!__atomic_load_n(&in_->attached, __ATOMIC_ACQUIRE)) {
+    usleep(1000);
+  }
+  // both ranks have it mapped, so nothing is left behind if they crash
+  shm_unlink(in_name.c_str());
+}
+
+ShmCollective::~ShmCollective() {
+  if (in_) { munmap(in_, sizeof(Channel)); }
+  if (out_) { munmap(out_, sizeof(Channel)); }
+}
+
+ShmCollective::Channel* ShmCollective::Map(const string& name, bool create) {
+  int fd;
+  if (create) {
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    CHECK_GE(fd, 0) << "Cannot create shared memory " << name << ": "
+        << strerror(errno);
+    CHECK_EQ(ftruncate(fd, sizeof(Channel)), 0) << strerror(errno);
+  } else {
+    // wait for the other rank to create it
+    struct stat st;
+    for (;;) {
+      fd = shm_open(name.c_str(), O_RDWR, 0);
+      if (fd >= 0) {
+        CHECK_EQ(fstat(fd, &st), 0) << strerror(errno);
+        if (st.st_size == sizeof(Channel)) { break; }
+        close(fd);
+      } else {
+        CHECK_EQ(errno, ENOENT) << "Cannot open shared memory " << name
+            << ": " << strerror(errno);
+      }
+      usleep(1000);
+    }
+  }
+  void* memory = mmap(NULL, sizeof(Channel), PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  CHECK(memory != MAP_FAILED) << "Cannot map shared memory " << name << ": "
+      << strerror(errno);
+  close(fd);
+  return static_cast<Channel*>(memory);
+}
+
+void ShmCollective::SendRecv(const void* send, size_t send_size, void* recv,
+    size_t recv_size) {
+  const char* send_bytes = static_cast<const char*>(send);
+  char* recv_bytes = static_cast<char*>(recv);
+  size_t sent = 0, received = 0;
+  int idle = 0;
+  while (sent < send_size || received < recv_size) {
+    bool progress = false;
+    if (sent < send_size) {
+      const uint64_t written = out_->written;
+      const uint64_t read = __atomic_load_n(&out_->read, __ATOMIC_ACQUIRE);
+      const size_t start = written % kChannelCapacity;
+      const size_t n = std::min(send_size - sent, std::min<size_t>(
+          kChannelCapacity - (written - read), kChannelCapacity - start));
+      if (n > 0) {
+        memcpy(out_->data + start, send_bytes + sent, n);
+        __atomic_store_n(&out_->written, written + n, __ATOMIC_RELEASE);
+        sent += n;
+        progress = true;
+      }
+    }
+    if (received < recv_size) {
+      const uint64_t read = in_->read;
+      const uint64_t written = __atomic_load_n(&in_->written,
+          __ATOMIC_ACQUIRE);
+      const size_t start = read % kChannelCapacity;
+      const size_t n = std::min(recv_size - received, std::min<size_t>(
+          written - read, kChannelCapacity - start));
+      if (n > 0) {
+        memcpy(recv_bytes + received, in_->data + start, n);
+        __atomic_store_n(&in_->read, read + n, __ATOMIC_RELEASE);
+        received += n;
+        progress = true;
+      }
+    }
+    // spin while the other rank is about to move, then let others run
+    if (progress) {
+      idle = 0;
+    } else if (++idle > 1000) {
+      usleep(idle > 100000 ? 1000 : 0);
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+void ParseAddress(const string& address, string* host, int* port) {
+  const size_t colon = address.rfind(':');
+  CHECK(colon != string::npos) << "Expected HOST:PORT, got " << address;
+  *host = address.substr(0, colon);
+  *port = boost::lexical_cast<int>(address.substr(colon + 1));
+}
+
+static void SetNoDelay(int fd) {
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)), 0)
+      << strerror(errno);
+}
+
+static void SetNonBlocking(int fd) {
+  CHECK_EQ(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK), 0)
+      << strerror(errno);
+}
+
+int ListenTCP(int port, int backlog) {
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listener, 0) << strerror(errno);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  local.sin_port = htons(port);
+  CHECK_EQ(bind(listener, reinterpret_cast<struct sockaddr*>(&local),
+      sizeof(local)), 0) << "Cannot listen on port " << port << ": "
+      << strerror(errno);
+  CHECK_EQ(listen(listener, backlog), 0) << strerror(errno);
+  return listener;
+}
+
+int ConnectTCP(const string& host, int port) {
+  struct addrinfo hints, *info;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  const string service = boost::lexical_cast<string>(port);
+  CHECK_EQ(getaddrinfo(host.c_str(), service.c_str(), &hints, &info), 0)
+      << "Cannot resolve " << host;
+  int fd;
+  for (int attempt = 0; ; ++attempt) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << strerror(errno);
+    if (connect(fd, info->ai_addr, info->ai_addrlen) == 0) { break; }
+    CHECK_LT(attempt, 60000) << "Cannot connect to " << host << ":" << port
+        << ": " << strerror(errno);
+    close(fd);
+    usleep(1000);
+  }
+  freeaddrinfo(info);
+  SetNoDelay(fd);
+  return fd;
+}
+
+int AcceptTCP(int listener) {
+  const int fd = accept(listener, NULL, NULL);
+  CHECK_GE(fd, 0) << strerror(errno);
+  SetNoDelay(fd);
+  return fd;
+}
+
+void SendAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = ::send(fd, bytes, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      CHECK_EQ(errno, EINTR) << strerror(errno);
+      continue;
+    }
+    bytes += n;
+    size -= n;
+  }
+}
+
+bool RecvAll(int fd, void* data, size_t size) {
+  char* bytes = static_cast<char*>(data);
+  size_t received = 0;
+  while (received < size) {
+    const ssize_t n = ::recv(fd, bytes + received, size - received, 0);
+    if (n < 0) {
+      CHECK(errno == EINTR || errno == ECONNRESET) << strerror(errno);
+      if (errno == ECONNRESET) { break; }
+      continue;
+    }
+    if (n == 0) { break; }
+    received += n;
+  }
+  CHECK(received == 0 || received == size)
+      << "The connection closed in the middle of a message.";
+  return received == size;
+}
+
+TCPCollective::TCPCollective(const vector<string>& addresses, int rank,
+    int size)
+    : Collective(rank, size), in_(-1), out_(-1) {
+  if (size_ == 1) { return; }
+  CHECK(addresses.size() == 1 || addresses.size() == size_)
+      << "Give the address of every rank, or of rank 0 only.";
+  vector<string> hosts(size_);
+  vector<int> ports(size_);
+  for (int r = 0; r < size_; ++r) {
+    if (addresses.size() == 1) {
+      ParseAddress(addresses[0], &hosts[r], &ports[r]);
+      ports[r] += r;
+    } else {
+      ParseAddress(addresses[r], &hosts[r], &ports[r]);
+    }
+  }
+  // Listen for the previous rank before connecting to the next one, so that
+  // every rank can connect as soon as its neighbour has started.
+  const int listener = ListenTCP(ports[rank_], 1);
+  const int next = (rank_ + 1) % size_;
+  out_ = ConnectTCP(hosts[next], ports[next]);
+  in_ = AcceptTCP(listener);
+  close(listener);
+  SetNonBlocking(in_);
+  SetNonBlocking(out_);
+  // make sure the ring is closed the right way around
+  int32_t sender = rank_, previous = -1;
+  SendRecv(&sender, sizeof(sender), &previous, sizeof(previous));
+  CHECK_EQ(previous, (rank_ + size_ - 1) % size_)
+      << "Rank " << rank_ << " was connected to by the wrong rank.";
+}
+
+TCPCollective::~TCPCollective() {
+  if (in_ >= 0) { close(in_); }
+  if (out_ >= 0) { close(out_); }
+}
+
+void TCPCollective::SendRecv(const void* send, size_t send_size, void* recv,
+    size_t recv_size) {
+  const char* send_bytes = static_cast<const char*>(send);
+  char* recv_bytes = static_cast<char*>(recv);
+  size_t sent = 0, received = 0;
+  while (sent < send_size || received < recv_size) {
+    struct pollfd fds[2];
+    int num_fds = 0;
+    if (sent < send_size) {
+      fds[num_fds].fd = out_;
+      fds[num_fds++].events = POLLOUT;
+    }
+    if (received < recv_size) {
+      fds[num_fds].fd = in_;
+      fds[num_fds++].events = POLLIN;
+    }
+    if (poll(fds, num_fds, -1) < 0) {
+      CHECK_EQ(errno, EINTR) << strerror(errno);
+      continue;
+    }
+    for (int i = 0; i < num_fds; ++i) {
+      if (!fds[i].revents) { continue; }
+      ssize_t n;
+      if (fds[i].fd == out_ && sent < send_size) {
+        n = ::send(out_, send_bytes + sent, send_size - sent, MSG_NOSIGNAL);
+        if (n > 0) { sent += n; }
+      } else {
+        n = ::recv(in_, recv_bytes + received, recv_size - received, 0);
+        CHECK_NE(n, 0) << "Rank " << (rank_ + size_ - 1) % size_
+            << " closed the connection.";
+        if (n > 0) { received += n; }
+      }
+      CHECK(n >= 0 || errno == EAGAIN || errno == EWOULDBLOCK ||
+          errno == EINTR) << strerror(errno);
+    }
+  }
+}
+
+Collective* GetCollective(const string& uri, int rank, int size) {
+  if (boost::starts_with(uri, "shm://")) {
+    return new ShmCollective(uri.substr(6), rank, size);
+  }
+  if (boost::starts_with(uri, "tcp://")) {
+    vector<string> addresses;
+    boost::split(addresses, uri.substr(6), boost::is_any_of(","));
+    return new TCPCollective(addresses, rank, size);
+  }
+  LOG(FATAL) << "Unknown collective " << uri
+      << ", expected shm://NAME or tcp://HOST:PORT[,HOST:PORT...]";
+  return NULL;  // Avoid warning
+}
+
+}  // namespace caffe
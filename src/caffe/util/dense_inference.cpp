@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <string>
+
+#include "caffe/layers/rand_cat_conv_layer.hpp"
+#include "caffe/util/dense_inference.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void ForwardDense(Net<Dtype>* net, const string& layer_name,
+    const string& blob_name, Blob<Dtype>* dense_map) {
+  CHECK(net->has_layer(layer_name)) << "Unknown layer name " << layer_name;
+  RandCatConvLayer<Dtype>* layer = dynamic_cast<RandCatConvLayer<Dtype>*>(
+      net->layer_by_name(layer_name).get());
+  CHECK(layer) << "Layer " << layer_name << " is not a RandCatConv layer";
+  // the later chunks read the blobs below the layer again, which a memory
+  // plan lets other blobs overwrite in the meantime
+  CHECK_EQ(net->planned_memory(), 0)
+      << "Dense inference does not support nets with plan_memory";
+  const int chunk_size = layer->chunk_size();
+  CHECK_GT(chunk_size, 0) << "Layer " << layer_name << " has no chunk_size";
+  CHECK(net->has_blob(blob_name)) << "Unknown blob name " << blob_name;
+  const Blob<Dtype>* output = net->blob_by_name(blob_name).get();
+  int layer_id = 0;
+  while (net->layer_names()[layer_id] != layer_name) { ++layer_id; }
+  const int last_layer = net->layers().size() - 1;
+  const Blob<Dtype>* bottom = net->bottom_vecs()[layer_id][0];
+
+  // the first chunk samples the points
+  layer->set_chunk(0);
+  net->ForwardFromTo(0, last_layer);
+  CHECK_EQ(output->num(), chunk_size)
+      << "Blob " << blob_name << " does not have a row per point";
+  const int row_size = output->count(1);
+  vector<int> map_shape(4);
+  map_shape[0] = bottom->num();
+  map_shape[1] = row_size;
+  map_shape[2] = bottom->height();
+  map_shape[3] = bottom->width();
+  dense_map->Reshape(map_shape);
+  Dtype* map_data = dense_map->mutable_cpu_data();
+  caffe_set(dense_map->count(), Dtype(0), map_data);
+  const int pixels = bottom->height() * bottom->width();
+
+  const int num_points = layer->num_points();
+  const int num_chunks = (num_points + chunk_size - 1) / chunk_size;
+  for (int chunk = 0; chunk < num_chunks; ++chunk) {
+    if (chunk > 0) {
+      layer->set_chunk(chunk);
+      net->ForwardFromTo(layer_id, last_layer);
+    }
+    const int begin = chunk * chunk_size;
+    const int rows = std::min(chunk_size, num_points - begin);
+    const Dtype* output_data = output->cpu_data();
+    for (int r = 0; r < rows; ++r) {
+      const int* point = layer->point(begin + r);
+      Dtype* pixel = map_data + point[0] * row_size * pixels +
+          point[2] * bottom->width() + point[1];
+      for (int k = 0; k < row_size; ++k) {
+        pixel[k * pixels] = output_data[r * row_size + k];
+      }
+    }
+  }
+  layer->set_chunk(-1);
+}
+
+template void ForwardDense<float>(Net<float>* net, const string& layer_name,
+    const string& blob_name, Blob<float>* dense_map);
+template void ForwardDense<double>(Net<double>* net, const string& layer_name,
+    const string& blob_name, Blob<double>* dense_map);
+
+}  // namespace caffe
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/epilogue.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+Epilogue<Dtype>::Epilogue(const EpilogueParameter& param)
+    : sum_(param.sum()), relu_(param.relu()),
+      negative_slope_(param.negative_slope()) {
+  // the gradient is computed from the output, where the sign of the input to
+  // the ReLU is only known for non-negative slopes
+  CHECK_GE(negative_slope_, 0) << "The epilogue ReLU needs a slope >= 0.";
+}
+
+template <typename Dtype>
+void Epilogue<Dtype>::Forward_cpu(const int rows, const int cols,
+    const Dtype* bias, const bool bias_per_row, const Dtype* residual,
+    Dtype* y) const {
+  if (!bias && !residual && !relu_) { return; }
+  // one row at a time, so every step after the first finds it in cache
+  for (int r = 0; r < rows; ++r) {
+    Dtype* y_row = y + r * cols;
+    if (bias && bias_per_row) {
+      const Dtype b = bias[r];
+      for (int c = 0; c < cols; ++c) {
+        y_row[c] += b;
+      }
+    } else if (bias) {
+      for (int c = 0; c < cols; ++c) {
+        y_row[c] += bias[c];
+      }
+    }
+    if (residual) {
+      const Dtype* residual_row = residual + r * cols;
+      for (int c = 0; c < cols; ++c) {
+        y_row[c] += residual_row[c];
+      }
+    }
+    if (relu_) {
+      for (int c = 0; c < cols; ++c) {
+        y_row[c] = std::max(y_row[c], Dtype(0))
+            + negative_slope_ * std::min(y_row[c], Dtype(0));
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+const Dtype* Epilogue<Dtype>::Backward_cpu(const Blob<Dtype>& top,
+    const bool propagate_residual, Blob<Dtype>* residual) {
+  const int count = top.count();
+  const Dtype* top_diff = top.cpu_diff();
+  const bool to_residual = sum_ && propagate_residual;
+  if (!relu_) {
+    if (to_residual) {
+      caffe_copy(count, top_diff, residual->mutable_cpu_diff());
+    }
+    return top_diff;
+  }
+  // the residual gets the same gradient, so keep it there if it is needed
+  Dtype* diff;
+  if (to_residual) {
+    diff = residual->mutable_cpu_diff();
+  } else {
+    diff_.ReshapeLike(top);
+    diff = diff_.mutable_cpu_diff();
+  }
+  const Dtype* top_data = top.cpu_data();
+  for (int i = 0; i < count; ++i) {
+    diff[i] = top_diff[i] * ((top_data[i] > 0)
+        + negative_slope_ * (top_data[i] <= 0));
+  }
+  return diff;
+}
+
+INSTANTIATE_CLASS(Epilogue);
+
+namespace {
+
+// Whether a layer has no per-layer gradient or loss settings that folding it
+// into another layer would lose.
+bool IsPlain(const LayerParameter& layer) {
+  return layer.propagate_down_size() == 0 && layer.loss_weight_size() == 0;
+}
+
+bool Writes(const LayerParameter& layer, const string& blob) {
+  for (int i = 0; i < layer.top_size(); ++i) {
+    if (layer.top(i) == blob) { return true; }
+  }
+  return false;
+}
+
+// The index of the only layer after `producer` that reads `blob` before it is
+// written again, or -1 if there is none or more than one.
+int SoleConsumer(const NetParameter& param, const int producer,
+    const string& blob) {
+  int consumer = -1;
+  for (int i = producer + 1; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      if (layer.bottom(j) != blob) { continue; }
+      if (consumer >= 0 && consumer != i) { return -1; }
+      consumer = i;
+    }
+    if (Writes(layer, blob)) { break; }
+  }
+  return consumer;
+}
+
+bool CanTakeEpilogue(const LayerParameter& layer) {
+  if (layer.bottom_size() != 1 || layer.top_size() != 1 ||
+      layer.has_epilogue_param() || !IsPlain(layer)) {
+    return false;
+  }
+  if (layer.type() == "Convolution") {
+    // only the CAFFE engine implements the epilogue
+    return layer.convolution_param().engine() !=
+        ConvolutionParameter_Engine_CUDNN;
+  }
+  return layer.type() == "InnerProduct";
+}
+
+bool IsFusableReLU(const LayerParameter& layer, const string& blob) {
+  return layer.type() == "ReLU" && layer.bottom_size() == 1 &&
+      layer.top_size() == 1 && layer.bottom(0) == blob &&
+      layer.relu_param().negative_slope() >= 0 && IsPlain(layer);
+}
+
+bool IsResidualSum(const LayerParameter& layer, const string& blob) {
+  if (layer.type() != "Eltwise" || layer.bottom_size() != 2 ||
+      layer.top_size() != 1 || layer.bottom(0) == layer.bottom(1) ||
+      (layer.bottom(0) != blob && layer.bottom(1) != blob) ||
+      layer.eltwise_param().operation() != EltwiseParameter_EltwiseOp_SUM ||
+      !IsPlain(layer)) {
+    return false;
+  }
+  for (int i = 0; i < layer.eltwise_param().coeff_size(); ++i) {
+    if (layer.eltwise_param().coeff(i) != 1) { return false; }
+  }
+  return true;
+}
+
+}  // namespace
+
+int FuseEpilogues(const NetParameter& param, NetParameter* param_fused) {
+  const int num_layers = param.layer_size();
+  // the folded layers, and the fused layers by the position they take
+  vector<bool> folded(num_layers, false);
+  map<int, LayerParameter> fused;
+  int num_fused = 0;
+  for (int i = 0; i < num_layers; ++i) {
+    const LayerParameter& layer = param.layer(i);
+    if (folded[i] || !CanTakeEpilogue(layer)) { continue; }
+    string top = layer.top(0);
+    string residual;
+    int sum_id = -1, relu_id = -1;
+    int next = SoleConsumer(param, i, top);
+    if (next >= 0 && !folded[next] && IsResidualSum(param.layer(next), top)) {
+      const LayerParameter& sum = param.layer(next);
+      residual = sum.bottom(sum.bottom(0) == top ? 1 : 0);
+      top = sum.top(0);
+      sum_id = next;
+      next = SoleConsumer(param, next, top);
+    }
+    if (next >= 0 && !folded[next] && IsFusableReLU(param.layer(next), top)) {
+      top = param.layer(next).top(0);
+      relu_id = next;
+    }
+    const int last = std::max(sum_id, relu_id);
+    if (last < 0) { continue; }
+    // The fused layer runs where the last folded layer did, so its inputs
+    // must still hold the same values there, and it cannot work in place.
+    bool valid = top != layer.bottom(0) && top != residual;
+    for (int k = i + 1; valid && k < last; ++k) {
+      valid = !Writes(param.layer(k), layer.bottom(0)) &&
+          (k <= sum_id || !Writes(param.layer(k), residual));
+    }
+    if (!valid) { continue; }
+    LayerParameter& fused_layer = fused[last];
+    fused_layer.CopyFrom(layer);
+    fused_layer.set_top(0, top);
+    EpilogueParameter* epilogue_param = fused_layer.mutable_epilogue_param();
+    if (sum_id >= 0) {
+      fused_layer.add_bottom(residual);
+      epilogue_param->set_sum(true);
+      folded[sum_id] = true;
+      ++num_fused;
+      LOG_IF(INFO, Caffe::root_solver()) << "Fusing "
+          << param.layer(sum_id).name() << " into " << layer.name();
+    }
+    if (relu_id >= 0) {
+      epilogue_param->set_relu(true);
+      epilogue_param->set_negative_slope(
+          param.layer(relu_id).relu_param().negative_slope());
+      folded[relu_id] = true;
+      ++num_fused;
+      LOG_IF(INFO, Caffe::root_solver()) << "Fusing "
+          << param.layer(relu_id).name() << " into " << layer.name();
+    }
+    folded[i] = true;
+  }
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  for (int i = 0; i < num_layers; ++i) {
+    map<int, LayerParameter>::const_iterator it = fused.find(i);
+    if (it != fused.end()) {
+      param_fused->add_layer()->CopyFrom(it->second);
+    } else if (!folded[i]) {
+      param_fused->add_layer()->CopyFrom(param.layer(i));
+    }
+  }
+  return num_fused;
+}
+
+}  // namespace caffe
@@ -0,0 +1,181 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/util/flat_weights.hpp"
+
+namespace caffe {
+
+namespace {
+
+const size_t kMagicSize = sizeof(kFlatWeightsMagic) - 1;
+
+inline uint64_t align(uint64_t offset) {
+  return (offset + kFlatWeightsAlignment - 1) / kFlatWeightsAlignment *
+      kFlatWeightsAlignment;
+}
+
+template <typename T>
+void write_value(std::ofstream* out, T value) {
+  out->write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Reads the index of a mapped file, checking that it stays in the file.
+class IndexReader {
+ public:
+  IndexReader(const char* begin, size_t size, const string& filename)
+      : begin_(begin), size_(size), position_(0), filename_(filename) {}
+
+  const char* Read(size_t n) {
+    CHECK_LE(n, size_ - position_) << "Truncated flat weights file "
+        << filename_;
+    const char* p = begin_ + position_;
+    position_ += n;
+    return p;
+  }
+  template <typename T>
+  T ReadValue() {
+    T value;
+    memcpy(&value, Read(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+ private:
+  const char* begin_;
+  size_t size_;
+  size_t position_;
+  const string& filename_;
+};
+
+}  // namespace
+
+template <typename Dtype>
+void FlatWeightsWriter<Dtype>::Add(const string& layer_name, int index,
+    const vector<int>& shape, const Dtype* data) {
+  layer_names_.push_back(layer_name);
+  indices_.push_back(index);
+  shapes_.push_back(shape);
+  data_.push_back(data);
+}
+
+template <typename Dtype>
+void FlatWeightsWriter<Dtype>::Write(const string& filename) const {
+  uint64_t index_end = kMagicSize + 3 * sizeof(uint32_t);
+  for (int i = 0; i < layer_names_.size(); ++i) {
+    index_end += layer_names_[i].size() + (3 + shapes_[i].size()) *
+        sizeof(uint32_t) + sizeof(uint64_t);
+  }
+  vector<uint64_t> offsets(layer_names_.size());
+  uint64_t offset = align(index_end);
+  for (int i = 0; i < layer_names_.size(); ++i) {
+    offsets[i] = offset;
+    uint64_t count = 1;
+    for (int k = 0; k < shapes_[i].size(); ++k) {
+      count *= shapes_[i][k];
+    }
+    offset = align(offset + count * sizeof(Dtype));
+  }
+
+  std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+  CHECK(out.good()) << "Couldn't open " << filename << " to save weights.";
+  out.write(kFlatWeightsMagic, kMagicSize);
+  write_value<uint32_t>(&out, kFlatWeightsVersion);
+  write_value<uint32_t>(&out, sizeof(Dtype));
+  write_value<uint32_t>(&out, layer_names_.size());
+  for (int i = 0; i < layer_names_.size(); ++i) {
+    write_value<uint32_t>(&out, layer_names_[i].size());
+    out.write(layer_names_[i].data(), layer_names_[i].size());
+    write_value<uint32_t>(&out, indices_[i]);
+    write_value<uint32_t>(&out, shapes_[i].size());
+    for (int k = 0; k < shapes_[i].size(); ++k) {
+      write_value<int32_t>(&out, shapes_[i][k]);
+    }
+    write_value<uint64_t>(&out, offsets[i]);
+  }
+  const vector<char> padding(kFlatWeightsAlignment, 0);
+  uint64_t position = index_end;
+  for (int i = 0; i < layer_names_.size(); ++i) {
+    out.write(&padding[0], offsets[i] - position);
+    uint64_t count = 1;
+    for (int k = 0; k < shapes_[i].size(); ++k) {
+      count *= shapes_[i][k];
+    }
+    out.write(reinterpret_cast<const char*>(data_[i]), count * sizeof(Dtype));
+    position = offsets[i] + count * sizeof(Dtype);
+  }
+  out.write(&padding[0], align(position) - position);
+  CHECK(out.good()) << "Error saving weights to " << filename << ".";
+}
+
+FlatWeightsFile::FlatWeightsFile(const string& filename)
+    : filename_(filename), memory_(NULL), size_(0), element_size_(0) {
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Couldn't open " << filename << ": " << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0) << strerror(errno);
+  size_ = st.st_size;
+  CHECK_GT(size_, kMagicSize) << "Not a flat weights file: " << filename;
+  // writable but private: writes go to copies of the pages, never the file
+  memory_ = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  CHECK(memory_ != MAP_FAILED) << "Couldn't map " << filename << ": "
+      << strerror(errno);
+  close(fd);
+
+  IndexReader reader(static_cast<const char*>(memory_), size_, filename_);
+  CHECK_EQ(memcmp(reader.Read(kMagicSize), kFlatWeightsMagic, kMagicSize), 0)
+      << "Not a flat weights file: " << filename;
+  const uint32_t version = reader.ReadValue<uint32_t>();
+  CHECK_EQ(version, kFlatWeightsVersion)
+      << "Unsupported flat weights version in " << filename;
+  element_size_ = reader.ReadValue<uint32_t>();
+  CHECK(element_size_ == sizeof(float) || element_size_ == sizeof(double))
+      << "Unsupported element size " << element_size_ << " in " << filename;
+  const uint32_t num_blobs = reader.ReadValue<uint32_t>();
+  for (int i = 0; i < num_blobs; ++i) {
+    const uint32_t name_size = reader.ReadValue<uint32_t>();
+    layer_names_.push_back(string(reader.Read(name_size), name_size));
+    indices_.push_back(reader.ReadValue<uint32_t>());
+    const uint32_t num_axes = reader.ReadValue<uint32_t>();
+    CHECK_LE(num_axes, static_cast<uint32_t>(kMaxBlobAxes))
+        << "Corrupt flat weights file " << filename;
+    vector<int> shape(num_axes);
+    uint64_t count = 1;
+    for (int k = 0; k < num_axes; ++k) {
+      shape[k] = reader.ReadValue<int32_t>();
+      CHECK_GE(shape[k], 0) << "Corrupt flat weights file " << filename;
+      count *= shape[k];
+    }
+    CHECK_LE(count, static_cast<uint64_t>(INT_MAX)) << "Blob too large in "
+        << filename;
+    shapes_.push_back(shape);
+    counts_.push_back(count);
+    const uint64_t offset = reader.ReadValue<uint64_t>();
+    CHECK_EQ(offset % kFlatWeightsAlignment, 0)
+        << "Corrupt flat weights file " << filename;
+    CHECK(offset <= size_ && count * element_size_ <= size_ - offset)
+        << "Truncated flat weights file " << filename;
+    offsets_.push_back(offset);
+  }
+}
+
+FlatWeightsFile::~FlatWeightsFile() {
+  munmap(memory_, size_);
+}
+
+void* FlatWeightsFile::data(int i) const {
+  return static_cast<char*>(memory_) + offsets_[i];
+}
+
+template class FlatWeightsWriter<float>;
+template class FlatWeightsWriter<double>;
+
+}  // namespace caffe
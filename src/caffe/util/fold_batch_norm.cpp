@@ -0,0 +1,181 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Whether `consumer` is a single-input, single-output layer right after
+// `producer` that reads its only top, and no later layer reads that top
+// unless `consumer` overwrites it in place.
+bool ConsumesOnly(const NetParameter& param, const int producer,
+    const int consumer) {
+  const LayerParameter& producer_param = param.layer(producer);
+  const LayerParameter& consumer_param = param.layer(consumer);
+  if (producer_param.top_size() != 1 || consumer_param.bottom_size() != 1 ||
+      consumer_param.top_size() != 1 ||
+      consumer_param.bottom(0) != producer_param.top(0)) {
+    return false;
+  }
+  if (consumer_param.top(0) == consumer_param.bottom(0)) {
+    return consumer == producer + 1;
+  }
+  for (int i = producer + 1; i < param.layer_size(); ++i) {
+    if (i == consumer) { continue; }
+    for (int j = 0; j < param.layer(i).bottom_size(); ++j) {
+      if (param.layer(i).bottom(j) == producer_param.top(0)) { return false; }
+    }
+  }
+  return consumer == producer + 1;
+}
+
+// Applies y_c = a_c * x_c + b_c to the outputs of a Convolution or
+// InnerProduct layer by rescaling its weights and replacing its bias.
+void FoldAffine(const LayerParameter& layer_param, const vector<double>& a,
+    const vector<double>& b, Blob<float>* weight, Blob<float>* bias) {
+  const int channels = a.size();
+  float* w = weight->mutable_cpu_data();
+  const bool transposed = layer_param.type() == "InnerProduct" &&
+      layer_param.inner_product_param().transpose();
+  const int inner = weight->count() / channels;
+  for (int i = 0; i < weight->count(); ++i) {
+    // rows are output channels, unless the InnerProduct weight is transposed
+    const int c = transposed ? i % channels : i / inner;
+    w[i] = static_cast<float>(w[i] * a[c]);
+  }
+  float* bias_data = bias->mutable_cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    bias_data[c] = static_cast<float>(b[c]);
+  }
+}
+
+}  // namespace
+
+int FoldBatchNorm(const NetParameter& param, const NetParameter& weights,
+    NetParameter* param_folded, NetParameter* weights_folded) {
+  map<string, const LayerParameter*> trained;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    trained[weights.layer(i).name()] = &weights.layer(i);
+  }
+  NetParameter folded(param);
+  folded.clear_layer();
+  int num_folded = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    LayerParameter* folded_layer = folded.add_layer();
+    folded_layer->CopyFrom(layer_param);
+    folded_layer->clear_blobs();
+    map<string, const LayerParameter*>::const_iterator it =
+        trained.find(layer_param.name());
+    const LayerParameter* layer_weights =
+        it == trained.end() ? NULL : it->second;
+    if (layer_weights) {
+      folded_layer->mutable_blobs()->CopyFrom(layer_weights->blobs());
+    }
+    // Look for Convolution / InnerProduct -> BatchNorm [-> Scale].
+    const bool is_conv = layer_param.type() == "Convolution";
+    if ((!is_conv && layer_param.type() != "InnerProduct") ||
+        !layer_weights || i + 1 >= param.layer_size()) {
+      continue;
+    }
+    const LayerParameter& bn_param = param.layer(i + 1);
+    // like BatchNormLayer, which uses the batch statistics in the TRAIN
+    // phase unless told otherwise; Net::Init gives layers the net's phase
+    const Phase bn_phase =
+        bn_param.has_phase() ? bn_param.phase() : param.state().phase();
+    const bool global_stats =
+        bn_param.batch_norm_param().has_use_global_stats() ?
+        bn_param.batch_norm_param().use_global_stats() : bn_phase == TEST;
+    if (bn_param.type() != "BatchNorm" || !ConsumesOnly(param, i, i + 1) ||
+        !global_stats || !trained.count(bn_param.name()) ||
+        trained[bn_param.name()]->blobs_size() != 3) {
+      continue;
+    }
+    const LayerParameter* scale_param = NULL;
+    if (i + 2 < param.layer_size() &&
+        param.layer(i + 2).type() == "Scale" &&
+        ConsumesOnly(param, i + 1, i + 2) &&
+        param.layer(i + 2).scale_param().axis() == 1 &&
+        param.layer(i + 2).scale_param().num_axes() == 1 &&
+        trained.count(param.layer(i + 2).name())) {
+      scale_param = &param.layer(i + 2);
+    }
+    const int channels = is_conv ?
+        layer_param.convolution_param().num_output() :
+        layer_param.inner_product_param().num_output();
+    // BatchNorm stores the statistics scaled by the sum of the moving
+    // average weights, see BatchNormLayer::Forward_cpu.
+    const LayerParameter& bn_weights = *trained[bn_param.name()];
+    Blob<float> mean, variance, factor;
+    mean.FromProto(bn_weights.blobs(0));
+    variance.FromProto(bn_weights.blobs(1));
+    factor.FromProto(bn_weights.blobs(2));
+    CHECK_EQ(mean.count(), channels)
+        << "BatchNorm " << bn_param.name() << " does not match "
+        << layer_param.name();
+    const double scale_factor = factor.cpu_data()[0] == 0 ?
+        0 : 1. / factor.cpu_data()[0];
+    const double eps = bn_param.batch_norm_param().eps();
+    Blob<float> gamma, beta;
+    if (scale_param) {
+      const LayerParameter& scale_weights = *trained[scale_param->name()];
+      gamma.FromProto(scale_weights.blobs(0));
+      CHECK_EQ(gamma.count(), channels)
+          << "Scale " << scale_param->name() << " does not match "
+          << layer_param.name();
+      if (scale_weights.blobs_size() > 1) {
+        beta.FromProto(scale_weights.blobs(1));
+      }
+    }
+    Blob<float> weight, bias;
+    weight.FromProto(layer_weights->blobs(0));
+    const bool had_bias = layer_weights->blobs_size() > 1;
+    if (had_bias) {
+      bias.FromProto(layer_weights->blobs(1));
+    } else {
+      bias.Reshape(vector<int>(1, channels));
+    }
+    vector<double> a(channels), b(channels);
+    for (int c = 0; c < channels; ++c) {
+      const double inv_std = 1. / std::sqrt(
+          variance.cpu_data()[c] * scale_factor + eps);
+      a[c] = inv_std * (scale_param ? gamma.cpu_data()[c] : 1.);
+      b[c] = a[c] * ((had_bias ? bias.cpu_data()[c] : 0.) -
+          mean.cpu_data()[c] * scale_factor) +
+          (beta.count() ? beta.cpu_data()[c] : 0.);
+    }
+    FoldAffine(layer_param, a, b, &weight, &bias);
+    folded_layer->clear_blobs();
+    weight.ToProto(folded_layer->add_blobs());
+    bias.ToProto(folded_layer->add_blobs());
+    if (is_conv) {
+      folded_layer->mutable_convolution_param()->set_bias_term(true);
+    } else {
+      folded_layer->mutable_inner_product_param()->set_bias_term(true);
+    }
+    const LayerParameter& last = scale_param ? *scale_param : bn_param;
+    folded_layer->set_top(0, last.top(0));
+    LOG(INFO) << "Folded " << bn_param.name()
+        << (scale_param ? " and " + scale_param->name() : string())
+        << " into " << layer_param.name();
+    const int skipped = scale_param ? 2 : 1;
+    num_folded += skipped;
+    i += skipped;
+  }
+  if (weights_folded) {
+    weights_folded->CopyFrom(folded);
+  }
+  param_folded->CopyFrom(folded);
+  for (int i = 0; i < param_folded->layer_size(); ++i) {
+    param_folded->mutable_layer(i)->clear_blobs();
+  }
+  return num_folded;
+}
+
+}  // namespace caffe
@@ -61,6 +61,8 @@ void hdf5_load_nd_dataset_helper(
     blob_dims[i] = dims[i];
   }
   blob->Reshape(blob_dims);
+  // about to be read
+  blob->cancel_deferred_fill();
 }
 
 template <>
@@ -147,6 +149,37 @@ void hdf5_save_string(hid_t loc_id, const string& dataset_name,
     << "Failed to save string dataset with name " << dataset_name;
 }
 
+string hdf5_load_bytes(hid_t loc_id, const string& dataset_name) {
+  int ndims;
+  herr_t status = H5LTget_dataset_ndims(loc_id, dataset_name.c_str(), &ndims);
+  CHECK_GE(status, 0) << "Failed to get dataset ndims for " << dataset_name;
+  CHECK_EQ(ndims, 1) << dataset_name << " does not hold bytes";
+  hsize_t size;
+  H5T_class_t class_;
+  size_t type_size;
+  status = H5LTget_dataset_info(loc_id, dataset_name.c_str(), &size,
+      &class_, &type_size);
+  CHECK_GE(status, 0) << "Failed to get dataset info for " << dataset_name;
+  CHECK_EQ(type_size, 1) << dataset_name << " does not hold bytes";
+  string bytes(size, '\0');
+  if (size > 0) {
+    status = H5LTread_dataset(loc_id, dataset_name.c_str(), H5T_NATIVE_UCHAR,
+        &bytes[0]);
+    CHECK_GE(status, 0)
+      << "Failed to load bytes dataset with name " << dataset_name;
+  }
+  return bytes;
+}
+
+void hdf5_save_bytes(hid_t loc_id, const string& dataset_name,
+                     const string& bytes) {
+  hsize_t size = bytes.size();
+  herr_t status = H5LTmake_dataset(loc_id, dataset_name.c_str(), 1, &size,
+      H5T_NATIVE_UCHAR, bytes.data());
+  CHECK_GE(status, 0)
+    << "Failed to save bytes dataset with name " << dataset_name;
+}
+
 int hdf5_load_int(hid_t loc_id, const string& dataset_name) {
   int val;
   herr_t status = H5LTread_dataset_int(loc_id, dataset_name.c_str(), &val);
@@ -0,0 +1,171 @@
+#include <algorithm>
+
+#include "caffe/util/hypercolumn.hpp"
+
+namespace caffe {
+
+// Reads one tap. The interpolation case and the layout are template
+// arguments so that every combination gets its own branch-free channel loop,
+// which is a plain vectorizable stream when the channels are contiguous.
+// dx / dy step to the right / lower neighbour, channels are cs apart.
+template <typename Dtype, bool kInterpX, bool kInterpY, bool kContiguous>
+inline void gather_tap(const Dtype* data, const int channels, const int cs,
+    const int dx, const int dy, const Dtype rx, const Dtype ry,
+    Dtype* out) {
+  const int stride = kContiguous ? 1 : cs;
+  for (int c = 0; c < channels; ++c, data += stride) {
+    if (kInterpX && kInterpY) {
+      out[c] = (data[0] * (1 - ry) + data[dy] * ry) * (1 - rx) +
+          (data[dx] * (1 - ry) + data[dx + dy] * ry) * rx;
+    } else if (kInterpX) {
+      out[c] = data[0] * (1 - rx) + data[dx] * rx;
+    } else if (kInterpY) {
+      out[c] = data[0] * (1 - ry) + data[dy] * ry;
+    } else {
+      out[c] = data[0];
+    }
+  }
+}
+
+template <typename Dtype, bool kNHWC, bool kCopyOnly>
+void gather_taps(const Dtype* data_im, const int channels, const int height,
+    const int width, const HypercolumnTap<Dtype>* taps, const int tap_stride,
+    const int num_taps, Dtype* data_col, const int col_stride) {
+  const int pixels = height * width;
+  const int dx = kNHWC ? channels : 1;
+  const int dy = kNHWC ? width * channels : width;
+  const int cs = kNHWC ? 1 : pixels;
+#pragma omp parallel for
+  for (int i = 0; i < num_taps; ++i) {
+    const HypercolumnTap<Dtype>& tap = taps[i * tap_stride];
+    const Dtype* data = kNHWC ?
+        data_im + (tap.n * pixels + tap.pixel) * channels :
+        data_im + tap.n * channels * pixels + tap.pixel;
+    Dtype* out = data_col + i * col_stride;
+    if (kCopyOnly || (!tap.interp_x && !tap.interp_y)) {
+      gather_tap<Dtype, false, false, kNHWC>(data, channels, cs, dx, dy,
+          tap.rx, tap.ry, out);
+    } else if (!tap.interp_y) {
+      gather_tap<Dtype, true, false, kNHWC>(data, channels, cs, dx, dy,
+          tap.rx, tap.ry, out);
+    } else if (!tap.interp_x) {
+      gather_tap<Dtype, false, true, kNHWC>(data, channels, cs, dx, dy,
+          tap.rx, tap.ry, out);
+    } else {
+      gather_tap<Dtype, true, true, kNHWC>(data, channels, cs, dx, dy,
+          tap.rx, tap.ry, out);
+    }
+  }
+}
+
+template <typename Dtype>
+void hypercolumn_gather_cpu(const Dtype* data_im, const bool nhwc,
+    const int channels, const int height, const int width,
+    const bool copy_only, const HypercolumnTap<Dtype>* taps,
+    const int tap_stride, const int num_taps, Dtype* data_col,
+    const int col_stride) {
+  if (nhwc && copy_only) {
+    gather_taps<Dtype, true, true>(data_im, channels, height, width, taps,
+        tap_stride, num_taps, data_col, col_stride);
+  } else if (nhwc) {
+    gather_taps<Dtype, true, false>(data_im, channels, height, width, taps,
+        tap_stride, num_taps, data_col, col_stride);
+  } else if (copy_only) {
+    gather_taps<Dtype, false, true>(data_im, channels, height, width, taps,
+        tap_stride, num_taps, data_col, col_stride);
+  } else {
+    gather_taps<Dtype, false, false>(data_im, channels, height, width, taps,
+        tap_stride, num_taps, data_col, col_stride);
+  }
+}
+
+template void hypercolumn_gather_cpu<float>(const float* data_im,
+    const bool nhwc, const int channels, const int height, const int width,
+    const bool copy_only, const HypercolumnTap<float>* taps,
+    const int tap_stride, const int num_taps, float* data_col,
+    const int col_stride);
+template void hypercolumn_gather_cpu<double>(const double* data_im,
+    const bool nhwc, const int channels, const int height, const int width,
+    const bool copy_only, const HypercolumnTap<double>* taps,
+    const int tap_stride, const int num_taps, double* data_col,
+    const int col_stride);
+
+template <typename Dtype, bool kInterpX, bool kInterpY>
+inline void scatter_tap(const Dtype* col, const int channels,
+    const int pixels, const int width, const Dtype rx, const Dtype ry,
+    Dtype* data) {
+  for (int c = 0; c < channels; ++c, data += pixels) {
+    if (kInterpX && kInterpY) {
+      data[0] += col[c] * (1 - ry) * (1 - rx);
+      data[width] += col[c] * ry * (1 - rx);
+      data[1] += col[c] * (1 - ry) * rx;
+      data[width + 1] += col[c] * ry * rx;
+    } else if (kInterpX) {
+      data[0] += col[c] * (1 - rx);
+      data[1] += col[c] * rx;
+    } else if (kInterpY) {
+      data[0] += col[c] * (1 - ry);
+      data[width] += col[c] * ry;
+    } else {
+      data[0] += col[c];
+    }
+  }
+}
+
+template <typename Dtype>
+void hypercolumn_scatter_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const HypercolumnTap<Dtype>& tap,
+    Dtype* data_im) {
+  const int pixels = height * width;
+  Dtype* data = data_im + tap.n * channels * pixels + tap.pixel;
+  if (!tap.interp_x && !tap.interp_y) {
+    scatter_tap<Dtype, false, false>(data_col, channels, pixels, width,
+        tap.rx, tap.ry, data);
+  } else if (!tap.interp_y) {
+    scatter_tap<Dtype, true, false>(data_col, channels, pixels, width,
+        tap.rx, tap.ry, data);
+  } else if (!tap.interp_x) {
+    scatter_tap<Dtype, false, true>(data_col, channels, pixels, width,
+        tap.rx, tap.ry, data);
+  } else {
+    scatter_tap<Dtype, true, true>(data_col, channels, pixels, width,
+        tap.rx, tap.ry, data);
+  }
+}
+
+template void hypercolumn_scatter_cpu<float>(const float* data_col,
+    const int channels, const int height, const int width,
+    const HypercolumnTap<float>& tap, float* data_im);
+template void hypercolumn_scatter_cpu<double>(const double* data_col,
+    const int channels, const int height, const int width,
+    const HypercolumnTap<double>& tap, double* data_im);
+
+template <typename Dtype>
+void nchw_to_nhwc_cpu(const Dtype* data, const int num, const int channels,
+    const int height, const int width, Dtype* data_nhwc) {
+  const int pixels = height * width;
+  // work on blocks of pixels so that both sides stay in cache
+  const int kBlock = 64;
+  const int blocks = (pixels + kBlock - 1) / kBlock;
+#pragma omp parallel for
+  for (int task = 0; task < num * blocks; ++task) {
+    const int n = task / blocks;
+    const int p_begin = (task % blocks) * kBlock;
+    const int p_end = std::min(p_begin + kBlock, pixels);
+    const Dtype* src = data + n * channels * pixels;
+    Dtype* dst = data_nhwc + n * pixels * channels;
+    for (int c = 0; c < channels; ++c) {
+      for (int p = p_begin; p < p_end; ++p) {
+        dst[p * channels + c] = src[c * pixels + p];
+      }
+    }
+  }
+}
+
+template void nchw_to_nhwc_cpu<float>(const float* data, const int num,
+    const int channels, const int height, const int width, float* data_nhwc);
+template void nchw_to_nhwc_cpu<double>(const double* data, const int num,
+    const int channels, const int height, const int width,
+    double* data_nhwc);
+
+}  // namespace caffe
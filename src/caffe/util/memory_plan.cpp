@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/memory_plan.hpp"
+
+namespace caffe {
+
+namespace {
+
+struct LargerInterval {
+  explicit LargerInterval(const vector<MemoryInterval>& intervals)
+      : intervals_(intervals) {}
+  bool operator()(int a, int b) const {
+    if (intervals_[a].size != intervals_[b].size) {
+      return intervals_[a].size > intervals_[b].size;
+    }
+    return intervals_[a].begin < intervals_[b].begin;
+  }
+  const vector<MemoryInterval>& intervals_;
+};
+
+inline bool Overlap(const MemoryInterval& a, const MemoryInterval& b) {
+  return a.begin <= b.end && b.begin <= a.end;
+}
+
+}  // namespace
+
+vector<size_t> PlanMemoryBuffers(const vector<MemoryInterval>& intervals,
+    vector<int>* assignment) {
+  vector<int> order(intervals.size());
+  for (int i = 0; i < order.size(); ++i) {
+    CHECK_LE(intervals[i].begin, intervals[i].end);
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), LargerInterval(intervals));
+  vector<size_t> sizes;
+  vector<vector<int> > members;
+  assignment->assign(intervals.size(), -1);
+  for (int k = 0; k < order.size(); ++k) {
+    const MemoryInterval& interval = intervals[order[k]];
+    // every buffer is at least as large as the interval, because the larger
+    // intervals are placed first, so the smallest compatible one fits best
+    int best = -1;
+    for (int b = 0; b < sizes.size(); ++b) {
+      if (best >= 0 && sizes[b] >= sizes[best]) { continue; }
+      bool compatible = true;
+      for (int m = 0; compatible && m < members[b].size(); ++m) {
+        compatible = !Overlap(interval, intervals[members[b][m]]);
+      }
+      if (compatible) { best = b; }
+    }
+    if (best < 0) {
+      best = sizes.size();
+      sizes.push_back(interval.size);
+      members.push_back(vector<int>());
+    }
+    members[best].push_back(order[k]);
+    (*assignment)[order[k]] = best;
+  }
+  return sizes;
+}
+
+size_t PeakLiveMemory(const vector<MemoryInterval>& intervals) {
+  int steps = 0;
+  for (int i = 0; i < intervals.size(); ++i) {
+    steps = std::max(steps, intervals[i].end + 1);
+  }
+  // sweep over the steps with the size changes at every interval boundary
+  vector<long long> change(steps + 1, 0);  // NOLINT(runtime/int)
+  for (int i = 0; i < intervals.size(); ++i) {
+    change[intervals[i].begin] += intervals[i].size;
+    change[intervals[i].end + 1] -= intervals[i].size;
+  }
+  long long live = 0, peak = 0;  // NOLINT(runtime/int)
+  for (int t = 0; t < steps; ++t) {
+    live += change[t];
+    peak = std::max(peak, live);
+  }
+  return peak;
+}
+
+}  // namespace caffe
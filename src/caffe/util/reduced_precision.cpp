@@ -0,0 +1,260 @@
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/common.hpp"
+#include "caffe/util/reduced_precision.hpp"
+
+namespace caffe {
+
+namespace {
+
+inline uint32_t float_bits(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+inline float bits_float(uint32_t x) {
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// A uniform number in [0, 1) from the top 24 random bits
+inline float uniform(uint32_t r) {
+  return (r >> 8) * (1.f / 16777216.f);
+}
+
+// Rounds a >= 0 to one of the integers around it.
+inline uint32_t stochastic_round(float a, uint32_t r) {
+  const float floor_a = std::floor(a);
+  return static_cast<uint32_t>(floor_a) + (a - floor_a > uniform(r));
+}
+
+uint16_t float_to_half(float f, uint32_t r) {
+  uint32_t x = float_bits(f);
+  const uint16_t sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+  if (x > 0x7f800000) { return sign | 0x7e00; }  // NaN
+  if (x == 0x7f800000) { return sign | 0x7c00; }
+  if (x < 0x38800000) {
+    // below 2^-14 half has only the multiples of 2^-24, up to 1024 of which
+    // is the smallest normal number
+    return sign | stochastic_round(bits_float(x) * 16777216.f, r);
+  }
+  // random bits below the 10 bits of the half mantissa carry into it with
+  // the probability of rounding up
+  x += r & 0x1fff;
+  const uint32_t h = (x >> 13) - (112 << 10);
+  return sign | std::min(h, 0x7bffu);  // saturated to the largest finite
+}
+
+float half_to_float(uint16_t h) {
+  const uint32_t sign = (h & 0x8000) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1f;
+  const uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    const float f = mantissa * (1.f / 16777216.f);
+    return sign ? -f : f;
+  }
+  if (exponent == 31) {
+    return bits_float(sign | 0x7f800000 | (mantissa << 13));
+  }
+  return bits_float(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+uint16_t float_to_bfloat(float f, uint32_t r) {
+  const uint32_t x = float_bits(f);
+  if ((x & 0x7fffffff) > 0x7f800000) { return (x >> 16) | 0x40; }  // NaN
+  if ((x & 0x7fffffff) == 0x7f800000) { return x >> 16; }
+  uint32_t y = x + (r & 0xffff);
+  if ((y & 0x7f800000) == 0x7f800000) {
+    y = (x & 0x80000000) | 0x7f7fffff;
+  }
+  return y >> 16;
+}
+
+inline float bfloat_to_float(uint16_t b) {
+  return bits_float(static_cast<uint32_t>(b) << 16);
+}
+
+// The scale and codes of an INT8 block
+inline float* int8_scale(void* codes, int offset) {
+  return reinterpret_cast<float*>(static_cast<char*>(codes) +
+      offset / kReducedBlockSize * (sizeof(float) + kReducedBlockSize));
+}
+
+inline const float* int8_scale(const void* codes, int offset) {
+  return int8_scale(const_cast<void*>(codes), offset);
+}
+
+// INT8 codes the magnitude of a value relative to the largest of its block
+// on a logarithmic scale: code c > 0 of the 127 of signed values stands for
+// 2^((c - 127) / 8), and that of the 255 of non-negative ones, with no sign
+// bit to keep, for 2^((c - 255) / 16). Both reach down to about 2^-16.
+struct LogCodes {
+  LogCodes() {
+    signed_value[0] = unsigned_value[0] = 0;
+    for (int c = 1; c < 256; ++c) {
+      unsigned_value[c] = std::pow(2.f, (c - 255) / 16.f);
+      if (c < 128) {
+        signed_value[c] = std::pow(2.f, (c - 127) / 8.f);
+      }
+    }
+  }
+  float signed_value[128];
+  float unsigned_value[256];
+};
+
+const LogCodes log_codes;
+
+// Returns the code of r in [0, 1] among levels codes of `value`, as many per
+// octave, rounding stochastically between the values around it.
+inline uint32_t log_code(float r, const float* value, int levels,
+    float per_octave, uint32_t bits) {
+  if (r <= 0) { return 0; }
+  const float a = levels + per_octave * std::log(r) * 1.44269504f;
+  if (a >= levels) { return levels; }
+  const int c = a < 1 ? 0 : static_cast<int>(a);
+  const float p = (r - value[c]) / (value[c + 1] - value[c]);
+  return c + (p > uniform(bits));
+}
+
+template <typename Dtype>
+void int8_encode_block(int n, const Dtype* x, bool nonnegative,
+    uint32_t seed, int offset, float* scale, uint8_t* q) {
+  float max_x = 0;
+  for (int i = 0; i < n; ++i) {
+    max_x = std::max(max_x, static_cast<float>(std::fabs(x[i])));
+  }
+  *scale = max_x;
+  if (max_x == 0) {
+    memset(q, 0, n);
+    return;
+  }
+  for (int i = 0; i < n; ++i) {
+    const float r = std::fabs(static_cast<float>(x[i])) / max_x;
+    const uint32_t bits = hash_bits(seed, offset + i);
+    if (nonnegative) {
+      const uint32_t c = log_code(r, log_codes.unsigned_value, 255, 16, bits);
+      q[i] = (c == 0 && x[i] > 0) ? 1 : c;
+    } else {
+      q[i] = log_code(r, log_codes.signed_value, 127, 8, bits) |
+          (x[i] < 0 ? 0x80 : 0);
+    }
+  }
+}
+
+template <typename Dtype>
+void int8_decode_block(int n, float scale, const uint8_t* q, bool nonnegative,
+    Dtype* x) {
+  if (nonnegative) {
+    for (int i = 0; i < n; ++i) {
+      x[i] = scale * log_codes.unsigned_value[q[i]];
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      const float a = scale * log_codes.signed_value[q[i] & 0x7f];
+      x[i] = (q[i] & 0x80) ? -a : a;
+    }
+  }
+}
+
+}  // namespace
+
+size_t reduced_precision_size(ReducedPrecision precision, int count) {
+  switch (precision) {
+  case SolverParameter_HistoryPrecision_FP16:
+  case SolverParameter_HistoryPrecision_BF16:
+    return count * sizeof(uint16_t);
+  case SolverParameter_HistoryPrecision_INT8:
+    return count + (count + kReducedBlockSize - 1) / kReducedBlockSize *
+        sizeof(float);
+  default:
+    LOG(FATAL) << "Unknown reduced precision: " << precision;
+  }
+  return 0;
+}
+
+template <typename Dtype>
+void reduced_precision_encode(ReducedPrecision precision, int n,
+    const Dtype* x, bool nonnegative, uint32_t seed, int offset,
+    void* codes) {
+  switch (precision) {
+  case SolverParameter_HistoryPrecision_FP16:
+  case SolverParameter_HistoryPrecision_BF16: {
+    const bool half = precision == SolverParameter_HistoryPrecision_FP16;
+    uint16_t* h = static_cast<uint16_t*>(codes) + offset;
+    for (int i = 0; i < n; ++i) {
+      const uint32_t r = hash_bits(seed, offset + i);
+      const float f = static_cast<float>(x[i]);
+      h[i] = half ? float_to_half(f, r) : float_to_bfloat(f, r);
+      if (nonnegative && h[i] == 0 && x[i] > 0) {
+        h[i] = 1;
+      }
+    }
+    break;
+  }
+  case SolverParameter_HistoryPrecision_INT8: {
+    CHECK_EQ(offset % kReducedBlockSize, 0)
+        << "INT8 values are encoded by whole blocks.";
+    for (int b = 0; b < n; b += kReducedBlockSize) {
+      float* scale = int8_scale(codes, offset + b);
+      int8_encode_block(std::min(kReducedBlockSize, n - b), x + b,
+          nonnegative, seed, offset + b, scale,
+          reinterpret_cast<uint8_t*>(scale + 1));
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown reduced precision: " << precision;
+  }
+}
+
+template <typename Dtype>
+void reduced_precision_decode(ReducedPrecision precision, int n,
+    const void* codes, bool nonnegative, int offset, Dtype* x) {
+  switch (precision) {
+  case SolverParameter_HistoryPrecision_FP16: {
+    const uint16_t* h = static_cast<const uint16_t*>(codes) + offset;
+    for (int i = 0; i < n; ++i) {
+      x[i] = half_to_float(h[i]);
+    }
+    break;
+  }
+  case SolverParameter_HistoryPrecision_BF16: {
+    const uint16_t* h = static_cast<const uint16_t*>(codes) + offset;
+    for (int i = 0; i < n; ++i) {
+      x[i] = bfloat_to_float(h[i]);
+    }
+    break;
+  }
+  case SolverParameter_HistoryPrecision_INT8: {
+    CHECK_EQ(offset % kReducedBlockSize, 0)
+        << "INT8 values are decoded by whole blocks.";
+    for (int b = 0; b < n; b += kReducedBlockSize) {
+      const float* scale = int8_scale(codes, offset + b);
+      int8_decode_block(std::min(kReducedBlockSize, n - b), *scale,
+          reinterpret_cast<const uint8_t*>(scale + 1), nonnegative, x + b);
+    }
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown reduced precision: " << precision;
+  }
+}
+
+template void reduced_precision_encode<float>(ReducedPrecision precision,
+    int n, const float* x, bool nonnegative, uint32_t seed, int offset,
+    void* codes);
+template void reduced_precision_encode<double>(ReducedPrecision precision,
+    int n, const double* x, bool nonnegative, uint32_t seed, int offset,
+    void* codes);
+template void reduced_precision_decode<float>(ReducedPrecision precision,
+    int n, const void* codes, bool nonnegative, int offset, float* x);
+template void reduced_precision_decode<double>(ReducedPrecision precision,
+    int n, const void* codes, bool nonnegative, int offset, double* x);
+
+}  // namespace caffe
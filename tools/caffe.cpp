@@ -5,6 +5,8 @@ namespace bp = boost::python;
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <cstring>
 #include <map>
@@ -30,6 +32,40 @@ DEFINE_string(gpu, "",
     "Optional; run in GPU mode on given device IDs separated by ','."
     "Use '-gpu all' to run on all available GPUs. The effective training "
     "batch size is multiplied by the number of devices.");
+DEFINE_int32(threads, 1,
+    "Optional; in CPU mode, train this many replicas of the solver on as "
+    "many threads, which share the weights and divide the OpenMP threads. "
+    "The effective training batch size is multiplied by the number of "
+    "threads.");
+DEFINE_bool(hogwild, false,
+    "Optional; with -threads, every replica applies its own update to the "
+    "shared weights without locking, instead of averaging the gradients. "
+    "Sets the solver's sparse_update.");
+DEFINE_int32(ranks, 1,
+    "Optional; in CPU mode, train as this many cooperating processes, which "
+    "average their gradients. Without -rank, they are all started here. The "
+    "effective training batch size is multiplied by the number of ranks.");
+DEFINE_int32(rank, -1,
+    "Optional; the rank of this process among -ranks processes that are "
+    "started separately, e.g. on several machines.");
+DEFINE_string(collective, "",
+    "Optional; how -ranks processes communicate: shm://NAME through shared "
+    "memory on one machine, or tcp://HOST:PORT[,HOST:PORT...] with the "
+    "address of every rank, or of rank 0 with the others listening on the "
+    "next ports. Defaults to shared memory when the ranks are started here.");
+DEFINE_string(param_server, "",
+    "Optional; in CPU mode, train asynchronously: -ranks workers push their "
+    "gradients to the parameter server at this HOST:PORT, which updates the "
+    "weights. Without -rank, this process serves and starts the workers.");
+DEFINE_bool(serve, false,
+    "Optional; with -param_server, only serve the -ranks workers, which are "
+    "started separately with -rank.");
+DEFINE_int32(push_period, 1,
+    "Optional; with -param_server, the iterations between the pushes of a "
+    "worker, whose gradients are averaged in between.");
+DEFINE_int32(staleness, 4,
+    "Optional; with -param_server, how many pushes a worker may be ahead "
+    "of the slowest one before it waits.");
 DEFINE_string(solver, "",
     "The solver definition protocol buffer text file.");
 DEFINE_string(model, "",
@@ -108,6 +144,21 @@ static void get_gpus(vector<int>* gpus) {
   }
 }
 
+// Start ranks first to -ranks - 1 as children of this process. Returns the
+// rank of the calling process, which is first - 1 for this one.
+static int start_ranks(int first, vector<pid_t>* children) {
+  for (int rank = first; rank < FLAGS_ranks; ++rank) {
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0) << "Cannot start rank " << rank;
+    if (pid == 0) {
+      children->clear();
+      return rank;
+    }
+    children->push_back(pid);
+  }
+  return first - 1;
+}
+
 // Parse phase from flags
 caffe::Phase get_phase_from_flags(caffe::Phase default_value) {
   if (FLAGS_phase == "")
@@ -210,7 +261,14 @@ int train() {
   if (gpus.size() == 0) {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
+    CHECK_GE(FLAGS_threads, 1);
+    Caffe::set_solver_count(FLAGS_threads);
+    if (FLAGS_threads > 1 && FLAGS_hogwild) {
+      // so that the replicas only write the weights they have gradients for
+      solver_param.set_sparse_update(true);
+    }
   } else {
+    CHECK_EQ(FLAGS_threads, 1) << "-threads is for training on the CPU.";
     ostringstream s;
     for (int i = 0; i < gpus.size(); ++i) {
       s << (i ? ", " : "") << gpus[i];
@@ -229,6 +287,55 @@ int train() {
     Caffe::set_solver_count(gpus.size());
   }
 
+  int rank = 0;
+  vector<pid_t> children;
+  string collective = FLAGS_collective;
+  const bool async = FLAGS_param_server.size() > 0;
+  bool serve = false;
+  if (async) {
+    CHECK_EQ(gpus.size(), 0) << "-param_server is for training on the CPU.";
+    CHECK_EQ(FLAGS_threads, 1) << "Give either -threads or -param_server.";
+    CHECK_GE(FLAGS_ranks, 1);
+    if (FLAGS_serve) {
+      CHECK_LT(FLAGS_rank, 0) << "Give either -serve or -rank.";
+      serve = true;
+    } else if (FLAGS_rank < 0) {
+      rank = start_ranks(0, &children);
+      serve = rank < 0;
+    } else {
+      CHECK_LT(FLAGS_rank, FLAGS_ranks);
+      rank = FLAGS_rank;
+    }
+    if (!serve) {
+      Caffe::set_solver_count(FLAGS_ranks);
+      Caffe::set_solver_rank(rank);
+      Caffe::set_multiprocess(true);
+      // the server tests and takes the snapshots
+      solver_param.clear_test_net();
+      solver_param.clear_test_net_param();
+      solver_param.clear_test_iter();
+      solver_param.clear_test_state();
+      solver_param.set_test_interval(0);
+      solver_param.set_snapshot(0);
+    }
+  } else if (FLAGS_ranks > 1) {
+    CHECK_EQ(gpus.size(), 0) << "-ranks is for training on the CPU.";
+    CHECK_EQ(FLAGS_threads, 1) << "Give either -threads or -ranks.";
+    if (FLAGS_rank < 0) {
+      if (collective.empty()) {
+        collective = "shm://caffe_" + boost::lexical_cast<string>(getpid());
+      }
+      rank = start_ranks(1, &children);
+    } else {
+      CHECK(collective.size()) << "Give -collective when starting each rank.";
+      CHECK_LT(FLAGS_rank, FLAGS_ranks);
+      rank = FLAGS_rank;
+    }
+    Caffe::set_solver_count(FLAGS_ranks);
+    Caffe::set_solver_rank(rank);
+    Caffe::set_multiprocess(true);
+  }
+
   caffe::SignalHandler signal_handler(
         GetRequestedAction(FLAGS_sigint_effect),
         GetRequestedAction(FLAGS_sighup_effect));
@@ -238,7 +345,9 @@ int train() {
 
   solver->SetActionFunction(signal_handler.GetActionFunction());
 
-  if (FLAGS_snapshot.size()) {
+  if (async && !serve) {
+    // the workers pull the weights from the server
+  } else if (FLAGS_snapshot.size()) {
     LOG(INFO) << "Resuming from " << FLAGS_snapshot;
     solver->Restore(FLAGS_snapshot.c_str());
   } else if (FLAGS_weights.size()) {
@@ -253,9 +362,34 @@ int train() {
 #else
     LOG(FATAL) << "Multi-GPU execution not available - rebuild with USE_NCCL";
 #endif
+  } else if (FLAGS_threads > 1 && FLAGS_hogwild) {
+    caffe::Hogwild<float> hogwild(solver);
+    hogwild.Run(FLAGS_threads);
+  } else if (FLAGS_threads > 1) {
+    caffe::CPUSync<float> sync(solver);
+    sync.Run(FLAGS_threads);
+  } else if (serve) {
+    caffe::ParamServer<float> server(solver, FLAGS_param_server,
+        FLAGS_staleness);
+    server.Run(FLAGS_ranks);
+  } else if (async) {
+    caffe::ParamWorker<float> worker(solver, FLAGS_param_server,
+        FLAGS_push_period);
+    worker.Run();
+  } else if (FLAGS_ranks > 1) {
+    shared_ptr<caffe::Collective> ring(
+        caffe::GetCollective(collective, rank, FLAGS_ranks));
+    caffe::CollectiveSync<float> sync(solver, ring);
+    sync.Run();
   } else {
     solver->Solve();
   }
+  for (int i = 0; i < children.size(); ++i) {
+    int status;
+    CHECK_EQ(waitpid(children[i], &status, 0), children[i]);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        << "Rank " << i + (async ? 0 : 1) << " failed.";
+  }
   LOG(INFO) << "Optimization Done.";
   return 0;
 }
@@ -284,9 +418,12 @@ int test() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
-  // Instantiate the caffe net.
+  // Instantiate the caffe net, leaving the params the weights overwrite
+  // unfilled.
+  Caffe::set_defer_fill(true);
   Net<float> caffe_net(FLAGS_model, caffe::TEST, FLAGS_level, &stages);
   caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  Caffe::set_defer_fill(false);
   LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
 
   vector<int> test_score_output_id;
@@ -352,8 +489,13 @@ int time() {
     LOG(INFO) << "Use CPU.";
     Caffe::set_mode(Caffe::CPU);
   }
-  // Instantiate the caffe net.
+  // Instantiate the caffe net, with the weights if given.
+  Caffe::set_defer_fill(FLAGS_weights.size() > 0);
   Net<float> caffe_net(FLAGS_model, phase, FLAGS_level, &stages);
+  if (FLAGS_weights.size()) {
+    caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  }
+  Caffe::set_defer_fill(false);
 
   // Do a clean forward and backward pass, so that memory allocation are done
   // and future iterations will be more stable.
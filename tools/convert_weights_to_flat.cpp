@@ -0,0 +1,43 @@
+// This is a script to convert the weights of a binary caffemodel to a flat
+// weights file, which a Net maps into memory instead of parsing it.
+// Usage:
+//    convert_weights_to_flat weights_in weights_out.caffemodel.flat
+// The blobs are written as float.
+
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/flat_weights.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3) {
+    LOG(ERROR) << "Usage: convert_weights_to_flat weights_in weights_out";
+    return 1;
+  }
+
+  NetParameter weights;
+  ReadNetParamsFromBinaryFileOrDie(string(argv[1]), &weights);
+  FlatWeightsWriter<float> writer;
+  // the blobs convert legacy shapes and double data, and hold the values
+  // until they are written
+  vector<shared_ptr<Blob<float> > > blobs;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    const LayerParameter& layer = weights.layer(i);
+    for (int j = 0; j < layer.blobs_size(); ++j) {
+      shared_ptr<Blob<float> > blob(new Blob<float>());
+      blob->FromProto(layer.blobs(j));
+      writer.Add(layer.name(), j, blob->shape(), blob->cpu_data());
+      blobs.push_back(blob);
+    }
+  }
+  writer.Write(argv[2]);
+  LOG(INFO) << "Wrote " << blobs.size() << " blobs of "
+      << weights.layer_size() << " layers to " << argv[2];
+  return 0;
+}
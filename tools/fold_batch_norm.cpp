@@ -0,0 +1,50 @@
+// This is a script to fold the BatchNorm and Scale layers of a trained net
+// into the Convolution and InnerProduct layers that precede them, for faster
+// inference.
+// Usage:
+//    fold_batch_norm net_proto_file_in weights_in net_proto_file_out
+//        weights_out
+// The net is loaded in the TEST phase, so the output is a deploy net.
+
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/fold_batch_norm.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 5) {
+    LOG(ERROR) << "Usage: fold_batch_norm net_proto_file_in weights_in "
+        << "net_proto_file_out weights_out";
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(string(argv[1]), &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  NetParameter filtered_param;
+  Net<float>::FilterNet(net_param, &filtered_param);
+
+  // Load the weights through a Net so that every format it reads is accepted.
+  Net<float> net(filtered_param);
+  net.CopyTrainedLayersFrom(string(argv[2]));
+  NetParameter weights;
+  net.ToProto(&weights);
+
+  NetParameter folded_param, folded_weights;
+  const int num_folded = FoldBatchNorm(filtered_param, weights,
+      &folded_param, &folded_weights);
+  LOG(INFO) << "Folded " << num_folded << " layers";
+
+  WriteProtoToTextFile(folded_param, argv[3]);
+  WriteProtoToBinaryFile(folded_weights, argv[4]);
+  LOG(INFO) << "Wrote folded net to " << argv[3] << " and its weights to "
+      << argv[4];
+  return 0;
+}